@@ -19,6 +19,7 @@
 
 #include "access/gist_private.h"
 #include "access/hash.h"
+#include "access/hnsw.h"
 #include "access/htup_details.h"
 #include "access/nbtree.h"
 #include "access/reloptions.h"
@@ -319,6 +320,24 @@ static relopt_int intRelOpts[] =
 			AccessExclusiveLock
 		}, 128, 1, 131072
 	},
+	{
+		{
+			"m",
+			"Maximum number of neighbours of an element on the upper layers of an HNSW index",
+			RELOPT_KIND_HNSW,
+			AccessExclusiveLock
+		},
+		HNSW_DEFAULT_M, HNSW_MIN_M, HNSW_MAX_M
+	},
+	{
+		{
+			"ef_construction",
+			"Size of the candidate list while building an HNSW index",
+			RELOPT_KIND_HNSW,
+			AccessExclusiveLock
+		},
+		HNSW_DEFAULT_EF_CONSTRUCTION, HNSW_MIN_EF_CONSTRUCTION, HNSW_MAX_EF_CONSTRUCTION
+	},
 	{
 		{
 			"gin_pending_list_limit",
@@ -75,6 +75,9 @@ static bool toastid_valueid_exists(Oid toastrelid, Oid valueid);
 static struct varlena *toast_fetch_datum(struct varlena *attr);
 static struct varlena *toast_fetch_datum_slice(struct varlena *attr,
 											   int32 sliceoffset, int32 length);
+static void toast_fetch_datum_slice_into(struct varlena *attr,
+										 int32 sliceoffset, int32 length,
+										 char *dest);
 static struct varlena *toast_decompress_datum(struct varlena *attr);
 static struct varlena *toast_decompress_datum_slice(struct varlena *attr, int32 slicelength);
 static int	toast_open_indexes(Relation toastrel,
@@ -361,6 +364,63 @@ heap_tuple_untoast_attr_slice(struct varlena *attr,
 	return result;
 }
 
+/* ----------
+ * heap_tuple_untoast_attr_into -
+ *
+ *	Copy the slicelength bytes at sliceoffset of the fully detoasted value
+ *	into dest, which the caller has allocated.  Non-compressed external
+ *	values are copied from the toast chunks without an intermediate palloc'd
+ *	copy, which matters for values of hundreds of megabytes.  It is an error
+ *	if the value is shorter than sliceoffset + slicelength.
+ * ----------
+ */
+void
+heap_tuple_untoast_attr_into(struct varlena *attr, int32 sliceoffset,
+							 int32 slicelength, char *dest)
+{
+	struct varlena *slice;
+	int32		slicelimit;
+
+	if (sliceoffset < 0 || slicelength < 0 ||
+		pg_add_s32_overflow(sliceoffset, slicelength, &slicelimit))
+		elog(ERROR, "invalid slice %d of %d bytes", sliceoffset, slicelength);
+
+	if (slicelength == 0)
+		return;
+
+	if (VARATT_IS_EXTERNAL_ONDISK(attr))
+	{
+		struct varatt_external toast_pointer;
+
+		VARATT_EXTERNAL_GET_POINTER(toast_pointer, attr);
+
+		if (!VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer))
+		{
+			if (slicelimit > toast_pointer.va_extsize)
+				elog(ERROR, "slice %d of %d bytes is beyond the end of a toast value of %d bytes",
+					 sliceoffset, slicelength, toast_pointer.va_extsize);
+			toast_fetch_datum_slice_into(attr, sliceoffset, slicelength, dest);
+			return;
+		}
+	}
+	else if (!VARATT_IS_EXTENDED(attr))
+	{
+		/* plain inline value, nothing to detoast */
+		if (slicelimit > VARSIZE(attr) - VARHDRSZ)
+			elog(ERROR, "slice %d of %d bytes is beyond the end of a value of %d bytes",
+				 sliceoffset, slicelength, (int) (VARSIZE(attr) - VARHDRSZ));
+		memcpy(dest, VARDATA(attr) + sliceoffset, slicelength);
+		return;
+	}
+
+	slice = heap_tuple_untoast_attr_slice(attr, sliceoffset, slicelength);
+	if (VARSIZE(slice) - VARHDRSZ != slicelength)
+		elog(ERROR, "slice %d of %d bytes is beyond the end of a value",
+			 sliceoffset, slicelength);
+	memcpy(dest, VARDATA(slice), slicelength);
+	pfree(slice);
+}
+
 
 /* ----------
  * toast_raw_datum_size -
@@ -2057,33 +2117,9 @@ toast_fetch_datum(struct varlena *attr)
 static struct varlena *
 toast_fetch_datum_slice(struct varlena *attr, int32 sliceoffset, int32 length)
 {
-	Relation	toastrel;
-	Relation   *toastidxs;
-	ScanKeyData toastkey[3];
-	int			nscankeys;
-	SysScanDesc toastscan;
-	HeapTuple	ttup;
-	TupleDesc	toasttupDesc;
 	struct varlena *result;
 	struct varatt_external toast_pointer;
 	int32		attrsize;
-	int32		residx;
-	int32		nextidx;
-	int			numchunks;
-	int			startchunk;
-	int			endchunk;
-	int32		startoffset;
-	int32		endoffset;
-	int			totalchunks;
-	Pointer		chunk;
-	bool		isnull;
-	char	   *chunkdata;
-	int32		chunksize;
-	int32		chcpystrt;
-	int32		chcpyend;
-	int			num_indexes;
-	int			validIndex;
-	SnapshotData SnapshotToast;
 
 	if (!VARATT_IS_EXTERNAL_ONDISK(attr))
 		elog(ERROR, "toast_fetch_datum_slice shouldn't be called for non-ondisk datums");
@@ -2098,7 +2134,6 @@ toast_fetch_datum_slice(struct varlena *attr, int32 sliceoffset, int32 length)
 	Assert(!VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer));
 
 	attrsize = toast_pointer.va_extsize;
-	totalchunks = ((attrsize - 1) / TOAST_MAX_CHUNK_SIZE) + 1;
 
 	if (sliceoffset >= attrsize)
 	{
@@ -2121,6 +2156,58 @@ toast_fetch_datum_slice(struct varlena *attr, int32 sliceoffset, int32 length)
 	if (length == 0)
 		return result;			/* Can save a lot of work at this point! */
 
+	toast_fetch_datum_slice_into(attr, sliceoffset, length, VARDATA(result));
+
+	return result;
+}
+
+/* ----------
+ * toast_fetch_datum_slice_into -
+ *
+ *	Copy length bytes starting at sliceoffset of a non-compressed external
+ *	datum into dest, straight from the toast chunks.  The caller has
+ *	checked that the range lies within the datum.
+ * ----------
+ */
+static void
+toast_fetch_datum_slice_into(struct varlena *attr, int32 sliceoffset,
+							 int32 length, char *dest)
+{
+	Relation	toastrel;
+	Relation   *toastidxs;
+	ScanKeyData toastkey[3];
+	int			nscankeys;
+	SysScanDesc toastscan;
+	HeapTuple	ttup;
+	TupleDesc	toasttupDesc;
+	struct varatt_external toast_pointer;
+	int32		attrsize;
+	int32		residx;
+	int32		nextidx;
+	int			numchunks;
+	int			startchunk;
+	int			endchunk;
+	int32		startoffset;
+	int32		endoffset;
+	int			totalchunks;
+	Pointer		chunk;
+	bool		isnull;
+	char	   *chunkdata;
+	int32		chunksize;
+	int32		chcpystrt;
+	int32		chcpyend;
+	int			num_indexes;
+	int			validIndex;
+	SnapshotData SnapshotToast;
+
+	VARATT_EXTERNAL_GET_POINTER(toast_pointer, attr);
+	Assert(!VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer));
+
+	attrsize = toast_pointer.va_extsize;
+	totalchunks = ((attrsize - 1) / TOAST_MAX_CHUNK_SIZE) + 1;
+
+	Assert(sliceoffset >= 0 && length > 0 && sliceoffset + length <= attrsize);
+
 	startchunk = sliceoffset / TOAST_MAX_CHUNK_SIZE;
 	endchunk = (sliceoffset + length - 1) / TOAST_MAX_CHUNK_SIZE;
 	numchunks = (endchunk - startchunk) + 1;
@@ -2256,7 +2343,7 @@ toast_fetch_datum_slice(struct varlena *attr, int32 sliceoffset, int32 length)
 		if (residx == endchunk)
 			chcpyend = endoffset;
 
-		memcpy(VARDATA(result) +
+		memcpy(dest +
 			   (residx * TOAST_MAX_CHUNK_SIZE - sliceoffset) + chcpystrt,
 			   chunkdata + chcpystrt,
 			   (chcpyend - chcpystrt) + 1);
@@ -2279,8 +2366,6 @@ toast_fetch_datum_slice(struct varlena *attr, int32 sliceoffset, int32 length)
 	systable_endscan_ordered(toastscan);
 	toast_close_indexes(toastidxs, num_indexes, AccessShareLock);
 	table_close(toastrel, AccessShareLock);
-
-	return result;
 }
 
 /* ----------
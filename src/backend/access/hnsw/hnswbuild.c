@@ -0,0 +1,653 @@
+/*-------------------------------------------------------------------------
+ *
+ * hnswbuild.c
+ *	  Build an HNSW index.
+ *
+ * The vectors are collected in memory and the graph is built there, with
+ * the inserts spread over the backend's thread pool unless
+ * max_parallel_maintenance_workers is 0.  The finished graph is written out
+ * page by page.  If the graph outgrows maintenance_work_mem it is written
+ * out early and the remaining tuples are inserted one by one into the
+ * on-disk graph like aminsert does.
+ *
+ * The insert threads only do arithmetic on memory that was allocated
+ * beforehand: each element's neighbour lists are protected by a spinlock,
+ * and each thread borrows one of the preallocated scratch areas.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/hnsw/hnswbuild.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/hnsw.h"
+#include "access/tableam.h"
+#include "catalog/index.h"
+#include "miscadmin.h"
+#include "model/thread_pool.h"
+#include "port/atomics.h"
+#include "storage/bufmgr.h"
+#include "storage/smgr.h"
+#include "storage/spin.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/vector.h"
+
+/* elements inserted between two interrupt checks */
+#define HNSW_BUILD_BATCH_SIZE	16384
+
+typedef struct HnswBuildNeighbor
+{
+	int32		element;
+	float4		distance;
+} HnswBuildNeighbor;
+
+typedef struct HnswBuildElement
+{
+	ItemPointerData heaptid;
+	ItemPointerData tid;		/* where it goes in the index */
+	int			level;
+	float4	   *vector;
+	HnswBuildNeighbor *neighbors;	/* HNSW_NEIGHBOR_COUNT(level, m) slots */
+	uint8		counts[HNSW_MAX_LEVEL + 1]; /* used slots per layer */
+	slock_t		mutex;			/* protects neighbors and counts */
+} HnswBuildElement;
+
+typedef struct HnswBuildCandidate
+{
+	int32		element;
+	float4		distance;
+	bool		expanded;
+} HnswBuildCandidate;
+
+/* per-thread working memory of a search */
+typedef struct HnswBuildScratch
+{
+	uint32	   *visited;		/* element was visited if it has the tag */
+	uint32		tag;
+	HnswBuildCandidate *w;		/* ef_construction slots */
+	int32	   *neighbors;		/* copy of one neighbour list */
+	HnswBuildNeighbor *selected;	/* neighbours picked for one layer */
+} HnswBuildScratch;
+
+typedef struct HnswBuildState
+{
+	HnswState	state;
+	double		indtuples;		/* total number of tuples indexed */
+	MemoryContext graphCtx;		/* the in-memory graph */
+	MemoryContext tmpCtx;		/* reset after each tuple */
+
+	HnswBuildElement *elements;
+	int			nelements;
+	int			maxelements;
+	Size		memoryUsed;
+	Size		memoryLimit;
+	bool		flushed;		/* graph is on disk, insert tuple by tuple */
+
+	/* shared by the insert threads */
+	int			entry;
+	int			entryLevel;
+	slock_t		entryMutex;
+	pg_atomic_uint32 next;		/* next element of the batch to insert */
+	int			batchEnd;
+	HnswBuildScratch *scratch;
+	int			nscratch;
+} HnswBuildState;
+
+
+/*
+ * Add a vector to the in-memory graph, not linked yet.
+ */
+static void
+HnswBuildAddElement(HnswBuildState *buildstate, ItemPointer heaptid,
+					const float4 *vector)
+{
+	HnswState  *state = &buildstate->state;
+	HnswBuildElement *e;
+	MemoryContext oldCtx;
+	int			nneighbors;
+
+	oldCtx = MemoryContextSwitchTo(buildstate->graphCtx);
+
+	if (buildstate->nelements == buildstate->maxelements)
+	{
+		buildstate->maxelements *= 2;
+		buildstate->elements = (HnswBuildElement *)
+			repalloc_huge(buildstate->elements,
+						  sizeof(HnswBuildElement) * buildstate->maxelements);
+		buildstate->memoryUsed += sizeof(HnswBuildElement) * buildstate->maxelements / 2;
+	}
+
+	e = &buildstate->elements[buildstate->nelements++];
+	e->heaptid = *heaptid;
+	ItemPointerSetInvalid(&e->tid);
+	e->level = HnswRandomLevel(state->m, state->dim);
+	nneighbors = HNSW_NEIGHBOR_COUNT(e->level, state->m);
+	e->vector = (float4 *) palloc(sizeof(float4) * state->dim);
+	memcpy(e->vector, vector, sizeof(float4) * state->dim);
+	e->neighbors = (HnswBuildNeighbor *) palloc(sizeof(HnswBuildNeighbor) * nneighbors);
+	memset(e->counts, 0, sizeof(e->counts));
+	SpinLockInit(&e->mutex);
+
+	buildstate->memoryUsed += sizeof(float4) * state->dim +
+		sizeof(HnswBuildNeighbor) * nneighbors;
+
+	MemoryContextSwitchTo(oldCtx);
+}
+
+/*
+ * The in-memory counterpart of HnswSearchLayer.
+ */
+static int
+HnswBuildSearchLayer(HnswBuildState *buildstate, HnswBuildScratch *scratch,
+					 const float4 *query, int nw, int ef, int layer)
+{
+	HnswState  *state = &buildstate->state;
+	HnswBuildCandidate *w = scratch->w;
+	uint32		tag = ++scratch->tag;
+	int			next = 0;
+
+	if (tag == 0)
+	{
+		memset(scratch->visited, 0, sizeof(uint32) * buildstate->nelements);
+		tag = scratch->tag = 1;
+	}
+
+	for (int i = 0; i < nw; i++)
+	{
+		scratch->visited[w[i].element] = tag;
+		w[i].expanded = false;
+	}
+
+	for (;;)
+	{
+		HnswBuildElement *c;
+		int			nneighbors;
+
+		while (next < nw && w[next].expanded)
+			next++;
+		if (next >= nw)
+			break;
+
+		w[next].expanded = true;
+		c = &buildstate->elements[w[next].element];
+
+		SpinLockAcquire(&c->mutex);
+		nneighbors = c->counts[layer];
+		for (int i = 0; i < nneighbors; i++)
+			scratch->neighbors[i] = c->neighbors[HNSW_LAYER_START(layer, state->m) + i].element;
+		SpinLockRelease(&c->mutex);
+
+		for (int i = 0; i < nneighbors; i++)
+		{
+			int32		element = scratch->neighbors[i];
+			float4		distance;
+			int			pos;
+			int			nmove;
+
+			if (scratch->visited[element] == tag)
+				continue;
+			scratch->visited[element] = tag;
+
+			distance = HnswDistance(state, query, buildstate->elements[element].vector);
+			if (nw == ef && distance >= w[nw - 1].distance)
+				continue;
+
+			pos = nw;
+			while (pos > 0 && w[pos - 1].distance > distance)
+				pos--;
+			nmove = Min(nw, ef - 1) - pos;
+			if (nmove > 0)
+				memmove(&w[pos + 1], &w[pos], sizeof(HnswBuildCandidate) * nmove);
+			w[pos].element = element;
+			w[pos].distance = distance;
+			w[pos].expanded = false;
+			nw = Min(nw + 1, ef);
+			if (pos < next)
+				next = pos;
+		}
+	}
+
+	return nw;
+}
+
+/*
+ * Link element idx into the neighbour list of target on one layer.
+ */
+static void
+HnswBuildAddBackLink(HnswBuildState *buildstate, int target, int layer,
+					 int idx, float4 distance)
+{
+	HnswBuildElement *t = &buildstate->elements[target];
+	int			m = buildstate->state.m;
+	HnswBuildNeighbor *list = &t->neighbors[HNSW_LAYER_START(layer, m)];
+
+	SpinLockAcquire(&t->mutex);
+	if (t->counts[layer] < HNSW_LAYER_SIZE(layer, m))
+	{
+		list[t->counts[layer]].element = idx;
+		list[t->counts[layer]].distance = distance;
+		t->counts[layer]++;
+	}
+	else
+	{
+		int			farthest = 0;
+
+		for (int i = 1; i < t->counts[layer]; i++)
+		{
+			if (list[i].distance > list[farthest].distance)
+				farthest = i;
+		}
+		if (list[farthest].distance > distance)
+		{
+			list[farthest].element = idx;
+			list[farthest].distance = distance;
+		}
+	}
+	SpinLockRelease(&t->mutex);
+}
+
+/*
+ * Link element idx into the in-memory graph.  Runs on the pool threads.
+ */
+static void
+HnswBuildInsert(HnswBuildState *buildstate, HnswBuildScratch *scratch, int idx)
+{
+	HnswState  *state = &buildstate->state;
+	HnswBuildElement *e = &buildstate->elements[idx];
+	HnswBuildCandidate *w = scratch->w;
+	int			m = state->m;
+	int			entry;
+	int			entryLevel;
+	int			nw = 1;
+
+	SpinLockAcquire(&buildstate->entryMutex);
+	entry = buildstate->entry;
+	entryLevel = buildstate->entryLevel;
+	SpinLockRelease(&buildstate->entryMutex);
+
+	w[0].element = entry;
+	w[0].distance = HnswDistance(state, e->vector, buildstate->elements[entry].vector);
+
+	for (int layer = entryLevel; layer > e->level; layer--)
+		nw = HnswBuildSearchLayer(buildstate, scratch, e->vector, nw, 1, layer);
+
+	for (int layer = Min(e->level, entryLevel); layer >= 0; layer--)
+	{
+		int			start = HNSW_LAYER_START(layer, m);
+		int			nslots = HNSW_LAYER_SIZE(layer, m);
+		int			n = 0;
+
+		nw = HnswBuildSearchLayer(buildstate, scratch, e->vector, nw,
+								  state->efConstruction, layer);
+
+		for (int i = 0; i < nw && n < nslots; i++)
+		{
+			if (w[i].element == idx)
+				continue;
+			scratch->selected[n].element = w[i].element;
+			scratch->selected[n].distance = w[i].distance;
+			n++;
+		}
+
+		/* others can find e on this layer as soon as the back links exist */
+		SpinLockAcquire(&e->mutex);
+		memcpy(&e->neighbors[start], scratch->selected, sizeof(HnswBuildNeighbor) * n);
+		e->counts[layer] = n;
+		SpinLockRelease(&e->mutex);
+
+		for (int i = 0; i < n; i++)
+			HnswBuildAddBackLink(buildstate, scratch->selected[i].element, layer,
+								 idx, scratch->selected[i].distance);
+	}
+
+	if (e->level > entryLevel)
+	{
+		SpinLockAcquire(&buildstate->entryMutex);
+		if (e->level > buildstate->entryLevel)
+		{
+			buildstate->entry = idx;
+			buildstate->entryLevel = e->level;
+		}
+		SpinLockRelease(&buildstate->entryMutex);
+	}
+}
+
+/*
+ * One of the nscratch inserters of a batch, taking the elements one by one
+ * so that no more threads than that work on the graph.
+ */
+static void
+HnswBuildInsertWorker(int i, void *arg)
+{
+	HnswBuildState *buildstate = (HnswBuildState *) arg;
+	HnswBuildScratch *scratch = &buildstate->scratch[i];
+
+	for (;;)
+	{
+		int			idx = (int) pg_atomic_fetch_add_u32(&buildstate->next, 1);
+
+		if (idx >= buildstate->batchEnd)
+			break;
+		HnswBuildInsert(buildstate, scratch, idx);
+	}
+}
+
+/*
+ * Link all collected elements into a graph.
+ */
+static void
+HnswBuildGraph(HnswBuildState *buildstate)
+{
+	HnswState  *state = &buildstate->state;
+	int			n = buildstate->nelements;
+	int			nthreads = 1;
+
+	if (n == 0)
+		return;
+
+	buildstate->entry = 0;
+	buildstate->entryLevel = buildstate->elements[0].level;
+	SpinLockInit(&buildstate->entryMutex);
+	pg_atomic_init_u32(&buildstate->next, 0);
+
+	if (n == 1)
+		return;
+
+	/* the backend itself and up to max_parallel_maintenance_workers threads */
+	if (max_parallel_maintenance_workers > 0)
+		nthreads = Min(thread_pool_nthreads(), max_parallel_maintenance_workers + 1);
+
+	buildstate->nscratch = nthreads;
+	buildstate->scratch = (HnswBuildScratch *)
+		MemoryContextAlloc(buildstate->graphCtx, sizeof(HnswBuildScratch) * nthreads);
+	for (int i = 0; i < nthreads; i++)
+	{
+		HnswBuildScratch *scratch = &buildstate->scratch[i];
+
+		scratch->visited = (uint32 *)
+			MemoryContextAllocHuge(buildstate->graphCtx, sizeof(uint32) * n);
+		memset(scratch->visited, 0, sizeof(uint32) * n);
+		scratch->tag = 0;
+		scratch->w = (HnswBuildCandidate *)
+			MemoryContextAlloc(buildstate->graphCtx,
+							   sizeof(HnswBuildCandidate) * state->efConstruction);
+		scratch->neighbors = (int32 *)
+			MemoryContextAlloc(buildstate->graphCtx,
+							   sizeof(int32) * HNSW_LAYER_SIZE(0, state->m));
+		scratch->selected = (HnswBuildNeighbor *)
+			MemoryContextAlloc(buildstate->graphCtx,
+							   sizeof(HnswBuildNeighbor) * HNSW_LAYER_SIZE(0, state->m));
+	}
+
+	elog(DEBUG1, "building hnsw graph of %d elements with %d threads and %s distance kernels",
+		 n, nthreads, vector_distance_isa());
+
+	for (int start = 1; start < n; start += HNSW_BUILD_BATCH_SIZE)
+	{
+		pg_atomic_write_u32(&buildstate->next, start);
+		buildstate->batchEnd = Min(start + HNSW_BUILD_BATCH_SIZE, n);
+		if (nthreads > 1)
+			thread_pool_parallel_for_c(nthreads, HnswBuildInsertWorker, buildstate);
+		else
+			HnswBuildInsertWorker(0, buildstate);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/*
+ * Write a finished page to the index.
+ */
+static void
+HnswBuildFlushPage(Relation index, Page cached, BlockNumber expected)
+{
+	Buffer		buffer = HnswNewBuffer(index);
+	GenericXLogState *state;
+	Page		page;
+
+	if (BufferGetBlockNumber(buffer) != expected)
+		elog(ERROR, "unexpected block %u while building hnsw index \"%s\", expected %u",
+			 BufferGetBlockNumber(buffer), RelationGetRelationName(index), expected);
+
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buffer, GENERIC_XLOG_FULL_IMAGE);
+	memcpy(page, cached, BLCKSZ);
+	GenericXLogFinish(state);
+	UnlockReleaseBuffer(buffer);
+}
+
+/*
+ * Write the in-memory graph to the index.  A first pass assigns every
+ * element its TID by filling pages exactly as the second pass does, which
+ * then writes the tuples with their neighbour links translated to TIDs.
+ */
+static void
+HnswBuildWriteGraph(HnswBuildState *buildstate)
+{
+	HnswState  *state = &buildstate->state;
+	Relation	index = state->index;
+	int			m = state->m;
+	int			dim = state->dim;
+	PGAlignedBlock cached;
+	HnswElementTuple etup;
+	HnswMetaPageData meta;
+	BlockNumber blkno;
+	int			ntuples = 0;
+
+	if (buildstate->nelements == 0)
+		return;
+
+	etup = (HnswElementTuple) palloc0(HNSW_MAX_ELEMENT_SIZE);
+
+	blkno = HNSW_HEAD_BLKNO;
+	HnswInitPage(cached.data, 0);
+	for (int i = 0; i < buildstate->nelements; i++)
+	{
+		HnswBuildElement *e = &buildstate->elements[i];
+		Size		size = HNSW_ELEMENT_SIZE(e->level, m, dim);
+		OffsetNumber offnum;
+
+		if (PageGetFreeSpace(cached.data) < MAXALIGN(size))
+		{
+			blkno++;
+			HnswInitPage(cached.data, 0);
+		}
+		offnum = PageAddItem(cached.data, (Item) etup, size, InvalidOffsetNumber,
+							 false, false);
+		ItemPointerSet(&e->tid, blkno, offnum);
+	}
+
+	blkno = HNSW_HEAD_BLKNO;
+	HnswInitPage(cached.data, 0);
+	for (int i = 0; i < buildstate->nelements; i++)
+	{
+		HnswBuildElement *e = &buildstate->elements[i];
+		Size		size = HNSW_ELEMENT_SIZE(e->level, m, dim);
+
+		memset(etup, 0, size);
+		etup->heaptid = e->heaptid;
+		etup->level = e->level;
+		etup->deleted = 0;
+		etup->dim = dim;
+		for (int layer = 0; layer <= e->level; layer++)
+		{
+			int			start = HNSW_LAYER_START(layer, m);
+
+			for (int j = 0; j < HNSW_LAYER_SIZE(layer, m); j++)
+			{
+				HnswNeighbor *n = &etup->neighbors[start + j];
+
+				if (j < e->counts[layer])
+				{
+					n->tid = buildstate->elements[e->neighbors[start + j].element].tid;
+					n->distance = e->neighbors[start + j].distance;
+				}
+				else
+					ItemPointerSetInvalid(&n->tid);
+			}
+		}
+		memcpy(HnswElementVector(etup, m), e->vector, sizeof(float4) * dim);
+
+		if (ItemPointerGetBlockNumber(&e->tid) != blkno)
+		{
+			HnswBuildFlushPage(index, cached.data, blkno);
+			CHECK_FOR_INTERRUPTS();
+			blkno++;
+			HnswInitPage(cached.data, 0);
+		}
+		if (PageAddItem(cached.data, (Item) etup, size, InvalidOffsetNumber,
+						false, false) != ItemPointerGetOffsetNumber(&e->tid))
+			elog(ERROR, "could not add element to hnsw index \"%s\"",
+				 RelationGetRelationName(index));
+		ntuples++;
+	}
+	if (ntuples > 0)
+		HnswBuildFlushPage(index, cached.data, blkno);
+
+	HnswGetMetaPageData(index, &meta);
+	meta.dim = dim;
+	meta.entryPoint = buildstate->elements[buildstate->entry].tid;
+	meta.entryLevel = buildstate->entryLevel;
+	meta.insertPage = blkno;
+	HnswUpdateMetaPage(index, &meta);
+
+	pfree(etup);
+}
+
+/*
+ * Build the graph of the collected elements, write it and free it.  Later
+ * tuples go directly to the on-disk graph.
+ */
+static void
+HnswBuildFlushGraph(HnswBuildState *buildstate)
+{
+	HnswBuildGraph(buildstate);
+	HnswBuildWriteGraph(buildstate);
+
+	MemoryContextDelete(buildstate->graphCtx);
+	buildstate->graphCtx = NULL;
+	buildstate->elements = NULL;
+	buildstate->nelements = 0;
+	buildstate->flushed = true;
+}
+
+/*
+ * Per-tuple callback for table_index_build_scan.
+ */
+static void
+hnswBuildCallback(Relation index, HeapTuple htup, Datum *values,
+				  bool *isnull, bool tupleIsAlive, void *state)
+{
+	HnswBuildState *buildstate = (HnswBuildState *) state;
+	HnswState  *hnswstate = &buildstate->state;
+	MemoryContext oldCtx;
+	Vector	   *vector;
+
+	/* NULL vectors are not indexed */
+	if (isnull[0])
+		return;
+
+	oldCtx = MemoryContextSwitchTo(buildstate->tmpCtx);
+
+	vector = DatumGetVector(values[0]);
+
+	if (buildstate->flushed)
+		HnswInsertElement(hnswstate, &htup->t_self, vector->x, vector->dim);
+	else
+	{
+		HnswCheckDim(hnswstate, vector->dim);
+		hnswstate->dim = vector->dim;
+		HnswBuildAddElement(buildstate, &htup->t_self, vector->x);
+
+		if (buildstate->memoryUsed > buildstate->memoryLimit)
+		{
+			ereport(NOTICE,
+					(errmsg("hnsw graph no longer fits into maintenance_work_mem after %.0f tuples",
+							buildstate->indtuples + 1),
+					 errdetail("The remaining tuples are inserted one at a time, which is much slower."),
+					 errhint("Increase maintenance_work_mem to speed up the build.")));
+			HnswBuildFlushGraph(buildstate);
+		}
+	}
+
+	buildstate->indtuples += 1;
+
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextReset(buildstate->tmpCtx);
+}
+
+/*
+ * Build a new HNSW index.
+ */
+IndexBuildResult *
+hnswbuild(Relation heap, Relation index, IndexInfo *indexInfo)
+{
+	IndexBuildResult *result;
+	double		reltuples;
+	HnswBuildState buildstate;
+
+	if (RelationGetNumberOfBlocks(index) != 0)
+		elog(ERROR, "index \"%s\" already contains data",
+			 RelationGetRelationName(index));
+
+	memset(&buildstate, 0, sizeof(buildstate));
+	HnswInitState(&buildstate.state, index, false);
+	HnswInitMetapage(index, buildstate.state.m);
+
+	buildstate.memoryLimit = (Size) maintenance_work_mem * 1024L;
+	buildstate.graphCtx = AllocSetContextCreate(CurrentMemoryContext,
+												"Hnsw build graph",
+												ALLOCSET_DEFAULT_SIZES);
+	buildstate.tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
+											  "Hnsw build temporary context",
+											  ALLOCSET_DEFAULT_SIZES);
+	buildstate.maxelements = 1024;
+	buildstate.elements = (HnswBuildElement *)
+		MemoryContextAllocHuge(buildstate.graphCtx,
+							   sizeof(HnswBuildElement) * buildstate.maxelements);
+	buildstate.memoryUsed = sizeof(HnswBuildElement) * buildstate.maxelements;
+
+	reltuples = table_index_build_scan(heap, index, indexInfo, true, true,
+									   hnswBuildCallback, (void *) &buildstate,
+									   NULL);
+
+	if (!buildstate.flushed)
+		HnswBuildFlushGraph(&buildstate);
+
+	MemoryContextDelete(buildstate.tmpCtx);
+
+	result = (IndexBuildResult *) palloc(sizeof(IndexBuildResult));
+	result->heap_tuples = reltuples;
+	result->index_tuples = buildstate.indtuples;
+
+	return result;
+}
+
+/*
+ * Build an empty HNSW index in the initialization fork.
+ */
+void
+hnswbuildempty(Relation index)
+{
+	Page		metapage;
+
+	/* Construct metapage. */
+	metapage = (Page) palloc(BLCKSZ);
+	HnswFillMetapage(metapage, HnswGetM(index));
+
+	/*
+	 * Write the page and log it, then sync it since the write did not go
+	 * through shared_buffers, like the other index AMs do.
+	 */
+	PageSetChecksumInplace(metapage, HNSW_METAPAGE_BLKNO);
+	smgrwrite(index->rd_smgr, INIT_FORKNUM, HNSW_METAPAGE_BLKNO,
+			  (char *) metapage, true);
+	log_newpage(&index->rd_smgr->smgr_rnode.node, INIT_FORKNUM,
+				HNSW_METAPAGE_BLKNO, metapage, true);
+	smgrimmedsync(index->rd_smgr, INIT_FORKNUM);
+}
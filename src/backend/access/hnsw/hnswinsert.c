@@ -0,0 +1,268 @@
+/*-------------------------------------------------------------------------
+ *
+ * hnswinsert.c
+ *	  Insert an element into the on-disk graph of an HNSW index.
+ *
+ * Inserts are serialized by a heavyweight lock on the metapage, scans don't
+ * take it and only ever hold one buffer lock at a time, so they run
+ * concurrently with an insert and see the neighbour lists page by page.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/hnsw/hnswinsert.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/hnsw.h"
+#include "catalog/index.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/vector.h"
+
+
+/*
+ * Append an element tuple to the insert page, or to a new page if it doesn't
+ * fit.  meta->insertPage is advanced in the latter case.
+ */
+static void
+HnswAddElementTuple(HnswState *state, HnswElementTuple etup, Size size,
+					HnswMetaPageData *meta, ItemPointer tid)
+{
+	Relation	index = state->index;
+	Buffer		buffer;
+	Page		page;
+	GenericXLogState *xstate;
+	OffsetNumber offnum;
+	BlockNumber blkno = meta->insertPage;
+
+	if (blkno != InvalidBlockNumber)
+	{
+		buffer = ReadBuffer(index, blkno);
+		LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+		xstate = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(xstate, buffer, 0);
+
+		if (PageGetFreeSpace(page) >= MAXALIGN(size))
+		{
+			offnum = PageAddItem(page, (Item) etup, size, InvalidOffsetNumber,
+								 false, false);
+			if (offnum == InvalidOffsetNumber)
+				elog(ERROR, "failed to add element to hnsw index \"%s\"",
+					 RelationGetRelationName(index));
+
+			GenericXLogFinish(xstate);
+			UnlockReleaseBuffer(buffer);
+			ItemPointerSet(tid, blkno, offnum);
+			return;
+		}
+
+		GenericXLogAbort(xstate);
+		UnlockReleaseBuffer(buffer);
+	}
+
+	buffer = HnswNewBuffer(index);
+	xstate = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(xstate, buffer, GENERIC_XLOG_FULL_IMAGE);
+	HnswInitPage(page, 0);
+
+	offnum = PageAddItem(page, (Item) etup, size, InvalidOffsetNumber,
+						 false, false);
+	if (offnum == InvalidOffsetNumber)
+		elog(ERROR, "failed to add element to hnsw index \"%s\"",
+			 RelationGetRelationName(index));
+
+	GenericXLogFinish(xstate);
+	blkno = BufferGetBlockNumber(buffer);
+	UnlockReleaseBuffer(buffer);
+
+	meta->insertPage = blkno;
+	ItemPointerSet(tid, blkno, offnum);
+}
+
+/*
+ * Add the new element tid to the neighbour list of an existing element on
+ * one layer.  A full list gives up its farthest neighbour if the new one is
+ * nearer, otherwise it is left alone.
+ */
+static void
+HnswAddBackLink(HnswState *state, ItemPointer neighbor, int layer,
+				ItemPointer tid, float4 distance)
+{
+	Relation	index = state->index;
+	Buffer		buffer;
+	Page		page;
+	GenericXLogState *xstate;
+	HnswElementTuple etup;
+	int			start = HNSW_LAYER_START(layer, state->m);
+	int			end = start + HNSW_LAYER_SIZE(layer, state->m);
+	int			slot = -1;
+
+	buffer = ReadBuffer(index, ItemPointerGetBlockNumber(neighbor));
+	LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+	xstate = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(xstate, buffer, 0);
+	etup = (HnswElementTuple)
+		PageGetItem(page, PageGetItemId(page, ItemPointerGetOffsetNumber(neighbor)));
+
+	Assert(layer <= etup->level);
+
+	for (int i = start; i < end; i++)
+	{
+		HnswNeighbor *n = &etup->neighbors[i];
+
+		if (!ItemPointerIsValid(&n->tid))
+		{
+			slot = i;
+			break;
+		}
+		if (n->distance > distance &&
+			(slot < 0 || n->distance > etup->neighbors[slot].distance))
+			slot = i;
+	}
+
+	if (slot >= 0)
+	{
+		etup->neighbors[slot].tid = *tid;
+		etup->neighbors[slot].distance = distance;
+		GenericXLogFinish(xstate);
+	}
+	else
+		GenericXLogAbort(xstate);
+
+	UnlockReleaseBuffer(buffer);
+}
+
+/*
+ * Insert a vector into the on-disk graph: find its neighbours on every layer
+ * up to its level, write the element and link the neighbours back to it.
+ */
+void
+HnswInsertElement(HnswState *state, ItemPointer heaptid, const float4 *vector,
+				  int dim)
+{
+	Relation	index = state->index;
+	HnswMetaPageData meta;
+	HnswElementTuple etup;
+	ItemPointerData tid;
+	Size		size;
+	int			level;
+	int			m;
+
+	/* serializes inserts, scans don't take this lock */
+	LockPage(index, HNSW_METAPAGE_BLKNO, ExclusiveLock);
+
+	HnswGetMetaPageData(index, &meta);
+	m = state->m = meta.m;
+	state->dim = meta.dim;
+	HnswCheckDim(state, dim);
+	state->dim = meta.dim = dim;
+
+	level = HnswRandomLevel(m, dim);
+	size = HNSW_ELEMENT_SIZE(level, m, dim);
+	etup = (HnswElementTuple) palloc0(size);
+	etup->heaptid = *heaptid;
+	etup->level = level;
+	etup->deleted = 0;
+	etup->dim = dim;
+	for (int i = 0; i < HNSW_NEIGHBOR_COUNT(level, m); i++)
+		ItemPointerSetInvalid(&etup->neighbors[i].tid);
+	memcpy(HnswElementVector(etup, m), vector, sizeof(float4) * dim);
+
+	if (meta.entryLevel >= 0)
+	{
+		int			ef = state->efConstruction;
+		HnswCandidate *w = (HnswCandidate *) palloc(sizeof(HnswCandidate) * ef);
+		int			nw = 1;
+
+		w[0].tid = meta.entryPoint;
+		HnswLoadElement(state, &w[0], vector);
+
+		/* greedy descent to the element's level */
+		for (int layer = meta.entryLevel; layer > level; layer--)
+			nw = HnswSearchLayer(state, vector, w, nw, 1, layer);
+
+		for (int layer = Min(level, meta.entryLevel); layer >= 0; layer--)
+		{
+			int			start = HNSW_LAYER_START(layer, m);
+			int			nslots = HNSW_LAYER_SIZE(layer, m);
+
+			nw = HnswSearchLayer(state, vector, w, nw, ef, layer);
+
+			/*
+			 * The nearest ones become the neighbours.  Deleted elements are
+			 * taken too, they still connect the graph.
+			 */
+			for (int i = 0; i < nw && i < nslots; i++)
+			{
+				etup->neighbors[start + i].tid = w[i].tid;
+				etup->neighbors[start + i].distance = w[i].distance;
+			}
+		}
+		pfree(w);
+	}
+
+	HnswAddElementTuple(state, etup, size, &meta, &tid);
+
+	for (int layer = 0; layer <= level; layer++)
+	{
+		int			start = HNSW_LAYER_START(layer, m);
+		int			end = start + HNSW_LAYER_SIZE(layer, m);
+
+		for (int i = start; i < end; i++)
+		{
+			if (ItemPointerIsValid(&etup->neighbors[i].tid))
+				HnswAddBackLink(state, &etup->neighbors[i].tid, layer, &tid,
+								etup->neighbors[i].distance);
+		}
+	}
+
+	if (level > meta.entryLevel)
+	{
+		meta.entryPoint = tid;
+		meta.entryLevel = level;
+	}
+	HnswUpdateMetaPage(index, &meta);
+
+	UnlockPage(index, HNSW_METAPAGE_BLKNO, ExclusiveLock);
+
+	pfree(etup);
+}
+
+/*
+ * Insert new tuple to the HNSW index.  NULL vectors are not indexed.
+ */
+bool
+hnswinsert(Relation index, Datum *values, bool *isnull,
+		   ItemPointer ht_ctid, Relation heapRel,
+		   IndexUniqueCheck checkUnique,
+		   IndexInfo *indexInfo)
+{
+	HnswState	state;
+	Vector	   *vector;
+	MemoryContext oldCtx;
+	MemoryContext insertCtx;
+
+	if (isnull[0])
+		return false;
+
+	insertCtx = AllocSetContextCreate(CurrentMemoryContext,
+									  "Hnsw insert temporary context",
+									  ALLOCSET_DEFAULT_SIZES);
+	oldCtx = MemoryContextSwitchTo(insertCtx);
+
+	vector = DatumGetVector(values[0]);
+
+	HnswInitState(&state, index, true);
+	HnswInsertElement(&state, ht_ctid, vector->x, vector->dim);
+
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextDelete(insertCtx);
+
+	return false;
+}
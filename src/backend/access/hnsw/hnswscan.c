@@ -0,0 +1,324 @@
+/*-------------------------------------------------------------------------
+ *
+ * hnswscan.c
+ *	  Search routines for HNSW indexes.
+ *
+ * A scan descends greedily from the entry point to layer 1 and then
+ * collects the hnsw_ef_search nearest elements it can find on layer 0.
+ * Those are returned in order with their exact distances, so the executor
+ * doesn't need to recheck or reorder them.  A scan that wants more rows
+ * searches layer 0 again with twice the candidates and goes on with those
+ * beyond the last distance returned.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/hnsw/hnswscan.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/hnsw.h"
+#include "access/relscan.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/bufmgr.h"
+#include "utils/float.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/vector.h"
+
+/* GUC parameter */
+int			hnsw_ef_search = HNSW_DEFAULT_EF_SEARCH;
+
+
+/*
+ * Begin scan of an HNSW index.
+ */
+IndexScanDesc
+hnswbeginscan(Relation r, int nkeys, int norderbys)
+{
+	IndexScanDesc scan;
+	HnswScanOpaque so;
+
+	scan = RelationGetIndexScan(r, nkeys, norderbys);
+
+	so = (HnswScanOpaque) palloc0(sizeof(HnswScanOpaqueData));
+	HnswInitState(&so->state, r, true);
+	so->first = true;
+	so->scanCtx = AllocSetContextCreate(CurrentMemoryContext,
+										"Hnsw scan context",
+										ALLOCSET_DEFAULT_SIZES);
+
+	if (norderbys > 0)
+	{
+		so->orderByTypes = (Oid *) palloc(sizeof(Oid) * norderbys);
+		scan->xs_orderbyvals = (Datum *) palloc0(sizeof(Datum) * norderbys);
+		scan->xs_orderbynulls = (bool *) palloc(sizeof(bool) * norderbys);
+		memset(scan->xs_orderbynulls, true, sizeof(bool) * norderbys);
+	}
+
+	scan->opaque = so;
+
+	return scan;
+}
+
+/*
+ * Rescan an HNSW index.
+ */
+void
+hnswrescan(IndexScanDesc scan, ScanKey scankey, int nscankeys,
+		   ScanKey orderbys, int norderbys)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+
+	if (scankey && scan->numberOfKeys > 0)
+		memmove(scan->keyData, scankey,
+				scan->numberOfKeys * sizeof(ScanKeyData));
+
+	if (orderbys && scan->numberOfOrderBys > 0)
+	{
+		memmove(scan->orderByData, orderbys,
+				scan->numberOfOrderBys * sizeof(ScanKeyData));
+
+		/* the distance functions return float8, the operators may not */
+		for (int i = 0; i < scan->numberOfOrderBys; i++)
+			so->orderByTypes[i] =
+				get_func_rettype(scan->orderByData[i].sk_func.fn_oid);
+	}
+
+	MemoryContextReset(so->scanCtx);
+	so->first = true;
+	so->w = NULL;
+	so->nw = 0;
+	so->ef = 0;
+	so->next = 0;
+	so->returned = NULL;
+
+	/* count an indexscan for stats */
+	pgstat_count_index_scan(scan->indexRelation);
+}
+
+/*
+ * Run the search for the query vector, leaving the results in so->w.
+ */
+static void
+hnswSearch(IndexScanDesc scan)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+	HnswState  *state = &so->state;
+	ScanKey		key = &scan->orderByData[0];
+	HnswMetaPageData meta;
+	Vector	   *query;
+	HASHCTL		ctl;
+	int			nw = 1;
+
+	if (key->sk_flags & SK_ISNULL)
+	{
+		so->nullQuery = true;
+		so->blkno = HNSW_HEAD_BLKNO;
+		so->offnum = FirstOffsetNumber;
+		return;
+	}
+	so->nullQuery = false;
+
+	HnswGetMetaPageData(scan->indexRelation, &meta);
+	if (meta.entryLevel < 0)
+		return;
+	state->m = meta.m;
+	state->dim = meta.dim;
+
+	query = DatumGetVector(key->sk_argument);
+	HnswCheckDim(state, query->dim);
+	so->query = (float4 *) palloc(sizeof(float4) * query->dim);
+	memcpy(so->query, query->x, sizeof(float4) * query->dim);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(ItemPointerData);
+	ctl.entrysize = sizeof(ItemPointerData);
+	ctl.hcxt = CurrentMemoryContext;
+	so->returned = hash_create("hnsw returned elements", 256, &ctl,
+							   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	so->lastDistance = -get_float4_infinity();
+
+	so->ef = hnsw_ef_search;
+	so->w = (HnswCandidate *) palloc(sizeof(HnswCandidate) * so->ef);
+	so->w[0].tid = meta.entryPoint;
+	HnswLoadElement(state, &so->w[0], so->query);
+
+	for (int layer = meta.entryLevel; layer > 0; layer--)
+		nw = HnswSearchLayer(state, so->query, so->w, nw, 1, layer);
+	so->entry = so->w[0];
+	so->nw = HnswSearchLayer(state, so->query, so->w, nw, so->ef, 0);
+}
+
+/*
+ * All results of the search were returned.  If its candidate list was full
+ * there may be more elements, search layer 0 again with twice the
+ * candidates.  The new list mostly repeats the old one: elements already
+ * returned are skipped, and so are those nearer than the last one returned,
+ * which the first search missed and which would come out of order now.
+ * Returns false if the graph has no more elements to offer.
+ */
+static bool
+hnswSearchMore(IndexScanDesc scan)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+	int			ef;
+
+	if (so->nw < so->ef || so->ef >= (int) (MaxAllocSize / sizeof(HnswCandidate) / 2))
+		return false;
+
+	ef = so->ef * 2;
+	elog(DEBUG1, "hnsw scan ran out of its %d candidates, searching again with %d",
+		 so->ef, ef);
+
+	pfree(so->w);
+	so->ef = ef;
+	so->w = (HnswCandidate *) palloc(sizeof(HnswCandidate) * ef);
+	so->w[0] = so->entry;
+	so->nw = HnswSearchLayer(&so->state, so->query, so->w, 1, ef, 0);
+	so->next = 0;
+
+	return true;
+}
+
+/*
+ * Fetch the next element of a NULL query in physical order.  All distances
+ * are NULL, so any order is right.
+ */
+static bool
+hnswNextPhysical(IndexScanDesc scan)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+	BlockNumber npages = RelationGetNumberOfBlocks(scan->indexRelation);
+
+	for (; so->blkno < npages; so->blkno++, so->offnum = FirstOffsetNumber)
+	{
+		Buffer		buffer;
+		Page		page;
+		OffsetNumber maxoff;
+
+		buffer = ReadBuffer(scan->indexRelation, so->blkno);
+		LockBuffer(buffer, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buffer);
+		maxoff = PageGetMaxOffsetNumber(page);
+
+		for (; so->offnum <= maxoff; so->offnum++)
+		{
+			HnswElementTuple etup = (HnswElementTuple)
+			PageGetItem(page, PageGetItemId(page, so->offnum));
+
+			if (etup->deleted)
+				continue;
+
+			scan->xs_heaptid = etup->heaptid;
+			so->offnum++;
+			UnlockReleaseBuffer(buffer);
+			return true;
+		}
+
+		UnlockReleaseBuffer(buffer);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return false;
+}
+
+/*
+ * Fetch the next tuple in the given scan.
+ */
+bool
+hnswgettuple(IndexScanDesc scan, ScanDirection dir)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+
+	/* the planner only uses the index to order by a distance */
+	if (scan->numberOfOrderBys == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("hnsw index scans require an ORDER BY distance operator")));
+
+	/* hnsw indexes are never lossy */
+	scan->xs_recheck = false;
+
+	if (so->first)
+	{
+		MemoryContext oldCtx = MemoryContextSwitchTo(so->scanCtx);
+
+		hnswSearch(scan);
+		so->first = false;
+		MemoryContextSwitchTo(oldCtx);
+	}
+
+	if (so->nullQuery)
+	{
+		index_store_float8_orderby_distances(scan, so->orderByTypes, NULL, false);
+		return hnswNextPhysical(scan);
+	}
+
+	for (;;)
+	{
+		HnswCandidate *c;
+		IndexOrderByDistance distance;
+		bool		found;
+
+		if (so->next >= so->nw)
+		{
+			MemoryContext oldCtx;
+			bool		more;
+
+			if (so->w == NULL)
+				return false;
+			oldCtx = MemoryContextSwitchTo(so->scanCtx);
+			more = hnswSearchMore(scan);
+			MemoryContextSwitchTo(oldCtx);
+			if (!more)
+				return false;
+			continue;
+		}
+
+		c = &so->w[so->next++];
+
+		/* deleted elements were only needed to find the others */
+		if (c->deleted)
+			continue;
+
+		/* a search again after the list ran out finds the returned ones too */
+		if (c->distance < so->lastDistance)
+			continue;
+		hash_search(so->returned, &c->tid, HASH_ENTER, &found);
+		if (found)
+			continue;
+		so->lastDistance = c->distance;
+
+		scan->xs_heaptid = c->heaptid;
+		distance.value = HnswOrderByDistance(&so->state, c->distance);
+		distance.isnull = false;
+		index_store_float8_orderby_distances(scan, so->orderByTypes,
+											 &distance, false);
+		return true;
+	}
+}
+
+/*
+ * End a scan and release resources.
+ */
+void
+hnswendscan(IndexScanDesc scan)
+{
+	HnswScanOpaque so = (HnswScanOpaque) scan->opaque;
+
+	MemoryContextDelete(so->scanCtx);
+	if (scan->numberOfOrderBys > 0)
+	{
+		pfree(so->orderByTypes);
+		pfree(scan->xs_orderbyvals);
+		pfree(scan->xs_orderbynulls);
+	}
+	pfree(so);
+	scan->opaque = NULL;
+}
@@ -0,0 +1,444 @@
+/*-------------------------------------------------------------------------
+ *
+ * hnswutils.c
+ *	  Utility routines for the HNSW index: state, pages and the search of
+ *	  one layer of the on-disk graph.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/hnsw/hnswutils.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/genam.h"
+#include "access/hnsw.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+#include "utils/float.h"
+#include "utils/fmgroids.h"
+#include "utils/hsearch.h"
+#include "utils/regproc.h"
+#include "utils/rel.h"
+
+
+/*
+ * Fill the state of an index.  The distance comes from the support function
+ * of the opclass, m and the dimension from the metapage unless the caller is
+ * going to create it.
+ */
+void
+HnswInitState(HnswState *state, Relation index, bool readMeta)
+{
+	Oid			procid = index_getprocid(index, 1, HNSW_DISTANCE_PROC);
+
+	state->index = index;
+	state->efConstruction = HnswGetEfConstruction(index);
+
+	/* resolve the kernels now, builds call them from several threads */
+	vector_distance_init();
+
+	switch (procid)
+	{
+		case F_VECTOR_L2_DISTANCE:
+			state->kind = HNSW_DISTANCE_L2;
+			state->kernel = vector_l2_squared_kernel;
+			break;
+		case F_VECTOR_NEGATIVE_INNER_PRODUCT:
+			state->kind = HNSW_DISTANCE_INNER_PRODUCT;
+			state->kernel = vector_inner_product_kernel;
+			break;
+		case F_VECTOR_COSINE_DISTANCE:
+			state->kind = HNSW_DISTANCE_COSINE;
+			state->kernel = vector_cosine_distance_kernel;
+			break;
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("hnsw does not support distance function %s",
+							format_procedure(procid))));
+	}
+
+	if (readMeta)
+	{
+		HnswMetaPageData meta;
+
+		HnswGetMetaPageData(index, &meta);
+		state->m = meta.m;
+		state->dim = meta.dim;
+	}
+	else
+	{
+		state->m = HnswGetM(index);
+		state->dim = 0;
+	}
+}
+
+/*
+ * Distance between two vectors of the index's dimension as the graph uses
+ * it: squared for l2 and negated for the inner product, so that smaller is
+ * nearer in all cases.  Safe to call from threads other than the backend's.
+ */
+float4
+HnswDistance(HnswState *state, const float4 *a, const float4 *b)
+{
+	float4		distance = state->kernel(a, b, state->dim);
+
+	if (state->kind == HNSW_DISTANCE_INNER_PRODUCT)
+		distance = -distance;
+
+	/* cosine distance to a zero vector is NaN, keep those at the far end */
+	if (isnan(distance))
+		distance = get_float4_infinity();
+
+	return distance;
+}
+
+/*
+ * Convert an internal distance into what the ORDER BY operator returns.
+ */
+double
+HnswOrderByDistance(HnswState *state, float4 distance)
+{
+	if (state->kind == HNSW_DISTANCE_L2)
+		return sqrt((double) distance);
+	return (double) distance;
+}
+
+/*
+ * Check that a vector of dimension dim can go into / be searched in the
+ * index.
+ */
+void
+HnswCheckDim(HnswState *state, int dim)
+{
+	if (dim < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("hnsw index \"%s\" cannot contain empty vectors",
+						RelationGetRelationName(state->index))));
+
+	if (state->dim != 0 && dim != state->dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("expected %d dimensions, not %d", state->dim, dim)));
+
+	if (HNSW_ELEMENT_SIZE(0, state->m, dim) > HNSW_MAX_ELEMENT_SIZE)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("vector with %d dimensions is too large for hnsw index \"%s\" with m = %d",
+						dim, RelationGetRelationName(state->index), state->m)));
+}
+
+/*
+ * Draw the level of a new element, exponentially distributed with
+ * normalization 1 / ln(m).  Levels whose tuple wouldn't fit on a page are
+ * cut down.
+ */
+int
+HnswRandomLevel(int m, int dim)
+{
+	double		r = ((double) random() + 1) / ((double) MAX_RANDOM_VALUE + 2);
+	int			level;
+
+	level = (int) floor(-log(r) / log((double) m));
+	level = Min(level, HNSW_MAX_LEVEL);
+
+	while (level > 0 && HNSW_ELEMENT_SIZE(level, m, dim) > HNSW_MAX_ELEMENT_SIZE)
+		level--;
+
+	return level;
+}
+
+/*
+ * Initialize any page of an HNSW index.
+ */
+void
+HnswInitPage(Page page, uint16 flags)
+{
+	HnswPageOpaque opaque;
+
+	PageInit(page, BLCKSZ, sizeof(HnswPageOpaqueData));
+
+	opaque = HnswPageGetOpaque(page);
+	memset(opaque, 0, sizeof(HnswPageOpaqueData));
+	opaque->flags = flags;
+	opaque->hnsw_page_id = HNSW_PAGE_ID;
+}
+
+/*
+ * Fill in the metapage of an empty index.  m is frozen here for the life of
+ * the index since the element tuples are laid out with it.
+ */
+void
+HnswFillMetapage(Page page, int m)
+{
+	HnswMetaPageData *metadata;
+
+	HnswInitPage(page, HNSW_META);
+	metadata = HnswPageGetMeta(page);
+	memset(metadata, 0, sizeof(HnswMetaPageData));
+	metadata->magicNumber = HNSW_MAGIC_NUMBER;
+	metadata->version = HNSW_VERSION;
+	metadata->dim = 0;
+	metadata->m = m;
+	metadata->entryLevel = -1;
+	ItemPointerSetInvalid(&metadata->entryPoint);
+	metadata->insertPage = InvalidBlockNumber;
+	((PageHeader) page)->pd_lower += sizeof(HnswMetaPageData);
+}
+
+/*
+ * Initialize the metapage of a new index.
+ */
+void
+HnswInitMetapage(Relation index, int m)
+{
+	Buffer		metaBuffer;
+	Page		metaPage;
+	GenericXLogState *state;
+
+	metaBuffer = HnswNewBuffer(index);
+	Assert(BufferGetBlockNumber(metaBuffer) == HNSW_METAPAGE_BLKNO);
+
+	state = GenericXLogStart(index);
+	metaPage = GenericXLogRegisterBuffer(state, metaBuffer,
+										 GENERIC_XLOG_FULL_IMAGE);
+	HnswFillMetapage(metaPage, m);
+	GenericXLogFinish(state);
+
+	UnlockReleaseBuffer(metaBuffer);
+}
+
+/*
+ * Copy the current contents of the metapage.
+ */
+void
+HnswGetMetaPageData(Relation index, HnswMetaPageData *meta)
+{
+	Buffer		buffer;
+
+	buffer = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	*meta = *HnswPageGetMeta(BufferGetPage(buffer));
+	UnlockReleaseBuffer(buffer);
+
+	if (meta->magicNumber != HNSW_MAGIC_NUMBER)
+		ereport(ERROR,
+				(errcode(ERRCODE_INDEX_CORRUPTED),
+				 errmsg("index \"%s\" is not an hnsw index",
+						RelationGetRelationName(index))));
+	if (meta->version != HNSW_VERSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_INDEX_CORRUPTED),
+				 errmsg("hnsw index \"%s\" has wrong version %u, expected %d",
+						RelationGetRelationName(index), meta->version,
+						HNSW_VERSION)));
+}
+
+/*
+ * Write back the entry point, dimension and insert page.
+ */
+void
+HnswUpdateMetaPage(Relation index, HnswMetaPageData *meta)
+{
+	Buffer		buffer;
+	Page		page;
+	GenericXLogState *xstate;
+
+	buffer = ReadBuffer(index, HNSW_METAPAGE_BLKNO);
+	LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+	xstate = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(xstate, buffer, 0);
+
+	*HnswPageGetMeta(page) = *meta;
+
+	GenericXLogFinish(xstate);
+	UnlockReleaseBuffer(buffer);
+}
+
+/*
+ * Allocate a new page by extending the index, pages are never freed.  The
+ * returned buffer is exclusively locked.
+ */
+Buffer
+HnswNewBuffer(Relation index)
+{
+	Buffer		buffer;
+	bool		needLock;
+
+	needLock = !RELATION_IS_LOCAL(index);
+	if (needLock)
+		LockRelationForExtension(index, ExclusiveLock);
+
+	buffer = ReadBuffer(index, P_NEW);
+	LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+
+	if (needLock)
+		UnlockRelationForExtension(index, ExclusiveLock);
+
+	return buffer;
+}
+
+/*
+ * Read the element c->tid: its heap TID, deleted flag and distance to query.
+ */
+void
+HnswLoadElement(HnswState *state, HnswCandidate *c, const float4 *query)
+{
+	Buffer		buffer;
+	Page		page;
+	HnswElementTuple etup;
+
+	buffer = ReadBuffer(state->index, ItemPointerGetBlockNumber(&c->tid));
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buffer);
+	etup = (HnswElementTuple)
+		PageGetItem(page, PageGetItemId(page, ItemPointerGetOffsetNumber(&c->tid)));
+
+	c->heaptid = etup->heaptid;
+	c->deleted = etup->deleted != 0;
+	c->distance = HnswDistance(state, query, HnswElementVector(etup, state->m));
+
+	UnlockReleaseBuffer(buffer);
+}
+
+/*
+ * Copy the neighbours of an element on one layer into out, returns how many
+ * there are.
+ */
+static int
+HnswLoadNeighbors(HnswState *state, ItemPointer tid, int layer,
+				  ItemPointerData *out)
+{
+	Buffer		buffer;
+	Page		page;
+	HnswElementTuple etup;
+	int			n = 0;
+
+	buffer = ReadBuffer(state->index, ItemPointerGetBlockNumber(tid));
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buffer);
+	etup = (HnswElementTuple)
+		PageGetItem(page, PageGetItemId(page, ItemPointerGetOffsetNumber(tid)));
+
+	if (layer <= etup->level)
+	{
+		int			start = HNSW_LAYER_START(layer, state->m);
+		int			end = start + HNSW_LAYER_SIZE(layer, state->m);
+
+		for (int i = start; i < end; i++)
+		{
+			if (ItemPointerIsValid(&etup->neighbors[i].tid))
+				out[n++] = etup->neighbors[i].tid;
+		}
+	}
+
+	UnlockReleaseBuffer(buffer);
+
+	return n;
+}
+
+/*
+ * Put c into the candidate list w of at most ef entries sorted by distance.
+ * Returns the position, or -1 if c is farther than everything in a full list.
+ */
+static int
+HnswInsertCandidate(HnswCandidate *w, int *nw, int ef, const HnswCandidate *c)
+{
+	int			pos = *nw;
+	int			nmove;
+
+	while (pos > 0 && w[pos - 1].distance > c->distance)
+		pos--;
+	if (pos >= ef)
+		return -1;
+
+	nmove = Min(*nw, ef - 1) - pos;
+	if (nmove > 0)
+		memmove(&w[pos + 1], &w[pos], sizeof(HnswCandidate) * nmove);
+	w[pos] = *c;
+	*nw = Min(*nw + 1, ef);
+
+	return pos;
+}
+
+/*
+ * Greedy search of one layer of the graph, starting from the nw entry points
+ * in w (at most ef of them).  The ef elements nearest to query that were
+ * found are left in w sorted by distance, their number is returned.
+ *
+ * The candidate list and the result list of the original algorithm are kept
+ * in one sorted array: the next element to expand is the nearest one not
+ * expanded yet, the search ends when all of w has been expanded.
+ */
+int
+HnswSearchLayer(HnswState *state, const float4 *query, HnswCandidate *w,
+				int nw, int ef, int layer)
+{
+	HASHCTL		ctl;
+	HTAB	   *visited;
+	ItemPointerData *neighbors;
+	int			next = 0;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(ItemPointerData);
+	ctl.entrysize = sizeof(ItemPointerData);
+	ctl.hcxt = CurrentMemoryContext;
+	visited = hash_create("hnsw visited elements", 256, &ctl,
+						  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	neighbors = (ItemPointerData *)
+		palloc(sizeof(ItemPointerData) * HNSW_LAYER_SIZE(0, state->m));
+
+	for (int i = 0; i < nw; i++)
+	{
+		hash_search(visited, &w[i].tid, HASH_ENTER, NULL);
+		w[i].expanded = false;
+	}
+
+	for (;;)
+	{
+		int			nneighbors;
+
+		while (next < nw && w[next].expanded)
+			next++;
+		if (next >= nw)
+			break;
+
+		CHECK_FOR_INTERRUPTS();
+
+		w[next].expanded = true;
+		nneighbors = HnswLoadNeighbors(state, &w[next].tid, layer, neighbors);
+
+		for (int i = 0; i < nneighbors; i++)
+		{
+			HnswCandidate c;
+			bool		found;
+			int			pos;
+
+			hash_search(visited, &neighbors[i], HASH_ENTER, &found);
+			if (found)
+				continue;
+
+			c.tid = neighbors[i];
+			c.expanded = false;
+			HnswLoadElement(state, &c, query);
+
+			pos = HnswInsertCandidate(w, &nw, ef, &c);
+			if (pos >= 0 && pos < next)
+				next = pos;
+		}
+	}
+
+	pfree(neighbors);
+	hash_destroy(visited);
+
+	return nw;
+}
@@ -0,0 +1,154 @@
+/*-------------------------------------------------------------------------
+ *
+ * hnswvacuum.c
+ *	  HNSW VACUUM functions.
+ *
+ * Dead elements are only marked deleted: they keep their place in the graph
+ * because other elements are reached through them, and scans skip them.
+ * Their space is reclaimed by REINDEX.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/hnsw/hnswvacuum.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/hnsw.h"
+#include "commands/vacuum.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+
+
+/*
+ * Bulk deletion of all index entries pointing to a set of heap tuples.
+ * The set of target tuples is specified via a callback routine that tells
+ * whether any given heap tuple (identified by ItemPointer) is being deleted.
+ *
+ * Result: a palloc'd struct containing statistical info for VACUUM displays.
+ */
+IndexBulkDeleteResult *
+hnswbulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
+			   IndexBulkDeleteCallback callback, void *callback_state)
+{
+	Relation	index = info->index;
+	BlockNumber blkno,
+				npages;
+
+	if (stats == NULL)
+		stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
+
+	/*
+	 * Iterate over the pages. We don't care about concurrently added pages,
+	 * they can't contain tuples to delete.
+	 */
+	npages = RelationGetNumberOfBlocks(index);
+	for (blkno = HNSW_HEAD_BLKNO; blkno < npages; blkno++)
+	{
+		Buffer		buffer;
+		Page		page;
+		GenericXLogState *gxlogState;
+		OffsetNumber offnum,
+					maxoff;
+		bool		changed = false;
+
+		vacuum_delay_point();
+
+		buffer = ReadBufferExtended(index, MAIN_FORKNUM, blkno,
+									RBM_NORMAL, info->strategy);
+
+		LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+		gxlogState = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(gxlogState, buffer, 0);
+
+		if (PageIsNew(page))
+		{
+			GenericXLogAbort(gxlogState);
+			UnlockReleaseBuffer(buffer);
+			continue;
+		}
+
+		maxoff = PageGetMaxOffsetNumber(page);
+		for (offnum = FirstOffsetNumber; offnum <= maxoff; offnum++)
+		{
+			HnswElementTuple etup = (HnswElementTuple)
+			PageGetItem(page, PageGetItemId(page, offnum));
+
+			if (etup->deleted)
+				continue;
+
+			if (callback(&etup->heaptid, callback_state))
+			{
+				etup->deleted = 1;
+				stats->tuples_removed += 1;
+				changed = true;
+			}
+		}
+
+		if (changed)
+			GenericXLogFinish(gxlogState);
+		else
+			GenericXLogAbort(gxlogState);
+		UnlockReleaseBuffer(buffer);
+	}
+
+	return stats;
+}
+
+/*
+ * Post-VACUUM cleanup: count the live elements and the pages.
+ *
+ * Result: a palloc'd struct containing statistical info for VACUUM displays.
+ */
+IndexBulkDeleteResult *
+hnswvacuumcleanup(IndexVacuumInfo *info, IndexBulkDeleteResult *stats)
+{
+	Relation	index = info->index;
+	BlockNumber npages,
+				blkno;
+
+	if (info->analyze_only)
+		return stats;
+
+	if (stats == NULL)
+		stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
+
+	npages = RelationGetNumberOfBlocks(index);
+	stats->num_pages = npages;
+	stats->pages_free = 0;
+	stats->num_index_tuples = 0;
+	for (blkno = HNSW_HEAD_BLKNO; blkno < npages; blkno++)
+	{
+		Buffer		buffer;
+		Page		page;
+		OffsetNumber offnum,
+					maxoff;
+
+		vacuum_delay_point();
+
+		buffer = ReadBufferExtended(index, MAIN_FORKNUM, blkno,
+									RBM_NORMAL, info->strategy);
+		LockBuffer(buffer, BUFFER_LOCK_SHARE);
+		page = (Page) BufferGetPage(buffer);
+
+		if (!PageIsNew(page))
+		{
+			maxoff = PageGetMaxOffsetNumber(page);
+			for (offnum = FirstOffsetNumber; offnum <= maxoff; offnum++)
+			{
+				HnswElementTuple etup = (HnswElementTuple)
+				PageGetItem(page, PageGetItemId(page, offnum));
+
+				if (!etup->deleted)
+					stats->num_index_tuples += 1;
+			}
+		}
+
+		UnlockReleaseBuffer(buffer);
+	}
+
+	return stats;
+}
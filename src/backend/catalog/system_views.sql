@@ -853,6 +853,48 @@ CREATE VIEW pg_replication_slots AS
     FROM pg_get_replication_slots() AS L
             LEFT JOIN pg_database D ON (L.datoid = D.oid);
 
+CREATE VIEW pg_model_cache AS
+    SELECT
+            C.model_path,
+            C.state,
+            C.size_bytes,
+            C.backends,
+            C.hits,
+            C.loaded_at,
+            C.last_access
+    FROM pg_model_cache_status() AS C;
+
+CREATE VIEW pg_predict_result_cache AS
+    SELECT
+            C.tier,
+            C.entries,
+            C.size_bytes,
+            C.hits,
+            C.misses
+    FROM pg_predict_result_cache_status() AS C;
+
+CREATE VIEW pg_stat_model AS
+    SELECT
+            S.datid,
+            D.datname,
+            S.model,
+            S.calls,
+            S.batches,
+            S.rows,
+            S.pre_time,
+            S.infer_time,
+            S.post_time,
+            S.pre_hist,
+            S.infer_hist,
+            S.post_hist,
+            S.loads,
+            S.load_time,
+            S.resident_bytes,
+            S.errors,
+            S.stats_reset
+    FROM pg_stat_get_model() AS S
+            LEFT JOIN pg_database AS D ON (S.datid = D.oid);
+
 CREATE VIEW pg_stat_database AS
     SELECT
             D.oid AS datid,
@@ -1312,6 +1354,7 @@ REVOKE EXECUTE ON FUNCTION pg_stat_reset() FROM public;
 REVOKE EXECUTE ON FUNCTION pg_stat_reset_shared(text) FROM public;
 REVOKE EXECUTE ON FUNCTION pg_stat_reset_single_table_counters(oid) FROM public;
 REVOKE EXECUTE ON FUNCTION pg_stat_reset_single_function_counters(oid) FROM public;
+REVOKE EXECUTE ON FUNCTION pg_stat_reset_model() FROM public;
 
 REVOKE EXECUTE ON FUNCTION lo_import(text) FROM public;
 REVOKE EXECUTE ON FUNCTION lo_import(text, oid) FROM public;
@@ -19,6 +19,7 @@
 #include "commands/defrem.h"
 #include "commands/prepare.h"
 #include "executor/nodeHash.h"
+#include "executor/nodePredict.h"
 #include "foreign/fdwapi.h"
 #include "jit/jit.h"
 #include "nodes/extensible.h"
@@ -102,6 +103,7 @@ static void show_tablesample(TableSampleClause *tsc, PlanState *planstate,
 							 List *ancestors, ExplainState *es);
 static void show_sort_info(SortState *sortstate, ExplainState *es);
 static void show_hash_info(HashState *hashstate, ExplainState *es);
+static void show_predict_info(PredictState *predictstate, ExplainState *es);
 static void show_tidbitmap_info(BitmapHeapScanState *planstate,
 								ExplainState *es);
 static void show_instrumentation_count(const char *qlabel, int which,
@@ -110,6 +112,7 @@ static void show_foreignscan_info(ForeignScanState *fsstate, ExplainState *es);
 static void show_eval_params(Bitmapset *bms_params, ExplainState *es);
 static const char *explain_get_index_name(Oid indexId);
 static void show_buffer_usage(ExplainState *es, const BufferUsage *usage);
+static void show_model_usage(ExplainState *es, const Instrumentation *instrument);
 static void ExplainIndexScanDetails(Oid indexid, ScanDirection indexorderdir,
 									ExplainState *es);
 static void ExplainScanTarget(Scan *plan, ExplainState *es);
@@ -164,6 +167,8 @@ ExplainQuery(ParseState *pstate, ExplainStmt *stmt, const char *queryString,
 			es->costs = defGetBoolean(opt);
 		else if (strcmp(opt->defname, "buffers") == 0)
 			es->buffers = defGetBoolean(opt);
+		else if (strcmp(opt->defname, "model") == 0)
+			es->model = defGetBoolean(opt);
 		else if (strcmp(opt->defname, "settings") == 0)
 			es->settings = defGetBoolean(opt);
 		else if (strcmp(opt->defname, "timing") == 0)
@@ -208,6 +213,11 @@ ExplainQuery(ParseState *pstate, ExplainStmt *stmt, const char *queryString,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("EXPLAIN option BUFFERS requires ANALYZE")));
 
+	if (es->model && !es->analyze)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("EXPLAIN option MODEL requires ANALYZE")));
+
 	/* if the timing was not set explicitly, set default value */
 	es->timing = (timing_set) ? es->timing : es->analyze;
 
@@ -483,6 +493,8 @@ ExplainOnePlan(PlannedStmt *plannedstmt, IntoClause *into, ExplainState *es,
 
 	if (es->buffers)
 		instrument_option |= INSTRUMENT_BUFFERS;
+	if (es->model)
+		instrument_option |= INSTRUMENT_MODEL;
 
 	/*
 	 * We always collect timing for the entire statement, even when node-level
@@ -1288,6 +1300,9 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		case T_Limit:
 			pname = sname = "Limit";
 			break;
+		case T_Predict:
+			pname = sname = "Predict";
+			break;
 		case T_Hash:
 			pname = sname = "Hash";
 			break;
@@ -1858,6 +1873,9 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		case T_Hash:
 			show_hash_info(castNode(HashState, planstate), es);
 			break;
+		case T_Predict:
+			show_predict_info(castNode(PredictState, planstate), es);
+			break;
 		default:
 			break;
 	}
@@ -1866,6 +1884,10 @@ ExplainNode(PlanState *planstate, List *ancestors,
 	if (es->buffers && planstate->instrument)
 		show_buffer_usage(es, &planstate->instrument->bufusage);
 
+	/* Show model inference usage */
+	if (es->model && planstate->instrument)
+		show_model_usage(es, planstate->instrument);
+
 	/* Show worker detail */
 	if (es->analyze && es->verbose && planstate->worker_instrument)
 	{
@@ -1902,6 +1924,8 @@ ExplainNode(PlanState *planstate, List *ancestors,
 				es->indent++;
 				if (es->buffers)
 					show_buffer_usage(es, &instrument->bufusage);
+				if (es->model)
+					show_model_usage(es, instrument);
 				es->indent--;
 			}
 			else
@@ -1926,6 +1950,8 @@ ExplainNode(PlanState *planstate, List *ancestors,
 
 				if (es->buffers)
 					show_buffer_usage(es, &instrument->bufusage);
+				if (es->model)
+					show_model_usage(es, instrument);
 
 				ExplainCloseGroup("Worker", NULL, true, es);
 			}
@@ -2732,6 +2758,25 @@ show_hash_info(HashState *hashstate, ExplainState *es)
 	}
 }
 
+/*
+ * Show the models a Predict node runs and, with ANALYZE, the number of
+ * batches it needed.
+ */
+static void
+show_predict_info(PredictState *predictstate, ExplainState *es)
+{
+	Predict    *plan = (Predict *) predictstate->ps.plan;
+	List	   *models = NIL;
+	ListCell   *lc;
+
+	foreach(lc, plan->modelNames)
+		models = lappend(models, strVal(lfirst(lc)));
+	ExplainPropertyList("Models", models, es);
+	ExplainPropertyInteger("Batch Size", NULL, predict_batch_size, es);
+	if (es->analyze)
+		ExplainPropertyInteger("Batches", NULL, predictstate->numBatches, es);
+}
+
 /*
  * If it's EXPLAIN ANALYZE, show exact/lossy pages for a BitmapHeapScan node
  */
@@ -2988,6 +3033,54 @@ show_buffer_usage(ExplainState *es, const BufferUsage *usage)
 	}
 }
 
+/*
+ * Show the model inference done by a node and its children: forward passes
+ * and rows, and the time of the preprocess, forward and postprocess stages.
+ * The model name is left out when the node ran more than one model.
+ */
+static void
+show_model_usage(ExplainState *es, const Instrumentation *instrument)
+{
+	const ModelUsage *usage = &instrument->modelusage;
+	double		avg_batch = 0.0;
+
+	if (usage->batches > 0)
+		avg_batch = (double) usage->rows / usage->batches;
+
+	if (es->format == EXPLAIN_FORMAT_TEXT)
+	{
+		/* Only nodes that ran a model */
+		if (usage->batches == 0)
+			return;
+
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfoString(es->str, "Model:");
+		if (!instrument->multiple_models)
+			appendStringInfo(es->str, " %s", usage->model);
+		appendStringInfo(es->str, " rows=%ld batches=%ld avg batch=%.1f\n",
+						 usage->rows, usage->batches, avg_batch);
+
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str, "Model Timings: pre=%0.3f infer=%0.3f post=%0.3f\n",
+						 usage->pre_us / 1000.0, usage->infer_us / 1000.0,
+						 usage->post_us / 1000.0);
+	}
+	else
+	{
+		if (usage->batches > 0 && !instrument->multiple_models)
+			ExplainPropertyText("Model Name", usage->model, es);
+		ExplainPropertyInteger("Model Rows", NULL, usage->rows, es);
+		ExplainPropertyInteger("Model Batches", NULL, usage->batches, es);
+		ExplainPropertyFloat("Model Average Batch Size", NULL, avg_batch, 1, es);
+		ExplainPropertyFloat("Model Pre Time", "ms",
+							 usage->pre_us / 1000.0, 3, es);
+		ExplainPropertyFloat("Model Infer Time", "ms",
+							 usage->infer_us / 1000.0, 3, es);
+		ExplainPropertyFloat("Model Post Time", "ms",
+							 usage->post_us / 1000.0, 3, es);
+	}
+}
+
 /*
  * Add some additional details about an IndexScan or IndexOnlyScan
  */
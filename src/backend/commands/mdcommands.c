@@ -11,6 +11,7 @@
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/genam.h"
+#include "access/reloptions.h"
 #include "catalog/indexing.h"
 #include "catalog/model_info.h"
 #include "catalog/model_layer_info.h"
@@ -20,18 +21,147 @@
 #include "common/relpath.h"
 #include "libpq/libpq-fs.h"
 #include "model/libtorch_wrapper.h"
+#include "model/model_cache.h"
 #include "model/predict_wrapper.h"
+#include "storage/fd.h"
+#include "storage/large_object.h"
 #include "storage/lockdefs.h"
 #include "utils/acl.h"
 #include "utils/builtins.h"
 #include "utils/elog.h"
 #include "utils/fmgroids.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
 #include "utils/catcache.h"
 #include "utils/timestamp.h"
 
 
+/* large objects are copied out this many bytes at a time */
+#define MODEL_UPLOAD_BUFSIZE (4 * 1024 * 1024)
+
+/* GUC parameter */
+bool model_preload_on_create = false;
+
+static char *export_large_object(Oid lobjId, const char *filename, const char *fmd5,
+                                 bool keep, Size *size);
+
+typedef struct ModelLayerInsertState
+{
+    Relation    rel;
+    const char  *mdname;
+} ModelLayerInsertState;
+
+/* model_parameter_extraction callback: insert one chunk of a layer */
+static void
+insert_model_layer_chunk(const char *layer_name, int16 layer_index, int32 chunk_no,
+                         Vector *chunk, void *arg)
+{
+    ModelLayerInsertState *state = (ModelLayerInsertState *) arg;
+    Datum		values[Natts_model_layer_info];
+	bool		nulls[Natts_model_layer_info];
+    HeapTuple   tuple;
+
+    MemSet(nulls, false, sizeof(nulls));
+    values[Anum_model_layer_info_layermodelname-1] = CStringGetDatum(state->mdname);
+    values[Anum_model_layer_info_layername-1] = CStringGetTextDatum(layer_name);
+    values[Anum_model_layer_info_layerindex-1] = Int16GetDatum(layer_index);
+    values[Anum_model_layer_info_layerchunkno-1] = Int32GetDatum(chunk_no);
+    values[Anum_model_layer_info_parameter-1] = PointerGetDatum(chunk);
+
+    tuple = heap_form_tuple(RelationGetDescr(state->rel), values, nulls);
+    CatalogTupleInsert(state->rel, tuple);
+
+    heap_freetuple(tuple);
+    pfree(DatumGetPointer(values[Anum_model_layer_info_layername-1]));
+}
+
+/*
+ * delete the layer rows of a model. They are scanned rather than listed
+ * through the LAYERMODELNAME catcache, which would detoast every chunk into
+ * memory. Returns the number of rows deleted.
+ */
+static int64
+delete_model_layers(const char *mdname)
+{
+    Relation    rel;
+    ScanKeyData key;
+    SysScanDesc scan;
+    HeapTuple   tuple;
+    int64       ndeleted = 0;
+
+    rel = table_open(ModelLayerInfoRelationId, RowExclusiveLock);
+    ScanKeyInit(&key,
+                Anum_model_layer_info_layermodelname,
+                BTEqualStrategyNumber, F_NAMEEQ,
+                CStringGetDatum(mdname));
+    scan = systable_beginscan(rel, ModelLayerInfoNameIndex, true, NULL, 1, &key);
+    while((tuple = systable_getnext(scan)) != NULL){
+        CatalogTupleDelete(rel, &tuple->t_self);
+        ndeleted++;
+    }
+    systable_endscan(scan);
+    table_close(rel, NoLock);
+
+    return ndeleted;
+}
+
+
+/* remove a model file, the optimized module saved next to it and the cached weights of it and its variants */
+static void
+remove_model_file(const char *filename)
+{
+    char       *optimized = psprintf("%s%s", filename, MODEL_OPTIMIZED_SUFFIX);
+
+    remove(filename);
+    remove(optimized);
+    model_cache_evict_model(filename);
+    pfree(optimized);
+}
+
+/*
+ * the fine-tuned weights of mdname are cached as "<base model path>#<mdname>",
+ * the base model and its blob stay
+ */
+static void
+evict_fine_tuned_model(HeapTuple tuple, const char *mdname)
+{
+    Datum       basemodel;
+    Datum       path;
+    HeapTuple   base_tuple;
+    bool        isnull;
+    char       *model_path;
+    char       *cache_key;
+
+    basemodel = SysCacheGetAttr(MODELNAME, tuple, Anum_model_info_basemodel, &isnull);
+    if(isnull){
+        return;
+    }
+    base_tuple = SearchSysCache1(BASEMODEL, basemodel);
+    if(!HeapTupleIsValid(base_tuple)){
+        return;
+    }
+    path = SysCacheGetAttr(BASEMODEL, base_tuple, Anum_base_model_info_modelpath, &isnull);
+    if(!isnull){
+        model_path = TextDatumGetCString(path);
+        cache_key = psprintf("%s#%s", model_path, mdname);
+        model_cache_evict(cache_key);
+        pfree(cache_key);
+        pfree(model_path);
+    }
+    ReleaseSysCache(base_tuple);
+}
+
+/* text[] of the WITH options of CREATE/MODIFY MODEL, checked by the model manager */
+static Datum
+transform_model_options(List *options)
+{
+    Datum       result = transformRelOptions((Datum) 0, options, NULL, NULL, false, false);
+
+    if(result != (Datum) 0)
+        model_load_options_validate(result);
+    return result;
+}
 
 /*
  *
@@ -45,28 +175,27 @@ createmd(ParseState *pstate, const CreatemdStmt *stmt)
     // int16       version = get_model_max_version(stmt->mdname)+1;
     char *dbDir = GetDatabasePath(MyDatabaseId, MyDatabaseTableSpace);
     char *filename = psprintf("%s/%s/%s",DataDir, dbDir, stmt->mdname);
-    export_large_object(stmt->looid, filename, stmt->md5);
+    char *optimized = psprintf("%s%s", filename, MODEL_OPTIMIZED_SUFFIX);
+    Size model_len;
+    char *model_bytes;
 
     Datum		new_record[Natts_model_info];
 	bool		new_record_nulls[Natts_model_info];
-    Datum		new_layer_record[Natts_model_layer_info];
-	bool		new_layer_record_nulls[Natts_model_layer_info];
 
     HeapTuple	tuple;
     Relation	pg_model_info_rel;
-    Relation    pg_model_layer_info_rel;
 
     char        *mdname = stmt->mdname;
     char        *desc   = stmt->desc;
     char        *md5 = stmt->md5;
     char        *base_model = stmt->base_model;
     char        *user = GetUserNameFromId(GetUserId(), false);
+    Datum       options;
 
-    ModelLayer  *model_layer = NULL;
     uint32       layer_size = 0;
 
 
-    // 先判断是否已经存在同名的model
+    // 先判断是否已经存在同名的model, 文件和缓存都属于它, 在此之前不能动
     if(SearchSysCacheExists1(MODELNAME, CStringGetDatum(mdname))){
         ereport(ERROR,
 				(errcode(ERRCODE_DUPLICATE_MODEL),
@@ -79,6 +208,8 @@ createmd(ParseState *pstate, const CreatemdStmt *stmt)
 				 errmsg("model \"%s\" already exists in model_layer_info", mdname)));
     }
 
+    options = transform_model_options(stmt->options);
+
     if(base_model != NULL){
         if(strcmp(mdname, base_model) == 0){
             ereport(ERROR,
@@ -90,9 +221,22 @@ createmd(ParseState *pstate, const CreatemdStmt *stmt)
                     (errcode(ERRCODE_UNDEFINED_BASE_MODEL),
                     errmsg("base model \"%s\" not exists in base_model_info", base_model)));
         }
+        // the module of a base model is shared by all models fine-tuned from it
+        if(options != (Datum) 0){
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                    errmsg("model options are not supported for models with a base model")));
+        }
     }
 
-
+    // a blob or optimized module left by an earlier, aborted createmd of the same name is stale
+    model_cache_evict_model(filename);
+    remove(optimized);
+    // frozen modules don't use the model cache, so there is nothing to warm
+    model_bytes = export_large_object(stmt->looid, filename, stmt->md5,
+                                      model_preload_on_create && base_model == NULL &&
+                                      options == (Datum) 0,
+                                      &model_len);
 
     // 插入新model的记录
     pg_model_info_rel = table_open(ModelInfoRelationId, RowExclusiveLock);
@@ -132,6 +276,12 @@ createmd(ParseState *pstate, const CreatemdStmt *stmt)
         new_record[Anum_model_info_description - 1] = CStringGetTextDatum(desc);
     }
 
+    if(options == (Datum) 0) {
+        new_record_nulls[Anum_model_info_modeloptions - 1] = true;
+    }else {
+        new_record[Anum_model_info_modeloptions - 1] = options;
+    }
+
     //new_record[Anum_model_info_updatetime- 1] = TimestampGetDatum(GetSQLLocalTimestamp(-1));
     tuple = heap_form_tuple(RelationGetDescr(pg_model_info_rel), new_record, new_record_nulls);
 
@@ -139,27 +289,22 @@ createmd(ParseState *pstate, const CreatemdStmt *stmt)
     table_close(pg_model_info_rel, RowExclusiveLock);
 
     if(base_model != NULL){
-        // insert model parameter
-        model_parameter_extraction(filename, &model_layer, &layer_size);
-        if(model_layer == NULL){
+        // insert model parameter, one row per chunk of each layer
+        ModelLayerInsertState insert_state;
+
+        insert_state.rel = table_open(ModelLayerInfoRelationId, RowExclusiveLock);
+        insert_state.mdname = mdname;
+        layer_size = model_parameter_extraction(filename, insert_model_layer_chunk, &insert_state);
+        table_close(insert_state.rel, RowExclusiveLock);
+        if(layer_size == 0){
             ereport(ERROR,
                     errmsg("model layer empty"));
         }
+    }
 
-        pg_model_layer_info_rel = table_open(ModelLayerInfoRelationId, RowExclusiveLock);
-        
-
-        for(int16 i=1; i<=layer_size; ++i){
-            MemSet(new_layer_record, 0, sizeof(new_layer_record));
-            MemSet(new_layer_record_nulls, false, sizeof(new_layer_record_nulls));
-            new_layer_record[Anum_model_layer_info_layermodelname-1] = CStringGetDatum(mdname);
-            new_layer_record[Anum_model_layer_info_layername-1] = CStringGetTextDatum(model_layer[i-1].layer_name);
-            new_layer_record[Anum_model_layer_info_layerindex-1] = Int16GetDatum(i);
-            new_layer_record[Anum_model_layer_info_parameter-1] = PointerGetDatum(model_layer[i-1].layer_parameter);
-            tuple = heap_form_tuple(RelationGetDescr(pg_model_layer_info_rel), new_layer_record, new_layer_record_nulls);
-            CatalogTupleInsert(pg_model_layer_info_rel, tuple);
-        }
-        table_close(pg_model_layer_info_rel, RowExclusiveLock);
+    if(model_bytes != NULL){
+        model_warm_from_buffer(filename, model_bytes, model_len);
+        pfree(model_bytes);
     }
 
     ForceSyncCommit();
@@ -174,7 +319,6 @@ dropmd(ParseState *pstate, const DropmdStmt *stmt){
     // 判断是否存在该model
     char        *mdname = stmt->mdname;
     Relation	pg_model_info_rel;
-    Relation    pg_model_layer_info_rel;
     HeapTuple	tuple;
     Datum       oldfilenamedatum;
     char        *oldFilename;
@@ -191,11 +335,12 @@ dropmd(ParseState *pstate, const DropmdStmt *stmt){
     tuple = SearchSysCache1(MODELNAME,CStringGetDatum(mdname));
 
     oldfilenamedatum = SysCacheGetAttr(MODELNAME, tuple, Anum_model_info_modelpath, &isnull);
-    // has base model
-    if(isnull){
+    // new model, delete model file
+    if(!isnull){
         oldFilename = TextDatumGetCString(oldfilenamedatum);
-        // delete model file
-        remove(oldFilename);
+        remove_model_file(oldFilename);
+    }else{
+        evict_fine_tuned_model(tuple, mdname);
     }
 
     CatalogTupleDelete(pg_model_info_rel,&tuple->t_self);
@@ -205,22 +350,12 @@ dropmd(ParseState *pstate, const DropmdStmt *stmt){
 
     // has base model
     if(isnull){
-        if(!SearchSysCacheExists1(LAYERMODELNAME, CStringGetDatum(mdname))){
+        // delete model_layer_info
+        if(delete_model_layers(mdname) == 0){
             ereport(ERROR,
                     (errcode(ERRCODE_UNDEFINED_MODEL),
-                    errmsg("model \"%s\" does not exist in model_layer_inf1o", mdname)));
-        }
-        // delete model_layer_info
-        pg_model_layer_info_rel = table_open(ModelLayerInfoRelationId, RowExclusiveLock);
-        if(SearchSysCacheExists1(LAYERMODELNAME, CStringGetDatum(mdname))){
-            CatCList* parameter_list = SearchSysCacheList1(LAYERMODELNAME,CStringGetDatum(mdname));
-            for(int i=0; i<parameter_list->n_members; i++){
-                HeapTuple proctup = &parameter_list->members[i]->tuple;
-                CatalogTupleDelete(pg_model_layer_info_rel,&proctup->t_self);
-            }
-            ReleaseCatCacheList(parameter_list);
+                    errmsg("model \"%s\" does not exist in model_layer_info", mdname)));
         }
-        table_close(pg_model_layer_info_rel, NoLock);
     }
 }
 
@@ -228,11 +363,10 @@ void
 updatemd(ParseState *pstate, const UpdatemdStmt *stmt)
 {
     char random_suffix[5];	
-    generate_random_digits(random_suffix, 4);
-    
     char *dbDir = GetDatabasePath(MyDatabaseId, MyDatabaseTableSpace);
-    char *filename = psprintf("%s/%s/%s-%s",DataDir, dbDir, stmt->mdname,random_suffix);
-    export_large_object(stmt->looid, filename, stmt->md5);
+    char *filename;
+    Size model_len;
+    char *model_bytes;
 
     HeapTuple	tuple;
     HeapTuple	newtuple;
@@ -246,9 +380,32 @@ updatemd(ParseState *pstate, const UpdatemdStmt *stmt)
     char        *user = GetUserNameFromId(GetUserId(), false);
     Datum       oldfilenamedatum;
     char        *oldFilename;
+    Datum       options = transform_model_options(stmt->options);
+    bool        has_options;
 
     Relation	pg_model_desc;
 
+    generate_random_digits(random_suffix, 4);
+    filename = psprintf("%s/%s/%s-%s",DataDir, dbDir, stmt->mdname,random_suffix);
+
+    // 查原来的tuple
+    pg_model_desc = table_open(ModelInfoRelationId, RowExclusiveLock);
+    tuple = SearchSysCache1(MODELNAME, CStringGetDatum(mdname));
+    if(!HeapTupleIsValid(tuple)) {
+        ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_MODEL),
+				 errmsg("model \"%s\" does not exist in model_info", mdname)));
+    }
+
+    // without WITH the options of the model are kept; frozen modules don't
+    // use the model cache, so there is nothing to warm and no need to keep the bytes
+    has_options = options != (Datum) 0 ||
+        !heap_attisnull(tuple, Anum_model_info_modeloptions, RelationGetDescr(pg_model_desc));
+
+    model_cache_evict_model(filename);
+    model_bytes = export_large_object(stmt->looid, filename, stmt->md5,
+                                      model_preload_on_create && !has_options, &model_len);
+
     replaces[Anum_model_info_modelpath - 1] = true;
     values[Anum_model_info_modelpath - 1] = CStringGetTextDatum(filename);
     nulls[Anum_model_info_modelpath - 1] = false;
@@ -271,16 +428,11 @@ updatemd(ParseState *pstate, const UpdatemdStmt *stmt)
         nulls[Anum_model_info_description - 1] = false;
     }
 
-    // 查原来的tuple
-    pg_model_desc = table_open(ModelInfoRelationId, RowExclusiveLock);
-    tuple = SearchSysCache1(MODELNAME, CStringGetDatum(mdname));
-    if(!HeapTupleIsValid(tuple)) {
-        ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_MODEL),
-				 errmsg("model \"%s\" does not exist in model_info", mdname)));
+    if(options != (Datum) 0) {
+        replaces[Anum_model_info_modeloptions - 1] = true;
+        values[Anum_model_info_modeloptions - 1] = options;
+        nulls[Anum_model_info_modeloptions - 1] = false;
     }
-    
-
 
     oldfilenamedatum = SysCacheGetAttr(MODELNAME, tuple, Anum_model_info_modelpath, &isnull);
     
@@ -296,82 +448,144 @@ updatemd(ParseState *pstate, const UpdatemdStmt *stmt)
     table_close(pg_model_desc,NoLock);
 
     // 删除原文件
-    remove(oldFilename);
+    remove_model_file(oldFilename);
+
+    if(model_bytes != NULL){
+        model_warm_from_buffer(filename, model_bytes, model_len);
+        pfree(model_bytes);
+    }
 
 }
 
 
 
 
-void
-export_large_object(Oid lobjId, const char *filename, const char* fmd5)
+/* write all of len bytes, retrying short writes */
+static void
+write_model_file(int fd, const char *data, Size len, const char *path)
+{
+    while(len > 0){
+        ssize_t     written;
+
+        errno = 0;
+        written = write(fd, data, len);
+        if(written <= 0){
+            /* if write didn't set errno, assume problem is no disk space */
+            if(errno == 0)
+                errno = ENOSPC;
+            ereport(ERROR,
+                    (errcode_for_file_access(),
+                     errmsg("could not write to file \"%s\": %m", path)));
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+/*
+ * copy large object lobjId to filename, checking it against fmd5 in the same
+ * pass, then drop the large object.
+ *
+ * The object is read MODEL_UPLOAD_BUFSIZE bytes at a time into a temporary
+ * file, which is fsync'ed and renamed into place like any other file of the
+ * data directory, so a crash never leaves a partial model behind. If keep is
+ * set and the object fits in model_cache_size, it is read into one buffer
+ * instead, which is returned (with its length in *size) for warming the model
+ * cache; otherwise NULL is returned.
+ */
+static char *
+export_large_object(Oid lobjId, const char *filename, const char *fmd5,
+                    bool keep, Size *size)
 {
-    int32       lobj_fd;
-    char        buf[8192];
-    int         nbytes;
-    int         dst_fd;
-    char        hexsum[33]; // 摘要校验
-    char        *err_msg;
+    LargeObjectDesc *lobj;
+    char        tmpfile[MAXPGPATH];
+    char       *buf;
+    char       *model_bytes = NULL;
+    int64       lo_size;
+    int64       total = 0;
+    volatile int fd;
+    char        md5_str[MD5_STR_LEN + 1];
     unsigned char md5_value[MD5_SIZE];
-    MD5_CTX md5;
-    
-    
-    lobj_fd = inv_open(lobjId, INV_READ, CurrentMemoryContext);
-    if (lobj_fd < 0)
-        ereport(ERROR, (errmsg("could not open large object %u", lobjId)));
-
-    dst_fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC | PG_BINARY, 0666);
-    if (dst_fd < 0){
-        inv_close(lobj_fd);
-        ereport(ERROR, (errcode_for_file_access(),
-                        errmsg("could not create file \"%s\" ", filename)));
+    MD5_CTX     md5;
+
+    lobj = inv_open(lobjId, INV_READ, CurrentMemoryContext);
+
+    lo_size = inv_seek(lobj, 0, SEEK_END);
+    inv_seek(lobj, 0, SEEK_SET);
+    if(keep && lo_size > 0 && lo_size <= (int64) model_cache_size * 1024 &&
+       lo_size <= (int64) MaxAllocHugeSize){
+        model_bytes = MemoryContextAllocExtended(CurrentMemoryContext, lo_size,
+                                                 MCXT_ALLOC_HUGE);
+        buf = NULL;
+    }else{
+        buf = palloc(MODEL_UPLOAD_BUFSIZE);
     }
-    MD5Init(&md5);
 
-    for (;;)
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", filename);
+    fd = OpenTransientFile(tmpfile, O_CREAT | O_WRONLY | O_TRUNC | PG_BINARY);
+    if(fd < 0)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not create file \"%s\": %m", tmpfile)));
+
+    PG_TRY();
     {
-        nbytes = inv_read(lobj_fd, buf, sizeof(buf));
-        if (nbytes <= 0)
-            break;
-        // if(!pg_md5_hash(buf, nbytes, hexsum)) {
-        //     err_msg = "model file check md5 failed";
-        //     goto error;
-        // }
-        MD5Update(&md5, buf, nbytes);
-        if ((int) write(dst_fd, buf, nbytes) != nbytes){
-            inv_close(lobj_fd);
-            close(dst_fd);
-            remove(filename);
-            ereport(ERROR, (errcode_for_file_access(),
-                                    errmsg("err_msg")));
+        MD5Init(&md5);
+        for(;;){
+            char   *dst = model_bytes ? model_bytes + total : buf;
+            int     want = MODEL_UPLOAD_BUFSIZE;
+            int     nbytes;
+
+            if(model_bytes)
+                want = (int) Min((int64) want, lo_size - total);
+            if(want <= 0)
+                break;
+            nbytes = inv_read(lobj, dst, want);
+            if(nbytes <= 0)
+                break;
+            MD5Update(&md5, (unsigned char *) dst, nbytes);
+            write_model_file(fd, dst, nbytes, tmpfile);
+            total += nbytes;
+            CHECK_FOR_INTERRUPTS();
         }
-    }
 
-    inv_close(lobj_fd);
-    if(close(dst_fd) != 0 ){
-        // ereport(ERROR, (errcode_for_file_access(),
-        //                 errmsg("could not close file \"%s\" ", filename)));
-        remove(filename);
-        ereport(ERROR, (errcode_for_file_access(),
-                                    errmsg("could not close file")));
+        MD5Final(&md5, md5_value);
+        for(int i = 0; i < MD5_SIZE; i++)
+            snprintf(md5_str + i * 2, 3, "%02x", md5_value[i]);
+        if(pg_strcasecmp(md5_str, fmd5) != 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATA_CORRUPTED),
+                     errmsg("file md5 not match")));
+
+        if(pg_fsync(fd) != 0)
+            ereport(data_sync_elevel(ERROR),
+                    (errcode_for_file_access(),
+                     errmsg("could not fsync file \"%s\": %m", tmpfile)));
+        if(CloseTransientFile(fd) != 0)
+            ereport(ERROR,
+                    (errcode_for_file_access(),
+                     errmsg("could not close file \"%s\": %m", tmpfile)));
+        fd = -1;
+
+        /* fsyncs the directory as well */
+        durable_rename(tmpfile, filename, ERROR);
     }
-    inv_drop(lobjId);
-    MD5Final(&md5, md5_value);
-    char *md5_str = palloc0(33);
-
-    for(int i = 0; i < MD5_SIZE; i++)
-	{
-		snprintf(md5_str + i*2, 2+1, "%02x", md5_value[i]);
-	}
-
-    if(pg_strcasecmp(md5_str, fmd5)){
-        remove(filename);
-        ereport(ERROR, (errcode_for_file_access(),
-                        errmsg("file md5 not match")));
+    PG_CATCH();
+    {
+        if(fd >= 0)
+            CloseTransientFile(fd);
+        unlink(tmpfile);
+        PG_RE_THROW();
     }
+    PG_END_TRY();
 
-        
-    return ;
+    inv_close(lobj);
+    inv_drop(lobjId);
+    if(buf)
+        pfree(buf);
+
+    *size = (Size) total;
+    return model_bytes;
 }
 
 
@@ -19,10 +19,16 @@
 
 BufferUsage pgBufferUsage;
 static BufferUsage save_pgBufferUsage;
+ModelUsage	pgModelUsage;
+static ModelUsage save_pgModelUsage;
 
 static void BufferUsageAdd(BufferUsage *dst, const BufferUsage *add);
 static void BufferUsageAccumDiff(BufferUsage *dst,
 								 const BufferUsage *add, const BufferUsage *sub);
+static void ModelUsageAdd(ModelUsage *dst, const ModelUsage *add);
+static void ModelUsageAccumDiff(ModelUsage *dst,
+								const ModelUsage *add, const ModelUsage *sub);
+static void InstrNoteModel(Instrumentation *instr, const char *model);
 
 
 /* Allocate new instrumentation structure(s) */
@@ -33,16 +39,19 @@ InstrAlloc(int n, int instrument_options)
 
 	/* initialize all fields to zeroes, then modify as needed */
 	instr = palloc0(n * sizeof(Instrumentation));
-	if (instrument_options & (INSTRUMENT_BUFFERS | INSTRUMENT_TIMER))
+	if (instrument_options & (INSTRUMENT_BUFFERS | INSTRUMENT_TIMER |
+							  INSTRUMENT_MODEL))
 	{
 		bool		need_buffers = (instrument_options & INSTRUMENT_BUFFERS) != 0;
 		bool		need_timer = (instrument_options & INSTRUMENT_TIMER) != 0;
+		bool		need_model = (instrument_options & INSTRUMENT_MODEL) != 0;
 		int			i;
 
 		for (i = 0; i < n; i++)
 		{
 			instr[i].need_bufusage = need_buffers;
 			instr[i].need_timer = need_timer;
+			instr[i].need_modelusage = need_model;
 		}
 	}
 
@@ -56,6 +65,7 @@ InstrInit(Instrumentation *instr, int instrument_options)
 	memset(instr, 0, sizeof(Instrumentation));
 	instr->need_bufusage = (instrument_options & INSTRUMENT_BUFFERS) != 0;
 	instr->need_timer = (instrument_options & INSTRUMENT_TIMER) != 0;
+	instr->need_modelusage = (instrument_options & INSTRUMENT_MODEL) != 0;
 }
 
 /* Entry to a plan node */
@@ -69,6 +79,10 @@ InstrStartNode(Instrumentation *instr)
 	/* save buffer usage totals at node entry, if needed */
 	if (instr->need_bufusage)
 		instr->bufusage_start = pgBufferUsage;
+
+	/* likewise model usage */
+	if (instr->need_modelusage)
+		instr->modelusage_start = pgModelUsage;
 }
 
 /* Exit from a plan node */
@@ -97,6 +111,18 @@ InstrStopNode(Instrumentation *instr, double nTuples)
 		BufferUsageAccumDiff(&instr->bufusage,
 							 &pgBufferUsage, &instr->bufusage_start);
 
+	/* Add delta of model usage, if the node ran any forward pass */
+	if (instr->need_modelusage &&
+		pgModelUsage.batches != instr->modelusage_start.batches)
+	{
+		/* the first pass may have switched from another node's model */
+		if (pgModelUsage.switches - instr->modelusage_start.switches > 1)
+			instr->multiple_models = true;
+		InstrNoteModel(instr, pgModelUsage.model);
+		ModelUsageAccumDiff(&instr->modelusage,
+							&pgModelUsage, &instr->modelusage_start);
+	}
+
 	/* Is this the first tuple of this cycle? */
 	if (!instr->running)
 	{
@@ -160,6 +186,14 @@ InstrAggNode(Instrumentation *dst, Instrumentation *add)
 	/* Add delta of buffer usage since entry to node's totals */
 	if (dst->need_bufusage)
 		BufferUsageAdd(&dst->bufusage, &add->bufusage);
+
+	if (dst->need_modelusage && add->modelusage.batches > 0)
+	{
+		if (add->multiple_models)
+			dst->multiple_models = true;
+		InstrNoteModel(dst, add->modelusage.model);
+		ModelUsageAdd(&dst->modelusage, &add->modelusage);
+	}
 }
 
 /* note current values during parallel executor startup */
@@ -167,21 +201,71 @@ void
 InstrStartParallelQuery(void)
 {
 	save_pgBufferUsage = pgBufferUsage;
+	save_pgModelUsage = pgModelUsage;
 }
 
 /* report usage after parallel executor shutdown */
 void
-InstrEndParallelQuery(BufferUsage *result)
+InstrEndParallelQuery(BufferUsage *bufusage, ModelUsage *modelusage)
 {
-	memset(result, 0, sizeof(BufferUsage));
-	BufferUsageAccumDiff(result, &pgBufferUsage, &save_pgBufferUsage);
+	memset(bufusage, 0, sizeof(BufferUsage));
+	BufferUsageAccumDiff(bufusage, &pgBufferUsage, &save_pgBufferUsage);
+	if (modelusage != NULL)
+	{
+		memset(modelusage, 0, sizeof(ModelUsage));
+		ModelUsageAccumDiff(modelusage, &pgModelUsage, &save_pgModelUsage);
+		strlcpy(modelusage->model, pgModelUsage.model, NAMEDATALEN);
+	}
 }
 
 /* accumulate work done by workers in leader's stats */
 void
-InstrAccumParallelQuery(BufferUsage *result)
+InstrAccumParallelQuery(BufferUsage *bufusage, ModelUsage *modelusage)
+{
+	BufferUsageAdd(&pgBufferUsage, bufusage);
+	if (modelusage != NULL && modelusage->batches > 0)
+	{
+		ModelUsageAdd(&pgModelUsage, modelusage);
+
+		/*
+		 * A worker that ran one model counted a switch for its first pass;
+		 * from the leader's view that is a switch only if the leader's last
+		 * model was another one.
+		 */
+		if (modelusage->switches == 1 &&
+			strcmp(pgModelUsage.model, modelusage->model) == 0)
+			pgModelUsage.switches--;
+		strlcpy(pgModelUsage.model, modelusage->model, NAMEDATALEN);
+	}
+}
+
+/*
+ * Count a forward pass of model over rows rows in pgModelUsage, with the
+ * time of its stages in microseconds.
+ */
+void
+InstrCountPrediction(const char *model, long rows,
+					 int64 pre_us, int64 infer_us, int64 post_us)
 {
-	BufferUsageAdd(&pgBufferUsage, result);
+	if (strncmp(pgModelUsage.model, model, NAMEDATALEN) != 0)
+	{
+		pgModelUsage.switches++;
+		strlcpy(pgModelUsage.model, model, NAMEDATALEN);
+	}
+	pgModelUsage.batches++;
+	pgModelUsage.rows += rows;
+	pgModelUsage.pre_us += pre_us;
+	pgModelUsage.infer_us += infer_us;
+	pgModelUsage.post_us += post_us;
+}
+
+/* remember the model of a node, noting when it has seen several */
+static void
+InstrNoteModel(Instrumentation *instr, const char *model)
+{
+	if (instr->modelusage.model[0] != '\0' && strcmp(instr->modelusage.model, model) != 0)
+		instr->multiple_models = true;
+	strlcpy(instr->modelusage.model, model, NAMEDATALEN);
 }
 
 /* dst += add */
@@ -223,3 +307,29 @@ BufferUsageAccumDiff(BufferUsage *dst,
 	INSTR_TIME_ACCUM_DIFF(dst->blk_write_time,
 						  add->blk_write_time, sub->blk_write_time);
 }
+
+/* dst += add */
+static void
+ModelUsageAdd(ModelUsage *dst, const ModelUsage *add)
+{
+	dst->batches += add->batches;
+	dst->rows += add->rows;
+	dst->switches += add->switches;
+	dst->pre_us += add->pre_us;
+	dst->infer_us += add->infer_us;
+	dst->post_us += add->post_us;
+}
+
+/* dst += add - sub */
+static void
+ModelUsageAccumDiff(ModelUsage *dst,
+					const ModelUsage *add,
+					const ModelUsage *sub)
+{
+	dst->batches += add->batches - sub->batches;
+	dst->rows += add->rows - sub->rows;
+	dst->switches += add->switches - sub->switches;
+	dst->pre_us += add->pre_us - sub->pre_us;
+	dst->infer_us += add->infer_us - sub->infer_us;
+	dst->post_us += add->post_us - sub->post_us;
+}
@@ -0,0 +1,484 @@
+/*-------------------------------------------------------------------------
+ *
+ * nodePredict.c
+ *	  Routines to evaluate predict_float/predict_text calls in batches
+ *
+ * The planner puts a Predict node on top of the plan when the final
+ * targetlist calls predict_float or predict_text with a constant model name
+ * and device.  The child then computes the model arguments of each call as
+ * resjunk columns, and this node collects a batch of child rows, runs one
+ * batched forward pass per call and returns the rows with the results
+ * filled in.
+ *
+ * Under a Gather the node runs in every worker, each batching its own share
+ * of the rows.  The leader publishes the models into the DSM segment of the
+ * parallel query and the workers load them from there, with the weights left
+ * in the segment, instead of each reading and copying the model again.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/executor/nodePredict.c
+ *
+ *-------------------------------------------------------------------------
+ */
+/*
+ * INTERFACE ROUTINES
+ *		ExecPredict			- return the next row with predictions
+ *		ExecInitPredict		- initialize node and subnodes
+ *		ExecEndPredict		- shutdown node and subnodes
+ *		ExecPredictEstimate	- space for the models in DSM
+ *		ExecPredictInitializeDSM	- publish the models
+ *		ExecPredictInitializeWorker - load the models from DSM
+ */
+
+#include "postgres.h"
+
+#include "executor/executor.h"
+#include "executor/nodePredict.h"
+#include "miscadmin.h"
+#include "model/predict_wrapper.h"
+#include "model/result_cache.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/memutils.h"
+
+int			predict_batch_size = 1024;
+
+/*
+ * The models a Predict node publishes for its workers.  Each call's model
+ * starts at its offset from the start of the struct, 0 if the call's model
+ * was not published or is the model of an earlier call.
+ */
+typedef struct SharedPredictModels
+{
+	int			numPredicts;
+	Size		offset[FLEXIBLE_ARRAY_MEMBER];
+} SharedPredictModels;
+
+
+/*
+ * Set up the batch state of every predict call once the argument types
+ * of the child are known.
+ */
+static void
+predict_init_batches(PredictState *node)
+{
+	Predict    *plan = (Predict *) node->ps.plan;
+	TupleDesc	childDesc = ExecGetResultType(outerPlanState(node));
+	MemoryContext oldcontext;
+	ListCell   *lc_model;
+	ListCell   *lc_device;
+	int			i = 0;
+
+	oldcontext = MemoryContextSwitchTo(node->ps.state->es_query_cxt);
+
+	forboth(lc_model, plan->modelNames, lc_device, plan->devices)
+	{
+		VecAggState *batch = (VecAggState *) palloc0(sizeof(VecAggState));
+		Oid		   *types = (Oid *) palloc(sizeof(Oid) * Max(plan->numArgs[i], 1));
+
+		/* feature matrix and argument types live as long as the node */
+		batch->ctx = CurrentMemoryContext;
+		batch->model = pstrdup(strVal(lfirst(lc_model)));
+		batch->cuda = pstrdup(strVal(lfirst(lc_device)));
+
+		for (int j = 0; j < plan->numArgs[i]; j++)
+			types[j] = TupleDescAttr(childDesc, plan->argColIdx[i] + j - 1)->atttypid;
+		initVecAggTypes(batch, types, plan->numArgs[i]);
+		pfree(types);
+
+		node->batches[i++] = batch;
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+	node->initialized = true;
+}
+
+/*
+ * Fetch the next batch of rows from the child and run the model calls on
+ * them.  Rows whose result is in the predict result cache are not sent to
+ * the model.  Everything of the previous batch is released.
+ */
+static void
+predict_fill_batch(PredictState *node)
+{
+	Predict    *plan = (Predict *) node->ps.plan;
+	PlanState  *outerNode = outerPlanState(node);
+	MemoryContext oldcontext;
+	int		  **missRows;
+	uint64	  **missHashes;
+	bool	  **missCacheable;
+	int		   *numMisses;
+	int			ntuples = 0;
+
+	if (!node->initialized)
+		predict_init_batches(node);
+
+	MemoryContextReset(node->batchContext);
+	oldcontext = MemoryContextSwitchTo(node->batchContext);
+
+	node->tuples = (MinimalTuple *) palloc(sizeof(MinimalTuple) * node->batchSize);
+	node->results = (Datum **) palloc(sizeof(Datum *) * node->numPredicts);
+	node->resultNulls = (bool **) palloc(sizeof(bool *) * node->numPredicts);
+	missRows = (int **) palloc(sizeof(int *) * node->numPredicts);
+	missHashes = (uint64 **) palloc(sizeof(uint64 *) * node->numPredicts);
+	missCacheable = (bool **) palloc(sizeof(bool *) * node->numPredicts);
+	numMisses = (int *) palloc0(sizeof(int) * node->numPredicts);
+
+	for (int i = 0; i < node->numPredicts; i++)
+	{
+		VecAggState *batch = node->batches[i];
+
+		batch->ins = NIL;
+		batch->outs = NIL;
+		batch->out_rows = NULL;
+		batch->feature_rows = 0;
+		batch->prcsd_batch_n = 0;
+		batch->nxt_csr = 0;
+
+		node->results[i] = (Datum *) palloc(sizeof(Datum) * node->batchSize);
+		node->resultNulls[i] = (bool *) palloc0(sizeof(bool) * node->batchSize);
+		missRows[i] = (int *) palloc(sizeof(int) * node->batchSize);
+		missHashes[i] = (uint64 *) palloc(sizeof(uint64) * node->batchSize);
+		missCacheable[i] = (bool *) palloc(sizeof(bool) * node->batchSize);
+	}
+
+	while (ntuples < node->batchSize)
+	{
+		TupleTableSlot *slot = ExecProcNode(outerNode);
+
+		if (TupIsNull(slot))
+		{
+			node->childDone = true;
+			break;
+		}
+
+		node->tuples[ntuples] = ExecCopySlotMinimalTuple(slot);
+
+		slot_getallattrs(slot);
+		for (int i = 0; i < node->numPredicts; i++)
+		{
+			VecAggState *batch = node->batches[i];
+			int			first = plan->argColIdx[i] - 1;
+			bool		ret_float8 = (plan->predictFuncs[i] == F_PG_PREDICT_FLOAT);
+			int			miss = numMisses[i];
+
+			missCacheable[i][miss] = predict_result_cache_size > 0 &&
+				result_cache_hash_values(batch->feature_types,
+										 &slot->tts_values[first],
+										 &slot->tts_isnull[first],
+										 batch->feature_dim,
+										 &missHashes[i][miss]);
+			if (missCacheable[i][miss] &&
+				result_cache_lookup(batch->model, ret_float8, missHashes[i][miss],
+									&node->results[i][ntuples]))
+				continue;
+
+			appendVecAggRow(batch,
+							&slot->tts_values[first],
+							&slot->tts_isnull[first]);
+			missRows[i][numMisses[i]++] = ntuples;
+		}
+		ntuples++;
+	}
+
+	for (int i = 0; i < node->numPredicts; i++)
+	{
+		VecAggState *batch = node->batches[i];
+		bool		ret_float8 = (plan->predictFuncs[i] == F_PG_PREDICT_FLOAT);
+		ListCell   *lc = NULL;
+
+		if (numMisses[i] == 0)
+			continue;
+
+		infer_batch_internal(batch, ret_float8);
+
+		if (!batch->columnar)
+			lc = list_head(batch->outs);
+
+		for (int j = 0; j < numMisses[i]; j++)
+		{
+			Args	   *out;
+			Datum		result;
+
+			if (batch->columnar)
+				out = &batch->out_rows[j];
+			else
+			{
+				out = (Args *) lfirst(lc);
+				lc = lnext(lc);
+			}
+
+			result = ret_float8 ?
+				Float8GetDatum(out->floating) :
+				PointerGetDatum(cstring_to_text(out->ptr));
+			node->results[i][missRows[i][j]] = result;
+
+			if (missCacheable[i][j])
+				result_cache_store(batch->model, ret_float8, missHashes[i][j], result);
+		}
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	node->numTuples = ntuples;
+	node->nextTuple = 0;
+	if (ntuples > 0)
+		node->numBatches++;
+
+	/* start small so the first rows come back fast, then grow */
+	node->batchSize = Min(node->batchSize * 2, Max(predict_batch_size, 1));
+}
+
+/* ----------------------------------------------------------------
+ *		ExecPredict
+ *
+ *		Returns the next buffered row, fetching and predicting a new
+ *		batch first when the current one is used up.
+ * ----------------------------------------------------------------
+ */
+static TupleTableSlot *
+ExecPredict(PlanState *pstate)
+{
+	PredictState *node = castNode(PredictState, pstate);
+	Predict    *plan = (Predict *) node->ps.plan;
+	TupleTableSlot *result = node->ps.ps_ResultTupleSlot;
+	TupleTableSlot *slot = node->batchSlot;
+	int			natts = result->tts_tupleDescriptor->natts;
+
+	CHECK_FOR_INTERRUPTS();
+
+	if (node->nextTuple >= node->numTuples)
+	{
+		if (node->childDone)
+			return ExecClearTuple(result);
+
+		predict_fill_batch(node);
+		if (node->numTuples == 0)
+			return ExecClearTuple(result);
+	}
+
+	ExecStoreMinimalTuple(node->tuples[node->nextTuple], slot, false);
+	slot_getallattrs(slot);
+
+	ExecClearTuple(result);
+	memcpy(result->tts_values, slot->tts_values, natts * sizeof(Datum));
+	memcpy(result->tts_isnull, slot->tts_isnull, natts * sizeof(bool));
+
+	for (int i = 0; i < node->numPredicts; i++)
+	{
+		int			attno = plan->resultColIdx[i] - 1;
+
+		result->tts_values[attno] = node->results[i][node->nextTuple];
+		result->tts_isnull[attno] = node->resultNulls[i][node->nextTuple];
+	}
+	node->nextTuple++;
+
+	return ExecStoreVirtualTuple(result);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecInitPredict
+ * ----------------------------------------------------------------
+ */
+PredictState *
+ExecInitPredict(Predict *node, EState *estate, int eflags)
+{
+	PredictState *predictstate;
+
+	/* check for unsupported flags */
+	Assert(!(eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK)));
+
+	/*
+	 * create state structure
+	 */
+	predictstate = makeNode(PredictState);
+	predictstate->ps.plan = (Plan *) node;
+	predictstate->ps.state = estate;
+	predictstate->ps.ExecProcNode = ExecPredict;
+
+	predictstate->numPredicts = node->numPredicts;
+	predictstate->batches = (VecAggState **)
+		palloc0(sizeof(VecAggState *) * node->numPredicts);
+	predictstate->batchSize = Min(PREDICT_INITIAL_BATCH_SIZE, Max(predict_batch_size, 1));
+	predictstate->batchContext = AllocSetContextCreate(CurrentMemoryContext,
+													   "Predict batch",
+													   ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * initialize child nodes
+	 */
+	outerPlanState(predictstate) = ExecInitNode(outerPlan(node), estate, eflags);
+
+	/*
+	 * Initialize result slot and type.  The targetlist is only used to
+	 * describe the output, its predict calls are never evaluated row by row.
+	 */
+	ExecInitResultTupleSlotTL(&predictstate->ps, &TTSOpsVirtual);
+	predictstate->batchSlot =
+		ExecInitExtraTupleSlot(estate,
+							   ExecGetResultType(outerPlanState(predictstate)),
+							   &TTSOpsMinimalTuple);
+
+	predictstate->ps.ps_ProjInfo = NULL;
+
+	return predictstate;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecEndPredict
+ * ----------------------------------------------------------------
+ */
+void
+ExecEndPredict(PredictState *node)
+{
+	ExecClearTuple(node->ps.ps_ResultTupleSlot);
+	ExecClearTuple(node->batchSlot);
+	MemoryContextDelete(node->batchContext);
+
+	ExecEndNode(outerPlanState(node));
+}
+
+void
+ExecReScanPredict(PredictState *node)
+{
+	ExecClearTuple(node->ps.ps_ResultTupleSlot);
+	ExecClearTuple(node->batchSlot);
+	MemoryContextReset(node->batchContext);
+
+	node->numTuples = 0;
+	node->nextTuple = 0;
+	node->childDone = false;
+	node->batchSize = Min(PREDICT_INITIAL_BATCH_SIZE, Max(predict_batch_size, 1));
+
+	/*
+	 * if chgParam of subnode is not null then plan will be re-scanned by
+	 * first ExecProcNode.
+	 */
+	if (node->ps.lefttree->chgParam == NULL)
+		ExecReScan(node->ps.lefttree);
+}
+
+/* ----------------------------------------------------------------
+ *						Parallel Query Support
+ * ----------------------------------------------------------------
+ */
+
+/* the call before i with the same model, or -1 */
+static int
+predict_same_model(Predict *plan, int i)
+{
+	char	   *model = strVal(list_nth(plan->modelNames, i));
+
+	for (int j = 0; j < i; j++)
+	{
+		if (strcmp(strVal(list_nth(plan->modelNames, j)), model) == 0)
+			return j;
+	}
+	return -1;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecPredictEstimate
+ *
+ *		Load the models in the leader and estimate the space needed to
+ *		publish them.
+ * ----------------------------------------------------------------
+ */
+void
+ExecPredictEstimate(PredictState *node, ParallelContext *pcxt)
+{
+	Predict    *plan = (Predict *) node->ps.plan;
+	Size		size;
+
+	if (pcxt->nworkers == 0)
+		return;
+
+	node->sharedSizes = (Size *)
+		MemoryContextAllocZero(node->ps.state->es_query_cxt,
+							   sizeof(Size) * node->numPredicts);
+
+	size = MAXALIGN(offsetof(SharedPredictModels, offset) +
+					sizeof(Size) * node->numPredicts);
+	for (int i = 0; i < node->numPredicts; i++)
+	{
+		if (predict_same_model(plan, i) >= 0)
+			continue;
+		node->sharedSizes[i] =
+			MAXALIGN(model_shared_size(strVal(list_nth(plan->modelNames, i))));
+		size = add_size(size, node->sharedSizes[i]);
+	}
+
+	shm_toc_estimate_chunk(&pcxt->estimator, size);
+	shm_toc_estimate_keys(&pcxt->estimator, 1);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecPredictInitializeDSM
+ *
+ *		Publish the models loaded by ExecPredictEstimate.
+ * ----------------------------------------------------------------
+ */
+void
+ExecPredictInitializeDSM(PredictState *node, ParallelContext *pcxt)
+{
+	Predict    *plan = (Predict *) node->ps.plan;
+	SharedPredictModels *shared;
+	Size		size;
+
+	if (pcxt->nworkers == 0 || node->sharedSizes == NULL)
+		return;
+
+	size = MAXALIGN(offsetof(SharedPredictModels, offset) +
+					sizeof(Size) * node->numPredicts);
+	for (int i = 0; i < node->numPredicts; i++)
+		size = add_size(size, node->sharedSizes[i]);
+
+	shared = shm_toc_allocate(pcxt->toc, size);
+	shared->numPredicts = node->numPredicts;
+
+	size = MAXALIGN(offsetof(SharedPredictModels, offset) +
+					sizeof(Size) * node->numPredicts);
+	for (int i = 0; i < node->numPredicts; i++)
+	{
+		shared->offset[i] = 0;
+		if (node->sharedSizes[i] == 0)
+			continue;
+		if (model_shared_publish(strVal(list_nth(plan->modelNames, i)),
+								 (char *) shared + size,
+								 node->sharedSizes[i]))
+			shared->offset[i] = size;
+		size += node->sharedSizes[i];
+	}
+
+	shm_toc_insert(pcxt->toc, plan->plan.plan_node_id, shared);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecPredictInitializeWorker
+ *
+ *		Load the models the leader published.  Models it couldn't
+ *		publish are loaded on the first batch, as in the leader.
+ * ----------------------------------------------------------------
+ */
+void
+ExecPredictInitializeWorker(PredictState *node, ParallelWorkerContext *pwcxt)
+{
+	Predict    *plan = (Predict *) node->ps.plan;
+	SharedPredictModels *shared;
+
+	shared = shm_toc_lookup(pwcxt->toc, plan->plan.plan_node_id, true);
+	if (shared == NULL)
+		return;
+
+	Assert(shared->numPredicts == node->numPredicts);
+	for (int i = 0; i < shared->numPredicts; i++)
+	{
+		if (shared->offset[i] != 0)
+			model_shared_attach(strVal(list_nth(plan->modelNames, i)),
+								(char *) shared + shared->offset[i]);
+	}
+}
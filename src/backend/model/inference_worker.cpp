@@ -0,0 +1,613 @@
+/*
+ * inference_worker.cpp
+ *
+ * inference background workers. A backend serializes its preprocessed input
+ * tensors into a DSM segment, queues the segment handle in InferenceQueue and
+ * waits on a shm_mq inside the same segment. A worker takes the oldest queued
+ * request, collects every other queued request for the same model until the
+ * batch reaches inference_max_batch_size rows or inference_max_wait_us
+ * elapsed, runs one forward() over the concatenated inputs and sends every
+ * backend its rows of the output.
+ */
+#include <torch/torch.h>
+#include <torch/script.h>
+#include <torch/csrc/jit/serialization/pickle.h>
+
+#include "model/model_manager.h"
+
+extern "C" {
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "model/inference_worker.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shm_toc.h"
+#include "storage/shmem.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+#include "utils/timestamp.h"
+
+int inference_workers = 0;
+int inference_max_batch_size = 64;
+int inference_max_wait_us = 1000;
+int inference_worker_threads = 1;
+
+bool am_inference_worker = false;
+
+extern ModelManager model_manager;
+
+#define INFERENCE_MAGIC             0x49464552
+#define INFERENCE_MQ_SIZE           65536
+#define INFERENCE_KEY_HEADER        0
+#define INFERENCE_KEY_PAYLOAD       1
+#define INFERENCE_KEY_MQ            2
+
+/*
+ * a request no worker has started on within this time is taken back and run
+ * by the backend itself, e.g. when the workers are gone or saturated
+ */
+#define INFERENCE_QUEUE_TIMEOUT_MS  1000
+#define INFERENCE_POLL_MS           10
+
+/* first byte of every reply */
+#define INFERENCE_REPLY_RESULT      'R'
+#define INFERENCE_REPLY_ERROR       'E'
+
+typedef struct InferenceRequestHeader {
+    Size    payload_len;
+} InferenceRequestHeader;
+
+typedef struct InferenceRequestSlot {
+    bool        used;
+    uint64      seq;                    /* submit order, oldest first */
+    dsm_handle  handle;
+    int32       nrows;
+    char        model_path[MAXPGPATH];
+} InferenceRequestSlot;
+
+typedef struct InferenceQueue {
+    uint64                  next_seq;
+    Latch*                  worker_latches[MAX_INFERENCE_WORKERS];
+    InferenceRequestSlot    slots[INFERENCE_QUEUE_SIZE];
+} InferenceQueue;
+
+/* a request taken off the queue by a worker */
+typedef struct InferenceRequest {
+    dsm_handle                      handle;
+    int32                           nrows;
+    dsm_segment*                    seg;
+    shm_mq_handle*                  mqh;
+    std::vector<torch::jit::IValue> input;
+    bool                            answered;
+} InferenceRequest;
+
+static InferenceQueue* inference_queue = NULL;
+
+static volatile sig_atomic_t got_SIGHUP = false;
+
+Size
+InferenceQueueShmemSize(void)
+{
+    return MAXALIGN(sizeof(InferenceQueue));
+}
+
+void
+InferenceQueueShmemInit(void)
+{
+    bool found;
+
+    inference_queue = (InferenceQueue*)ShmemInitStruct("Inference Queue", sizeof(InferenceQueue), &found);
+    if(!found){
+        MemSet(inference_queue, 0, sizeof(InferenceQueue));
+    }
+}
+
+void
+InferenceWorkersRegister(void)
+{
+    BackgroundWorker bgw;
+
+    for(int i = 0; i < inference_workers; i++){
+        memset(&bgw, 0, sizeof(bgw));
+        bgw.bgw_flags = BGWORKER_SHMEM_ACCESS;
+        bgw.bgw_start_time = BgWorkerStart_PostmasterStart;
+        snprintf(bgw.bgw_library_name, BGW_MAXLEN, "postgres");
+        snprintf(bgw.bgw_function_name, BGW_MAXLEN, "InferenceWorkerMain");
+        snprintf(bgw.bgw_name, BGW_MAXLEN, "inference worker %d", i);
+        snprintf(bgw.bgw_type, BGW_MAXLEN, "inference worker");
+        bgw.bgw_restart_time = 5;
+        bgw.bgw_notify_pid = 0;
+        bgw.bgw_main_arg = Int32GetDatum(i);
+
+        RegisterBackgroundWorker(&bgw);
+    }
+}
+
+static void
+wakeup_inference_workers(void)
+{
+    Latch* latches[MAX_INFERENCE_WORKERS];
+
+    LWLockAcquire(InferenceQueueLock, LW_SHARED);
+    memcpy(latches, inference_queue->worker_latches, sizeof(latches));
+    LWLockRelease(InferenceQueueLock);
+
+    for(int i = 0; i < MAX_INFERENCE_WORKERS; i++){
+        if(latches[i] != NULL){
+            SetLatch(latches[i]);
+        }
+    }
+}
+
+/*
+ * run forward() for input in an inference worker. Returns false when the
+ * request can't be queued (queue full, unsupported input) or no worker
+ * answers it, the caller runs the model itself then.
+ */
+bool
+inference_queue_submit(const char *model_path, std::vector<torch::jit::IValue>& input, torch::jit::IValue& output)
+{
+    std::vector<char>       payload;
+    Size                    payload_len;
+    shm_toc_estimator       estimator;
+    Size                    seg_size;
+    dsm_segment*            seg;
+    shm_toc*                toc;
+    InferenceRequestHeader* header;
+    char*                   payload_space;
+    shm_mq*                 mq;
+    shm_mq_handle*          mqh;
+    shm_mq_result           res;
+    Size                    nbytes;
+    void*                   data;
+    int                     slot_no = -1;
+    uint64                  seq = 0;
+    int32                   nrows;
+    TimestampTz             submitted;
+
+    if(inference_queue == NULL || input.empty() || !input[0].isTensor() ||
+       input[0].toTensor().dim() == 0 || strlen(model_path) >= MAXPGPATH){
+        return false;
+    }
+    nrows = input[0].toTensor().size(0);
+
+    try {
+        payload = torch::jit::pickle_save(c10::ivalue::Tuple::create(input));
+    }
+    catch (const std::exception& e) {
+        return false;
+    }
+    payload_len = payload.size();
+
+    shm_toc_initialize_estimator(&estimator);
+    shm_toc_estimate_chunk(&estimator, sizeof(InferenceRequestHeader));
+    shm_toc_estimate_chunk(&estimator, payload_len);
+    shm_toc_estimate_chunk(&estimator, INFERENCE_MQ_SIZE);
+    shm_toc_estimate_keys(&estimator, 3);
+    seg_size = shm_toc_estimate(&estimator);
+
+    seg = dsm_create(seg_size, 0);
+    toc = shm_toc_create(INFERENCE_MAGIC, dsm_segment_address(seg), seg_size);
+
+    header = (InferenceRequestHeader*)shm_toc_allocate(toc, sizeof(InferenceRequestHeader));
+    header->payload_len = payload_len;
+    shm_toc_insert(toc, INFERENCE_KEY_HEADER, header);
+
+    payload_space = (char*)shm_toc_allocate(toc, payload_len);
+    memcpy(payload_space, payload.data(), payload_len);
+    shm_toc_insert(toc, INFERENCE_KEY_PAYLOAD, payload_space);
+    std::vector<char>().swap(payload);
+
+    mq = shm_mq_create(shm_toc_allocate(toc, INFERENCE_MQ_SIZE), INFERENCE_MQ_SIZE);
+    shm_toc_insert(toc, INFERENCE_KEY_MQ, mq);
+    shm_mq_set_receiver(mq, MyProc);
+    mqh = shm_mq_attach(mq, seg, NULL);
+
+    LWLockAcquire(InferenceQueueLock, LW_EXCLUSIVE);
+    for(int i = 0; i < INFERENCE_QUEUE_SIZE; i++){
+        if(!inference_queue->slots[i].used){
+            InferenceRequestSlot* slot = &inference_queue->slots[i];
+
+            slot->used = true;
+            slot->seq = inference_queue->next_seq++;
+            slot->handle = dsm_segment_handle(seg);
+            slot->nrows = nrows;
+            strlcpy(slot->model_path, model_path, MAXPGPATH);
+            slot_no = i;
+            seq = slot->seq;
+            break;
+        }
+    }
+    LWLockRelease(InferenceQueueLock);
+
+    if(slot_no < 0){
+        dsm_detach(seg);
+        return false;
+    }
+
+    wakeup_inference_workers();
+    submitted = GetCurrentTimestamp();
+
+    /* if we error out here the worker finds the segment gone or detached */
+    for(;;){
+        res = shm_mq_receive(mqh, &nbytes, &data, true);
+        if(res != SHM_MQ_WOULD_BLOCK){
+            break;
+        }
+        /*
+         * no worker attached in time. A worker that takes the slot after we
+         * withdrew it can't attach the segment any more, one that attached
+         * just now finds us detached.
+         */
+        if(shm_mq_get_sender(mq) == NULL &&
+           TimestampDifferenceExceeds(submitted, GetCurrentTimestamp(), INFERENCE_QUEUE_TIMEOUT_MS)){
+            LWLockAcquire(InferenceQueueLock, LW_EXCLUSIVE);
+            if(inference_queue->slots[slot_no].used && inference_queue->slots[slot_no].seq == seq){
+                inference_queue->slots[slot_no].used = false;
+            }
+            LWLockRelease(InferenceQueueLock);
+            dsm_detach(seg);
+            return false;
+        }
+        (void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                         INFERENCE_POLL_MS, WAIT_EVENT_MQ_RECEIVE);
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    /* the worker went away before answering, the input is still ours to run */
+    if(res == SHM_MQ_DETACHED){
+        dsm_detach(seg);
+        return false;
+    }
+    if(nbytes < 1){
+        dsm_detach(seg);
+        ereport(ERROR, (errmsg("inference worker sent an empty reply")));
+    }
+
+    if(((char*)data)[0] == INFERENCE_REPLY_ERROR){
+        char* msg = pnstrdup((char*)data + 1, nbytes - 1);
+
+        dsm_detach(seg);
+        ereport(ERROR, (errmsg("inference worker error, error message:%s", msg)));
+    }
+
+    try {
+        output = torch::jit::pickle_load(std::vector<char>((char*)data + 1, (char*)data + nbytes));
+    }
+    catch (const std::exception& e) {
+        dsm_detach(seg);
+        ereport(ERROR, (errmsg("could not read inference worker result, error message:%s", e.what())));
+    }
+
+    dsm_detach(seg);
+    return true;
+}
+
+static void
+inference_worker_sighup(SIGNAL_ARGS)
+{
+    int save_errno = errno;
+
+    got_SIGHUP = true;
+    SetLatch(MyLatch);
+
+    errno = save_errno;
+}
+
+static void
+inference_worker_onexit(int code, Datum arg)
+{
+    LWLockAcquire(InferenceQueueLock, LW_EXCLUSIVE);
+    inference_queue->worker_latches[DatumGetInt32(arg)] = NULL;
+    LWLockRelease(InferenceQueueLock);
+}
+
+/*
+ * move queued requests for model_path into batch, oldest first, as long as
+ * the batch stays within inference_max_batch_size rows. Caller holds
+ * InferenceQueueLock exclusively.
+ */
+static void
+take_requests_locked(const char* model_path, std::vector<InferenceRequest>& batch, int32* rows)
+{
+    for(;;){
+        InferenceRequestSlot* oldest = NULL;
+
+        for(int i = 0; i < INFERENCE_QUEUE_SIZE; i++){
+            InferenceRequestSlot* slot = &inference_queue->slots[i];
+
+            if(!slot->used || strcmp(slot->model_path, model_path) != 0){
+                continue;
+            }
+            /* a single oversized request still makes a batch on its own */
+            if(*rows > 0 && *rows + slot->nrows > inference_max_batch_size){
+                continue;
+            }
+            if(oldest == NULL || slot->seq < oldest->seq){
+                oldest = slot;
+            }
+        }
+
+        if(oldest == NULL){
+            return;
+        }
+
+        InferenceRequest request;
+        request.handle = oldest->handle;
+        request.nrows = oldest->nrows;
+        request.seg = NULL;
+        request.mqh = NULL;
+        request.answered = false;
+        batch.push_back(std::move(request));
+
+        *rows += oldest->nrows;
+        oldest->used = false;
+    }
+}
+
+/*
+ * pick the model of the oldest queued request and gather a batch for it.
+ * Returns false when the queue is empty.
+ */
+static bool
+collect_batch(char* model_path, std::vector<InferenceRequest>& batch)
+{
+    InferenceRequestSlot*   oldest = NULL;
+    int32                   rows = 0;
+    TimestampTz             deadline;
+
+    LWLockAcquire(InferenceQueueLock, LW_EXCLUSIVE);
+    for(int i = 0; i < INFERENCE_QUEUE_SIZE; i++){
+        InferenceRequestSlot* slot = &inference_queue->slots[i];
+        if(slot->used && (oldest == NULL || slot->seq < oldest->seq)){
+            oldest = slot;
+        }
+    }
+    if(oldest == NULL){
+        LWLockRelease(InferenceQueueLock);
+        return false;
+    }
+    strlcpy(model_path, oldest->model_path, MAXPGPATH);
+    take_requests_locked(model_path, batch, &rows);
+    LWLockRelease(InferenceQueueLock);
+
+    /* give concurrent sessions a moment to join the batch */
+    deadline = GetCurrentTimestamp() + inference_max_wait_us;
+    while(rows < inference_max_batch_size){
+        TimestampTz now = GetCurrentTimestamp();
+
+        if(now >= deadline){
+            break;
+        }
+        pg_usleep(Min(deadline - now, 100));
+        CHECK_FOR_INTERRUPTS();
+
+        LWLockAcquire(InferenceQueueLock, LW_EXCLUSIVE);
+        take_requests_locked(model_path, batch, &rows);
+        LWLockRelease(InferenceQueueLock);
+    }
+
+    return true;
+}
+
+static void
+send_reply(InferenceRequest& request, char kind, const char* data, Size len)
+{
+    shm_mq_iovec iov[2];
+
+    if(request.mqh == NULL || request.answered){
+        return;
+    }
+
+    iov[0].data = &kind;
+    iov[0].len = 1;
+    iov[1].data = data;
+    iov[1].len = len;
+
+    /* a backend that went away just detaches, nothing to do about it */
+    (void) shm_mq_sendv(request.mqh, iov, 2, false);
+    request.answered = true;
+}
+
+/* rows [start, start + len) of a batched model output */
+static torch::jit::IValue
+narrow_rows(const torch::jit::IValue& value, int64_t start, int64_t len)
+{
+    if(value.isTensor()){
+        // clone so that pickling doesn't serialize the whole batch storage
+        return value.toTensor().narrow(0, start, len).clone();
+    }
+    if(value.isTuple()){
+        std::vector<torch::jit::IValue> elements;
+        for(const auto& e : value.toTuple()->elements()){
+            elements.push_back(narrow_rows(e, start, len));
+        }
+        return c10::ivalue::Tuple::create(std::move(elements));
+    }
+    if(value.isList()){
+        auto list = value.toList();
+        c10::impl::GenericList part(list.elementType());
+        for(int64_t i = start; i < start + len; i++){
+            part.push_back(list.get(i));
+        }
+        return part;
+    }
+    return value;
+}
+
+static bool
+attach_request(InferenceRequest& request)
+{
+    shm_toc*                toc;
+    InferenceRequestHeader* header;
+    char*                   payload;
+    shm_mq*                 mq;
+
+    /* the backend may have given up already */
+    request.seg = dsm_attach(request.handle);
+    if(request.seg == NULL){
+        return false;
+    }
+
+    toc = shm_toc_attach(INFERENCE_MAGIC, dsm_segment_address(request.seg));
+    if(toc == NULL){
+        return false;
+    }
+    header = (InferenceRequestHeader*)shm_toc_lookup(toc, INFERENCE_KEY_HEADER, false);
+    payload = (char*)shm_toc_lookup(toc, INFERENCE_KEY_PAYLOAD, false);
+    mq = (shm_mq*)shm_toc_lookup(toc, INFERENCE_KEY_MQ, false);
+
+    shm_mq_set_sender(mq, MyProc);
+    request.mqh = shm_mq_attach(mq, request.seg, NULL);
+
+    try {
+        auto tuple = torch::jit::pickle_load(std::vector<char>(payload, payload + header->payload_len));
+        request.input = tuple.toTuple()->elements().vec();
+    }
+    catch (const std::exception& e) {
+        send_reply(request, INFERENCE_REPLY_ERROR, e.what(), strlen(e.what()));
+        return false;
+    }
+    return true;
+}
+
+static void
+run_one(const char* model_path, std::vector<torch::jit::IValue>& input, torch::jit::IValue& output)
+{
+    if(!model_manager_predict_multi_input(&model_manager, model_path, input, output)){
+        ereport(ERROR, (errmsg("%s:predict error!", model_path)));
+    }
+}
+
+static void
+run_batch(const char* model_path, std::vector<InferenceRequest>& batch)
+{
+    std::vector<InferenceRequest*>  ready;
+    std::vector<torch::jit::IValue> batch_input;
+    torch::jit::IValue              output;
+    MemoryContext                   oldcontext = CurrentMemoryContext;
+
+    PG_TRY();
+    {
+        for(auto& request : batch){
+            if(attach_request(request)){
+                ready.push_back(&request);
+            }
+        }
+
+        if(!ready.empty()){
+            bool    concatenated = true;
+            size_t  ninputs = ready[0]->input.size();
+
+            if(!model_manager_load_model(&model_manager, model_path)){
+                ereport(ERROR, (errmsg("load model error")));
+            }
+
+            /* inputs of different shape can't share a forward pass */
+            try {
+                for(size_t i = 0; i < ninputs; i++){
+                    std::vector<at::Tensor> col_tensors;
+                    for(auto request : ready){
+                        if(request->input.size() != ninputs){
+                            throw std::runtime_error("input count mismatch");
+                        }
+                        col_tensors.push_back(request->input[i].toTensor());
+                    }
+                    batch_input.push_back(torch::cat(col_tensors, 0));
+                }
+            }
+            catch (const std::exception& e) {
+                concatenated = false;
+            }
+
+            if(concatenated){
+                int64_t offset = 0;
+
+                run_one(model_path, batch_input, output);
+                for(auto request : ready){
+                    std::vector<char> reply = torch::jit::pickle_save(narrow_rows(output, offset, request->nrows));
+                    send_reply(*request, INFERENCE_REPLY_RESULT, reply.data(), reply.size());
+                    offset += request->nrows;
+                }
+            }else{
+                for(auto request : ready){
+                    run_one(model_path, request->input, output);
+                    std::vector<char> reply = torch::jit::pickle_save(output);
+                    send_reply(*request, INFERENCE_REPLY_RESULT, reply.data(), reply.size());
+                }
+            }
+        }
+    }
+    PG_CATCH();
+    {
+        ErrorData* edata;
+
+        MemoryContextSwitchTo(oldcontext);
+        edata = CopyErrorData();
+        FlushErrorState();
+
+        for(auto& request : batch){
+            send_reply(request, INFERENCE_REPLY_ERROR, edata->message, strlen(edata->message));
+        }
+        FreeErrorData(edata);
+    }
+    PG_END_TRY();
+
+    for(auto& request : batch){
+        if(request.seg != NULL){
+            dsm_detach(request.seg);
+        }
+    }
+}
+
+void
+InferenceWorkerMain(Datum main_arg)
+{
+    int worker_no = DatumGetInt32(main_arg);
+
+    pqsignal(SIGHUP, inference_worker_sighup);
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+
+    am_inference_worker = true;
+    CurrentResourceOwner = ResourceOwnerCreate(NULL, "inference worker");
+
+    LWLockAcquire(InferenceQueueLock, LW_EXCLUSIVE);
+    inference_queue->worker_latches[worker_no] = MyLatch;
+    LWLockRelease(InferenceQueueLock);
+    on_shmem_exit(inference_worker_onexit, main_arg);
+
+    for(;;){
+        std::vector<InferenceRequest>   batch;
+        char                            model_path[MAXPGPATH];
+
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+
+        if(got_SIGHUP){
+            got_SIGHUP = false;
+            ProcessConfigFile(PGC_SIGHUP);
+        }
+
+        if(!collect_batch(model_path, batch)){
+            (void) WaitLatch(MyLatch, WL_LATCH_SET | WL_EXIT_ON_PM_DEATH, -1L,
+                             WAIT_EVENT_INFERENCE_WORKER_MAIN);
+            continue;
+        }
+
+        run_batch(model_path, batch);
+    }
+}
+
+}
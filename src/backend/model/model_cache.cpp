@@ -0,0 +1,488 @@
+/*
+ * model_cache.cpp
+ *
+ * server-wide model weight cache. The shared-memory part only keeps a small
+ * directory (key -> blob file, size, refcount, LRU clock); the weights
+ * themselves live in pg_model_cache/blob_<id> and are mmap'ed by every
+ * backend that uses the model, so N backends share one copy in the page
+ * cache. Blobs are private mappings, a backend that writes into a weight
+ * only copies the touched pages.
+ */
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+extern "C" {
+
+#include "postgres.h"
+
+#include "common/file_perm.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "model/model_cache.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+int model_cache_size = 1048576;
+
+typedef enum ModelCacheState {
+    MODEL_CACHE_LOADING,
+    MODEL_CACHE_READY
+} ModelCacheState;
+
+typedef struct ModelCacheEntry {
+    char            key[MODEL_CACHE_KEY_LEN];   /* hash key, must be first */
+    ModelCacheState state;
+    uint32          blob_id;
+    Size            size;
+    int             refcount;       /* backends that have the blob mapped */
+    uint64          last_used;      /* LRU clock */
+    int64           hits;
+    TimestampTz     loaded_at;
+    TimestampTz     last_access;
+} ModelCacheEntry;
+
+typedef struct ModelCacheCtl {
+    uint32  next_blob_id;
+    uint64  clock;
+    Size    total_size;     /* includes blobs still being written */
+} ModelCacheCtl;
+
+typedef struct ModelCacheMapping {
+    char*   blob;
+    Size    size;
+    uint32  blob_id;
+} ModelCacheMapping;
+
+static ModelCacheCtl* cache_ctl = NULL;
+static HTAB* cache_hash = NULL;
+
+/* blobs mapped by this backend, key -> mapping */
+static std::unordered_map<std::string, ModelCacheMapping> local_mappings;
+static bool detach_registered = false;
+
+#define MODEL_CACHE_BUDGET ((Size) model_cache_size * 1024)
+
+static void
+blob_path(char* path, uint32 blob_id)
+{
+    snprintf(path, MAXPGPATH, "%s/blob_%u", MODEL_CACHE_DIR, blob_id);
+}
+
+Size
+ModelCacheShmemSize(void)
+{
+    Size size = MAXALIGN(sizeof(ModelCacheCtl));
+    size = add_size(size, hash_estimate_size(MODEL_CACHE_MAX_ENTRIES, sizeof(ModelCacheEntry)));
+    return size;
+}
+
+void
+ModelCacheShmemInit(void)
+{
+    HASHCTL     info;
+    bool        found;
+    struct stat st;
+
+    cache_ctl = (ModelCacheCtl*)ShmemInitStruct("Model Cache Ctl", sizeof(ModelCacheCtl), &found);
+    if(!found){
+        MemSet(cache_ctl, 0, sizeof(ModelCacheCtl));
+        /* blobs of a previous postmaster are unreachable, drop them */
+        if(stat(MODEL_CACHE_DIR, &st) == 0){
+            rmtree(MODEL_CACHE_DIR, false);
+        }
+    }
+
+    MemSet(&info, 0, sizeof(info));
+    info.keysize = MODEL_CACHE_KEY_LEN;
+    info.entrysize = sizeof(ModelCacheEntry);
+    cache_hash = ShmemInitHash("Model Cache", MODEL_CACHE_MAX_ENTRIES, MODEL_CACHE_MAX_ENTRIES,
+                               &info, HASH_ELEM);
+}
+
+static void
+model_cache_detach_all(int code, Datum arg)
+{
+    if(local_mappings.empty()){
+        return;
+    }
+
+    LWLockAcquire(ModelCacheLock, LW_EXCLUSIVE);
+    for(auto& it : local_mappings){
+        ModelCacheEntry* entry = (ModelCacheEntry*)hash_search(cache_hash, it.first.c_str(), HASH_FIND, NULL);
+        /* the key may have been evicted and reused by a newer blob */
+        if(entry != NULL && entry->blob_id == it.second.blob_id && entry->refcount > 0){
+            entry->refcount--;
+        }
+    }
+    LWLockRelease(ModelCacheLock);
+    local_mappings.clear();
+}
+
+static void
+remember_mapping(const char* key, char* blob, Size size, uint32 blob_id)
+{
+    if(!detach_registered){
+        on_shmem_exit(model_cache_detach_all, (Datum) 0);
+        detach_registered = true;
+    }
+    local_mappings[key] = ModelCacheMapping{blob, size, blob_id};
+}
+
+static char*
+map_blob(uint32 blob_id, Size size)
+{
+    char    path[MAXPGPATH];
+    int     fd;
+    void*   blob;
+
+    blob_path(path, blob_id);
+    fd = open(path, O_RDONLY | PG_BINARY, 0);
+    if(fd < 0){
+        return NULL;
+    }
+    blob = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    return blob == MAP_FAILED ? NULL : (char*)blob;
+}
+
+/* caller holds ModelCacheLock exclusively */
+static void
+remove_entry_locked(ModelCacheEntry* entry)
+{
+    char path[MAXPGPATH];
+
+    blob_path(path, entry->blob_id);
+    unlink(path);
+    cache_ctl->total_size -= entry->size;
+    hash_search(cache_hash, entry->key, HASH_REMOVE, NULL);
+}
+
+/*
+ * evict unreferenced blobs, least recently used first, until need more bytes
+ * and one more entry fit. Caller holds ModelCacheLock exclusively.
+ */
+static bool
+evict_lru_locked(Size need)
+{
+    while(cache_ctl->total_size + need > MODEL_CACHE_BUDGET ||
+          hash_get_num_entries(cache_hash) >= MODEL_CACHE_MAX_ENTRIES){
+        HASH_SEQ_STATUS     status;
+        ModelCacheEntry*    entry;
+        ModelCacheEntry*    victim = NULL;
+
+        hash_seq_init(&status, cache_hash);
+        while((entry = (ModelCacheEntry*)hash_seq_search(&status)) != NULL){
+            if(entry->state != MODEL_CACHE_READY || entry->refcount > 0){
+                continue;
+            }
+            if(victim == NULL || entry->last_used < victim->last_used){
+                victim = entry;
+            }
+        }
+
+        if(victim == NULL){
+            return false;
+        }
+        remove_entry_locked(victim);
+    }
+    return true;
+}
+
+char*
+model_cache_attach(const char *key, Size *size)
+{
+    ModelCacheEntry*    entry;
+    uint32              blob_id;
+    Size                blob_size;
+    char*               blob;
+
+    if(cache_hash == NULL || model_cache_size <= 0 || strlen(key) >= MODEL_CACHE_KEY_LEN){
+        return NULL;
+    }
+
+    auto mapped = local_mappings.find(key);
+    if(mapped != local_mappings.end()){
+        *size = mapped->second.size;
+        return mapped->second.blob;
+    }
+
+    LWLockAcquire(ModelCacheLock, LW_EXCLUSIVE);
+    entry = (ModelCacheEntry*)hash_search(cache_hash, key, HASH_FIND, NULL);
+    if(entry == NULL || entry->state != MODEL_CACHE_READY){
+        LWLockRelease(ModelCacheLock);
+        return NULL;
+    }
+    /* pin it before mapping so nobody evicts the file under us */
+    entry->refcount++;
+    entry->hits++;
+    entry->last_used = ++cache_ctl->clock;
+    entry->last_access = GetCurrentTimestamp();
+    blob_id = entry->blob_id;
+    blob_size = entry->size;
+    LWLockRelease(ModelCacheLock);
+
+    blob = map_blob(blob_id, blob_size);
+    if(blob == NULL){
+        LWLockAcquire(ModelCacheLock, LW_EXCLUSIVE);
+        entry = (ModelCacheEntry*)hash_search(cache_hash, key, HASH_FIND, NULL);
+        if(entry != NULL && entry->blob_id == blob_id){
+            entry->refcount--;
+        }
+        LWLockRelease(ModelCacheLock);
+        return NULL;
+    }
+
+    remember_mapping(key, blob, blob_size, blob_id);
+    *size = blob_size;
+    return blob;
+}
+
+char*
+model_cache_store(const char *key, const ModelCacheSegment *segs, int nsegs, Size *size)
+{
+    static const char   zeros[MODEL_CACHE_ALIGN] = {0};
+    ModelCacheEntry*    entry;
+    bool                found;
+    Size                total = 0;
+    uint32              blob_id;
+    char                path[MAXPGPATH];
+    int                 fd;
+    bool                write_ok = true;
+    char*               blob = NULL;
+
+    if(cache_hash == NULL || model_cache_size <= 0 || strlen(key) >= MODEL_CACHE_KEY_LEN){
+        return NULL;
+    }
+
+    for(int i = 0; i < nsegs; i++){
+        total += MODEL_CACHE_ALIGN_SIZE(segs[i].len);
+    }
+    if(total == 0 || total > MODEL_CACHE_BUDGET){
+        return NULL;
+    }
+
+    LWLockAcquire(ModelCacheLock, LW_EXCLUSIVE);
+    entry = (ModelCacheEntry*)hash_search(cache_hash, key, HASH_FIND, NULL);
+    if(entry != NULL || !evict_lru_locked(total)){
+        LWLockRelease(ModelCacheLock);
+        return NULL;
+    }
+    entry = (ModelCacheEntry*)hash_search(cache_hash, key, HASH_ENTER_NULL, &found);
+    if(entry == NULL){
+        LWLockRelease(ModelCacheLock);
+        return NULL;
+    }
+    /* reserve the space while we write, the entry is invisible to attach */
+    entry->state = MODEL_CACHE_LOADING;
+    entry->blob_id = ++cache_ctl->next_blob_id;
+    entry->size = total;
+    entry->refcount = 1;
+    entry->hits = 0;
+    entry->last_used = ++cache_ctl->clock;
+    cache_ctl->total_size += total;
+    blob_id = entry->blob_id;
+    LWLockRelease(ModelCacheLock);
+
+    if(MakePGDirectory(MODEL_CACHE_DIR) < 0 && errno != EEXIST){
+        write_ok = false;
+    }
+
+    blob_path(path, blob_id);
+    fd = write_ok ? open(path, O_CREAT | O_WRONLY | O_TRUNC | PG_BINARY, pg_file_create_mode) : -1;
+    if(fd < 0){
+        write_ok = false;
+    }
+    for(int i = 0; write_ok && i < nsegs; i++){
+        Size pad = MODEL_CACHE_ALIGN_SIZE(segs[i].len) - segs[i].len;
+        const char* data = (const char*)segs[i].data;
+        Size left = segs[i].len;
+
+        while(left > 0){
+            ssize_t n = write(fd, data, left);
+            if(n <= 0){
+                write_ok = false;
+                break;
+            }
+            data += n;
+            left -= n;
+        }
+        if(write_ok && pad > 0 && write(fd, zeros, pad) != (ssize_t)pad){
+            write_ok = false;
+        }
+    }
+    if(fd >= 0 && close(fd) != 0){
+        write_ok = false;
+    }
+    if(write_ok){
+        blob = map_blob(blob_id, total);
+    }
+
+    LWLockAcquire(ModelCacheLock, LW_EXCLUSIVE);
+    entry = (ModelCacheEntry*)hash_search(cache_hash, key, HASH_FIND, NULL);
+    if(entry == NULL || entry->blob_id != blob_id){
+        /* evicted by DROP MODEL while we were writing */
+        LWLockRelease(ModelCacheLock);
+        unlink(path);
+        if(blob != NULL){
+            munmap(blob, total);
+        }
+        return NULL;
+    }
+    if(blob == NULL){
+        remove_entry_locked(entry);
+        LWLockRelease(ModelCacheLock);
+        ereport(LOG, (errmsg("could not write model cache blob for \"%s\"", key)));
+        return NULL;
+    }
+    entry->state = MODEL_CACHE_READY;
+    entry->loaded_at = GetCurrentTimestamp();
+    entry->last_access = entry->loaded_at;
+    LWLockRelease(ModelCacheLock);
+
+    remember_mapping(key, blob, total, blob_id);
+    *size = total;
+    return blob;
+}
+
+void
+model_cache_detach(const char *key)
+{
+    ModelCacheEntry* entry;
+
+    auto mapped = local_mappings.find(key);
+    if(mapped == local_mappings.end()){
+        return;
+    }
+
+    munmap(mapped->second.blob, mapped->second.size);
+
+    LWLockAcquire(ModelCacheLock, LW_EXCLUSIVE);
+    entry = (ModelCacheEntry*)hash_search(cache_hash, key, HASH_FIND, NULL);
+    /* the key may have been evicted and reused by a newer blob */
+    if(entry != NULL && entry->blob_id == mapped->second.blob_id && entry->refcount > 0){
+        entry->refcount--;
+    }
+    LWLockRelease(ModelCacheLock);
+
+    local_mappings.erase(mapped);
+}
+
+void
+model_cache_evict(const char *key)
+{
+    ModelCacheEntry* entry;
+
+    if(cache_hash == NULL || strlen(key) >= MODEL_CACHE_KEY_LEN){
+        return;
+    }
+
+    /* backends that still map the blob keep using it, unlink is safe */
+    LWLockAcquire(ModelCacheLock, LW_EXCLUSIVE);
+    entry = (ModelCacheEntry*)hash_search(cache_hash, key, HASH_FIND, NULL);
+    if(entry != NULL){
+        remove_entry_locked(entry);
+    }
+    LWLockRelease(ModelCacheLock);
+}
+
+void
+model_cache_evict_model(const char *model_path)
+{
+    HASH_SEQ_STATUS     status;
+    ModelCacheEntry*    entry;
+    size_t              len = strlen(model_path);
+
+    if(cache_hash == NULL || len >= MODEL_CACHE_KEY_LEN){
+        return;
+    }
+
+    /* dynahash allows removing the entry hash_seq_search just returned */
+    LWLockAcquire(ModelCacheLock, LW_EXCLUSIVE);
+    hash_seq_init(&status, cache_hash);
+    while((entry = (ModelCacheEntry*)hash_seq_search(&status)) != NULL){
+        if(strncmp(entry->key, model_path, len) == 0 &&
+           (entry->key[len] == '\0' || entry->key[len] == '#')){
+            remove_entry_locked(entry);
+        }
+    }
+    LWLockRelease(ModelCacheLock);
+}
+
+/*
+ * pg_model_cache view: one row per resident (or loading) blob
+ */
+Datum
+pg_model_cache_status(PG_FUNCTION_ARGS)
+{
+#define PG_MODEL_CACHE_STATUS_COLS 7
+    ReturnSetInfo*      rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc           tupdesc;
+    Tuplestorestate*    tupstore;
+    MemoryContext       per_query_ctx;
+    MemoryContext       oldcontext;
+    HASH_SEQ_STATUS     status;
+    ModelCacheEntry*    entry;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("materialize mode required, but it is not allowed in this context")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+
+    MemoryContextSwitchTo(oldcontext);
+
+    if(cache_hash == NULL){
+        return (Datum) 0;
+    }
+
+    LWLockAcquire(ModelCacheLock, LW_SHARED);
+    hash_seq_init(&status, cache_hash);
+    while((entry = (ModelCacheEntry*)hash_seq_search(&status)) != NULL){
+        Datum   values[PG_MODEL_CACHE_STATUS_COLS];
+        bool    nulls[PG_MODEL_CACHE_STATUS_COLS];
+
+        MemSet(nulls, false, sizeof(nulls));
+        values[0] = CStringGetTextDatum(entry->key);
+        values[1] = CStringGetTextDatum(entry->state == MODEL_CACHE_READY ? "ready" : "loading");
+        values[2] = Int64GetDatum((int64) entry->size);
+        values[3] = Int32GetDatum(entry->refcount);
+        values[4] = Int64GetDatum(entry->hits);
+        values[5] = TimestampTzGetDatum(entry->loaded_at);
+        values[6] = TimestampTzGetDatum(entry->last_access);
+        if(entry->state != MODEL_CACHE_READY){
+            nulls[5] = true;
+            nulls[6] = true;
+        }
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    LWLockRelease(ModelCacheLock);
+
+    return (Datum) 0;
+}
+
+}
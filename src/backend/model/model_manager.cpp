@@ -1,102 +1,1078 @@
 
 #include "model/model_manager.h"
+#include "model/thread_pool.h"
+#include <cctype>
+#include <cmath>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <torch/csrc/jit/ir/constants.h>
+#include <torch/csrc/jit/ir/ir.h>
+#include <torch/csrc/jit/passes/constant_propagation.h>
+#include <torch/csrc/jit/passes/dead_code_elimination.h>
 #include "catalog/model_info_d.h"
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include "postgres.h"
+#include "miscadmin.h"
 #include "utils/relcache.h"
 #include "utils/syscache.h"
 #include "utils/builtins.h"
 #include "utils/rel.h"
 #include "storage/lockdefs.h"
 #include "access/table.h"
+#include "access/genam.h"
 #include "access/htup_details.h"
+#include "access/reloptions.h"
+#include "access/tuptoaster.h"
+#include "catalog/indexing.h"
 #include "catalog/model_info.h"
 #include "catalog/model_layer_info.h"
 #include "catalog/base_model_info.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "storage/fd.h"
 #include "utils/memutils.h"
 #include "utils/catcache.h"
+#include "utils/fmgroids.h"
 #include "utils/vector_tensor.h"
+#include "model/model_cache.h"
+#include "model/inference_worker.h"
+#include "model/torch_threads.h"
 
 extern char pkglib_path[];
 
 ModelManager model_manager;
 
+/*
+ * share the weights of module with the other backends: attach to the blob in
+ * the model cache if somebody published it already, otherwise publish ours.
+ * On success every parameter and buffer points into the mapped blob and the
+ * private copy made by torch::jit::load is released.
+ */
+/*
+ * the parameters and buffers of module, in the order of a weights blob, and
+ * the size of that blob. Returns false if a tensor can't live in a blob.
+ */
+static bool
+model_manager_weight_tensors(torch::jit::script::Module& module, std::vector<torch::Tensor>& tensors, Size* blob_size)
+{
+    *blob_size = 0;
+    for(const auto& parm : module.named_parameters(true)){
+        tensors.push_back(parm.value);
+    }
+    for(const auto& buffer : module.named_buffers(true)){
+        tensors.push_back(buffer.value);
+    }
+
+    for(auto& tensor : tensors){
+        if(tensor.device().type() != at::kCPU || !tensor.is_contiguous()){
+            return false;
+        }
+        *blob_size += MODEL_CACHE_ALIGN_SIZE(tensor.nbytes());
+    }
+    return true;
+}
+
+/* point every tensor into blob, laid out by model_manager_weight_tensors */
+static void
+model_manager_attach_weights(std::vector<torch::Tensor>& tensors, char* blob)
+{
+    Size offset = 0;
+
+    for(auto& tensor : tensors){
+        tensor.set_data(torch::from_blob(blob + offset, tensor.sizes(), tensor.strides(), tensor.options()));
+        offset += MODEL_CACHE_ALIGN_SIZE(tensor.nbytes());
+    }
+}
+
+static void
+model_manager_share_weights(torch::jit::script::Module& module, const char* cache_key)
+{
+    std::vector<torch::Tensor>      tensors;
+    std::vector<ModelCacheSegment>  segs;
+    Size                            expected_size = 0;
+    Size                            blob_size = 0;
+    char*                           blob;
+
+    if(!model_manager_weight_tensors(module, tensors, &expected_size)){
+        return;
+    }
+
+    blob = model_cache_attach(cache_key, &blob_size);
+    if(blob == NULL){
+        for(auto& tensor : tensors){
+            segs.push_back(ModelCacheSegment{tensor.data_ptr(), tensor.nbytes()});
+        }
+        blob = model_cache_store(cache_key, segs.data(), segs.size(), &blob_size);
+    }
+
+    if(blob == NULL){
+        return;
+    }
+    // a blob of other weights under this key, keep the private copy and let it be evicted
+    if(blob_size != expected_size){
+        model_cache_detach(cache_key);
+        return;
+    }
+    model_manager_attach_weights(tensors, blob);
+}
+
+/*
+ * copy the vector of one layer row into a parameter of the base model,
+ * starting at element offset. A row is either the whole layer, with the
+ * shape of the parameter, or a 1-D chunk of a layer split by
+ * MODEL_LAYER_CHUNK_DIM. The data is copied from the toast chunks straight
+ * into the parameter storage, without detoasting the vector into a palloc'd
+ * copy first. Returns the number of elements copied.
+ */
+static int64
+model_manager_load_layer(torch::Tensor& tensor, Datum parm_datum, int32 chunk_no, int64 offset,
+                         const char* model_name, const char* layer_name)
+{
+    struct varlena* attr = (struct varlena*) DatumGetPointer(parm_datum);
+    const int32     header_size = offsetof(Vector, x) - VARHDRSZ;
+    Vector          header;
+    Size            raw_size = toast_raw_datum_size(parm_datum);
+    int64           numel = tensor.numel();
+    bool            whole;
+
+    heap_tuple_untoast_attr_into(attr, 0, header_size, (char*) &header + VARHDRSZ);
+    if(raw_size != VECTOR_SIZE(header.dim) || header.shape_size > MAX_VECTOR_SHAPE_SIZE){
+        ereport(ERROR,
+                errmsg("layer \"%s\" of model \"%s\" is not a valid vector", layer_name, model_name));
+    }
+
+    whole = chunk_no == 0 && (int64) header.dim == numel;
+    if(whole){
+        if(header.shape_size != (unsigned int) tensor.dim()){
+            ereport(ERROR,
+                    errmsg("layer \"%s\" of model \"%s\" does not match the base model", layer_name, model_name));
+        }
+        for(unsigned int i=0; i<header.shape_size; ++i){
+            if(header.shape[i] != tensor.size(i)){
+                ereport(ERROR,
+                        errmsg("layer \"%s\" of model \"%s\" does not match the base model", layer_name, model_name));
+            }
+        }
+    }else if(header.shape_size != 1 || offset + header.dim > numel){
+        ereport(ERROR,
+                errmsg("chunk %d of layer \"%s\" of model \"%s\" does not match the base model",
+                       chunk_no, layer_name, model_name));
+    }
+
+    if(tensor.scalar_type() == torch::kFloat32 && tensor.is_contiguous() && tensor.device().type() == at::kCPU){
+        heap_tuple_untoast_attr_into(attr, header_size, sizeof(float) * (Size) header.dim,
+                                     (char*) tensor.data_ptr() + sizeof(float) * offset);
+        return header.dim;
+    }
+
+    // other dtypes are converted by torch
+    Vector* layer_parm = DatumGetVector(parm_datum);
+    try {
+        if(whole){
+            tensor.copy_(vector_to_tensor(*layer_parm));
+        }else{
+            tensor.view({-1}).narrow(0, offset, header.dim).copy_(vector_to_tensor(*layer_parm));
+        }
+    }
+    catch (const std::exception& e) {
+        ereport(ERROR, (errmsg("load layer \"%s\" failed, error message: %s", layer_name, e.what())));
+    }
+    if((Pointer) layer_parm != DatumGetPointer(parm_datum)){
+        pfree(layer_parm);
+    }
+    return header.dim;
+}
+
+/*
+ * load the layer rows of model_name into the parameters of module. The rows
+ * are read with an index scan rather than through the LAYERMODELNAME
+ * catcache, which would keep a flattened copy of every layer in the backend,
+ * and matched to the parameters by a hash of their names. The ordered index
+ * scan returns the chunks of a layer one after the other in chunk order, so
+ * only one chunk is in flight at a time.
+ */
+static void
+model_manager_load_layers(torch::jit::script::Module& module, const char* model_name)
+{
+    Relation                                        pg_model_layer_info_rel;
+    Relation                                        pg_model_layer_info_idx;
+    TupleDesc                                       tupdesc;
+    ScanKeyData                                     key;
+    SysScanDesc                                     scan;
+    HeapTuple                                       tuple;
+    size_t                                          nlayers = 0;
+    std::unordered_map<std::string, torch::Tensor>  parameters;
+    std::string                                     cur_layer;
+    torch::Tensor*                                  cur_tensor = nullptr;
+    int64                                           cur_offset = 0;
+    int32                                           next_chunk = 0;
+
+    for(const auto& parm : module.named_parameters()){
+        parameters.emplace(parm.name, parm.value.detach());
+    }
+
+    pg_model_layer_info_rel = table_open(ModelLayerInfoRelationId, AccessShareLock);
+    pg_model_layer_info_idx = index_open(ModelLayerInfoNameIndex, AccessShareLock);
+    tupdesc = RelationGetDescr(pg_model_layer_info_rel);
+
+    ScanKeyInit(&key,
+                Anum_model_layer_info_layermodelname,
+                BTEqualStrategyNumber, F_NAMEEQ,
+                CStringGetDatum(model_name));
+    scan = systable_beginscan_ordered(pg_model_layer_info_rel, pg_model_layer_info_idx,
+                                      NULL, 1, &key);
+
+    while((tuple = systable_getnext_ordered(scan, ForwardScanDirection)) != NULL){
+        bool    is_null;
+        char*   layer_name;
+        int32   chunk_no;
+        Datum   parm_datum;
+
+        layer_name = TextDatumGetCString(heap_getattr(tuple, Anum_model_layer_info_layername, tupdesc, &is_null));
+        chunk_no = DatumGetInt32(heap_getattr(tuple, Anum_model_layer_info_layerchunkno, tupdesc, &is_null));
+
+        if(nlayers == 0 || cur_layer != layer_name){
+            if(cur_tensor != nullptr && cur_offset != cur_tensor->numel()){
+                ereport(ERROR,
+                        errmsg("layer \"%s\" of model \"%s\" is missing chunks", cur_layer.c_str(), model_name));
+            }
+            nlayers++;
+            cur_layer = layer_name;
+            auto it = parameters.find(cur_layer);
+            cur_tensor = it != parameters.end() ? &it->second : nullptr;
+            cur_offset = 0;
+            next_chunk = 0;
+        }
+
+        if(chunk_no != next_chunk++){
+            ereport(ERROR,
+                    errmsg("layer \"%s\" of model \"%s\" is missing chunk %d", layer_name, model_name, next_chunk - 1));
+        }
+
+        if(cur_tensor != nullptr){
+            parm_datum = heap_getattr(tuple, Anum_model_layer_info_parameter, tupdesc, &is_null);
+            if(is_null){
+                ereport(ERROR,
+                        errmsg("layer \"%s\" of model \"%s\" has no parameter", layer_name, model_name));
+            }
+            cur_offset += model_manager_load_layer(*cur_tensor, parm_datum, chunk_no, cur_offset,
+                                                   model_name, layer_name);
+        }
+        pfree(layer_name);
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    systable_endscan_ordered(scan);
+    index_close(pg_model_layer_info_idx, AccessShareLock);
+    table_close(pg_model_layer_info_rel, AccessShareLock);
+
+    if(cur_tensor != nullptr && cur_offset != cur_tensor->numel()){
+        ereport(ERROR,
+                errmsg("layer \"%s\" of model \"%s\" is missing chunks", cur_layer.c_str(), model_name));
+    }
+    if(nlayers == 0){
+        ereport(ERROR,
+                errmsg("model \"%s\" does not exist in model_layer_info", model_name));
+    }
+    // verify model layer num
+    if(nlayers != parameters.size()){
+        ereport(ERROR,
+                errmsg("model \"%s\" layer num not equal to base model", model_name));
+    }
+}
+
+ModelPrecision
+model_manager_parse_precision(const char *name)
+{
+    if(pg_strcasecmp(name, "fp32") == 0){
+        return MODEL_PRECISION_FP32;
+    }else if(pg_strcasecmp(name, "bf16") == 0){
+        return MODEL_PRECISION_BF16;
+    }else if(pg_strcasecmp(name, "int8-dynamic") == 0 || pg_strcasecmp(name, "int8_dynamic") == 0){
+        return MODEL_PRECISION_INT8_DYNAMIC;
+    }
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("invalid model precision \"%s\"", name),
+             errhint("Valid precisions are fp32, bf16 and int8-dynamic.")));
+    return MODEL_PRECISION_FP32;
+}
+
+static const char*
+model_manager_precision_name(ModelPrecision precision)
+{
+    switch(precision){
+        case MODEL_PRECISION_BF16:
+            return "bf16";
+        case MODEL_PRECISION_INT8_DYNAMIC:
+            return "int8-dynamic";
+        default:
+            return "fp32";
+    }
+}
+
+/*
+ * parse the modeloptions of model_info, a text[] of name=value. CREATE MODEL
+ * calls this too, so bad options are rejected before they are stored.
+ */
+void
+model_manager_parse_load_options(Datum options, ModelLoadOptions& load_options)
+{
+    List*       defs = untransformRelOptions(options);
+    ListCell*   cell;
+
+    foreach(cell, defs){
+        DefElem* def = (DefElem*) lfirst(cell);
+
+        if(strcmp(def->defname, "precision") == 0){
+            load_options.precision = model_manager_parse_precision(defGetString(def));
+        }else if(strcmp(def->defname, "freeze") == 0){
+            load_options.freeze = defGetBoolean(def);
+        }else if(strcmp(def->defname, "optimize") == 0){
+            load_options.optimize = defGetBoolean(def);
+        }else if(strcmp(def->defname, "persist") == 0){
+            load_options.persist = defGetBoolean(def);
+        }else if(strcmp(def->defname, "warmup") == 0){
+            load_options.warmup = pg_strtoint32(defGetString(def));
+            if(load_options.warmup < 0){
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("model option \"warmup\" must not be negative")));
+            }
+        }else if(strcmp(def->defname, "warmup_shape") == 0){
+            char*   shapes = pstrdup(defGetString(def));
+            char*   shape_save;
+
+            load_options.warmup_shape.clear();
+            for(char* shape = strtok_r(shapes, ";", &shape_save); shape != NULL;
+                shape = strtok_r(NULL, ";", &shape_save)){
+                std::vector<int64_t>    dims;
+                char*                   dim_save;
+
+                for(char* dim = strtok_r(shape, ", ", &dim_save); dim != NULL;
+                    dim = strtok_r(NULL, ", ", &dim_save)){
+                    char*   end;
+                    long    value = strtol(dim, &end, 10);
+
+                    if(*end != '\0' || value <= 0 || value > INT_MAX){
+                        ereport(ERROR,
+                                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                                 errmsg("invalid dimension \"%s\" in model option \"warmup_shape\"", dim)));
+                    }
+                    dims.push_back(value);
+                }
+                load_options.warmup_shape.push_back(dims);
+            }
+            pfree(shapes);
+        }else if(strcmp(def->defname, "num_class") == 0){
+            load_options.engine.num_class = pg_strtoint32(defGetString(def));
+            if(load_options.engine.num_class < 1){
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("model option \"num_class\" must be at least 1")));
+            }
+        }else if(strcmp(def->defname, "base_score") == 0){
+            char*   value = defGetString(def);
+            char*   end;
+
+            errno = 0;
+            load_options.engine.base_score = strtod(value, &end);
+            if(end == value || *end != '\0' || errno != 0 || std::isnan(load_options.engine.base_score)){
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("invalid value \"%s\" for model option \"base_score\"", value)));
+            }
+            load_options.engine.has_base_score = true;
+        }else{
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("unrecognized model option \"%s\"", def->defname)));
+        }
+    }
+
+    if(load_options.warmup > 0 && load_options.warmup_shape.empty()){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("model option \"warmup\" requires \"warmup_shape\"")));
+    }
+    // optimize_for_inference rewrites the aten::linear nodes int8-dynamic quantizes
+    if(load_options.precision == MODEL_PRECISION_INT8_DYNAMIC && load_options.optimize){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("model option \"optimize\" cannot be combined with precision int8-dynamic")));
+    }
+    if(load_options.persist && !load_options.freeze && !load_options.optimize &&
+       load_options.precision != MODEL_PRECISION_INT8_DYNAMIC){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("model option \"persist\" requires a frozen module"),
+                 errhint("Add \"freeze\" or \"optimize\", or use precision int8-dynamic.")));
+    }
+}
+
+/*
+ * a bf16 module takes and returns bfloat16 tensors, the callbacks around it
+ * work with float32 ones. Casts the from tensors of value, also inside tuples.
+ */
+static torch::jit::IValue
+model_manager_cast_value(const torch::jit::IValue& value, at::ScalarType from, at::ScalarType to)
+{
+    if(value.isTensor()){
+        const at::Tensor& tensor = value.toTensor();
+        return tensor.scalar_type() == from ? torch::jit::IValue(tensor.to(to)) : value;
+    }
+    if(value.isTuple()){
+        std::vector<torch::jit::IValue> elements;
+        for(const auto& element : value.toTuple()->elements()){
+            elements.push_back(model_manager_cast_value(element, from, to));
+        }
+        return c10::ivalue::Tuple::create(std::move(elements));
+    }
+    return value;
+}
+
+static void
+model_manager_collect_linear(torch::jit::Block* block, std::vector<torch::jit::Node*>& nodes)
+{
+    for(torch::jit::Node* node : block->nodes()){
+        if(node->kind() == c10::Symbol::fromQualString("aten::linear")){
+            nodes.push_back(node);
+        }
+        for(torch::jit::Block* sub_block : node->blocks()){
+            model_manager_collect_linear(sub_block, nodes);
+        }
+    }
+}
+
+/*
+ * dynamic int8 quantization of a frozen module: every aten::linear with a
+ * constant 2-D float weight becomes an fbgemm int8 GEMM, the weight is
+ * quantized here and the activations on every call. Other layers, LSTMs
+ * included, stay float. The weights are packed for fbgemm by
+ * model_manager_pack_int8, which has to run again after loading a saved
+ * module because the packed matrices are not serializable.
+ * Returns the number of layers quantized.
+ */
+static int
+model_manager_quantize_dynamic(torch::jit::script::Module& module)
+{
+    std::shared_ptr<torch::jit::Graph>  graph = module.get_method("forward").graph();
+    std::vector<torch::jit::Node*>      linears;
+    c10::Symbol                         quantized_linear = c10::Symbol::fromQualString("aten::fbgemm_linear_int8_weight_fp32_activation");
+    c10::Symbol                         pack = c10::Symbol::fromQualString("aten::fbgemm_pack_quantized_matrix");
+    int                                 nquantized = 0;
+
+    model_manager_collect_linear(graph->block(), linears);
+    for(torch::jit::Node* node : linears){
+        c10::optional<torch::jit::IValue>   weight = torch::jit::toIValue(node->input(1));
+        c10::optional<torch::jit::IValue>   bias = torch::jit::toIValue(node->input(2));
+        at::Tensor                          bias_tensor;
+
+        if(!weight || !weight->isTensor() || !bias || !(bias->isTensor() || bias->isNone())){
+            continue;
+        }
+        const at::Tensor& weight_tensor = weight->toTensor();
+        if(weight_tensor.dim() != 2 || weight_tensor.scalar_type() != at::kFloat){
+            continue;
+        }
+        bias_tensor = bias->isTensor() ? bias->toTensor().to(at::kFloat).contiguous()
+                                       : at::zeros({weight_tensor.size(0)}, at::kFloat);
+
+        auto quantized = at::fbgemm_linear_quantize_weight(weight_tensor.contiguous());
+        torch::jit::WithInsertPoint guard(node);
+        torch::jit::Value* qweight = graph->insertConstant(std::get<0>(quantized));
+        torch::jit::Node* packed = graph->insertNode(graph->create(pack, {qweight}));
+        torch::jit::Node* qlinear = graph->insertNode(graph->create(quantized_linear,
+            {node->input(0), qweight, packed->output(),
+             graph->insertConstant(std::get<1>(quantized)),
+             graph->insertConstant(std::get<2>(quantized)),
+             graph->insertConstant(std::get<3>(quantized)),
+             graph->insertConstant(bias_tensor)}));
+
+        packed->output()->setType(c10::TensorType::get());
+        qlinear->output()->setType(node->output()->type());
+        node->output()->replaceAllUsesWith(qlinear->output());
+        node->destroy();
+        nquantized++;
+    }
+    torch::jit::EliminateDeadCode(graph);
+    return nquantized;
+}
+
+/* fold the fbgemm_pack_quantized_matrix nodes of an int8-dynamic module into constants */
+static void
+model_manager_pack_int8(torch::jit::script::Module& module)
+{
+    std::shared_ptr<torch::jit::Graph> graph = module.get_method("forward").graph();
+
+    torch::jit::ConstantPropagation(graph);
+}
+
+/*
+ * apply the precision, freeze and optimize options to module. With persist
+ * the frozen result is saved as <model_path>.opt, with its precision in the
+ * archive, for the next backends. If torch rejects the module it is loaded
+ * again as it is. Returns whether module is frozen, *precision is set to the
+ * precision module runs at.
+ */
+static bool
+model_manager_optimize(torch::jit::script::Module& module, const ModelLoadOptions& options, const char* model_path,
+                       ModelPrecision* precision)
+{
+    bool    frozen = options.freeze || options.optimize || options.precision == MODEL_PRECISION_INT8_DYNAMIC;
+
+    try {
+        // before freezing, the weights are still parameters .to() converts
+        if(options.precision == MODEL_PRECISION_BF16){
+            module.to(at::kBFloat16);
+        }
+        if(options.optimize){
+            // freezes the module first
+            module = torch::jit::optimize_for_inference(module);
+        }else if(frozen){
+            module = torch::jit::freeze(module);
+        }
+        if(options.precision == MODEL_PRECISION_INT8_DYNAMIC &&
+           model_manager_quantize_dynamic(module) == 0){
+            ereport(WARNING, (errmsg("model \"%s\" has no linear layer to quantize", model_path)));
+        }
+    }
+    catch (const std::exception& e) {
+        ereport(WARNING, (errmsg("could not optimize model \"%s\", error message: %s", model_path, e.what())));
+        try {
+            module = torch::jit::load(model_path);
+            module.to(at::kCPU);
+            module.eval();
+        }
+        catch (const std::exception& e) {
+            ereport(ERROR, (errmsg("load model failed, error message: %s", e.what())));
+        }
+        *precision = MODEL_PRECISION_FP32;
+        return false;
+    }
+    *precision = options.precision;
+
+    if(options.persist){
+        char*                   optimized_path = psprintf("%s%s", model_path, MODEL_OPTIMIZED_SUFFIX);
+        char*                   tmp_path = psprintf("%s.%d", optimized_path, MyProcPid);
+        torch::jit::ExtraFilesMap extra_files{{"precision", model_manager_precision_name(options.precision)}};
+
+        try {
+            module.save(tmp_path, extra_files);
+            durable_rename(tmp_path, optimized_path, WARNING);
+        }
+        catch (const std::exception& e) {
+            unlink(tmp_path);
+            ereport(WARNING, (errmsg("could not save optimized model \"%s\", error message: %s", optimized_path, e.what())));
+        }
+        pfree(tmp_path);
+        pfree(optimized_path);
+    }
+
+    if(options.precision == MODEL_PRECISION_INT8_DYNAMIC){
+        model_manager_pack_int8(module);
+    }
+    return frozen;
+}
+
+/*
+ * run options.warmup forward passes on zero inputs of options.warmup_shape,
+ * so the profiling executor has specialized the graph before the first query
+ */
+static void
+model_manager_warmup(torch::jit::script::Module& module, const ModelLoadOptions& options,
+                     ModelPrecision precision, const char* model_path)
+{
+    std::vector<torch::jit::IValue> inputs;
+    torch::NoGradGuard              no_grad;
+    at::ScalarType                  dtype = precision == MODEL_PRECISION_BF16 ? at::kBFloat16 : at::kFloat;
+
+    for(const auto& shape : options.warmup_shape){
+        inputs.push_back(torch::zeros(shape, dtype));
+    }
+
+    try {
+        for(int i = 0; i < options.warmup; i++){
+            module.forward(inputs);
+        }
+    }
+    catch (const std::exception& e) {
+        ereport(WARNING, (errmsg("warmup of model \"%s\" failed, error message: %s", model_path, e.what())));
+    }
+}
+
+/* engines offered a model file before torch::jit::load, in order */
+static const ModelEngineLoader model_engines[] = {
+    tree_engine_load
+};
+
+/* rows an engine scores per task of the thread pool */
+#define MODEL_ENGINE_CHUNK_ROWS 256
+
+/*
+ * load data, NUL-terminated, with the first engine that knows its format.
+ * Only JSON is offered to the engines, TorchScript archives are zip files.
+ */
+static bool
+model_manager_try_engines(ModelManager *manager, const char *model_path, char *data, Size len)
+{
+    const char*                 p = data;
+    auto                        it = manager->module_load_options_.find(model_path);
+    const ModelEngineOptions*   options = it == manager->module_load_options_.end() ? NULL : &it->second.engine;
+
+    while(p < data + len && isspace((unsigned char) *p)){
+        p++;
+    }
+    if(p == data + len || (*p != '{' && *p != '[')){
+        return false;
+    }
+
+    for(ModelEngineLoader loader : model_engines){
+        ModelEngine* engine = loader(model_path, data, len, options);
+
+        if(engine != NULL){
+            manager->module_engine_[model_path] = std::shared_ptr<ModelEngine>(engine);
+            manager->module_overridden_.erase(model_path);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* load model_path with an engine if it is a JSON file one of them knows */
+static bool
+model_manager_load_engine(ModelManager *manager, const char *model_path)
+{
+    struct stat st;
+    char        head[64];
+    char*       data;
+    Size        done = 0;
+    ssize_t     n;
+    size_t      skip;
+    int         fd;
+    bool        loaded;
+
+    fd = OpenTransientFile(model_path, O_RDONLY | PG_BINARY);
+    if(fd < 0){
+        return false;
+    }
+
+    // a look at the start of the file, most models are TorchScript
+    n = read(fd, head, sizeof(head) - 1);
+    if(n <= 0 || fstat(fd, &st) != 0){
+        CloseTransientFile(fd);
+        return false;
+    }
+    head[n] = '\0';
+    skip = strspn(head, " \t\r\n");
+    if(head[skip] != '{' && head[skip] != '['){
+        CloseTransientFile(fd);
+        return false;
+    }
+
+    data = (char*) palloc_extended(st.st_size + 1, MCXT_ALLOC_HUGE);
+    memcpy(data, head, n);
+    done = n;
+    while(done < (Size) st.st_size){
+        n = read(fd, data + done, st.st_size - done);
+        if(n <= 0){
+            break;
+        }
+        done += n;
+    }
+    CloseTransientFile(fd);
+    data[done] = '\0';
+
+    loaded = model_manager_try_engines(manager, model_path, data, done);
+    pfree(data);
+    return loaded;
+}
+
+ModelEngine*
+model_manager_get_engine(ModelManager *manager, const char *model_path)
+{
+    auto it = manager->module_engine_.find(model_path);
+
+    return it == manager->module_engine_.end() ? NULL : it->second.get();
+}
+
+void
+model_manager_engine_predict(ModelEngine *engine, const float *rows, int64 nrows, int64 ncols, float8 *out)
+{
+    int64   nchunks = (nrows + MODEL_ENGINE_CHUNK_ROWS - 1) / MODEL_ENGINE_CHUNK_ROWS;
+    int     nout = engine->num_outputs();
+
+    if(ncols < engine->num_features()){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("%s model expects %d features, got " INT64_FORMAT,
+                        engine->name(), engine->num_features(), ncols)));
+    }
+
+    if(nchunks <= 1){
+        engine->predict(rows, nrows, ncols, out);
+        return;
+    }
+    try {
+        thread_pool_parallel_for(thread_pool_get(), (int) nchunks, [&](int chunk){
+            int64 begin = (int64) chunk * MODEL_ENGINE_CHUNK_ROWS;
+
+            engine->predict(rows + begin * ncols, Min((int64) MODEL_ENGINE_CHUNK_ROWS, nrows - begin),
+                            ncols, out + begin * nout);
+        });
+    }
+    catch (const std::exception& e) {
+        ereport(ERROR, (errmsg("%s model predict error, error message: %s", engine->name(), e.what())));
+    }
+}
+
+/*
+ * forward for a model served by an engine: the first input is read as
+ * [rows, features] floats, the output is [rows, outputs]
+ */
+static bool
+model_manager_engine_forward(ModelEngine *engine, std::vector<torch::jit::IValue>& input, torch::jit::IValue& output)
+{
+    if(input.size() != 1 || !input[0].isTensor()){
+        ereport(ERROR, (errmsg("%s model takes a single tensor of features", engine->name())));
+    }
+
+    torch::Tensor   features = input[0].toTensor().to(at::kCPU, at::kFloat).contiguous();
+    int64           nrows = features.dim() == 0 ? 1 : features.size(0);
+    torch::Tensor   scores;
+
+    if(nrows == 0){
+        output = torch::empty({0, (int64) engine->num_outputs()}, torch::kFloat);
+        return true;
+    }
+    features = features.reshape({nrows, -1});
+    scores = torch::empty({nrows, (int64) engine->num_outputs()}, torch::kDouble);
+    model_manager_engine_predict(engine, features.data_ptr<float>(), nrows, features.size(1), scores.data_ptr<double>());
+    output = scores.to(at::kFloat);
+    return true;
+}
+
 bool 
 model_manager_load_model(ModelManager *manager, const char *model_path, const char *model_name, const char *base_model)
 {
-    Relation    pg_model_layer_info_rel; 
-    size_t      parm_vector_size;  
+    torch::jit::script::Module  module;
+    const ModelLoadOptions*     options = NULL;
+    ModelPrecision              precision = MODEL_PRECISION_FP32;
+    bool                        frozen = false;
+    char*                       optimized_path;
 
-    if(manager->module_handle_.find(model_path) != manager->module_handle_.end()){
+    if(manager->module_handle_.find(model_path) != manager->module_handle_.end() ||
+       manager->module_engine_.find(model_path) != manager->module_engine_.end()){
         return true;
     }
+    if(model_name == NULL && model_manager_load_engine(manager, model_path)){
+        return true;
+    }
+
+    // load options only apply to models without fine-tuned layers
+    if(model_name == NULL){
+        auto it = manager->module_load_options_.find(model_path);
+        if(it != manager->module_load_options_.end()){
+            options = &it->second;
+        }
+    }
 
-    // load base model
+    // load base model, or the module an earlier backend optimized and saved
+    optimized_path = psprintf("%s%s", model_path, MODEL_OPTIMIZED_SUFFIX);
     try {
-        torch::jit::script::Module cur_module = torch::jit::load(model_path);
-        manager->module_handle_[model_path].first = cur_module;
-        manager->module_handle_[model_path].second = at::kCPU;
-        manager->module_handle_[model_path].first.to(manager->module_handle_[model_path].second);
-        manager->module_handle_[model_path].first.eval();
-        //return true;
+        if(model_name == NULL && access(optimized_path, F_OK) == 0){
+            torch::jit::ExtraFilesMap extra_files{{"precision", ""}};
+
+            module = torch::jit::load(optimized_path, c10::nullopt, extra_files);
+            frozen = true;
+            if(!extra_files["precision"].empty()){
+                precision = model_manager_parse_precision(extra_files["precision"].c_str());
+            }
+            if(precision == MODEL_PRECISION_INT8_DYNAMIC){
+                model_manager_pack_int8(module);
+            }
+        }else{
+            module = torch::jit::load(model_path);
+            module.to(at::kCPU);
+            module.eval();
+        }
     }
     catch (const std::exception& e) {
         ereport(ERROR, (errmsg("load model failed, error message: %s", e.what())));
         return false;
     }
+    pfree(optimized_path);
 
-    // load parameter
+    if(!frozen && options != NULL){
+        frozen = model_manager_optimize(module, *options, model_path, &precision);
+    }
+
+    // load parameter, the module is only registered once it is complete
     if(model_name != NULL){
-        // read layer parameter in layer_model_info
-        pg_model_layer_info_rel = table_open(ModelLayerInfoRelationId, AccessShareLock);
-        if(!SearchSysCacheExists1(LAYERMODELNAME, CStringGetDatum(model_name))){
-            ereport(ERROR,
-                    errmsg("model \"%s\" does not exist in model_layer_info", model_name));
+        model_manager_load_layers(module, model_name);
+    }
+
+    // share weights with other backends, fine-tuned variants get their own blob
+    if(model_name != NULL){
+        char* cache_key = psprintf("%s#%s", model_path, model_name);
+        model_manager_share_weights(module, cache_key);
+        pfree(cache_key);
+        manager->module_overridden_.insert(model_path);
+    }else{
+        if(!frozen && precision == MODEL_PRECISION_BF16){
+            char* cache_key = psprintf("%s#bf16", model_path);
+            model_manager_share_weights(module, cache_key);
+            pfree(cache_key);
+        }else if(!frozen){
+            model_manager_share_weights(module, model_path);
         }
+        manager->module_overridden_.erase(model_path);
+    }
 
-        CatCList* parameter_list = SearchSysCacheList1(LAYERMODELNAME,CStringGetDatum(model_name));
-        parm_vector_size = parameter_list->n_members;
-        // layer_tensor_parm is ordered
-        auto layer_tensor_parm = manager->module_handle_[model_path].first.named_parameters();
+    if(options != NULL && options->warmup > 0){
+        model_manager_warmup(module, *options, precision, model_path);
+    }
 
-        // verify model layer num
-        if(parm_vector_size != layer_tensor_parm.size()){
-            ereport(ERROR,
-                    errmsg("model \"%s\" layer num not equal to base model", model_name));
-        }
-
-        //int32 index=0;
-        bool is_null;
-        for(size_t index=0; index<parm_vector_size; ++index){
-            HeapTuple proctup = &parameter_list->members[index]->tuple;
-            char* layer_name = DatumGetCString(SysCacheGetAttr(LAYERMODELNAME, proctup, Anum_model_layer_info_layername, &is_null));
-
-
-            for(const auto& parm : layer_tensor_parm){
-                // model_layer_info exist in model
-                //ereport(INFO,
-                    //errmsg("parm.name:%s", parm.name.c_str()));
-                if(parm.name == layer_name){
-                    torch::Tensor tensor = parm.value.detach();
-                    //ereport(INFO,
-                        //errmsg("layer_name:%s", layer_name));
-                    Vector* layer_parm = DatumGetVector(SysCacheGetAttr(LAYERMODELNAME, proctup, Anum_model_layer_info_parameter, &is_null));
-                    tensor.copy_(vector_to_tensor(*layer_parm));
-                    break;
-                }
-            }
-        }
-        ReleaseCatCacheList(parameter_list);
-        table_close(pg_model_layer_info_rel, AccessShareLock);
-        
+    if(frozen){
+        manager->module_frozen_.insert(model_path);
+    }else{
+        manager->module_frozen_.erase(model_path);
+    }
+    if(precision == MODEL_PRECISION_BF16){
+        manager->module_bf16_.insert(model_path);
+    }else{
+        manager->module_bf16_.erase(model_path);
     }
+    manager->module_handle_[model_path].first = module;
+    manager->module_handle_[model_path].second = at::kCPU;
     return true;
     
 }
 
+/*
+ * read-only std::streambuf over a memory buffer. torch::jit::load seeks
+ * around the zip archive, so seekoff and seekpos are needed too.
+ */
+class ModelBufferStream : public std::streambuf {
+public:
+    ModelBufferStream(char* data, size_t len){
+        setg(data, data, data + len);
+    }
+
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        char* base = dir == std::ios_base::beg ? eback() :
+                     dir == std::ios_base::cur ? gptr() : egptr();
+
+        if(off < eback() - base || off > egptr() - base){
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), base + off, egptr());
+        return pos_type(gptr() - eback());
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
+/*
+ * load model_path from its bytes, already in memory right after an upload,
+ * and publish its weights to the model cache under model_path. Returns false
+ * if the bytes are not a TorchScript archive.
+ */
+bool
+model_manager_load_model_from_buffer(ModelManager *manager, const char *model_path, char *data, size_t len)
+{
+    torch::jit::script::Module  module;
+
+    if(len > 0 && (data[0] == '{' || data[0] == '[' || isspace((unsigned char) data[0]))){
+        char*   json = pnstrdup(data, len);
+        bool    loaded = model_manager_try_engines(manager, model_path, json, len);
+
+        pfree(json);
+        if(loaded){
+            return true;
+        }
+    }
+
+    try {
+        ModelBufferStream   buffer(data, len);
+        std::istream        stream(&buffer);
+
+        module = torch::jit::load(stream);
+        module.to(at::kCPU);
+        module.eval();
+    }
+    catch (const std::exception& e) {
+        ereport(WARNING, (errmsg("could not preload model \"%s\", error message: %s", model_path, e.what())));
+        return false;
+    }
+
+    model_manager_share_weights(module, model_path);
+    manager->module_overridden_.erase(model_path);
+    manager->module_handle_[model_path].first = module;
+    manager->module_handle_[model_path].second = at::kCPU;
+    return true;
+}
+
+/*
+ * a model published into a parallel query's DSM segment: the TorchScript
+ * archive, then the weights of the leader's module in the layout of a model
+ * cache blob, starting at weights_off. archive_len is 0 if publishing failed.
+ */
+typedef struct ModelSharedHeader {
+    Size    archive_len;
+    Size    weights_off;
+    Size    weights_len;
+    int32   ntensors;
+    bool    overridden;     // weights are fine-tuned layers, not the archive's
+} ModelSharedHeader;
+
+#define MODEL_SHARED_ARCHIVE_OFF MAXALIGN(sizeof(ModelSharedHeader))
+
+/*
+ * whether model_path is loaded on the CPU as the model file describes it:
+ * fp32, neither frozen nor converted to bf16 or int8. Only such a module can
+ * be rebuilt from the file by another process.
+ */
+static bool
+model_manager_plain_cpu_module(ModelManager *manager, const char *model_path)
+{
+    auto    it = manager->module_handle_.find(model_path);
+    auto    options = manager->module_load_options_.find(model_path);
+
+    return it != manager->module_handle_.end() && it->second.second == at::kCPU &&
+           manager->module_frozen_.count(model_path) == 0 && manager->module_bf16_.count(model_path) == 0 &&
+           (options == manager->module_load_options_.end() || options->second.precision == MODEL_PRECISION_FP32);
+}
+
+Size
+model_manager_shared_size(ModelManager *manager, const char *model_path)
+{
+    std::vector<torch::Tensor>  tensors;
+    Size                        weights_len;
+    struct stat                 st;
+    auto                        it = manager->module_handle_.find(model_path);
+
+    // the archive alone can't rebuild frozen, bf16 or quantized modules
+    if(!model_manager_plain_cpu_module(manager, model_path)){
+        return 0;
+    }
+    if(!model_manager_weight_tensors(it->second.first, tensors, &weights_len)){
+        return 0;
+    }
+    if(stat(model_path, &st) != 0 || st.st_size <= 0){
+        return 0;
+    }
+    return MODEL_SHARED_ARCHIVE_OFF + st.st_size + MODEL_CACHE_ALIGN + weights_len;
+}
+
+bool
+model_manager_publish_shared(ModelManager *manager, const char *model_path, char *dest, Size size)
+{
+    ModelSharedHeader*          header = (ModelSharedHeader*) dest;
+    std::vector<torch::Tensor>  tensors;
+    Size                        weights_len;
+    Size                        done = 0;
+    char*                       archive = dest + MODEL_SHARED_ARCHIVE_OFF;
+    char*                       weights;
+    struct stat                 st;
+    int                         fd;
+    auto                        it = manager->module_handle_.find(model_path);
+
+    MemSet(header, 0, sizeof(ModelSharedHeader));
+    if(it == manager->module_handle_.end() ||
+       !model_manager_weight_tensors(it->second.first, tensors, &weights_len)){
+        return false;
+    }
+
+    fd = OpenTransientFile(model_path, O_RDONLY | PG_BINARY);
+    if(fd < 0){
+        return false;
+    }
+    if(fstat(fd, &st) != 0 || st.st_size <= 0 ||
+       MODEL_SHARED_ARCHIVE_OFF + st.st_size + MODEL_CACHE_ALIGN + weights_len > size){
+        CloseTransientFile(fd);
+        return false;
+    }
+    while(done < (Size) st.st_size){
+        ssize_t n = read(fd, archive + done, st.st_size - done);
+        if(n <= 0){
+            CloseTransientFile(fd);
+            return false;
+        }
+        done += n;
+    }
+    CloseTransientFile(fd);
+
+    weights = (char*) TYPEALIGN(MODEL_CACHE_ALIGN, archive + done);
+    for(auto& tensor : tensors){
+        memcpy(weights, tensor.data_ptr(), tensor.nbytes());
+        weights += MODEL_CACHE_ALIGN_SIZE(tensor.nbytes());
+    }
+
+    header->weights_off = (char*) TYPEALIGN(MODEL_CACHE_ALIGN, archive + done) - dest;
+    header->weights_len = weights_len;
+    header->ntensors = tensors.size();
+    header->overridden = manager->module_overridden_.count(model_path) > 0;
+    header->archive_len = done;
+    return true;
+}
+
+bool
+model_manager_attach_shared(ModelManager *manager, const char *model_path, char *src)
+{
+    ModelSharedHeader*          header = (ModelSharedHeader*) src;
+    torch::jit::script::Module  module;
+    std::vector<torch::Tensor>  tensors;
+    Size                        weights_len;
+
+    if(header->archive_len == 0){
+        return false;
+    }
+    if(manager->module_handle_.find(model_path) != manager->module_handle_.end()){
+        return true;
+    }
+
+    try {
+        ModelBufferStream   buffer(src + MODEL_SHARED_ARCHIVE_OFF, header->archive_len);
+        std::istream        stream(&buffer);
+
+        module = torch::jit::load(stream);
+        module.to(at::kCPU);
+        module.eval();
+    }
+    catch (const std::exception& e) {
+        ereport(WARNING, (errmsg("could not attach shared model \"%s\", error message: %s", model_path, e.what())));
+        return false;
+    }
+
+    if(!model_manager_weight_tensors(module, tensors, &weights_len) ||
+       tensors.size() != (size_t) header->ntensors || weights_len != header->weights_len){
+        return false;
+    }
+    model_manager_attach_weights(tensors, src + header->weights_off);
+
+    if(header->overridden){
+        manager->module_overridden_.insert(model_path);
+    }else{
+        manager->module_overridden_.erase(model_path);
+    }
+    manager->module_frozen_.erase(model_path);
+    manager->module_bf16_.erase(model_path);
+    manager->module_handle_[model_path].first = module;
+    manager->module_handle_[model_path].second = at::kCPU;
+    return true;
+}
+
 char* replace_model_path(char* origin_path) {
     char                tmp_path[MAXPGPATH];
     char                model_path_root[MAXPGPATH];
@@ -162,6 +1138,18 @@ model_manager_get_model_path(ModelManager *manager, const char *model_name, char
         path_datum = heap_getattr(model_info_tuple, Anum_model_info_modelpath, 
                               RelationGetDescr(pg_model_info_rel), &path_is_null);
         if(!path_is_null) *model_path = replace_model_path(TextDatumGetCString(path_datum));  
+
+        // remember the load options until the model is loaded
+        if(!path_is_null && manager->module_handle_.find(*model_path) == manager->module_handle_.end()){
+            bool    options_is_null;
+            Datum   options_datum = heap_getattr(model_info_tuple, Anum_model_info_modeloptions,
+                                                 RelationGetDescr(pg_model_info_rel), &options_is_null);
+
+            manager->module_load_options_.erase(*model_path);
+            if(!options_is_null){
+                model_manager_parse_load_options(options_datum, manager->module_load_options_[*model_path]);
+            }
+        }
     }
 
     ReleaseSysCache(model_info_tuple);
@@ -208,6 +1196,10 @@ model_manager_set_cuda(ModelManager *manager, const char *model_path)
         if(manager->module_handle_[model_path].second == at::kCUDA){
             return true;
         } else {
+            // the weights of a frozen module are graph constants, .to() doesn't move them
+            if(manager->module_frozen_.count(model_path) > 0){
+                return false;
+            }
             if(torch::cuda::is_available()){
                 manager->module_handle_[model_path].second = at::kCUDA;
                 manager->module_handle_[model_path].first.to(at::kCUDA);
@@ -232,31 +1224,90 @@ model_manager_get_device_type(ModelManager *manager, const char *model_path, tor
     return true;
 }
 
+int64
+model_manager_module_bytes(ModelManager *manager, const char *model_path)
+{
+    int64 bytes = 0;
+
+    auto engine = manager->module_engine_.find(model_path);
+    if(engine != manager->module_engine_.end()){
+        return engine->second->memory_bytes();
+    }
+    auto it = manager->module_handle_.find(model_path);
+    if(it == manager->module_handle_.end()){
+        return 0;
+    }
+    for(const auto& param : it->second.first.parameters()){
+        bytes += param.nbytes();
+    }
+    for(const auto& buffer : it->second.first.buffers()){
+        bytes += buffer.nbytes();
+    }
+    return bytes;
+}
+
+/* move the preprocessed tensors to the device of the model */
+static bool
+move_to_model_device(ModelManager *manager, const char *model_path, std::vector<torch::jit::IValue>& input_tensor)
+{
+    if(manager->module_handle_.find(model_path) == manager->module_handle_.end()){
+        ereport(ERROR, (errmsg("model:%s handle not exist!", model_path)));
+    }
+    for(auto& tensor : input_tensor){
+        tensor = tensor.toTensor().to(manager->module_handle_[model_path].second);
+    }
+    return true;
+}
+
+static bool
+has_pre_process(ModelManager *manager, const char *model_path)
+{
+    return manager->module_preprocess_functions_.find(model_path) != manager->module_preprocess_functions_.end() ||
+           manager->module_batch_preprocess_functions_.find(model_path) != manager->module_batch_preprocess_functions_.end();
+}
+
 bool 
 model_manager_pre_process(ModelManager *manager, const char *model_path, std::vector<torch::jit::IValue>& input_tensor, Args *args)
 {
+    if(!has_pre_process(manager, model_path)){
+        register_default_model();
+    }
+
     if(manager->module_preprocess_functions_.find(model_path) != manager->module_preprocess_functions_.end()){
-model_process_registered:
-        if(manager->module_preprocess_functions_[model_path](input_tensor, args)){
-            if(manager->module_handle_.find(model_path) != manager->module_handle_.end()){
-                for(auto& tensor : input_tensor){
-                    tensor = tensor.toTensor().to(manager->module_handle_[model_path].second);
-                }
-                return true;
-            }else{
-                ereport(ERROR, (errmsg("model:%s handle not exist!", model_path)));
-            }
-        }else{
+        if(!manager->module_preprocess_functions_[model_path](input_tensor, args)){
             return false;
         }
-        
-    } else {
-        register_default_model();
-        goto model_process_registered;
+        return move_to_model_device(manager, model_path, input_tensor);
     }
+
+    // 只注册了batch预处理时当作一行的batch
+    if(manager->module_batch_preprocess_functions_.find(model_path) != manager->module_batch_preprocess_functions_.end()){
+        return model_manager_batch_pre_process(manager, model_path, input_tensor, &args, 1);
+    }
+
     return false;
 }
 
+bool
+model_manager_has_batch_pre_process(ModelManager *manager, const char *model_path)
+{
+    if(!has_pre_process(manager, model_path)){
+        register_default_model();
+    }
+    return manager->module_batch_preprocess_functions_.find(model_path) != manager->module_batch_preprocess_functions_.end();
+}
+
+bool
+model_manager_batch_pre_process(ModelManager *manager, const char *model_path, std::vector<torch::jit::IValue>& input_tensor, Args **rows, int nrows)
+{
+    auto it = manager->module_batch_preprocess_functions_.find(model_path);
+
+    if(it == manager->module_batch_preprocess_functions_.end() || !it->second(input_tensor, rows, nrows)){
+        return false;
+    }
+    return move_to_model_device(manager, model_path, input_tensor);
+}
+
 bool 
 model_manager_output_process_float(ModelManager *manager, const char *model_path, torch::jit::IValue& output_tensor, Args *args, float8& result)
 {
@@ -282,6 +1333,30 @@ model_manager_output_process_text(ModelManager *manager, const char *model_path,
     return false;
 }
 
+bool
+model_manager_batch_output_process_float(ModelManager *manager, const char *model_path, torch::jit::IValue& output_tensor, Args** rows, int nrows, std::vector<float8>& results)
+{
+    auto it = manager->module_batch_outputprocess_functions_float_.find(model_path);
+
+    if(it == manager->module_batch_outputprocess_functions_float_.end()){
+        return false;
+    }
+    results.reserve(nrows);
+    return it->second(output_tensor, rows, nrows, results);
+}
+
+bool
+model_manager_batch_output_process_text(ModelManager *manager, const char *model_path, torch::jit::IValue& output_tensor, Args** rows, int nrows, std::vector<std::string>& results)
+{
+    auto it = manager->module_batch_outputprocess_functions_text_.find(model_path);
+
+    if(it == manager->module_batch_outputprocess_functions_text_.end()){
+        return false;
+    }
+    results.reserve(nrows);
+    return it->second(output_tensor, rows, nrows, results);
+}
+
 void 
 model_manager_register_pre_process(ModelManager *manager, const char *model_name, PreProcessCallback func)
 {
@@ -295,6 +1370,19 @@ model_manager_register_pre_process(ModelManager *manager, const char *model_name
     }
 }
 
+void 
+model_manager_register_batch_pre_process(ModelManager *manager, const char *model_name, BatchPreProcessCallback func)
+{
+    char* model_path = nullptr;
+    char* base_model = nullptr;
+    if(model_manager_get_model_path(manager, model_name, &model_path, &base_model)){
+        manager->module_batch_preprocess_functions_[model_path] = func;
+        return;
+    }else{
+        ereport(ERROR, (errmsg("model:%s not exist!", model_name)));
+    }
+}
+
 void 
 model_manager_register_output_process_float(ModelManager *manager, const char *model_name, OutputProcessFloatCallback func)
 {
@@ -321,36 +1409,285 @@ model_manager_register_output_process_text(ModelManager *manager, const char *mo
     }
 }
 
+void 
+model_manager_register_batch_output_process_float(ModelManager *manager, const char *model_name, BatchOutputProcessFloatCallback func)
+{
+    char* model_path = nullptr;
+    char* base_model = nullptr;
+    if(model_manager_get_model_path(manager, model_name, &model_path, &base_model)){
+        manager->module_batch_outputprocess_functions_float_[model_path] = func;
+        return;
+    }else{
+        ereport(ERROR, (errmsg("model:%s not exist!", model_name)));
+    }
+}
+
+void 
+model_manager_register_batch_output_process_text(ModelManager *manager, const char *model_name, BatchOutputProcessTextCallback func)
+{
+    char* model_path = nullptr;
+    char* base_model = nullptr;
+    if(model_manager_get_model_path(manager, model_name, &model_path, &base_model)){
+        manager->module_batch_outputprocess_functions_text_[model_path] = func;
+        return;
+    }else{
+        ereport(ERROR, (errmsg("model:%s not exist!", model_name)));
+    }
+}
+
 bool 
 model_manager_predict(ModelManager *manager, const char *model_path, torch::jit::IValue& input, torch::jit::IValue& output)
 {
+    ModelEngine* engine = model_manager_get_engine(manager, model_path);
+
+    if(engine != NULL){
+        std::vector<torch::jit::IValue> inputs{input};
+        torch::jit::IValue              scores;
+
+        model_manager_engine_forward(engine, inputs, scores);
+        output = scores.toTensor();
+        return true;
+    }
     if(manager->module_handle_.find(model_path) == manager->module_handle_.end()){
         return false;
     }
+    int leased = torch_threads_acquire();
     try {
-        output = manager->module_handle_[model_path].first.forward({input}).toTensor();
-        return true;
+        if(manager->module_bf16_.count(model_path) > 0){
+            output = model_manager_cast_value(
+                manager->module_handle_[model_path].first.forward({model_manager_cast_value(input, at::kFloat, at::kBFloat16)}),
+                at::kBFloat16, at::kFloat).toTensor();
+        }else{
+            output = manager->module_handle_[model_path].first.forward({input}).toTensor();
+        }
     }
     catch (const std::exception& e) {
+        torch_threads_release(leased);
         ereport(ERROR, (errmsg("predict error, error message:%s", e.what())));
         return false;
     }
+    torch_threads_release(leased);
+    return true;
 }
 
 bool 
 model_manager_predict_multi_input(ModelManager *manager, const char *model_path, std::vector<torch::jit::IValue>& input, torch::jit::IValue& output)
 {
+    ModelEngine* engine = model_manager_get_engine(manager, model_path);
+
+    if(engine != NULL){
+        return model_manager_engine_forward(engine, input, output);
+    }
     if(manager->module_handle_.find(model_path) == manager->module_handle_.end()){
         return false;
     }
-    try {
-        output = manager->module_handle_[model_path].first.forward(input);
+    // 交给inference worker和其他会话的请求合批执行，队列满时在本进程执行
+    // worker从模型文件加载，只有和文件一致的fp32模块才能交给它
+    if(inference_workers > 0 && !am_inference_worker &&
+       model_manager_plain_cpu_module(manager, model_path) &&
+       manager->module_overridden_.find(model_path) == manager->module_overridden_.end() &&
+       inference_queue_submit(model_path, input, output)){
         return true;
     }
+    int leased = torch_threads_acquire();
+    try {
+        if(manager->module_bf16_.count(model_path) > 0){
+            std::vector<torch::jit::IValue> bf16_input;
+
+            for(const auto& value : input){
+                bf16_input.push_back(model_manager_cast_value(value, at::kFloat, at::kBFloat16));
+            }
+            output = model_manager_cast_value(manager->module_handle_[model_path].first.forward(bf16_input),
+                                              at::kBFloat16, at::kFloat);
+        }else{
+            output = manager->module_handle_[model_path].first.forward(input);
+        }
+    }
     catch (const std::exception& e) {
+        torch_threads_release(leased);
         ereport(ERROR, (errmsg("muti predict error, error message:%s", e.what())));
         return false;
     }
+    torch_threads_release(leased);
+    return true;
+}
+
+/* the first tensor of a model output, as float32 */
+static at::Tensor
+model_manager_output_tensor(const torch::jit::IValue& output)
+{
+    if(output.isTensor()){
+        return output.toTensor().to(at::kFloat);
+    }
+    if(output.isTuple() && !output.toTuple()->elements().empty()){
+        return model_manager_output_tensor(output.toTuple()->elements()[0]);
+    }
+    throw std::runtime_error("model output is not a tensor");
+}
+
+/*
+ * float32 tensor of a column of a sample row, vector or one of its compact
+ * companions, false for any other type
+ */
+static bool
+model_manager_sample_tensor(Oid type, Datum value, at::Tensor& tensor)
+{
+    float scale;
+
+    switch(type){
+        case VECTOROID:
+            tensor = vector_to_tensor(*DatumGetVector(value));
+            return true;
+        case HALFVECOID:
+            tensor = halfvec_to_tensor(*DatumGetCompactVector(value)).to(at::kFloat);
+            return true;
+        case BF16VECOID:
+            tensor = bf16vec_to_tensor(*DatumGetCompactVector(value)).to(at::kFloat);
+            return true;
+        case INT8VECOID:
+            tensor = int8vec_to_tensor(*DatumGetCompactVector(value), &scale).to(at::kFloat).mul_(scale);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * model_precision_compare(model, precision, sample): run the rows of the
+ * query sample, one vector, halfvec, bf16vec or int8vec column per model
+ * input, through the model at fp32
+ * and at precision, and report the forward latency of both and how far the
+ * outputs are apart. The raw outputs are compared, the pre- and post-process
+ * callbacks of the model are not involved. The first row only warms up both
+ * modules and is not timed.
+ */
+Datum
+model_precision_compare(PG_FUNCTION_ARGS)
+{
+#define MODEL_PRECISION_COMPARE_COLS 6
+    char*                       model_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char*                       sample = text_to_cstring(PG_GETARG_TEXT_PP(2));
+    char*                       model_path = NULL;
+    char*                       base_model = NULL;
+    ModelLoadOptions            options;
+    ModelPrecision              precision;
+    torch::jit::script::Module  reference;
+    torch::jit::script::Module  variant;
+    TupleDesc                   tupdesc;
+    Datum                       values[MODEL_PRECISION_COMPARE_COLS];
+    bool                        nulls[MODEL_PRECISION_COMPARE_COLS];
+    int64                       rows = 0;
+    int64                       nelems = 0;
+    int64                       top1_rows = 0;
+    int64                       top1_agree = 0;
+    double                      reference_us = 0;
+    double                      variant_us = 0;
+    double                      max_diff = 0;
+    double                      sum_diff = 0;
+
+    if(get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE){
+        elog(ERROR, "return type must be a row type");
+    }
+
+    options.precision = model_manager_parse_precision(text_to_cstring(PG_GETARG_TEXT_PP(1)));
+    model_manager_get_model_path(&model_manager, model_name, &model_path, &base_model);
+    if(base_model != NULL || model_path == NULL){
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("model \"%s\" has a base model, only its base model can be compared", model_name)));
+    }
+
+    try {
+        reference = torch::jit::load(model_path);
+        reference.to(at::kCPU);
+        reference.eval();
+        variant = torch::jit::load(model_path);
+        variant.to(at::kCPU);
+        variant.eval();
+    }
+    catch (const std::exception& e) {
+        ereport(ERROR, (errmsg("load model failed, error message: %s", e.what())));
+    }
+    model_manager_optimize(variant, options, model_path, &precision);
+
+    if(SPI_connect() != SPI_OK_CONNECT){
+        elog(ERROR, "SPI_connect failed");
+    }
+    if(SPI_execute(sample, true, 0) != SPI_OK_SELECT){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("sample must be a SELECT query")));
+    }
+
+    for(uint64 i = 0; i < SPI_processed; i++){
+        HeapTuple                       tuple = SPI_tuptable->vals[i];
+        TupleDesc                       desc = SPI_tuptable->tupdesc;
+        std::vector<torch::jit::IValue> inputs;
+        std::vector<torch::jit::IValue> variant_inputs;
+
+        for(int col = 1; col <= desc->natts; col++){
+            bool        isnull;
+            Datum       value = SPI_getbinval(tuple, desc, col, &isnull);
+            at::Tensor  tensor;
+
+            if(isnull || !model_manager_sample_tensor(SPI_gettypeid(desc, col), value, tensor)){
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATATYPE_MISMATCH),
+                         errmsg("columns of the sample query must be non-null vectors")));
+            }
+            inputs.push_back(tensor);
+            variant_inputs.push_back(precision == MODEL_PRECISION_BF16 ?
+                                     model_manager_cast_value(inputs.back(), at::kFloat, at::kBFloat16) :
+                                     inputs.back());
+        }
+
+        try {
+            torch::NoGradGuard  no_grad;
+            auto                start = std::chrono::steady_clock::now();
+            torch::jit::IValue  reference_output = reference.forward(inputs);
+            auto                middle = std::chrono::steady_clock::now();
+            torch::jit::IValue  variant_output = variant.forward(variant_inputs);
+            auto                end = std::chrono::steady_clock::now();
+            at::Tensor          expected = model_manager_output_tensor(reference_output);
+            at::Tensor          actual = model_manager_output_tensor(variant_output);
+            at::Tensor          diff;
+
+            if(expected.sizes() != actual.sizes()){
+                throw std::runtime_error("outputs of the two precisions differ in shape");
+            }
+            diff = (expected - actual).abs();
+            max_diff = std::max(max_diff, diff.max().item<double>());
+            sum_diff += diff.sum().item<double>();
+            nelems += diff.numel();
+            if(expected.dim() >= 1 && expected.size(-1) > 1){
+                at::Tensor expected_top1 = expected.argmax(-1);
+
+                top1_agree += expected_top1.eq(actual.argmax(-1)).sum().item<int64_t>();
+                top1_rows += expected_top1.numel();
+            }
+            if(i > 0){
+                reference_us += std::chrono::duration_cast<std::chrono::microseconds>(middle - start).count();
+                variant_us += std::chrono::duration_cast<std::chrono::microseconds>(end - middle).count();
+            }
+        }
+        catch (const std::exception& e) {
+            ereport(ERROR, (errmsg("predict error, error message:%s", e.what())));
+        }
+        rows++;
+        CHECK_FOR_INTERRUPTS();
+    }
+    SPI_finish();
+
+    MemSet(nulls, false, sizeof(nulls));
+    values[0] = Int64GetDatum(rows);
+    values[1] = Float8GetDatum(reference_us / 1000.0);
+    values[2] = Float8GetDatum(variant_us / 1000.0);
+    values[3] = Float8GetDatum(max_diff);
+    values[4] = Float8GetDatum(nelems > 0 ? sum_diff / nelems : 0);
+    values[5] = Float8GetDatum(top1_rows > 0 ? (double) top1_agree / top1_rows : 0);
+    nulls[5] = top1_rows == 0;
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
 }
 
 #ifdef __cplusplus
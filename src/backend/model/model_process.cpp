@@ -1,9 +1,16 @@
 #include <cstddef>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <opencv/cv.h>
 #include <opencv2/opencv.hpp>
 #include <sentencepiece_processor.h>
 
 #include "model/model_manager.h"
+#include "model/thread_pool.h"
 
 extern "C" {
 #include "utils/elog.h"
@@ -12,27 +19,127 @@ extern "C" {
 extern char pkglib_path[];
 extern ModelManager model_manager;
 
-bool LoadFromImagePath(std::vector<torch::jit::IValue>& img_tensor, Args* args)
+#define DEFECT_IMAGE_SIZE   64
+
+/* read a whole file into buf, reused across calls on the same thread */
+static bool
+read_image_file(const char* path, std::vector<uchar>& buf)
 {
-    cv::Mat image;
-    cv::Mat image_float;
-    char* url = (char*)args[0].ptr;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    size_t done = 0;
 
-    image = cv::imread(url);
-    cv::cvtColor(image, image, cv::COLOR_BGR2RGB);
-    image.convertTo(image_float, CV_32FC3, 1.0/255, 0);
-    cv::resize(image_float, image_float, cv::Size(64, 64));
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    buf.resize(st.st_size);
+    while (done < buf.size()) {
+        ssize_t n = read(fd, buf.data() + done, buf.size() - done);
+        if (n <= 0) {
+            close(fd);
+            return false;
+        }
+        done += n;
+    }
+    close(fd);
+    return true;
+}
 
-    auto tensor = torch::from_blob(image_float.data, {1, 64, 64, 3});
-    tensor = tensor.permute({0,3,1,2});
-    tensor[0][0] = tensor[0][0].sub_(0.485).div_(0.229);
-    tensor[0][1] = tensor[0][1].sub_(0.456).div_(0.224);
-    tensor[0][2] = tensor[0][2].sub_(0.406).div_(0.225);
-    
-    img_tensor.push_back(tensor);
+/*
+ * decode the image of every row into one preallocated [nrows, 3, 64, 64]
+ * tensor. The files are announced to the kernel first so their reads
+ * overlap, rows are decoded on the thread pool, resized while still uint8
+ * and then converted, channel-swapped and normalized in a single pass.
+ */
+bool ImageBatchPreProcess(std::vector<torch::jit::IValue>& img_tensor, Args** rows, int nrows)
+{
+    const int64_t size = DEFECT_IMAGE_SIZE;
+    const float mean[3] = {0.485f, 0.456f, 0.406f};
+    const float stdev[3] = {0.229f, 0.224f, 0.225f};
+    float scale[3];
+    float bias[3];
+
+    for (int c = 0; c < 3; c++) {
+        scale[c] = 1.0f / (255.0f * stdev[c]);
+        bias[c] = -mean[c] / stdev[c];
+    }
+
+#ifdef USE_POSIX_FADVISE
+    if (nrows > 1) {
+        for (int i = 0; i < nrows; i++) {
+            int fd = open((const char*)rows[i][0].ptr, O_RDONLY);
+            if (fd >= 0) {
+                (void) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+            }
+        }
+    }
+#endif
+
+    torch::Tensor batch = torch::empty({(long)nrows, 3, size, size}, torch::kFloat32);
+    float* out = batch.data_ptr<float>();
+
+    auto decode_row = [&](int i) {
+        thread_local std::vector<uchar> file_buf;
+        thread_local cv::Mat decoded;
+        thread_local cv::Mat resized;
+        const char* url = (const char*)rows[i][0].ptr;
+
+        if (!read_image_file(url, file_buf)) {
+            throw std::runtime_error(std::string("could not read image \"") + url + "\"");
+        }
+        cv::imdecode(cv::Mat(1, (int)file_buf.size(), CV_8UC1, file_buf.data()), cv::IMREAD_COLOR, &decoded);
+        if (decoded.empty()) {
+            throw std::runtime_error(std::string("could not decode image \"") + url + "\"");
+        }
+        cv::resize(decoded, resized, cv::Size(size, size));
+
+        // BGR interleaved uint8 -> RGB planar normalized float
+        float* plane = out + i * 3 * size * size;
+        for (int64_t y = 0; y < size; y++) {
+            const uchar* px = resized.ptr<uchar>(y);
+            for (int c = 0; c < 3; c++) {
+                float* dst = plane + c * size * size + y * size;
+                const uchar* src = px + (2 - c);
+                for (int64_t x = 0; x < size; x++) {
+                    dst[x] = src[x * 3] * scale[c] + bias[c];
+                }
+            }
+        }
+    };
+
+    if (nrows == 1) {
+        decode_row(0);
+    } else {
+        thread_pool_parallel_for(thread_pool_get(), nrows, decode_row);
+    }
+
+    img_tensor.push_back(batch);
     return true;
 }
 
+bool LoadFromImagePath(std::vector<torch::jit::IValue>& img_tensor, Args* args)
+{
+    try {
+        return ImageBatchPreProcess(img_tensor, &args, 1);
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+static const std::array<const char*, 6> defect_labels{
+    "A thick and thin place",
+    "Bad selvage",
+    "Ball",
+    "Broken ends or warp",
+    "Hole",
+    "Oil spot"
+};
+
 bool OutPutClassifyFloat(torch::jit::IValue& output_tensor, Args* args, float8& result)
 {
     auto tensor = output_tensor.toTensor().slice(1, 0, 6);
@@ -46,93 +153,131 @@ bool OutPutClassifyFloat(torch::jit::IValue& output_tensor, Args* args, float8&
 
 bool OutPutClassifyText(torch::jit::IValue& output_tensor, Args* args, std::string& result)
 {
-    std::array<const char*, 6> results{
-        "A thick and thin place",
-        "Bad selvage",
-        "Ball",
-        "Broken ends or warp",
-        "Hole",
-        "Oil spot"
-    };
-
     auto tensor = output_tensor.toTensor().slice(1, 0, 6);
     
     std::tuple<torch::Tensor,torch::Tensor> res = tensor.sort(1, true);
     torch::Tensor top_scores = std::get<1>(res);
 
     int index = top_scores[0][0].item<int>();    
-    result = results[index];
+    result = defect_labels[index];
 
     return true;
 }
 
-bool SST2PreProcess(std::vector<torch::jit::IValue>& input_tensor, Args* args)
+/* top score of the 6 defect classes for every row, one max over the batch */
+bool BatchOutPutClassifyFloat(torch::jit::IValue& output_tensor, Args** rows, int nrows, std::vector<float8>& results)
 {
-    char* text_a = NULL;
-    auto max_length = 128;
-    torch::DeviceType device_type;
+    auto scores = std::get<0>(output_tensor.toTensor().slice(1, 0, 6).max(1)).to(at::kCPU).to(at::kDouble).contiguous();
+    const double* data = scores.data_ptr<double>();
 
-    if (model_manager_get_device_type(&model_manager, "sst2", device_type)) {
-        ereport(NOTICE, (errmsg("failed to find device type for model sst2")));
-        return false;
+    results.assign(data, data + scores.numel());
+    return true;
+}
+
+bool BatchOutPutClassifyText(torch::jit::IValue& output_tensor, Args** rows, int nrows, std::vector<std::string>& results)
+{
+    auto indices = output_tensor.toTensor().slice(1, 0, 6).argmax(1).to(at::kCPU).contiguous();
+    const int64_t* data = indices.data_ptr<int64_t>();
+
+    for (int64_t i = 0; i < indices.numel(); i++) {
+        results.emplace_back(defect_labels[data[i]]);
     }
+    return true;
+}
 
-    text_a = (char*)args[0].ptr;
+/*
+ * sentencepiece processors by file path, loaded once per backend. Encode is
+ * const so the preprocessing threads share them.
+ */
+static std::mutex tokenizer_mutex;
+static std::unordered_map<std::string, std::unique_ptr<sentencepiece::SentencePieceProcessor>> tokenizers;
+
+static const sentencepiece::SentencePieceProcessor*
+get_tokenizer(const char* file_name)
+{
+    // same as replace_model_path("{model_path}/...") but without palloc, may run on a pool thread
+    std::string path = std::string(pkglib_path) + "/../model/" + file_name;
+    std::lock_guard<std::mutex> lock(tokenizer_mutex);
 
-    // load spiece model
-    sentencepiece::SentencePieceProcessor process;
+    auto it = tokenizers.find(path);
+    if (it != tokenizers.end()) {
+        return it->second.get();
+    }
+
+    std::unique_ptr<sentencepiece::SentencePieceProcessor> process(new sentencepiece::SentencePieceProcessor());
+    if (!process->Load(path).ok()) {
+        return nullptr;
+    }
+    return (tokenizers[path] = std::move(process)).get();
+}
 
-    if (!process.Load(replace_model_path("{model_path}/spiece.model")).ok()){
+/*
+ * tokenize the text of every row straight into pre-padded [nrows, 128]
+ * token_ids, attention_mask and token_type_ids, plus the position_ids
+ */
+bool SST2BatchPreProcess(std::vector<torch::jit::IValue>& input_tensor, Args** rows, int nrows)
+{
+    const int64_t max_length = 128;
+    const sentencepiece::SentencePieceProcessor* process = get_tokenizer("spiece.model");
+
+    if (process == nullptr) {
         return false;
     }
 
+    const long cls_id = process->PieceToId("[CLS]");
+    const long sep_id = process->PieceToId("[SEP]");
+    const long pad_id = process->PieceToId("<pad>");
+
     auto opts_data = torch::TensorOptions().dtype(torch::kLong);
-    std::vector<int> tis_int_a;
-    process.Encode(text_a, &tis_int_a);
-
-    const std::string cls_token = "[CLS]";
-    const std::string sep_token = "[SEP]";
-    const std::string pad_token = "<pad>";
-
-    // add abnormal token
-    tis_int_a.insert(tis_int_a.begin(), process.PieceToId(cls_token));
-    tis_int_a.push_back(process.PieceToId(sep_token));
-
-    // Splice the sentenpiece
-    std::vector<long> tis;
-    tis.reserve(tis_int_a.size());
-    tis.insert(tis.end(), tis_int_a.begin(), tis_int_a.end());
-    tis.resize(max_length, process.PieceToId(pad_token));
-
-    // create attention_mask, token_type_ids, and position_ids
-    std::vector<long> am(tis_int_a.size(), 1);
-    am.resize(max_length, 0);
-    std::vector<long> ttis(tis_int_a.size(), 0);
-    ttis.resize(max_length, 1);
-
-
-    torch::Tensor token_ids =
-        torch::from_blob(tis.data(), {(long)max_length}, opts_data).clone();
-    torch::Tensor attention_mask =
-        torch::from_blob(am.data(), {(long)max_length}, opts_data).clone();
-    torch::Tensor token_type_ids =
-        torch::from_blob(ttis.data(), {(long)max_length}, opts_data).clone();
-    torch::Tensor position_ids = torch::arange(0, (long)max_length, opts_data);
-
-    //std::vector<torch::IValue> inputs;
-    token_ids = torch::unsqueeze(token_ids, 0);
-    attention_mask = torch::unsqueeze(attention_mask, 0);
-    token_type_ids = torch::unsqueeze(token_type_ids, 0);
-    position_ids = torch::unsqueeze(position_ids, 0);
-
-    input_tensor.push_back(token_ids.to(device_type));
-    input_tensor.push_back(attention_mask.to(device_type));
-    input_tensor.push_back(token_type_ids.to(device_type));
-    input_tensor.push_back(position_ids.to(device_type));
+    torch::Tensor token_ids = torch::full({(long)nrows, max_length}, pad_id, opts_data);
+    torch::Tensor attention_mask = torch::zeros({(long)nrows, max_length}, opts_data);
+    torch::Tensor token_type_ids = torch::ones({(long)nrows, max_length}, opts_data);
+    torch::Tensor position_ids = torch::arange(0, max_length, opts_data).unsqueeze(0).expand({(long)nrows, max_length}).contiguous();
+
+    long* tis = token_ids.data_ptr<long>();
+    long* am = attention_mask.data_ptr<long>();
+    long* ttis = token_type_ids.data_ptr<long>();
+
+    auto encode_row = [&](int i) {
+        std::vector<int> pieces;
+        long* row_tis = tis + i * max_length;
+        int64_t len = 0;
+
+        process->Encode((const char*)rows[i][0].ptr, &pieces);
+
+        // [CLS] pieces [SEP], cut to max_length like the resize of the row-wise version
+        row_tis[len++] = cls_id;
+        for (size_t j = 0; j < pieces.size() && len < max_length; j++) {
+            row_tis[len++] = pieces[j];
+        }
+        if (len < max_length) {
+            row_tis[len++] = sep_id;
+        }
+        for (int64_t j = 0; j < len; j++) {
+            am[i * max_length + j] = 1;
+            ttis[i * max_length + j] = 0;
+        }
+    };
+
+    if (nrows == 1) {
+        encode_row(0);
+    } else {
+        thread_pool_parallel_for(thread_pool_get(), nrows, encode_row);
+    }
+
+    input_tensor.push_back(token_ids);
+    input_tensor.push_back(attention_mask);
+    input_tensor.push_back(token_type_ids);
+    input_tensor.push_back(position_ids);
 
     return true;
 }
 
+bool SST2PreProcess(std::vector<torch::jit::IValue>& input_tensor, Args* args)
+{
+    return SST2BatchPreProcess(input_tensor, &args, 1);
+}
+
 bool SST2OutputProcessFloat(torch::jit::IValue& outputs, Args* args, float8& result)
 {
     auto tensor = outputs.toTuple()->elements()[0].toTensor();
@@ -156,17 +301,56 @@ bool SST2OutputProcessText(torch::jit::IValue& outputs, Args* args, std::string&
     return true;
 }
 
+/* argmax of the logits of the whole batch, walked once */
+static torch::Tensor
+sst2_batch_labels(torch::jit::IValue& outputs)
+{
+    return outputs.toTuple()->elements()[0].toTensor().argmax(1).to(at::kCPU).contiguous();
+}
+
+bool SST2BatchOutputProcessFloat(torch::jit::IValue& outputs, Args** rows, int nrows, std::vector<float8>& results)
+{
+    auto labels = sst2_batch_labels(outputs);
+    const int64_t* data = labels.data_ptr<int64_t>();
+
+    results.assign(data, data + labels.numel());
+    return true;
+}
+
+bool SST2BatchOutputProcessText(torch::jit::IValue& outputs, Args** rows, int nrows, std::vector<std::string>& results)
+{
+    auto labels = sst2_batch_labels(outputs);
+    const int64_t* data = labels.data_ptr<int64_t>();
+
+    for (int64_t i = 0; i < labels.numel(); i++) {
+        if (data[i] == 0) {
+            results.emplace_back("消极情绪");
+        } else if (data[i] == 1) {
+            results.emplace_back("积极情绪");
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
 extern "C" {
 
 void register_default_model()
 {
     model_manager_register_pre_process(&model_manager, "defect", LoadFromImagePath);
+    model_manager_register_batch_pre_process(&model_manager, "defect", ImageBatchPreProcess);
     model_manager_register_output_process_float(&model_manager, "defect", OutPutClassifyFloat);
     model_manager_register_output_process_text(&model_manager, "defect", OutPutClassifyText);
+    model_manager_register_batch_output_process_float(&model_manager, "defect", BatchOutPutClassifyFloat);
+    model_manager_register_batch_output_process_text(&model_manager, "defect", BatchOutPutClassifyText);
     
     model_manager_register_pre_process(&model_manager, "sst2", SST2PreProcess);
+    model_manager_register_batch_pre_process(&model_manager, "sst2", SST2BatchPreProcess);
     model_manager_register_output_process_float(&model_manager, "sst2", SST2OutputProcessFloat);
     model_manager_register_output_process_text(&model_manager, "sst2", SST2OutputProcessText);
+    model_manager_register_batch_output_process_float(&model_manager, "sst2", SST2BatchOutputProcessFloat);
+    model_manager_register_batch_output_process_text(&model_manager, "sst2", SST2BatchOutputProcessText);
 }
 
 }
\ No newline at end of file
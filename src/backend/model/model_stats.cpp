@@ -0,0 +1,344 @@
+/*
+ * model_stats.cpp
+ *
+ * pg_stat_model. Each prediction takes ModelStatsLock shared, finds the
+ * entry of its model and adds to the counters under the entry spinlock, the
+ * way pg_stat_statements does, so concurrent backends only contend on the
+ * same model and only for a few instructions. The lock is taken exclusive
+ * to create an entry and by pg_stat_reset_model. When model_stats_max
+ * models are tracked new ones are not counted until the next reset.
+ */
+extern "C" {
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type_d.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "model/model_stats.h"
+#include "port/pg_bitutils.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+bool track_model_stats = true;
+int model_stats_max = 1000;
+
+typedef struct ModelStatsKey {
+    Oid     dbid;
+    char    model[NAMEDATALEN];
+} ModelStatsKey;
+
+typedef struct ModelStatsCounters {
+    int64   calls;          /* forward passes, one per call or batch */
+    int64   batches;
+    int64   rows;
+    int64   errors;
+    int64   loads;
+    int64   load_us;
+    int64   resident_bytes; /* of the last load */
+    int64   stage_us[MODEL_STATS_NSTAGES];
+    int64   hist[MODEL_STATS_NSTAGES][MODEL_STATS_HIST_BUCKETS];
+} ModelStatsCounters;
+
+typedef struct ModelStatsEntry {
+    ModelStatsKey       key;
+    slock_t             mutex;
+    ModelStatsCounters  counters;
+} ModelStatsEntry;
+
+typedef struct ModelStatsCtl {
+    TimestampTz         stats_reset;
+} ModelStatsCtl;
+
+static ModelStatsCtl* stats_ctl = NULL;
+static HTAB* stats_hash = NULL;
+
+/* the prediction between model_stats_begin and model_stats_report */
+static char in_flight[NAMEDATALEN];
+static bool callbacks_registered = false;
+
+Size
+ModelStatsShmemSize(void)
+{
+    Size size = MAXALIGN(sizeof(ModelStatsCtl));
+    size = add_size(size, hash_estimate_size(model_stats_max, sizeof(ModelStatsEntry)));
+    return size;
+}
+
+void
+ModelStatsShmemInit(void)
+{
+    HASHCTL     info;
+    bool        found;
+
+    stats_ctl = (ModelStatsCtl*)ShmemInitStruct("Model Stats Ctl", sizeof(ModelStatsCtl), &found);
+    if(!found){
+        stats_ctl->stats_reset = GetCurrentTimestamp();
+    }
+
+    MemSet(&info, 0, sizeof(info));
+    info.keysize = sizeof(ModelStatsKey);
+    info.entrysize = sizeof(ModelStatsEntry);
+    stats_hash = ShmemInitHash("Model Stats", model_stats_max, model_stats_max,
+                               &info, HASH_ELEM | HASH_BLOBS);
+}
+
+static int
+hist_bucket(int64 us)
+{
+    if(us < 2){
+        return 0;
+    }
+    return Min(pg_leftmost_one_pos64((uint64) us), MODEL_STATS_HIST_BUCKETS - 1);
+}
+
+/*
+ * the entry of model_name with its spinlock held, created if there is room.
+ * NULL if the model is not counted. Callers only add to the counters and
+ * hand the entry to model_stats_unlock.
+ */
+static ModelStatsEntry*
+model_stats_lock(const char* model_name)
+{
+    ModelStatsKey       key;
+    ModelStatsEntry*    entry;
+
+    if(!track_model_stats || stats_hash == NULL || model_name == NULL){
+        return NULL;
+    }
+
+    MemSet(&key, 0, sizeof(key));
+    key.dbid = MyDatabaseId;
+    strlcpy(key.model, model_name, NAMEDATALEN);
+
+    LWLockAcquire(ModelStatsLock, LW_SHARED);
+    entry = (ModelStatsEntry*)hash_search(stats_hash, &key, HASH_FIND, NULL);
+    if(entry == NULL){
+        bool found;
+
+        LWLockRelease(ModelStatsLock);
+        LWLockAcquire(ModelStatsLock, LW_EXCLUSIVE);
+        entry = (ModelStatsEntry*)hash_search(stats_hash, &key, HASH_ENTER_NULL, &found);
+        if(entry == NULL){
+            LWLockRelease(ModelStatsLock);
+            return NULL;
+        }
+        if(!found){
+            SpinLockInit(&entry->mutex);
+            MemSet(&entry->counters, 0, sizeof(entry->counters));
+        }
+    }
+
+    SpinLockAcquire(&entry->mutex);
+    return entry;
+}
+
+static void
+model_stats_unlock(ModelStatsEntry* entry)
+{
+    SpinLockRelease(&entry->mutex);
+    LWLockRelease(ModelStatsLock);
+}
+
+static void
+model_stats_abort(void)
+{
+    ModelStatsEntry* entry;
+
+    if(in_flight[0] == '\0'){
+        return;
+    }
+    entry = model_stats_lock(in_flight);
+    in_flight[0] = '\0';
+    if(entry != NULL){
+        entry->counters.errors++;
+        model_stats_unlock(entry);
+    }
+}
+
+static void
+model_stats_xact_callback(XactEvent event, void* arg)
+{
+    if(event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT){
+        model_stats_abort();
+    }
+}
+
+static void
+model_stats_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                             SubTransactionId parentSubid, void* arg)
+{
+    if(event == SUBXACT_EVENT_ABORT_SUB){
+        model_stats_abort();
+    }
+}
+
+void
+model_stats_begin(const char* model_name)
+{
+    if(!track_model_stats){
+        return;
+    }
+    if(!callbacks_registered){
+        RegisterXactCallback(model_stats_xact_callback, NULL);
+        RegisterSubXactCallback(model_stats_subxact_callback, NULL);
+        callbacks_registered = true;
+    }
+    strlcpy(in_flight, model_name, NAMEDATALEN);
+}
+
+void
+model_stats_report(const char* model_name, int64 rows, bool batch,
+                   const int64 stage_us[MODEL_STATS_NSTAGES])
+{
+    ModelStatsEntry* entry;
+
+    in_flight[0] = '\0';
+    entry = model_stats_lock(model_name);
+    if(entry == NULL){
+        return;
+    }
+    entry->counters.calls++;
+    entry->counters.batches += batch ? 1 : 0;
+    entry->counters.rows += rows;
+    for(int i = 0; i < MODEL_STATS_NSTAGES; i++){
+        entry->counters.stage_us[i] += stage_us[i];
+        entry->counters.hist[i][hist_bucket(stage_us[i])]++;
+    }
+    model_stats_unlock(entry);
+}
+
+void
+model_stats_report_load(const char* model_name, int64 load_us, int64 resident_bytes)
+{
+    ModelStatsEntry* entry = model_stats_lock(model_name);
+
+    if(entry == NULL){
+        return;
+    }
+    entry->counters.loads++;
+    entry->counters.load_us += load_us;
+    entry->counters.resident_bytes = resident_bytes;
+    model_stats_unlock(entry);
+}
+
+static Datum
+hist_array(const int64* hist)
+{
+    Datum elems[MODEL_STATS_HIST_BUCKETS];
+
+    for(int i = 0; i < MODEL_STATS_HIST_BUCKETS; i++){
+        elems[i] = Int64GetDatum(hist[i]);
+    }
+    return PointerGetDatum(construct_array(elems, MODEL_STATS_HIST_BUCKETS, INT8OID,
+                                           sizeof(int64), FLOAT8PASSBYVAL, 'd'));
+}
+
+/*
+ * pg_stat_model view: one row per model of every database
+ */
+Datum
+pg_stat_get_model(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_MODEL_COLS 16
+    ReturnSetInfo*      rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc           tupdesc;
+    Tuplestorestate*    tupstore;
+    MemoryContext       per_query_ctx;
+    MemoryContext       oldcontext;
+    HASH_SEQ_STATUS     status;
+    ModelStatsEntry*    entry;
+    TimestampTz         stats_reset;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("materialize mode required, but it is not allowed in this context")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+
+    if(stats_hash == NULL){
+        MemoryContextSwitchTo(oldcontext);
+        return (Datum) 0;
+    }
+
+    LWLockAcquire(ModelStatsLock, LW_SHARED);
+    stats_reset = stats_ctl->stats_reset;
+    hash_seq_init(&status, stats_hash);
+    while((entry = (ModelStatsEntry*)hash_seq_search(&status)) != NULL){
+        Datum               values[PG_STAT_GET_MODEL_COLS];
+        bool                nulls[PG_STAT_GET_MODEL_COLS];
+        ModelStatsCounters  c;
+        int                 col = 0;
+
+        SpinLockAcquire(&entry->mutex);
+        c = entry->counters;
+        SpinLockRelease(&entry->mutex);
+
+        MemSet(nulls, false, sizeof(nulls));
+        values[col++] = ObjectIdGetDatum(entry->key.dbid);
+        values[col++] = CStringGetTextDatum(entry->key.model);
+        values[col++] = Int64GetDatum(c.calls);
+        values[col++] = Int64GetDatum(c.batches);
+        values[col++] = Int64GetDatum(c.rows);
+        for(int i = 0; i < MODEL_STATS_NSTAGES; i++){
+            values[col++] = Float8GetDatum(c.stage_us[i] / 1000.0);
+        }
+        for(int i = 0; i < MODEL_STATS_NSTAGES; i++){
+            values[col++] = hist_array(c.hist[i]);
+        }
+        values[col++] = Int64GetDatum(c.loads);
+        values[col++] = Float8GetDatum(c.load_us / 1000.0);
+        values[col++] = Int64GetDatum(c.resident_bytes);
+        values[col++] = Int64GetDatum(c.errors);
+        values[col++] = TimestampTzGetDatum(stats_reset);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    LWLockRelease(ModelStatsLock);
+
+    MemoryContextSwitchTo(oldcontext);
+    return (Datum) 0;
+}
+
+Datum
+pg_stat_reset_model(PG_FUNCTION_ARGS)
+{
+    HASH_SEQ_STATUS     status;
+    ModelStatsEntry*    entry;
+
+    if(stats_hash == NULL){
+        PG_RETURN_VOID();
+    }
+
+    LWLockAcquire(ModelStatsLock, LW_EXCLUSIVE);
+    hash_seq_init(&status, stats_hash);
+    while((entry = (ModelStatsEntry*)hash_seq_search(&status)) != NULL){
+        hash_search(stats_hash, &entry->key, HASH_REMOVE, NULL);
+    }
+    stats_ctl->stats_reset = GetCurrentTimestamp();
+    LWLockRelease(ModelStatsLock);
+
+    PG_RETURN_VOID();
+}
+
+}
@@ -7,12 +7,14 @@
  * @Description: 这是默认设置,请设置`customMade`, 打开koroFileHeader查看配置 进行设置: https://github.com/OBKoro1/koro1FileHeader/wiki/%E9%85%8D%E7%BD%AE
  */
 #include "model/model_manager.h"
+#include "model/model_stats.h"
 #include "model/predict_wrapper.h"
+#include "model/thread_pool.h"
 #include "utils/vector_tensor.h"
 
 #ifdef __cplusplus
+#include <algorithm>
 #include <sstream>
-#include <thread>
 #include <vector>
 #include "ATen/core/TensorBody.h"
 
@@ -20,10 +22,16 @@ extern "C" {
 #endif
 #include "postgres.h"
 
+#include "catalog/model_layer_info.h"
 #include "catalog/pg_type_d.h"
+#include "executor/instrument.h"
 #include "fmgr.h"
+#include "miscadmin.h"
 #include "port.h"
 #include "utils/builtins.h"
+#include "utils/float.h"
+#include "utils/inval.h"
+#include "utils/syscache.h"
 
 extern ModelManager model_manager;
 
@@ -95,11 +103,193 @@ makeVecFromArgs(FunctionCallInfo fcinfo, int start, int dim)
 }
 
 static bool
-wait_and_check_error(std::vector<std::thread> &pool, std::vector<int> &res, int parallel_num)
+is_numeric_arg_type(Oid type)
+{
+    switch (type) {
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case FLOAT4OID:
+        case FLOAT8OID:
+        case NUMERICOID:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * decide whether the batch can be kept as a plain float matrix: every
+ * argument is numeric and the model has no preprocess callback that wants
+ * Args. types are copied to state->ctx.
+ */
+void
+initVecAggTypes(VecAggState *state, const Oid *types, int ntypes)
+{
+    char* model_path = nullptr;
+    char* base_model = nullptr;
+
+    state->columnar = false;
+    state->feature_dim = ntypes;
+    state->feature_types = (Oid*) MemoryContextAlloc(state->ctx, sizeof(Oid) * Max(ntypes, 1));
+    memcpy(state->feature_types, types, sizeof(Oid) * ntypes);
+
+    if (ntypes == 0)
+        return;
+    for (int i = 0; i < ntypes; i++) {
+        if (!is_numeric_arg_type(types[i]))
+            return;
+    }
+    if (strlen(state->model) == 0 ||
+        !model_manager_get_model_path(&model_manager, state->model, &model_path, &base_model))
+        return;
+    if (model_manager.module_preprocess_functions_.find(model_path) != model_manager.module_preprocess_functions_.end() ||
+        model_manager.module_batch_preprocess_functions_.find(model_path) != model_manager.module_batch_preprocess_functions_.end())
+        return;
+
+    state->columnar = true;
+}
+
+/* initVecAggTypes for the argument types of the aggregate call, on its first row */
+void
+initVecAggColumnar(VecAggState *state, FunctionCallInfo fcinfo, int start)
+{
+    int     ntypes = Max(PG_NARGS() - start, 0);
+    Oid*    types = (Oid*) palloc(sizeof(Oid) * Max(ntypes, 1));
+
+    for (int i = 0; i < ntypes; i++)
+        types[i] = get_fn_expr_argtype(fcinfo->flinfo, start + i);
+    initVecAggTypes(state, types, ntypes);
+    pfree(types);
+}
+
+/* room for one more row in the feature matrix */
+static float*
+next_feature_row(VecAggState *state)
+{
+    if (state->feature_rows == state->feature_capacity) {
+        int64 capacity = Max(state->feature_capacity * 2, VEC_AGG_INITIAL_ROWS);
+        Size size = (Size) capacity * state->feature_dim * sizeof(float);
+
+        if (state->features == NULL)
+            state->features = (float*) MemoryContextAllocHuge(state->ctx, size);
+        else
+            state->features = (float*) repalloc_huge(state->features, size);
+        state->feature_capacity = capacity;
+    }
+
+    return state->features + state->feature_rows++ * state->feature_dim;
+}
+
+static float
+datum_to_feature(Datum value, Oid type)
+{
+    switch (type) {
+        case INT2OID:
+            return (float) DatumGetInt16(value);
+        case INT4OID:
+            return (float) DatumGetInt32(value);
+        case INT8OID:
+            return (float) DatumGetInt64(value);
+        case FLOAT4OID:
+            return DatumGetFloat4(value);
+        case FLOAT8OID:
+            return (float) DatumGetFloat8(value);
+        case NUMERICOID:
+            return (float) DatumGetFloat8(DirectFunctionCall1(numeric_float8, value));
+        default:
+            return get_float4_nan();
+    }
+}
+
+/* append the arguments of one row to the feature matrix, NULL becomes NaN */
+void
+appendVecAggFeatures(VecAggState *state, FunctionCallInfo fcinfo, int start)
+{
+    float* row = next_feature_row(state);
+
+    for (int i = 0; i < state->feature_dim; i++) {
+        int arg = start + i;
+
+        if (PG_ARGISNULL(arg))
+            row[i] = get_float4_nan();
+        else
+            row[i] = datum_to_feature(PG_GETARG_DATUM(arg), state->feature_types[i]);
+    }
+}
+
+/*
+ * append one row given as datums of the types passed to initVecAggTypes,
+ * either to the feature matrix or as Args to state->ins.
+ */
+void
+appendVecAggRow(VecAggState *state, const Datum *values, const bool *isnull)
+{
+    Args* vec;
+
+    if (state->columnar) {
+        float* row = next_feature_row(state);
+
+        for (int i = 0; i < state->feature_dim; i++)
+            row[i] = isnull[i] ? get_float4_nan() : datum_to_feature(values[i], state->feature_types[i]);
+        return;
+    }
+
+    vec = (Args*) palloc0(sizeof(Args) * Max(state->feature_dim, 1));
+    for (int i = 0; i < state->feature_dim; i++) {
+        if (isnull[i])
+            continue;
+        switch (state->feature_types[i]) {
+            case INT2OID:
+                vec[i].integer = DatumGetInt16(values[i]);
+                break;
+            case INT4OID:
+                vec[i].integer = DatumGetInt32(values[i]);
+                break;
+            case INT8OID:
+                vec[i].integer = (int) DatumGetInt64(values[i]);
+                break;
+            case FLOAT4OID:
+                vec[i].floating = DatumGetFloat4(values[i]);
+                break;
+            case FLOAT8OID:
+                vec[i].floating = DatumGetFloat8(values[i]);
+                break;
+            case TEXTOID:
+                vec[i].ptr = TextDatumGetCString(values[i]);
+                break;
+            case CSTRINGOID:
+                vec[i].ptr = pstrdup(DatumGetCString(values[i]));
+                break;
+            case NUMERICOID:
+                vec[i].floating = DatumGetFloat8(DirectFunctionCall1(numeric_float8, values[i]));
+                break;
+            default:
+                ereport(ERROR, (errmsg("%d type don't support!", state->feature_types[i])));
+                break;
+        }
+    }
+    state->ins = lappend(state->ins, vec);
+}
+
+/*
+ * run task for every row on the backend's thread pool. Returns true if a row
+ * failed, *detail is the message of an exception thrown by task if any.
+ */
+static bool
+wait_and_check_error(std::vector<int> &res, int parallel_num, const std::function<void(int)> &task, char **detail)
 {
     bool has_error = false;
-    for (auto &t : pool)
-            t.join();
+
+    *detail = NULL;
+    std::fill(res.begin(), res.end(), 0);
+    try {
+        thread_pool_parallel_for(thread_pool_get(), parallel_num, task);
+    }
+    catch (const std::exception& e) {
+        *detail = pstrdup(e.what());
+        return true;
+    }
 
     for (int i = 0; i < parallel_num; i++)
     {
@@ -110,8 +300,6 @@ wait_and_check_error(std::vector<std::thread> &pool, std::vector<int> &res, int
             }
     }
 
-    pool.clear();
-    res.clear();
     return has_error;
 }
 
@@ -122,11 +310,12 @@ input_batch_tensor.clear(); \
 output.~IValue();    \
 outputs.clear()
 
-#define WAIT_AND_CHECK_ERROR(stage)                            \
-if (wait_and_check_error(pool, res, prcsd_batch_n))            \
-{                                                              \
-    CLEAN_UP_CPP_OBJS();                                        \
-    ereport(ERROR, (errmsg("meet error in " stage " stage"))); \
+#define WAIT_AND_CHECK_ERROR(stage, task)                                \
+if (wait_and_check_error(res, prcsd_batch_n, task, &error_detail))       \
+{                                                                        \
+    CLEAN_UP_CPP_OBJS();                                                  \
+    ereport(ERROR, (errmsg("meet error in " stage " stage"),             \
+                    error_detail ? errdetail("%s", error_detail) : 0));  \
 }
 
 #define CLOCK_START() auto start = std::chrono::system_clock::now()
@@ -178,13 +367,137 @@ split_results(torch::jit::IValue output) {
     return ret;
 }
 
+/* a forward pass finished: count it for EXPLAIN (ANALYZE, MODEL) and pg_stat_model */
+static void
+report_prediction(const char* model_name, int64 rows, bool batch, const int64 stage_us[MODEL_STATS_NSTAGES])
+{
+    InstrCountPrediction(model_name, rows, stage_us[MODEL_STATS_PRE],
+                         stage_us[MODEL_STATS_INFER], stage_us[MODEL_STATS_POST]);
+    model_stats_report(model_name, rows, batch, stage_us);
+}
+
+/* load the model of model_path, a load that is not a cache hit counts in pg_stat_model */
+static bool
+load_model_counted(const char* stats_name, const char* model_path, const char* model_name = NULL, const char* base_model = NULL)
+{
+    bool    resident = model_manager.module_handle_.count(model_path) > 0 ||
+                       model_manager.module_engine_.count(model_path) > 0;
+    auto    start = std::chrono::steady_clock::now();
+
+    if(!model_manager_load_model(&model_manager, model_path, model_name, base_model)){
+        return false;
+    }
+    if(!resident){
+        model_stats_report_load(stats_name,
+                                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count(),
+                                model_manager_module_bytes(&model_manager, model_path));
+    }
+    return true;
+}
+
+static bool
+has_pre_process_callback(const char* model_path)
+{
+    return model_manager.module_preprocess_functions_.count(model_path) > 0 ||
+           model_manager.module_batch_preprocess_functions_.count(model_path) > 0;
+}
+
+static bool
+has_output_process_callback(const char* model_path, bool ret_float8)
+{
+    return ret_float8 ? model_manager.module_outputprocess_functions_float_.count(model_path) > 0 ||
+                        model_manager.module_batch_outputprocess_functions_float_.count(model_path) > 0
+                      : model_manager.module_outputprocess_functions_text_.count(model_path) > 0 ||
+                        model_manager.module_batch_outputprocess_functions_text_.count(model_path) > 0;
+}
+
+/*
+ * the result of nrows rows of a model without an output callback, the same
+ * in the batch and the row-wise path: per row the best score as float, its
+ * index as text. False if output is not a tensor of nrows rows.
+ */
+static bool
+default_output(const torch::jit::IValue& output, int nrows, bool ret_float8,
+               std::vector<float8>& float_results, std::vector<std::string>& text_results)
+{
+    if (!output.isTensor())
+        return false;
+
+    const at::Tensor& tensor = output.toTensor();
+    if (tensor.dim() == 0 || tensor.numel() == 0 || (nrows > 1 && tensor.size(0) != nrows))
+        return false;
+
+    auto best = tensor.to(at::kCPU).to(at::kDouble).reshape({(int64_t) nrows, -1}).max(1);
+    if (ret_float8) {
+        auto values = std::get<0>(best).contiguous();
+        const double* value_data = values.data_ptr<double>();
+        float_results.assign(value_data, value_data + nrows);
+    } else {
+        auto indices = std::get<1>(best).contiguous();
+        const int64_t* index_data = indices.data_ptr<int64_t>();
+        for (int i = 0; i < nrows; i++)
+            text_results.push_back(std::to_string(index_data[i]));
+    }
+    return true;
+}
+
+/*
+ * the result of a row scored by an engine: the best score as float, as text
+ * the best class, the class of a binary classifier or the value of a
+ * regression
+ */
+static void
+engine_result(ModelEngine* engine, const float8* scores, bool ret_float8, Args* out)
+{
+    int nout = engine->num_outputs();
+    int best = 0;
+
+    for (int i = 1; i < nout; i++) {
+        if (scores[i] > scores[best])
+            best = i;
+    }
+    if (ret_float8)
+        out->floating = scores[best];
+    else if (nout > 1)
+        out->ptr = psprintf("%d", best);
+    else if (engine->classifier())
+        out->ptr = pstrdup(scores[0] >= 0.5 ? "1" : "0");
+    else
+        out->ptr = float8out_internal(scores[0]);
+}
+
+/* a columnar batch of a model served by an engine, scored from the feature matrix */
+static void
+infer_batch_engine(VecAggState *state, ModelEngine* engine, bool ret_float8, int prcsd_batch_n)
+{
+    std::vector<float8> scores((size_t) prcsd_batch_n * engine->num_outputs());
+
+    {
+        CLOCK_START();
+        model_manager_engine_predict(engine, state->features, prcsd_batch_n, state->feature_dim, scores.data());
+        CLOCK_END(infer);
+    }
+    {
+        CLOCK_START();
+        state->out_rows = (Args*) palloc0(sizeof(Args) * Max(prcsd_batch_n, 1));
+        for (int i = 0; i < prcsd_batch_n; i++)
+            engine_result(engine, &scores[(size_t) i * engine->num_outputs()], ret_float8, &state->out_rows[i]);
+        CLOCK_END(post);
+    }
+}
 
 void
 infer_batch_internal(VecAggState *state, bool ret_float8)
 {
     char* model_path = nullptr;
     char* base_model = nullptr;
-    int prcsd_batch_n = state->ins->length;
+    int prcsd_batch_n = VecAggStateRows(state);
+    int64 stage_us[MODEL_STATS_NSTAGES] = {-state->pre_time, -state->infer_time, -state->post_time};
+
+    if (state->out_rows != nullptr) {
+        pfree(state->out_rows);
+        state->out_rows = nullptr;
+    }
     
     if(strlen(state->model) == 0){
         ereport(ERROR, (errmsg("model name is empty!")));
@@ -193,9 +506,10 @@ infer_batch_internal(VecAggState *state, bool ret_float8)
     if(!model_manager_get_model_path(&model_manager, state->model, &model_path, &base_model)){
         ereport(ERROR, (errmsg("model not exist,can't get path!")));
     }
+    model_stats_begin(state->model);
 
     // 1. 加载模型
-    if(!model_manager_load_model(&model_manager, model_path)){
+    if(!load_model_counted(state->model, model_path)){
         ereport(ERROR, (errmsg("load model error")));
     }
     
@@ -203,26 +517,80 @@ infer_batch_internal(VecAggState *state, bool ret_float8)
     if(pg_strcasecmp(state->cuda, "gpu") == 0 && 
        model_manager_set_cuda(&model_manager, model_path)){
     }
+
+    // 树模型等由引擎直接对特征矩阵打分，不构造tensor
+    ModelEngine* engine = model_manager_get_engine(&model_manager, model_path);
+    if (engine != nullptr && state->columnar && !has_output_process_callback(model_path, ret_float8))
+    {
+        infer_batch_engine(state, engine, ret_float8, prcsd_batch_n);
+
+        state->prcsd_batch_n = prcsd_batch_n;
+        state->batch_i++;
+        stage_us[MODEL_STATS_PRE] += state->pre_time;
+        stage_us[MODEL_STATS_INFER] += state->infer_time;
+        stage_us[MODEL_STATS_POST] += state->post_time;
+        report_prediction(state->model, prcsd_batch_n, true, stage_us);
+        return;
+    }
  
-    std::vector<std::thread> pool;
     std::vector<int> res(prcsd_batch_n, 0);
-    std::vector<std::vector<torch::jit::IValue>> input_tensors(prcsd_batch_n, std::vector<torch::jit::IValue>());
+    char* error_detail = nullptr;
+    std::vector<std::vector<torch::jit::IValue>> input_tensors(state->columnar ? 0 : prcsd_batch_n, std::vector<torch::jit::IValue>());
     //std::vector<std::vector<at::Tensor>> batch_inputs_tmp;
     std::vector<torch::jit::IValue> input_batch_tensor;
     torch::jit::IValue output;
     std::vector<torch::jit::IValue> outputs; // batch of tuples<tensor|list|tuple> or tensors
 
     // 3. 输入预处理
+    if (state->columnar)
     {
         CLOCK_START();
 
-        for (int i = 0; i < prcsd_batch_n; i++) {
-            pool.emplace_back([&, i](){
-                Args* in = (Args*)list_nth(state->ins, i);
-                res[i] = model_manager_pre_process(&model_manager, model_path, input_tensors[i], in);
-            });
+        // 数值特征已经按行连续存放，直接包装为batch输入，不逐行构造tensor也不concat
+        torch::DeviceType device_type = at::kCPU;
+        model_manager_get_device_type(&model_manager, model_path, device_type);
+        input_batch_tensor.emplace_back(
+            torch::from_blob(state->features, {(int64_t) prcsd_batch_n, (int64_t) state->feature_dim}, torch::kFloat32).to(device_type));
+
+        CLOCK_END(pre);
+    }
+    else if (model_manager_has_batch_pre_process(&model_manager, model_path))
+    {
+        CLOCK_START();
+
+        // 整个batch一次预处理，直接得到batch输入，不需要逐行concat
+        std::vector<Args*> rows;
+        ListCell* lc;
+
+        rows.reserve(prcsd_batch_n);
+        foreach(lc, state->ins)
+            rows.push_back((Args*)lfirst(lc));
+        input_tensors.clear();
+
+        bool ok = false;
+        try {
+            ok = model_manager_batch_pre_process(&model_manager, model_path, input_batch_tensor, rows.data(), prcsd_batch_n);
+        } catch (const std::exception& e) {
+            error_detail = pstrdup(e.what());
         }
-        WAIT_AND_CHECK_ERROR("preprocess");
+        if (!ok) {
+            std::vector<Args*>().swap(rows);
+            CLEAN_UP_CPP_OBJS();
+            ereport(ERROR, (errmsg("meet error in preprocess stage"),
+                            error_detail ? errdetail("%s", error_detail) : 0));
+        }
+
+        CLOCK_END(pre);
+    }
+    else
+    {
+        CLOCK_START();
+
+        auto pre_task = [&](int i){
+            Args* in = (Args*)list_nth(state->ins, i);
+            res[i] = model_manager_pre_process(&model_manager, model_path, input_tensors[i], in);
+        };
+        WAIT_AND_CHECK_ERROR("preprocess", pre_task);
 
         CLOCK_END(pre);
     }
@@ -232,7 +600,8 @@ infer_batch_internal(VecAggState *state, bool ret_float8)
         CLOCK_START();
 
         int each_input_tensor_size = (input_tensors.size() != 0 ? input_tensors[0].size() : 0);
-        input_batch_tensor.resize(each_input_tensor_size);
+        if (each_input_tensor_size > 0)
+            input_batch_tensor.resize(each_input_tensor_size);
         for(int i = 0; i < each_input_tensor_size; ++i) {
             std::vector<at::Tensor> col_tensors(prcsd_batch_n);
             for(int j = 0; j < prcsd_batch_n; ++j){
@@ -251,33 +620,154 @@ infer_batch_internal(VecAggState *state, bool ret_float8)
     
 
     // 5. 结果处理
+    if (!has_output_process_callback(model_path, ret_float8))
     {
         CLOCK_START();
 
-        outputs = split_results(output);
-        if (outputs.empty()) {
+        // 没有输出回调时一次处理整个batch: float取每行最大得分，text取其下标
+        std::vector<float8> float_results;
+        std::vector<std::string> text_results;
+        bool ok = false;
+
+        try {
+            ok = default_output(output, prcsd_batch_n, ret_float8, float_results, text_results);
+        } catch (const std::exception& e) {
+            error_detail = pstrdup(e.what());
+        }
+        if (!ok) {
+            std::vector<float8>().swap(float_results);
+            std::vector<std::string>().swap(text_results);
             CLEAN_UP_CPP_OBJS();
-            ereport(ERROR, (errmsg("cannot handle the result type from model!")));
+            ereport(ERROR, (errmsg("cannot handle the result type from model!"),
+                            error_detail ? errdetail("%s", error_detail) : 0));
         }
 
-        for (int i = 0; i < prcsd_batch_n; i++)
-            state->outs = lappend(state->outs, palloc0(sizeof(Args)));
-
+        if (state->columnar)
+            state->out_rows = (Args*) palloc0(sizeof(Args) * prcsd_batch_n);
         for (int i = 0; i < prcsd_batch_n; i++) {
-            pool.emplace_back([&, i](){
-                Args* in = (Args*)list_nth(state->ins, i);
+            Args* out_row;
+
+            if (state->columnar) {
+                out_row = &state->out_rows[i];
+            } else {
+                out_row = (Args*) palloc0(sizeof(Args));
+                state->outs = lappend(state->outs, out_row);
+            }
+            if (ret_float8)
+                out_row->floating = float_results[i];
+            else
+                out_row->ptr = pnstrdup(text_results[i].data(), text_results[i].size());
+        }
+
+        CLOCK_END(post);
+    }
+    else
+    {
+        CLOCK_START();
+
+        // 列存模式下按行还原Args给输出回调
+        Args* columnar_ins = nullptr;
+        if (state->columnar) {
+            state->out_rows = (Args*) palloc0(sizeof(Args) * prcsd_batch_n);
+            columnar_ins = (Args*) palloc(sizeof(Args) * prcsd_batch_n * state->feature_dim);
+            for (int64 i = 0; i < (int64) prcsd_batch_n * state->feature_dim; i++)
+                columnar_ins[i].floating = state->features[i];
+        } else {
+            for (int i = 0; i < prcsd_batch_n; i++)
+                state->outs = lappend(state->outs, palloc0(sizeof(Args)));
+        }
+
+        if (ret_float8 ? model_manager.module_batch_outputprocess_functions_float_.count(model_path) != 0
+                       : model_manager.module_batch_outputprocess_functions_text_.count(model_path) != 0)
+        {
+            // 输出回调一次处理整个batch，不拆分output
+            std::vector<Args*> in_rows(prcsd_batch_n);
+            std::vector<Args*> out_rows(prcsd_batch_n);
+            std::vector<float8> float_results;
+            std::vector<std::string> text_results;
+            ListCell* in_lc = state->columnar ? nullptr : list_head(state->ins);
+            ListCell* out_lc = state->columnar ? nullptr : list_head(state->outs);
+            bool ok = false;
+
+            for (int i = 0; i < prcsd_batch_n; i++) {
+                if (state->columnar) {
+                    in_rows[i] = &columnar_ins[i * state->feature_dim];
+                    out_rows[i] = &state->out_rows[i];
+                } else {
+                    in_rows[i] = (Args*)lfirst(in_lc);
+                    out_rows[i] = (Args*)lfirst(out_lc);
+                    in_lc = lnext(in_lc);
+                    out_lc = lnext(out_lc);
+                }
+            }
+
+            try {
+                ok = ret_float8 ?
+                    model_manager_batch_output_process_float(&model_manager, model_path, output, in_rows.data(), prcsd_batch_n, float_results) :
+                    model_manager_batch_output_process_text(&model_manager, model_path, output, in_rows.data(), prcsd_batch_n, text_results);
+            } catch (const std::exception& e) {
+                error_detail = pstrdup(e.what());
+            }
+            if (ok && (ret_float8 ? float_results.size() : text_results.size()) != (size_t) prcsd_batch_n) {
+                error_detail = psprintf("output callback returned %zu results for %d rows",
+                                        ret_float8 ? float_results.size() : text_results.size(), prcsd_batch_n);
+                ok = false;
+            }
+            if (!ok) {
+                std::vector<float8>().swap(float_results);
+                std::vector<std::string>().swap(text_results);
+                CLEAN_UP_CPP_OBJS();
+                ereport(ERROR, (errmsg("meet error in postprocess stage"),
+                                error_detail ? errdetail("%s", error_detail) : 0));
+            }
+
+            for (int i = 0; i < prcsd_batch_n; i++) {
+                if (ret_float8)
+                    out_rows[i]->floating = float_results[i];
+                else
+                    out_rows[i]->ptr = pnstrdup(text_results[i].data(), text_results[i].size());
+            }
+        }
+        else
+        {
+            outputs = split_results(output);
+            if (outputs.empty()) {
+                CLEAN_UP_CPP_OBJS();
+                ereport(ERROR, (errmsg("cannot handle the result type from model!")));
+            }
+
+            // 线程池里不能palloc，文本结果先留在std::string里，回到后端线程再复制
+            std::vector<std::string> text_results(ret_float8 ? 0 : prcsd_batch_n);
+            auto post_task = [&](int i){
+                Args* in = state->columnar ? &columnar_ins[i * state->feature_dim] : (Args*)list_nth(state->ins, i);
+                Args* out_row = state->columnar ? &state->out_rows[i] : (Args*)list_nth(state->outs, i);
                 torch::jit::IValue wrapped_out(outputs[i]);
                 if (ret_float8) {
-                    float8& out = ((Args*)list_nth(state->outs, i))->floating;
+                    float8& out = out_row->floating;
                     res[i] = model_manager_output_process_float(&model_manager, model_path, wrapped_out, in, out);
                 } else {
-                    std::string result_str;
-                    res[i] = model_manager_output_process_text(&model_manager, model_path, wrapped_out, in, result_str);   
-                    ((Args*)list_nth(state->outs, i))->ptr = pstrdup(result_str.c_str());
+                    res[i] = model_manager_output_process_text(&model_manager, model_path, wrapped_out, in, text_results[i]);
                 }
-            });
+            };
+            if (wait_and_check_error(res, prcsd_batch_n, post_task, &error_detail))
+            {
+                std::vector<std::string>().swap(text_results);
+                CLEAN_UP_CPP_OBJS();
+                ereport(ERROR, (errmsg("meet error in postprocess stage"),
+                                error_detail ? errdetail("%s", error_detail) : 0));
+            }
+            if (!ret_float8) {
+                ListCell* out_lc = state->columnar ? nullptr : list_head(state->outs);
+
+                for (int i = 0; i < prcsd_batch_n; i++) {
+                    Args* out_row = state->columnar ? &state->out_rows[i] : (Args*)lfirst(out_lc);
+
+                    out_row->ptr = pnstrdup(text_results[i].data(), text_results[i].size());
+                    if (!state->columnar)
+                        out_lc = lnext(out_lc);
+                }
+            }
         }
-        WAIT_AND_CHECK_ERROR("postprocess");
 
         CLOCK_END(post);
     }
@@ -285,6 +775,97 @@ infer_batch_internal(VecAggState *state, bool ret_float8)
     /* update infered batch size */
     state->prcsd_batch_n = prcsd_batch_n;
     state->batch_i++;
+
+    stage_us[MODEL_STATS_PRE] += state->pre_time;
+    stage_us[MODEL_STATS_INFER] += state->infer_time;
+    stage_us[MODEL_STATS_POST] += state->post_time;
+    report_prediction(state->model, prcsd_batch_n, true, stage_us);
+}
+
+/*
+ * model name -> model file of an engine model, "" for models no engine
+ * serves. Spares TorchScript models a catalog lookup per predict call,
+ * dropped on every model_info invalidation.
+ */
+static std::unordered_map<std::string, std::string> native_models;
+static bool native_callback_registered = false;
+
+static void
+native_models_invalidate(Datum arg, int cacheid, uint32 hashvalue)
+{
+    native_models.clear();
+}
+
+bool
+predict_native(const char* model_name, FunctionCallInfo fcinfo, int start, bool ret_float8, Datum* result)
+{
+    char* model_path = nullptr;
+    char* base_model = nullptr;
+    int ncols = PG_NARGS() - start;
+    int64 stage_us[MODEL_STATS_NSTAGES] = {0, 0, 0};
+    ModelEngine* engine;
+    Args out;
+
+    if (ncols <= 0 || strlen(model_name) == 0)
+        return false;
+    auto known = native_models.find(model_name);
+    if (known != native_models.end() && known->second.empty())
+        return false;
+    for (int i = 0; i < ncols; i++) {
+        if (!is_numeric_arg_type(get_fn_expr_argtype(fcinfo->flinfo, start + i)))
+            return false;
+    }
+    // copied, loading the model may process invalidations that clear the map
+    bool cached = known != native_models.end();
+
+    if (cached) {
+        model_path = pstrdup(known->second.c_str());
+    } else {
+        if (!native_callback_registered) {
+            CacheRegisterSyscacheCallback(MODELNAME, native_models_invalidate, (Datum) 0);
+            native_callback_registered = true;
+        }
+        if (!model_manager_get_model_path(&model_manager, model_name, &model_path, &base_model))
+            return false;
+        if (base_model != nullptr || model_manager.module_handle_.count(model_path) > 0) {
+            native_models[model_name] = "";
+            return false;
+        }
+    }
+
+    model_stats_begin(model_name);
+    if (!load_model_counted(model_name, model_path))
+        ereport(ERROR, (errmsg("load model error")));
+    engine = model_manager_get_engine(&model_manager, model_path);
+    if (engine == nullptr) {
+        native_models[model_name] = "";
+        return false;
+    }
+    if (!cached)
+        native_models[model_name] = model_path;
+    if (has_pre_process_callback(model_path) || has_output_process_callback(model_path, ret_float8))
+        return false;
+
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector<float> features(ncols);
+    std::vector<float8> scores(engine->num_outputs());
+
+    for (int i = 0; i < ncols; i++) {
+        features[i] = PG_ARGISNULL(start + i) ? get_float4_nan() :
+            datum_to_feature(PG_GETARG_DATUM(start + i), get_fn_expr_argtype(fcinfo->flinfo, start + i));
+    }
+    auto infer_start = std::chrono::steady_clock::now();
+    model_manager_engine_predict(engine, features.data(), 1, ncols, scores.data());
+    auto post_start = std::chrono::steady_clock::now();
+    engine_result(engine, scores.data(), ret_float8, &out);
+    *result = ret_float8 ? Float8GetDatum(out.floating) : CStringGetTextDatum((char*) out.ptr);
+    auto end_time = std::chrono::steady_clock::now();
+
+    stage_us[MODEL_STATS_PRE] = std::chrono::duration_cast<std::chrono::microseconds>(infer_start - start_time).count();
+    stage_us[MODEL_STATS_INFER] = std::chrono::duration_cast<std::chrono::microseconds>(post_start - infer_start).count();
+    stage_us[MODEL_STATS_POST] = std::chrono::duration_cast<std::chrono::microseconds>(end_time - post_start).count();
+    report_prediction(model_name, 1, false, stage_us);
+    return true;
 }
 
 float8 
@@ -307,17 +888,18 @@ predict_float(const char* model_name, const char* cuda, Args* args)
     if(!model_manager_get_model_path(&model_manager, model_name, &model_path, &base_model)){
         ereport(ERROR, (errmsg("model not exist,can't get path!")));
     }
+    model_stats_begin(model_name);
     
     //ereport(INFO, (errmsg("model_path:%s", model_path)));
 
     
     // 1. 加载模型
     if(base_model == nullptr){
-        if(!model_manager_load_model(&model_manager, model_path)){
+        if(!load_model_counted(model_name, model_path)){
             ereport(ERROR, (errmsg("load model error")));
         }
     }else{
-        if(!model_manager_load_model(&model_manager, model_path, model_name, base_model)){
+        if(!load_model_counted(model_name, model_path, model_name, base_model)){
             ereport(ERROR, (errmsg("load model error")));
         }
     }
@@ -347,7 +929,22 @@ predict_float(const char* model_name, const char* cuda, Args* args)
     // 5. 结果处理
     float8 result;
     start_time = std::chrono::system_clock::now();
-    if(!model_manager_output_process_float(&model_manager, model_path, output_tensor, args, result)){
+    if(!has_output_process_callback(model_path, true)){
+        std::vector<float8> float_results;
+        std::vector<std::string> text_results;
+
+        bool ok = false;
+
+        try {
+            ok = default_output(output_tensor, 1, true, float_results, text_results);
+        } catch (const std::exception& e) {
+            ereport(ERROR, (errmsg("cannot handle the result type from model!"), errdetail("%s", e.what())));
+        }
+        if(!ok){
+            ereport(ERROR, (errmsg("cannot handle the result type from model!")));
+        }
+        result = float_results[0];
+    }else if(!model_manager_output_process_float(&model_manager, model_path, output_tensor, args, result)){
         ereport(ERROR, (errmsg("%s OutputProcessFloat callback is empty!", model_path)));
     }
     after_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - start_time).count();
@@ -356,14 +953,19 @@ predict_float(const char* model_name, const char* cuda, Args* args)
 
     if(Debug_print_batch_time == true){
         ereport(NOTICE, 
-                (errmsg(" pre process: %ld ms(%.2f%%)\n"
-                        " infer: %ld ms(%.2f%%)\n"
-                        " post process: %ld ms(%.2f%%)",
+                (errmsg(" pre process: %ld us(%.2f%%)\n"
+                        " infer: %ld us(%.2f%%)\n"
+                        " post process: %ld us(%.2f%%)",
                         pre_time, (pre_time / (float)total_time) * 100, 
                         predict_time, (predict_time / (float)total_time)  * 100, 
                         after_time, (after_time / (float)total_time  * 100))));
     }
 
+    {
+        int64 stage_us[MODEL_STATS_NSTAGES] = {pre_time, predict_time, after_time};
+        report_prediction(model_name, 1, false, stage_us);
+    }
+
     // ereport(INFO, (errmsg("after: %f", result)));
     return result;
 }
@@ -388,17 +990,18 @@ predict_text(const char* model_name, const char* cuda, Args* args)
     if(!model_manager_get_model_path(&model_manager, model_name, &model_path, &base_model)){
         ereport(ERROR, (errmsg("model not exist,can't get path!")));
     }
+    model_stats_begin(model_name);
     
     //ereport(INFO, (errmsg("model_path:%s", model_path.c_str())));
 
     
     // 1. 加载模型
     if(base_model == nullptr){
-        if(!model_manager_load_model(&model_manager, model_path)){
+        if(!load_model_counted(model_name, model_path)){
             ereport(ERROR, (errmsg("load model error")));
         }
     }else{
-        if(!model_manager_load_model(&model_manager, model_path, model_name, base_model)){
+        if(!load_model_counted(model_name, model_path, model_name, base_model)){
             ereport(ERROR, (errmsg("load model error")));
         }
     }
@@ -429,8 +1032,23 @@ predict_text(const char* model_name, const char* cuda, Args* args)
     text* result = nullptr;
     std::string result_str;
     start_time = std::chrono::system_clock::now();
-    if(!model_manager_output_process_text(&model_manager, model_path, output_tensor, args, result_str)){
-        ereport(ERROR, (errmsg("%s OutputProcessFloat callback is empty!", model_path)));
+    if(!has_output_process_callback(model_path, false)){
+        std::vector<float8> float_results;
+        std::vector<std::string> text_results;
+
+        bool ok = false;
+
+        try {
+            ok = default_output(output_tensor, 1, false, float_results, text_results);
+        } catch (const std::exception& e) {
+            ereport(ERROR, (errmsg("cannot handle the result type from model!"), errdetail("%s", e.what())));
+        }
+        if(!ok){
+            ereport(ERROR, (errmsg("cannot handle the result type from model!")));
+        }
+        result_str = text_results[0];
+    }else if(!model_manager_output_process_text(&model_manager, model_path, output_tensor, args, result_str)){
+        ereport(ERROR, (errmsg("%s OutputProcessText callback is empty!", model_path)));
     }
     after_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - start_time).count();
 
@@ -438,14 +1056,19 @@ predict_text(const char* model_name, const char* cuda, Args* args)
 
     if(Debug_print_batch_time == true){
         ereport(NOTICE, 
-                (errmsg(" pre process: %ld ms(%.2f%%)\n"
-                        " infer: %ld ms(%.2f%%)\n"
-                        " post process: %ld ms(%.2f%%)",
+                (errmsg(" pre process: %ld us(%.2f%%)\n"
+                        " infer: %ld us(%.2f%%)\n"
+                        " post process: %ld us(%.2f%%)",
                         pre_time, (pre_time / (float)total_time) * 100, 
                         predict_time, (predict_time / (float)total_time)  * 100, 
                         after_time, (after_time / (float)total_time  * 100))));
     }
 
+    {
+        int64 stage_us[MODEL_STATS_NSTAGES] = {pre_time, predict_time, after_time};
+        report_prediction(model_name, 1, false, stage_us);
+    }
+
     result = (text*)palloc(result_str.size() + VARHDRSZ);
     SET_VARSIZE(result, result_str.size() + VARHDRSZ);
     memcpy(VARDATA(result), result_str.c_str(), result_str.size());
@@ -454,44 +1077,126 @@ predict_text(const char* model_name, const char* cuda, Args* args)
 }
 
 
-void   
-model_parameter_extraction(const char* model_path, ModelLayer** parameter_list, uint32* layer_size)
+/*
+ * hand the parameters of a model to callback one chunk at a time, so that
+ * only the loaded module and one chunk are in memory. Returns the number of
+ * parameters.
+ */
+uint32
+model_parameter_extraction(const char* model_path, ModelLayerChunkCallback callback, void* arg)
 {
-    //uint32 layer_size = 0;
     torch::jit::script::Module model;
     try {
         model = torch::jit::load(model_path);
     }
     catch (const std::exception& e) {
-        *parameter_list = NULL;
         ereport(ERROR, (errmsg("load model failed, error message: %s", e.what())));
     }
 
-    
     auto parms = model.named_parameters();
-    *layer_size = parms.size();
-    ereport(INFO, (errmsg("layer_size:%d", *layer_size)));
-    *parameter_list = (ModelLayer*)palloc((*layer_size) * sizeof(ModelLayer));
-    int index=0;
+    uint32 layer_size = parms.size();
+    ereport(INFO, (errmsg("layer_size:%d", layer_size)));
+
+    int16 index = 1;
     for(const auto& pair : parms){
-        std::string name = pair.name;
-        torch::Tensor tensor = pair.value;
+        torch::Tensor tensor;
+        try {
+            tensor = pair.value.detach().to(torch::kFloat32).contiguous();
+        }
+        catch (const std::exception& e) {
+            ereport(ERROR, (errmsg("layer \"%s\" cannot be stored, error message: %s", pair.name.c_str(), e.what())));
+        }
+        const float* data = tensor.data_ptr<float>();
+        int64 numel = tensor.numel();
+
+        if(numel <= MODEL_LAYER_CHUNK_DIM){
+            Vector* vector = tensor_to_vector(tensor);
+            callback(pair.name.c_str(), index, 0, vector, arg);
+            pfree(vector);
+        }else{
+            int32 chunk_no = 0;
+            for(int64 offset=0; offset<numel; offset+=MODEL_LAYER_CHUNK_DIM, chunk_no++){
+                unsigned int dim = (unsigned int) Min(numel - offset, (int64) MODEL_LAYER_CHUNK_DIM);
+                Vector* chunk = new_vector(dim, 1);
+
+                chunk->shape[0] = (int32) dim;
+                memcpy(chunk->x, data + offset, sizeof(float) * (size_t) dim);
+                callback(pair.name.c_str(), index, chunk_no, chunk, arg);
+                pfree(chunk);
+                CHECK_FOR_INTERRUPTS();
+            }
+        }
 
-        (*parameter_list)[index].layer_name = (char*)palloc((name.size() + 1) * sizeof(char));
-        strcpy((*parameter_list)[index].layer_name, name.c_str());
+        ereport(INFO, (errmsg("layer name:%s", pair.name.c_str())));
+        index++;
+    }
 
-        Vector* vector = tensor_to_vector(tensor);
-        (*parameter_list)[index].layer_parameter = vector;
+    return layer_size;
+}
 
-        for(unsigned int i=0; i<vector->dim; ++i){
-            //ereport(INFO, (errmsg("vector:%f", vector->x[i])));
-        }
+/*
+ * called by createmd and updatemd with the bytes of the model they just
+ * wrote, so the first prediction finds it loaded and in the model cache
+ */
+void
+model_warm_from_buffer(const char* model_path, char* data, Size len)
+{
+    model_manager_load_model_from_buffer(&model_manager, model_path, data, len);
+}
 
-        ereport(INFO, (errmsg("layer name:%s", (*parameter_list)[index].layer_name)));
-        index++;
+/* loads model_name in the leader of a parallel query, 0 if it can't be published */
+Size
+model_shared_size(const char* model_name)
+{
+    char* model_path = nullptr;
+    char* base_model = nullptr;
+
+    if(!model_manager_get_model_path(&model_manager, model_name, &model_path, &base_model)){
+        return 0;
+    }
+    // 微调模型的权重挂在基模型路径上, 按路径发布会和基模型混淆, workers 自行加载
+    if(base_model != nullptr){
+        return 0;
+    }
+    if(!load_model_counted(model_name, model_path)){
+        return 0;
+    }
+    return model_manager_shared_size(&model_manager, model_path);
+}
+
+bool
+model_shared_publish(const char* model_name, char* dest, Size size)
+{
+    char* model_path = nullptr;
+    char* base_model = nullptr;
+
+    if(!model_manager_get_model_path(&model_manager, model_name, &model_path, &base_model)){
+        return false;
+    }
+    return model_manager_publish_shared(&model_manager, model_path, dest, size);
+}
+
+/* the attached module is only valid while the worker is attached to the segment */
+bool
+model_shared_attach(const char* model_name, char* src)
+{
+    char* model_path = nullptr;
+    char* base_model = nullptr;
+
+    if(!model_manager_get_model_path(&model_manager, model_name, &model_path, &base_model)){
+        return false;
     }
+    return model_manager_attach_shared(&model_manager, model_path, src);
 }
 
+/* error out on WITH options of CREATE MODEL the model manager can't apply */
+void
+model_load_options_validate(Datum options)
+{
+    ModelLoadOptions    load_options;
+
+    model_manager_parse_load_options(options, load_options);
+}
 
 
 #ifdef __cplusplus
@@ -0,0 +1,512 @@
+/*
+ * result_cache.cpp
+ *
+ * predict result cache. A result is identified by the model (md5 of the
+ * weight file, so MODIFY MODEL naturally starts a new key space), the
+ * return kind and a 64-bit hash of the input values.
+ *
+ * The backend tier is an LRU list bounded by predict_result_cache_size. The
+ * shared tier is a set-associative array of fixed-size slots under
+ * PredictResultCacheLock, a new result replaces the least recently used way
+ * of its set. Both tiers drop the entries of a model when its model_info
+ * row is invalidated.
+ */
+#include <list>
+#include <string>
+#include <unordered_map>
+
+extern "C" {
+
+#include "postgres.h"
+
+#include "catalog/model_info.h"
+#include "catalog/pg_type_d.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "model/result_cache.h"
+#include "port/atomics.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hashutils.h"
+#include "utils/inval.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+int predict_result_cache_size = 0;
+int predict_result_cache_shared_entries = 0;
+
+typedef struct ResultCacheSlot {
+    bool                used;
+    bool                ret_float8;
+    uint32              name_hash;      /* MODELNAME hash of the model name */
+    uint64              input_hash;
+    pg_atomic_uint64    last_used;      /* LRU clock, bumped under a shared lock */
+    char                model[RESULT_CACHE_MODEL_KEY_LEN];
+    float8              floating;
+    int                 text_len;
+    char                text[RESULT_CACHE_SHARED_TEXT_LEN];
+} ResultCacheSlot;
+
+typedef struct ResultCacheCtl {
+    int                 nsets;
+    pg_atomic_uint64    clock;
+    pg_atomic_uint64    hits;
+    pg_atomic_uint64    misses;
+    ResultCacheSlot     slots[FLEXIBLE_ARRAY_MEMBER];
+} ResultCacheCtl;
+
+static ResultCacheCtl* shared_cache = NULL;
+
+static int
+shared_cache_sets(void)
+{
+    return (predict_result_cache_shared_entries + RESULT_CACHE_SHARED_WAYS - 1) / RESULT_CACHE_SHARED_WAYS;
+}
+
+Size
+ResultCacheShmemSize(void)
+{
+    if(predict_result_cache_shared_entries <= 0){
+        return 0;
+    }
+    return add_size(offsetof(ResultCacheCtl, slots),
+                    mul_size(mul_size(shared_cache_sets(), RESULT_CACHE_SHARED_WAYS),
+                             sizeof(ResultCacheSlot)));
+}
+
+void
+ResultCacheShmemInit(void)
+{
+    bool found;
+
+    if(predict_result_cache_shared_entries <= 0){
+        return;
+    }
+
+    shared_cache = (ResultCacheCtl*)ShmemInitStruct("Predict Result Cache", ResultCacheShmemSize(), &found);
+    if(!found){
+        MemSet(shared_cache, 0, ResultCacheShmemSize());
+        shared_cache->nsets = shared_cache_sets();
+        pg_atomic_init_u64(&shared_cache->clock, 0);
+        pg_atomic_init_u64(&shared_cache->hits, 0);
+        pg_atomic_init_u64(&shared_cache->misses, 0);
+        for(int i = 0; i < shared_cache->nsets * RESULT_CACHE_SHARED_WAYS; i++){
+            pg_atomic_init_u64(&shared_cache->slots[i].last_used, 0);
+        }
+    }
+}
+
+/* backend tier */
+
+typedef struct LocalKey {
+    std::string model;
+    uint64      input_hash;
+    bool        ret_float8;
+
+    bool operator==(const LocalKey& other) const {
+        return input_hash == other.input_hash && ret_float8 == other.ret_float8 && model == other.model;
+    }
+} LocalKey;
+
+struct LocalKeyHash {
+    size_t operator()(const LocalKey& key) const {
+        return hash_combine64(key.input_hash, std::hash<std::string>()(key.model)) + key.ret_float8;
+    }
+};
+
+typedef struct LocalEntry {
+    LocalKey    key;
+    uint32      name_hash;
+    float8      floating;
+    std::string text;
+    Size        bytes;
+} LocalEntry;
+
+typedef struct ModelIdentity {
+    std::string key;
+    uint32      name_hash;
+} ModelIdentity;
+
+static std::list<LocalEntry> local_lru;     // most recently used first
+static std::unordered_map<LocalKey, std::list<LocalEntry>::iterator, LocalKeyHash> local_index;
+static Size local_bytes = 0;
+static int64 local_hits = 0;
+static int64 local_misses = 0;
+
+/* model name -> cache identity, dropped on every model_info invalidation */
+static std::unordered_map<std::string, ModelIdentity> model_identities;
+static bool callback_registered = false;
+
+#define LOCAL_CACHE_BUDGET ((Size) predict_result_cache_size * 1024)
+
+static void
+local_evict(Size budget)
+{
+    while(local_bytes > budget && !local_lru.empty()){
+        LocalEntry& victim = local_lru.back();
+        local_bytes -= victim.bytes;
+        local_index.erase(victim.key);
+        local_lru.pop_back();
+    }
+}
+
+static void
+result_cache_invalidate(Datum arg, int cacheid, uint32 hashvalue)
+{
+    model_identities.clear();
+
+    for(auto it = local_lru.begin(); it != local_lru.end();){
+        if(hashvalue == 0 || it->name_hash == hashvalue){
+            local_bytes -= it->bytes;
+            local_index.erase(it->key);
+            it = local_lru.erase(it);
+        }else{
+            ++it;
+        }
+    }
+
+    if(shared_cache == NULL){
+        return;
+    }
+
+    LWLockAcquire(PredictResultCacheLock, LW_EXCLUSIVE);
+    for(int i = 0; i < shared_cache->nsets * RESULT_CACHE_SHARED_WAYS; i++){
+        ResultCacheSlot* slot = &shared_cache->slots[i];
+        if(slot->used && (hashvalue == 0 || slot->name_hash == hashvalue)){
+            slot->used = false;
+        }
+    }
+    LWLockRelease(PredictResultCacheLock);
+}
+
+static bool
+resolve_model(const char* model_name, ModelIdentity& identity)
+{
+    HeapTuple   tuple;
+    Datum       datum;
+    bool        isnull;
+
+    auto it = model_identities.find(model_name);
+    if(it != model_identities.end()){
+        identity = it->second;
+        return true;
+    }
+
+    if(!callback_registered){
+        CacheRegisterSyscacheCallback(MODELNAME, result_cache_invalidate, (Datum) 0);
+        callback_registered = true;
+    }
+
+    tuple = SearchSysCache1(MODELNAME, CStringGetDatum(model_name));
+    if(!HeapTupleIsValid(tuple)){
+        return false;
+    }
+
+    datum = SysCacheGetAttr(MODELNAME, tuple, Anum_model_info_md5, &isnull);
+    if(!isnull){
+        identity.key = NameStr(*DatumGetName(datum));
+    }else{
+        // fine-tuned models have no md5, a re-created model gets a new createtime
+        identity.key = model_name;
+        datum = SysCacheGetAttr(MODELNAME, tuple, Anum_model_info_createtime, &isnull);
+        if(!isnull){
+            identity.key += "@" + std::to_string((int64) DatumGetTimestamp(datum));
+        }
+    }
+    ReleaseSysCache(tuple);
+
+    if(identity.key.size() >= RESULT_CACHE_MODEL_KEY_LEN){
+        identity.key.resize(RESULT_CACHE_MODEL_KEY_LEN - 1);
+    }
+    identity.name_hash = GetSysCacheHashValue1(MODELNAME, CStringGetDatum(model_name));
+    model_identities[model_name] = identity;
+    return true;
+}
+
+static void
+local_store(const LocalKey& key, uint32 name_hash, bool ret_float8, float8 floating, const char* text, int text_len)
+{
+    Size bytes = sizeof(LocalEntry) + key.model.size() + text_len + 64;
+
+    if(bytes > LOCAL_CACHE_BUDGET || local_index.count(key) > 0){
+        return;
+    }
+
+    local_evict(LOCAL_CACHE_BUDGET - bytes);
+    local_lru.push_front(LocalEntry{key, name_hash, floating,
+                                    ret_float8 ? std::string() : std::string(text, text_len), bytes});
+    local_index[key] = local_lru.begin();
+    local_bytes += bytes;
+}
+
+static ResultCacheSlot*
+shared_find(const char* model, bool ret_float8, uint64 input_hash)
+{
+    ResultCacheSlot* set = &shared_cache->slots[(input_hash % shared_cache->nsets) * RESULT_CACHE_SHARED_WAYS];
+
+    for(int i = 0; i < RESULT_CACHE_SHARED_WAYS; i++){
+        if(set[i].used && set[i].input_hash == input_hash && set[i].ret_float8 == ret_float8 &&
+           strcmp(set[i].model, model) == 0){
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+/* fold one argument into hash, false if its type can't be hashed */
+static bool
+hash_value(uint64& hash, Oid type, Datum value, bool isnull)
+{
+    hash = hash_combine64(hash, type);
+    if(isnull){
+        hash = hash_combine64(hash, UINT64CONST(0xffffffffffffffff));
+        return true;
+    }
+
+    switch(type){
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case FLOAT4OID:
+        case FLOAT8OID:
+            hash = DatumGetUInt64(hash_any_extended((const unsigned char*)&value, sizeof(Datum), hash));
+            return true;
+        case TEXTOID:
+        case NUMERICOID:
+        {
+            struct varlena* data = PG_DETOAST_DATUM_PACKED(value);
+            hash = DatumGetUInt64(hash_any_extended((const unsigned char*)VARDATA_ANY(data),
+                                                    VARSIZE_ANY_EXHDR(data), hash));
+            return true;
+        }
+        case CSTRINGOID:
+        {
+            const char* str = DatumGetCString(value);
+            hash = DatumGetUInt64(hash_any_extended((const unsigned char*)str, strlen(str), hash));
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool
+result_cache_hash_args(FunctionCallInfo fcinfo, int start, uint64* input_hash)
+{
+    uint64 hash = 0;
+
+    for(int i = start; i < PG_NARGS(); i++){
+        if(!hash_value(hash, get_fn_expr_argtype(fcinfo->flinfo, i), PG_GETARG_DATUM(i), PG_ARGISNULL(i))){
+            return false;
+        }
+    }
+    *input_hash = hash;
+    return true;
+}
+
+bool
+result_cache_hash_values(const Oid* types, const Datum* values, const bool* isnull, int n, uint64* input_hash)
+{
+    uint64 hash = 0;
+
+    for(int i = 0; i < n; i++){
+        if(!hash_value(hash, types[i], values[i], isnull[i])){
+            return false;
+        }
+    }
+    *input_hash = hash;
+    return true;
+}
+
+bool
+result_cache_lookup(const char* model_name, bool ret_float8, uint64 input_hash, Datum* result)
+{
+    ModelIdentity   identity;
+    float8          floating = 0;
+    char            text[RESULT_CACHE_SHARED_TEXT_LEN];
+    int             text_len = 0;
+    bool            found = false;
+
+    if(predict_result_cache_size <= 0 || !resolve_model(model_name, identity)){
+        return false;
+    }
+
+    try {
+        LocalKey key{identity.key, input_hash, ret_float8};
+        auto it = local_index.find(key);
+
+        if(it != local_index.end()){
+            local_lru.splice(local_lru.begin(), local_lru, it->second);
+            local_hits++;
+            *result = ret_float8 ? Float8GetDatum(it->second->floating) :
+                PointerGetDatum(cstring_to_text_with_len(it->second->text.data(), it->second->text.size()));
+            return true;
+        }
+        local_misses++;
+
+        if(shared_cache == NULL){
+            return false;
+        }
+
+        LWLockAcquire(PredictResultCacheLock, LW_SHARED);
+        ResultCacheSlot* slot = shared_find(identity.key.c_str(), ret_float8, input_hash);
+        if(slot != NULL){
+            pg_atomic_write_u64(&slot->last_used, pg_atomic_fetch_add_u64(&shared_cache->clock, 1));
+            floating = slot->floating;
+            text_len = slot->text_len;
+            memcpy(text, slot->text, text_len);
+            found = true;
+        }
+        LWLockRelease(PredictResultCacheLock);
+
+        if(!found){
+            pg_atomic_fetch_add_u64(&shared_cache->misses, 1);
+            return false;
+        }
+        pg_atomic_fetch_add_u64(&shared_cache->hits, 1);
+
+        local_store(key, identity.name_hash, ret_float8, floating, text, text_len);
+    }
+    catch (const std::bad_alloc&) {
+        // the backend tier is best effort, fall through to what we have
+        if(!found){
+            return false;
+        }
+    }
+
+    *result = ret_float8 ? Float8GetDatum(floating) : PointerGetDatum(cstring_to_text_with_len(text, text_len));
+    return true;
+}
+
+void
+result_cache_store(const char* model_name, bool ret_float8, uint64 input_hash, Datum result)
+{
+    ModelIdentity   identity;
+    float8          floating = 0;
+    const char*     text = NULL;
+    int             text_len = 0;
+
+    if(predict_result_cache_size <= 0 || !resolve_model(model_name, identity)){
+        return;
+    }
+
+    if(ret_float8){
+        floating = DatumGetFloat8(result);
+    }else{
+        text = VARDATA_ANY(DatumGetPointer(result));
+        text_len = VARSIZE_ANY_EXHDR(DatumGetPointer(result));
+    }
+
+    try {
+        local_store(LocalKey{identity.key, input_hash, ret_float8}, identity.name_hash,
+                    ret_float8, floating, text, text_len);
+    }
+    catch (const std::bad_alloc&) {
+    }
+
+    if(shared_cache == NULL || text_len > RESULT_CACHE_SHARED_TEXT_LEN){
+        return;
+    }
+
+    LWLockAcquire(PredictResultCacheLock, LW_EXCLUSIVE);
+    ResultCacheSlot* slot = shared_find(identity.key.c_str(), ret_float8, input_hash);
+    if(slot == NULL){
+        ResultCacheSlot* set = &shared_cache->slots[(input_hash % shared_cache->nsets) * RESULT_CACHE_SHARED_WAYS];
+
+        // a free way, else the least recently used one
+        for(int i = 0; i < RESULT_CACHE_SHARED_WAYS; i++){
+            if(!set[i].used){
+                slot = &set[i];
+                break;
+            }
+            if(slot == NULL || pg_atomic_read_u64(&set[i].last_used) < pg_atomic_read_u64(&slot->last_used)){
+                slot = &set[i];
+            }
+        }
+        slot->used = true;
+        slot->ret_float8 = ret_float8;
+        slot->name_hash = identity.name_hash;
+        slot->input_hash = input_hash;
+        strlcpy(slot->model, identity.key.c_str(), RESULT_CACHE_MODEL_KEY_LEN);
+    }
+    slot->floating = floating;
+    slot->text_len = text_len;
+    if(text_len > 0){
+        memcpy(slot->text, text, text_len);
+    }
+    pg_atomic_write_u64(&slot->last_used, pg_atomic_fetch_add_u64(&shared_cache->clock, 1));
+    LWLockRelease(PredictResultCacheLock);
+}
+
+/*
+ * pg_predict_result_cache_status
+ *
+ * one row for this backend's tier and one for the shared tier if configured
+ */
+Datum
+pg_predict_result_cache_status(PG_FUNCTION_ARGS)
+{
+#define PG_PREDICT_RESULT_CACHE_STATUS_COLS 5
+    ReturnSetInfo*      rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc           tupdesc;
+    Tuplestorestate*    tupstore;
+    MemoryContext       per_query_ctx;
+    MemoryContext       oldcontext;
+    Datum               values[PG_PREDICT_RESULT_CACHE_STATUS_COLS];
+    bool                nulls[PG_PREDICT_RESULT_CACHE_STATUS_COLS];
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("materialize mode required, but it is not allowed in this context")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+
+    MemoryContextSwitchTo(oldcontext);
+
+    MemSet(nulls, false, sizeof(nulls));
+    values[0] = CStringGetTextDatum("backend");
+    values[1] = Int64GetDatum((int64) local_lru.size());
+    values[2] = Int64GetDatum((int64) local_bytes);
+    values[3] = Int64GetDatum(local_hits);
+    values[4] = Int64GetDatum(local_misses);
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+    if(shared_cache != NULL){
+        int64 entries = 0;
+
+        LWLockAcquire(PredictResultCacheLock, LW_SHARED);
+        for(int i = 0; i < shared_cache->nsets * RESULT_CACHE_SHARED_WAYS; i++){
+            if(shared_cache->slots[i].used){
+                entries++;
+            }
+        }
+        LWLockRelease(PredictResultCacheLock);
+
+        values[0] = CStringGetTextDatum("shared");
+        values[1] = Int64GetDatum(entries);
+        values[2] = Int64GetDatum((int64) ResultCacheShmemSize());
+        values[3] = Int64GetDatum((int64) pg_atomic_read_u64(&shared_cache->hits));
+        values[4] = Int64GetDatum((int64) pg_atomic_read_u64(&shared_cache->misses));
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    return (Datum) 0;
+}
+
+}
@@ -0,0 +1,256 @@
+/*
+ * thread_pool.cpp
+ *
+ * per-backend work-stealing thread pool. A parallel_for is cut into about
+ * four chunks per thread which are dealt round-robin to the worker queues.
+ * Workers take chunks from the front of their own queue and steal from the
+ * back of the others, the calling backend steals too until the job is done.
+ */
+#include "model/thread_pool.h"
+
+extern "C" {
+
+#include "storage/ipc.h"
+
+int model_thread_pool_size = 0;
+
+#define THREAD_POOL_CHUNKS_PER_THREAD   4
+
+struct ThreadPoolJob {
+    const std::function<void(int)>* fn;
+    std::atomic<int>                pending;    // chunks not finished yet
+    std::atomic<bool>               failed;
+    std::mutex                      mutex;
+    std::condition_variable         done;
+    std::exception_ptr              error;
+};
+
+static ThreadPool* backend_pool = NULL;
+
+static int
+thread_pool_wanted_size(void)
+{
+    int size = model_thread_pool_size;
+
+    if(size <= 0){
+        size = (int)std::thread::hardware_concurrency();
+    }
+    return Max(1, Min(size, MAX_THREAD_POOL_SIZE));
+}
+
+/* take a task, own queue first (self < 0 for the caller) then steal */
+static bool
+thread_pool_pop(ThreadPool* pool, int self, ThreadPoolTask& task)
+{
+    int nqueues = pool->queues_.size();
+
+    if(pool->queued_.load() == 0){
+        return false;
+    }
+
+    if(self >= 0){
+        ThreadPoolQueue* queue = pool->queues_[self].get();
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if(!queue->tasks.empty()){
+            task = queue->tasks.front();
+            queue->tasks.pop_front();
+            pool->queued_--;
+            return true;
+        }
+    }
+
+    for(int i = 1; i <= nqueues; i++){
+        ThreadPoolQueue* queue = pool->queues_[(Max(self, 0) + i) % nqueues].get();
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if(!queue->tasks.empty()){
+            task = queue->tasks.back();
+            queue->tasks.pop_back();
+            pool->queued_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+thread_pool_run_task(ThreadPoolTask& task)
+{
+    ThreadPoolJob* job = task.job;
+
+    for(int i = task.begin; i < task.end && !job->failed.load(); i++){
+        try {
+            (*job->fn)(i);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            if(!job->error){
+                job->error = std::current_exception();
+            }
+            job->failed = true;
+        }
+    }
+
+    // under the mutex, the caller frees job as soon as it sees pending drop to 0
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if(--job->pending == 0){
+        job->done.notify_all();
+    }
+}
+
+static void
+thread_pool_worker(ThreadPool* pool, int self)
+{
+    ThreadPoolTask task;
+
+    for(;;){
+        if(thread_pool_pop(pool, self, task)){
+            thread_pool_run_task(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(pool->mutex_);
+        pool->wakeup_.wait(lock, [pool]{ return pool->stop_ || pool->queued_.load() > 0; });
+        if(pool->stop_){
+            return;
+        }
+    }
+}
+
+static void
+thread_pool_destroy(ThreadPool* pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex_);
+        pool->stop_ = true;
+    }
+    pool->wakeup_.notify_all();
+    for(auto& t : pool->threads_){
+        t.join();
+    }
+    delete pool;
+}
+
+static void
+thread_pool_shutdown(int code, Datum arg)
+{
+    if(backend_pool != NULL){
+        thread_pool_destroy(backend_pool);
+        backend_pool = NULL;
+    }
+}
+
+ThreadPool*
+thread_pool_get(void)
+{
+    static bool exit_registered = false;
+    int         size = thread_pool_wanted_size();
+
+    // the backend itself is one of the threads
+    if(backend_pool != NULL && (int)backend_pool->threads_.size() == size - 1){
+        return backend_pool;
+    }
+    if(backend_pool != NULL){
+        thread_pool_destroy(backend_pool);
+        backend_pool = NULL;
+    }
+
+    ThreadPool* pool = new ThreadPool();
+    pool->queued_ = 0;
+    pool->stop_ = false;
+    for(int i = 0; i < size - 1; i++){
+        pool->queues_.emplace_back(new ThreadPoolQueue());
+    }
+    for(int i = 0; i < size - 1; i++){
+        pool->threads_.emplace_back(thread_pool_worker, pool, i);
+    }
+    backend_pool = pool;
+
+    if(!exit_registered){
+        on_proc_exit(thread_pool_shutdown, (Datum) 0);
+        exit_registered = true;
+    }
+    return backend_pool;
+}
+
+void
+thread_pool_parallel_for(ThreadPool* pool, int n, const std::function<void(int)>& fn)
+{
+    ThreadPoolJob   job;
+    ThreadPoolTask  task;
+    int             nqueues = pool->queues_.size();
+    int             nchunks;
+    int             chunk_size;
+
+    if(n <= 0){
+        return;
+    }
+
+    job.fn = &fn;
+    job.failed = false;
+
+    if(nqueues == 0){
+        ThreadPoolTask all = {&job, 0, n};
+        job.pending = 1;
+        thread_pool_run_task(all);
+    }else{
+        nchunks = Min(n, (nqueues + 1) * THREAD_POOL_CHUNKS_PER_THREAD);
+        chunk_size = (n + nchunks - 1) / nchunks;
+        nchunks = (n + chunk_size - 1) / chunk_size;
+        job.pending = nchunks;
+
+        for(int i = 0; i < nchunks; i++){
+            ThreadPoolQueue* queue = pool->queues_[i % nqueues].get();
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->tasks.push_back({&job, i * chunk_size, Min(n, (i + 1) * chunk_size)});
+        }
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex_);
+            pool->queued_ += nchunks;
+        }
+        pool->wakeup_.notify_all();
+
+        while(thread_pool_pop(pool, -1, task)){
+            thread_pool_run_task(task);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(job.mutex);
+    job.done.wait(lock, [&job]{ return job.pending.load() == 0; });
+
+    if(job.error){
+        std::rethrow_exception(job.error);
+    }
+}
+
+int
+thread_pool_nthreads(void)
+{
+    ThreadPool* pool = NULL;
+
+    try {
+        pool = thread_pool_get();
+    }
+    catch (const std::exception& e) {
+        ereport(ERROR,
+                (errmsg("could not start the thread pool: %s", e.what())));
+    }
+    return (int)pool->threads_.size() + 1;
+}
+
+void
+thread_pool_parallel_for_c(int n, void (*fn)(int i, void* arg), void* arg)
+{
+    ThreadPool* pool = NULL;
+
+    try {
+        pool = thread_pool_get();
+    }
+    catch (const std::exception& e) {
+        ereport(ERROR,
+                (errmsg("could not start the thread pool: %s", e.what())));
+    }
+    // fn is C and can't throw, the pool itself doesn't either
+    thread_pool_parallel_for(pool, n, [fn, arg](int i){ fn(i, arg); });
+}
+
+}
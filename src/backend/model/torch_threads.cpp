@@ -0,0 +1,300 @@
+/*
+ * torch_threads.cpp
+ *
+ * libtorch starts one intra-op thread per core in every backend, so with
+ * many sessions running models at once the machine is oversubscribed many
+ * times over. The thread counts are set per session here, and with
+ * model_thread_budget every forward pass leases its intra-op threads from a
+ * counter in shared memory: it gets what it asks for while the budget lasts
+ * and a single thread once it is spent, so no backend ever waits for threads.
+ */
+#include <torch/torch.h>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "model/torch_threads.h"
+
+extern "C" {
+
+#include "miscadmin.h"
+#include "model/inference_worker.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+
+int model_intra_op_threads = 0;
+int model_inter_op_threads = 0;
+int model_thread_budget = 0;
+char* model_thread_affinity = NULL;
+
+typedef struct TorchThreadsCtl {
+    pg_atomic_uint32    leased;         /* intra-op threads in use by all backends */
+    pg_atomic_uint32    next_node;      /* round robin of the 'numa' affinity */
+} TorchThreadsCtl;
+
+static TorchThreadsCtl* threads_ctl = NULL;
+
+/* what is in effect in this backend */
+static int          default_intra_threads = 0;
+static int          current_intra_threads = 0;
+static int          applied_inter_threads = 0;
+static std::string  applied_affinity;
+static int          held_threads = 0;
+#ifdef __linux__
+static cpu_set_t    original_cpus;
+#endif
+
+Size
+TorchThreadsShmemSize(void)
+{
+    return MAXALIGN(sizeof(TorchThreadsCtl));
+}
+
+void
+TorchThreadsShmemInit(void)
+{
+    bool found;
+
+    threads_ctl = (TorchThreadsCtl*)ShmemInitStruct("Torch Threads Ctl", sizeof(TorchThreadsCtl), &found);
+    if(!found){
+        pg_atomic_init_u32(&threads_ctl->leased, 0);
+        pg_atomic_init_u32(&threads_ctl->next_node, 0);
+    }
+}
+
+/* parse a list like '0-15,32-47' into ids, false on a syntax error */
+static bool
+parse_id_list(const char* list, std::vector<int>& ids)
+{
+    const char* p = list;
+
+    while(*p != '\0' && *p != '\n'){
+        char*   end;
+        long    first = strtol(p, &end, 10);
+        long    last = first;
+
+        if(end == p || first < 0){
+            return false;
+        }
+        p = end;
+        if(*p == '-'){
+            p++;
+            last = strtol(p, &end, 10);
+            if(end == p || last < first){
+                return false;
+            }
+            p = end;
+        }
+        if(last >= 65536){
+            return false;
+        }
+        for(long id = first; id <= last; id++){
+            ids.push_back((int) id);
+        }
+        if(*p == ','){
+            p++;
+        }else if(*p != '\0' && *p != '\n'){
+            return false;
+        }
+    }
+    return !ids.empty();
+}
+
+bool
+check_model_thread_affinity(char** newval, void** extra, GucSource source)
+{
+    std::vector<int> cpus;
+
+    if(**newval == '\0'){
+        return true;
+    }
+#ifdef __linux__
+    if(pg_strcasecmp(*newval, "numa") == 0){
+        return true;
+    }
+    if(parse_id_list(*newval, cpus)){
+        for(int cpu : cpus){
+            if(cpu >= CPU_SETSIZE){
+                GUC_check_errdetail("CPU %d is out of range.", cpu);
+                return false;
+            }
+        }
+        return true;
+    }
+    GUC_check_errdetail("Use \"numa\" or a list of CPUs like \"0-15,32-47\".");
+#else
+    GUC_check_errdetail("CPU affinity is only supported on Linux.");
+#endif
+    return false;
+}
+
+#ifdef __linux__
+static bool
+read_sysfs_list(const char* path, std::vector<int>& ids)
+{
+    char    buf[4096];
+    FILE*   file = fopen(path, "r");
+    bool    ok;
+
+    if(file == NULL){
+        return false;
+    }
+    ok = fgets(buf, sizeof(buf), file) != NULL && parse_id_list(buf, ids);
+    fclose(file);
+    return ok;
+}
+
+/*
+ * the CPUs of affinity. 'numa' is the CPUs of one node, the backends are
+ * dealt to the nodes round robin.
+ */
+static bool
+affinity_cpus(const char* affinity, cpu_set_t* set)
+{
+    std::vector<int> cpus;
+
+    if(pg_strcasecmp(affinity, "numa") == 0){
+        std::vector<int>    nodes;
+        char                path[MAXPGPATH];
+        int                 node;
+
+        if(!read_sysfs_list("/sys/devices/system/node/online", nodes)){
+            ereport(WARNING, (errmsg("could not read the NUMA nodes of the machine")));
+            return false;
+        }
+        node = nodes[pg_atomic_fetch_add_u32(&threads_ctl->next_node, 1) % nodes.size()];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if(!read_sysfs_list(path, cpus)){
+            ereport(WARNING, (errmsg("could not read the CPUs of NUMA node %d", node)));
+            return false;
+        }
+    }else if(!parse_id_list(affinity, cpus)){
+        return false;
+    }
+
+    CPU_ZERO(set);
+    for(int cpu : cpus){
+        if(cpu < CPU_SETSIZE){
+            CPU_SET(cpu, set);
+        }
+    }
+    return true;
+}
+#endif
+
+/*
+ * bind the backend and its intra-op threads to the CPUs of
+ * model_thread_affinity, '' gives the backend its original CPUs back.
+ * Threads libtorch starts later inherit the mask of the backend.
+ */
+static void
+apply_affinity(void)
+{
+    const char* affinity = model_thread_affinity != NULL ? model_thread_affinity : "";
+
+    if(applied_affinity == affinity){
+        return;
+    }
+#ifdef __linux__
+    cpu_set_t set;
+
+    if(applied_affinity.empty() && sched_getaffinity(0, sizeof(original_cpus), &original_cpus) != 0){
+        ereport(WARNING, (errmsg("could not get CPU affinity: %m")));
+        return;
+    }
+    applied_affinity = affinity;
+    if(*affinity == '\0'){
+        set = original_cpus;
+    }else if(!affinity_cpus(affinity, &set)){
+        return;
+    }
+
+    if(sched_setaffinity(0, sizeof(set), &set) != 0){
+        ereport(WARNING, (errmsg("could not set CPU affinity: %m")));
+        return;
+    }
+    // one chunk per intra-op thread, each binds the thread running it
+    at::parallel_for(0, at::get_num_threads(), 1, [&set](int64_t begin, int64_t end){
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    });
+#else
+    applied_affinity = affinity;
+#endif
+}
+
+/* inter-op threads can only be set before libtorch starts its inter-op pool */
+static void
+apply_inter_threads(void)
+{
+    if(model_inter_op_threads <= 0 || model_inter_op_threads == applied_inter_threads){
+        return;
+    }
+    applied_inter_threads = model_inter_op_threads;
+    try {
+        at::set_num_interop_threads(model_inter_op_threads);
+    }
+    catch (const std::exception& e) {
+        ereport(WARNING,
+                (errmsg("model_inter_op_threads can only be changed before the first inference of a session")));
+    }
+}
+
+static void
+torch_threads_onexit(int code, Datum arg)
+{
+    torch_threads_release(held_threads);
+}
+
+int
+torch_threads_acquire(void)
+{
+    int want;
+    int grant;
+    int leased = 0;
+
+    if(default_intra_threads == 0){
+        default_intra_threads = at::get_num_threads();
+        current_intra_threads = default_intra_threads;
+        on_shmem_exit(torch_threads_onexit, (Datum) 0);
+    }
+    apply_inter_threads();
+    apply_affinity();
+
+    // inference workers have their own setting
+    want = am_inference_worker ? inference_worker_threads : model_intra_op_threads;
+    if(want <= 0){
+        want = default_intra_threads;
+    }
+    grant = want;
+
+    if(model_thread_budget > 0 && threads_ctl != NULL){
+        uint32 used = pg_atomic_read_u32(&threads_ctl->leased);
+
+        do {
+            grant = Max(1, Min(want, model_thread_budget - (int) used));
+        } while(!pg_atomic_compare_exchange_u32(&threads_ctl->leased, &used, used + grant));
+        leased = grant;
+        held_threads += leased;
+    }
+
+    if(grant != current_intra_threads){
+        at::set_num_threads(grant);
+        current_intra_threads = grant;
+    }
+    return leased;
+}
+
+void
+torch_threads_release(int leased)
+{
+    if(leased > 0 && threads_ctl != NULL){
+        pg_atomic_fetch_sub_u32(&threads_ctl->leased, leased);
+        held_threads -= leased;
+    }
+}
+
+}
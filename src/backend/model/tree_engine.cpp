@@ -0,0 +1,707 @@
+/*
+ * tree_engine.cpp
+ *
+ * gradient-boosted tree ensembles without libtorch. XGBoost JSON models
+ * (save_model), XGBoost JSON dumps (dump_model with dump_format json) and
+ * LightGBM JSON dumps (dump_model) are parsed as jsonb and flattened into
+ * one array per node field. The two children of a split are adjacent, so a
+ * split only keeps the index of its left child, and a leaf is a node with
+ * feature -1 whose threshold is the leaf value. Rows are scored a block at a
+ * time: every tree runs over all rows of the block before the next tree, so
+ * the nodes of a tree stay in cache while the rows walk it.
+ */
+#include "model/model_engine.h"
+
+#include <cmath>
+#include <vector>
+
+extern "C" {
+
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/jsonb.h"
+#include "utils/memutils.h"
+
+#define TREE_BLOCK_ROWS             64
+
+/* flags of a split */
+#define TREE_NODE_DEFAULT_LEFT      0x01    /* missing values go left */
+#define TREE_NODE_NAN_AS_ZERO       0x02    /* NaN is compared as 0, LightGBM missing_type None */
+#define TREE_NODE_ZERO_MISSING      0x04    /* 0 is missing too, LightGBM missing_type Zero */
+
+typedef enum TreeTransform {
+    TREE_IDENTITY,
+    TREE_SIGMOID,
+    TREE_SOFTMAX,
+    TREE_EXP
+} TreeTransform;
+
+class TreeEngine final : public ModelEngine {
+public:
+    std::vector<int32_t>    feature_;       // split feature, -1 for a leaf
+    std::vector<float>      value_;         // go left if x < value, the leaf value of a leaf
+    std::vector<int32_t>    left_;          // left child, the right child follows it
+    std::vector<uint8_t>    flags_;         // TREE_NODE_*
+    std::vector<int32_t>    roots_;         // root of each tree
+    std::vector<int32_t>    groups_;        // output each tree adds to
+    int                     num_features_ = 0;
+    int                     num_outputs_ = 1;
+    double                  base_score_ = 0.0;      // initial margin of every output
+    TreeTransform           transform_ = TREE_IDENTITY;
+    double                  sigmoid_scale_ = 1.0;
+    const char*             format_ = "";
+
+    const char* name() const override { return format_; }
+    int num_features() const override { return num_features_; }
+    int num_outputs() const override { return num_outputs_; }
+    bool classifier() const override { return transform_ == TREE_SIGMOID || transform_ == TREE_SOFTMAX; }
+
+    Size memory_bytes() const override {
+        return feature_.capacity() * sizeof(int32_t) + value_.capacity() * sizeof(float) +
+               left_.capacity() * sizeof(int32_t) + flags_.capacity() * sizeof(uint8_t) +
+               roots_.capacity() * sizeof(int32_t) + groups_.capacity() * sizeof(int32_t);
+    }
+
+    void predict(const float* rows, int64 nrows, int64 ncols, float8* out) const override;
+
+    // n new nodes, leaves until they are split; returns the first
+    int32_t add_nodes(int n) {
+        int32_t first = feature_.size();
+
+        feature_.resize(first + n, -1);
+        value_.resize(first + n, 0.0f);
+        left_.resize(first + n, 0);
+        flags_.resize(first + n, 0);
+        return first;
+    }
+
+private:
+    void transform(float8* margins, int64 nrows) const;
+};
+
+static inline bool
+tree_go_left(uint8_t flags, float threshold, float x)
+{
+    if(unlikely(std::isnan(x) || ((flags & TREE_NODE_ZERO_MISSING) && x == 0.0f))){
+        if(!(flags & TREE_NODE_NAN_AS_ZERO)){
+            return flags & TREE_NODE_DEFAULT_LEFT;
+        }
+        x = 0.0f;
+    }
+    return x < threshold;
+}
+
+void
+TreeEngine::predict(const float* rows, int64 nrows, int64 ncols, float8* out) const
+{
+    const int32_t*  feature = feature_.data();
+    const float*    value = value_.data();
+    const int32_t*  left = left_.data();
+    const uint8_t*  flags = flags_.data();
+
+    for(int64 begin = 0; begin < nrows; begin += TREE_BLOCK_ROWS){
+        int64       n = Min((int64) TREE_BLOCK_ROWS, nrows - begin);
+        float8*     margins = out + begin * num_outputs_;
+        const float* block = rows + begin * ncols;
+
+        for(int64 i = 0; i < n * num_outputs_; i++){
+            margins[i] = base_score_;
+        }
+        for(size_t t = 0; t < roots_.size(); t++){
+            const int32_t   root = roots_[t];
+            const int32_t   group = groups_[t];
+            const float*    row = block;
+
+            for(int64 r = 0; r < n; r++, row += ncols){
+                int32_t node = root;
+
+                while(feature[node] >= 0){
+                    node = left[node] + (tree_go_left(flags[node], value[node], row[feature[node]]) ? 0 : 1);
+                }
+                margins[r * num_outputs_ + group] += value[node];
+            }
+        }
+        transform(margins, n);
+    }
+}
+
+void
+TreeEngine::transform(float8* margins, int64 nrows) const
+{
+    switch(transform_){
+        case TREE_IDENTITY:
+            break;
+        case TREE_SIGMOID:
+            for(int64 i = 0; i < nrows * num_outputs_; i++){
+                margins[i] = 1.0 / (1.0 + std::exp(-sigmoid_scale_ * margins[i]));
+            }
+            break;
+        case TREE_EXP:
+            for(int64 i = 0; i < nrows * num_outputs_; i++){
+                margins[i] = std::exp(margins[i]);
+            }
+            break;
+        case TREE_SOFTMAX:
+            for(int64 r = 0; r < nrows; r++){
+                float8* row = margins + r * num_outputs_;
+                float8  max = row[0];
+                float8  sum = 0.0;
+
+                for(int k = 1; k < num_outputs_; k++){
+                    max = Max(max, row[k]);
+                }
+                for(int k = 0; k < num_outputs_; k++){
+                    row[k] = std::exp(row[k] - max);
+                    sum += row[k];
+                }
+                for(int k = 0; k < num_outputs_; k++){
+                    row[k] /= sum;
+                }
+            }
+            break;
+    }
+}
+
+/* jsonb access */
+
+static JsonbValue*
+json_get(JsonbContainer* container, const char* key)
+{
+    JsonbValue  k;
+
+    if(container == NULL || !JsonContainerIsObject(container)){
+        return NULL;
+    }
+    k.type = jbvString;
+    k.val.string.val = (char*) key;
+    k.val.string.len = strlen(key);
+    return findJsonbValueFromContainer(container, JB_FOBJECT, &k);
+}
+
+/* the object or array of v, NULL for a scalar */
+static JsonbContainer*
+json_container(JsonbValue* v)
+{
+    return v != NULL && v->type == jbvBinary ? v->val.binary.data : NULL;
+}
+
+static JsonbContainer*
+json_get_container(JsonbContainer* container, const char* key)
+{
+    return json_container(json_get(container, key));
+}
+
+static int
+json_array_size(JsonbContainer* array)
+{
+    return array != NULL && JsonContainerIsArray(array) ? JsonContainerSize(array) : 0;
+}
+
+static char*
+json_string(JsonbValue* v)
+{
+    return v != NULL && v->type == jbvString ? pnstrdup(v->val.string.val, v->val.string.len) : NULL;
+}
+
+/*
+ * a number, a bool or a string holding a number: XGBoost writes its model
+ * parameters as strings, some versions as "[5E-1]"
+ */
+static bool
+json_number(JsonbValue* v, double* result)
+{
+    char*   str;
+    char*   end;
+
+    if(v == NULL){
+        return false;
+    }
+    switch(v->type){
+        case jbvNumeric:
+            *result = DatumGetFloat8(DirectFunctionCall1(numeric_float8, NumericGetDatum(v->val.numeric)));
+            return true;
+        case jbvBool:
+            *result = v->val.boolean ? 1.0 : 0.0;
+            return true;
+        case jbvString:
+            str = json_string(v);
+            while(*str == '[' || *str == ' '){
+                str++;
+            }
+            errno = 0;
+            *result = strtod(str, &end);
+            return end != str && errno == 0;
+        default:
+            return false;
+    }
+}
+
+static double
+json_get_number(JsonbContainer* container, const char* key, const char* path)
+{
+    double  result;
+
+    if(!json_number(json_get(container, key), &result)){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("tree model \"%s\": \"%s\" is missing or not a number", path, key)));
+    }
+    return result;
+}
+
+static double
+json_get_number_default(JsonbContainer* container, const char* key, double def)
+{
+    double  result;
+
+    return json_number(json_get(container, key), &result) ? result : def;
+}
+
+static double
+json_array_number(JsonbContainer* array, int i, const char* key, const char* path)
+{
+    double  result;
+
+    if(!json_number(getIthJsonbValueFromContainer(array, i), &result)){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("tree model \"%s\": element %d of \"%s\" is not a number", path, i, key)));
+    }
+    return result;
+}
+
+static int
+tree_feature_index(double feature, const char* path)
+{
+    if(feature < 0 || feature >= PG_INT32_MAX || feature != std::floor(feature)){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("tree model \"%s\": invalid split feature %g", path, feature)));
+    }
+    return (int) feature;
+}
+
+/* the float threshold t' with x < t' exactly when x <= t, for float x */
+static float
+tree_threshold_le(double t)
+{
+    float f = (float) t;
+
+    if((double) f > t){
+        f = std::nextafter(f, -INFINITY);
+    }
+    return std::nextafter(f, INFINITY);
+}
+
+/*
+ * XGBoost JSON model: learner.gradient_booster.model.trees, each tree a set
+ * of parallel arrays indexed by node id
+ */
+typedef struct XGBoostTree {
+    JsonbContainer* left;
+    JsonbContainer* right;
+    JsonbContainer* split_indices;
+    JsonbContainer* split_conditions;
+    JsonbContainer* default_left;
+    int             nnodes;
+} XGBoostTree;
+
+static void
+xgboost_place_node(TreeEngine* engine, const XGBoostTree& tree, int nid, int32_t idx, float scale,
+                   const char* path, int depth)
+{
+    double  left;
+
+    check_stack_depth();
+    if(nid < 0 || nid >= tree.nnodes || depth > tree.nnodes){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("tree model \"%s\": invalid node %d", path, nid)));
+    }
+
+    left = json_array_number(tree.left, nid, "left_children", path);
+    if(left < 0){
+        engine->value_[idx] = scale * json_array_number(tree.split_conditions, nid, "split_conditions", path);
+        return;
+    }
+
+    int32_t children = engine->add_nodes(2);
+
+    engine->feature_[idx] = tree_feature_index(json_array_number(tree.split_indices, nid, "split_indices", path), path);
+    engine->value_[idx] = (float) json_array_number(tree.split_conditions, nid, "split_conditions", path);
+    engine->left_[idx] = children;
+    if(json_array_number(tree.default_left, nid, "default_left", path) != 0){
+        engine->flags_[idx] |= TREE_NODE_DEFAULT_LEFT;
+    }
+    xgboost_place_node(engine, tree, (int) left, children, scale, path, depth + 1);
+    xgboost_place_node(engine, tree, (int) json_array_number(tree.right, nid, "right_children", path),
+                       children + 1, scale, path, depth + 1);
+}
+
+static void
+xgboost_load_model(TreeEngine* engine, JsonbContainer* learner, const char* path)
+{
+    JsonbContainer* booster = json_get_container(learner, "gradient_booster");
+    JsonbContainer* param = json_get_container(learner, "learner_model_param");
+    JsonbContainer* model;
+    JsonbContainer* trees;
+    JsonbContainer* tree_info;
+    JsonbContainer* weight_drop = NULL;
+    char*           booster_name = json_string(json_get(booster, "name"));
+    char*           objective = json_string(json_get(json_get_container(learner, "objective"), "name"));
+    double          base_score;
+    int             ntrees;
+
+    if(booster_name != NULL && strcmp(booster_name, "dart") == 0){
+        weight_drop = json_get_container(booster, "weight_drop");
+        booster = json_get_container(booster, "gbtree");
+    }else if(booster_name == NULL || strcmp(booster_name, "gbtree") != 0){
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("tree model \"%s\": booster \"%s\" is not supported", path,
+                        booster_name ? booster_name : ""),
+                 errhint("Only the gbtree and dart boosters are.")));
+    }
+    model = json_get_container(booster, "model");
+    trees = json_get_container(model, "trees");
+    tree_info = json_get_container(model, "tree_info");
+    ntrees = json_array_size(trees);
+
+    engine->format_ = "xgboost";
+    engine->num_features_ = (int) json_get_number(param, "num_feature", path);
+    engine->num_outputs_ = Max((int) json_get_number_default(param, "num_class", 0), 1);
+    base_score = json_get_number_default(param, "base_score", 0.5);
+
+    // base_score is given after the objective's transform
+    if(objective == NULL){
+        objective = pstrdup("reg:squarederror");
+    }
+    if(strcmp(objective, "binary:logistic") == 0 || strcmp(objective, "reg:logistic") == 0){
+        engine->transform_ = TREE_SIGMOID;
+        base_score = std::log(base_score / (1.0 - base_score));
+    }else if(strncmp(objective, "multi:", 6) == 0){
+        engine->transform_ = TREE_SOFTMAX;
+    }else if(strcmp(objective, "count:poisson") == 0 || strcmp(objective, "reg:gamma") == 0 ||
+             strcmp(objective, "reg:tweedie") == 0 || strcmp(objective, "survival:cox") == 0){
+        engine->transform_ = TREE_EXP;
+        base_score = std::log(base_score);
+    }
+    engine->base_score_ = base_score;
+
+    for(int t = 0; t < ntrees; t++){
+        JsonbContainer* json_tree = json_container(getIthJsonbValueFromContainer(trees, t));
+        JsonbContainer* split_type = json_get_container(json_tree, "split_type");
+        XGBoostTree     tree;
+        float           scale = 1.0f;
+        int             group = 0;
+
+        for(int i = 0; i < json_array_size(split_type); i++){
+            if(json_array_number(split_type, i, "split_type", path) != 0){
+                ereport(ERROR,
+                        (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                         errmsg("tree model \"%s\": categorical splits are not supported", path)));
+            }
+        }
+
+        tree.left = json_get_container(json_tree, "left_children");
+        tree.right = json_get_container(json_tree, "right_children");
+        tree.split_indices = json_get_container(json_tree, "split_indices");
+        tree.split_conditions = json_get_container(json_tree, "split_conditions");
+        tree.default_left = json_get_container(json_tree, "default_left");
+        tree.nnodes = json_array_size(tree.left);
+        if(tree.nnodes == 0 || json_array_size(tree.right) != tree.nnodes ||
+           json_array_size(tree.split_indices) != tree.nnodes ||
+           json_array_size(tree.split_conditions) != tree.nnodes ||
+           json_array_size(tree.default_left) != tree.nnodes){
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("tree model \"%s\": tree %d is not a valid XGBoost tree", path, t)));
+        }
+
+        if(tree_info != NULL){
+            group = (int) json_array_number(tree_info, t, "tree_info", path);
+        }
+        if(weight_drop != NULL){
+            scale = (float) json_array_number(weight_drop, t, "weight_drop", path);
+        }
+
+        engine->roots_.push_back(engine->add_nodes(1));
+        engine->groups_.push_back(group);
+        xgboost_place_node(engine, tree, 0, engine->roots_.back(), scale, path, 0);
+    }
+}
+
+/*
+ * XGBoost JSON dump: an array of nested trees, the children of a split are
+ * found by their nodeid. A dump records neither the objective nor
+ * base_score nor the number of classes, so the scores are raw margins, the
+ * num_class and base_score model options fill in the rest.
+ */
+static JsonbContainer*
+xgboost_dump_child(JsonbContainer* children, double nodeid, const char* path)
+{
+    for(int i = 0; i < json_array_size(children); i++){
+        JsonbContainer* child = json_container(getIthJsonbValueFromContainer(children, i));
+
+        if(json_get_number(child, "nodeid", path) == nodeid){
+            return child;
+        }
+    }
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("tree model \"%s\": node %g is missing", path, nodeid)));
+    return NULL;
+}
+
+static void
+xgboost_place_dump_node(TreeEngine* engine, JsonbContainer* node, int32_t idx, const char* path)
+{
+    JsonbValue*     split = json_get(node, "split");
+    JsonbContainer* children = json_get_container(node, "children");
+    double          yes;
+    double          feature;
+    char*           name;
+    int32_t         first;
+
+    check_stack_depth();
+    if(split == NULL){
+        engine->value_[idx] = (float) json_get_number(node, "leaf", path);
+        return;
+    }
+
+    // "f<index>" unless the booster had feature names
+    name = json_string(split);
+    if(name != NULL){
+        char* end;
+
+        feature = name[0] == 'f' ? strtod(name + 1, &end) : -1;
+        if(name[0] != 'f' || end == name + 1 || *end != '\0'){
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("tree model \"%s\": split on named feature \"%s\"", path, name),
+                     errhint("Dump the model without feature names, so splits refer to f0, f1, ...")));
+        }
+    }else if(!json_number(split, &feature)){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("tree model \"%s\": invalid split", path)));
+    }
+
+    first = engine->add_nodes(2);
+    yes = json_get_number(node, "yes", path);
+    engine->feature_[idx] = tree_feature_index(feature, path);
+    engine->value_[idx] = (float) json_get_number(node, "split_condition", path);
+    engine->left_[idx] = first;
+    if(json_get_number_default(node, "missing", yes) == yes){
+        engine->flags_[idx] |= TREE_NODE_DEFAULT_LEFT;
+    }
+    engine->num_features_ = Max(engine->num_features_, engine->feature_[idx] + 1);
+    xgboost_place_dump_node(engine, xgboost_dump_child(children, yes, path), first, path);
+    xgboost_place_dump_node(engine, xgboost_dump_child(children, json_get_number(node, "no", path), path),
+                            first + 1, path);
+}
+
+static void
+xgboost_load_dump(TreeEngine* engine, JsonbContainer* trees, const char* path, const ModelEngineOptions* options)
+{
+    int ntrees = json_array_size(trees);
+
+    engine->format_ = "xgboost";
+    if(options != NULL && options->num_class > 0){
+        engine->num_outputs_ = options->num_class;
+    }
+    if(options != NULL && options->has_base_score){
+        engine->base_score_ = options->base_score;
+    }
+    // a multi-class booster adds one tree per class in every round
+    if(ntrees % engine->num_outputs_ != 0){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("tree model \"%s\": %d trees can't be split into %d classes", path, ntrees,
+                        engine->num_outputs_)));
+    }
+    for(int t = 0; t < ntrees; t++){
+        JsonbContainer* tree = json_container(getIthJsonbValueFromContainer(trees, t));
+
+        if(tree == NULL || !JsonContainerIsObject(tree)){
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("tree model \"%s\": tree %d is not an object", path, t)));
+        }
+        engine->roots_.push_back(engine->add_nodes(1));
+        engine->groups_.push_back(t % engine->num_outputs_);
+        xgboost_place_dump_node(engine, tree, engine->roots_.back(), path);
+    }
+}
+
+/* LightGBM JSON dump: tree_info[].tree_structure, nested splits and leaves */
+static void
+lightgbm_place_node(TreeEngine* engine, JsonbContainer* node, int32_t idx, float scale, const char* path)
+{
+    char*   decision_type;
+    char*   missing_type;
+    int32_t first;
+
+    check_stack_depth();
+    if(json_get(node, "split_feature") == NULL){
+        engine->value_[idx] = scale * (float) json_get_number(node, "leaf_value", path);
+        return;
+    }
+
+    decision_type = json_string(json_get(node, "decision_type"));
+    if(decision_type != NULL && strcmp(decision_type, "<=") != 0){
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("tree model \"%s\": decision type \"%s\" is not supported", path, decision_type)));
+    }
+
+    first = engine->add_nodes(2);
+    engine->feature_[idx] = tree_feature_index(json_get_number(node, "split_feature", path), path);
+    engine->value_[idx] = tree_threshold_le(json_get_number(node, "threshold", path));
+    engine->left_[idx] = first;
+    if(json_get_number_default(node, "default_left", 1) != 0){
+        engine->flags_[idx] |= TREE_NODE_DEFAULT_LEFT;
+    }
+    missing_type = json_string(json_get(node, "missing_type"));
+    if(missing_type == NULL || strcmp(missing_type, "None") == 0){
+        engine->flags_[idx] |= TREE_NODE_NAN_AS_ZERO;
+    }else if(strcmp(missing_type, "Zero") == 0){
+        engine->flags_[idx] |= TREE_NODE_ZERO_MISSING;
+    }
+    lightgbm_place_node(engine, json_get_container(node, "left_child"), first, scale, path);
+    lightgbm_place_node(engine, json_get_container(node, "right_child"), first + 1, scale, path);
+}
+
+static void
+lightgbm_load(TreeEngine* engine, JsonbContainer* root, const char* path)
+{
+    JsonbContainer* tree_info = json_get_container(root, "tree_info");
+    char*           objective = json_string(json_get(root, "objective"));
+    char*           param;
+    int             ntrees = json_array_size(tree_info);
+    int             per_iteration = Max((int) json_get_number_default(root, "num_tree_per_iteration", 1), 1);
+    float           scale = 1.0f;
+
+    engine->format_ = "lightgbm";
+    engine->num_features_ = (int) json_get_number(root, "max_feature_idx", path) + 1;
+    engine->num_outputs_ = Max((int) json_get_number_default(root, "num_class", 1), 1);
+
+    // "binary sigmoid:1", "multiclass num_class:3", "regression"
+    if(objective == NULL){
+        objective = pstrdup("regression");
+    }
+    param = strstr(objective, "sigmoid:");
+    if(strncmp(objective, "binary", 6) == 0 || strncmp(objective, "multiclassova", 13) == 0 ||
+       strncmp(objective, "cross_entropy", 13) == 0 || strncmp(objective, "xentropy", 8) == 0){
+        engine->transform_ = TREE_SIGMOID;
+        if(param != NULL){
+            engine->sigmoid_scale_ = strtod(param + strlen("sigmoid:"), NULL);
+        }
+    }else if(strncmp(objective, "multiclass", 10) == 0 || strncmp(objective, "softmax", 7) == 0){
+        engine->transform_ = TREE_SOFTMAX;
+    }else if(strncmp(objective, "poisson", 7) == 0 || strncmp(objective, "gamma", 5) == 0 ||
+             strncmp(objective, "tweedie", 7) == 0){
+        engine->transform_ = TREE_EXP;
+    }
+
+    // random forest mode averages the iterations
+    if(json_get_number_default(root, "average_output", 0) != 0 && ntrees > 0){
+        scale = (float) per_iteration / ntrees;
+    }
+
+    for(int t = 0; t < ntrees; t++){
+        JsonbContainer* info = json_container(getIthJsonbValueFromContainer(tree_info, t));
+        JsonbContainer* structure = json_get_container(info, "tree_structure");
+
+        if(structure == NULL){
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("tree model \"%s\": tree %d has no tree_structure", path, t)));
+        }
+        engine->roots_.push_back(engine->add_nodes(1));
+        engine->groups_.push_back(t % per_iteration);
+        lightgbm_place_node(engine, structure, engine->roots_.back(), scale, path);
+    }
+}
+
+ModelEngine*
+tree_engine_load(const char* path, char* data, Size len, const ModelEngineOptions* options)
+{
+    MemoryContext   parse_context;
+    MemoryContext   old_context;
+    JsonbContainer* root;
+    JsonbContainer* learner;
+    TreeEngine*     engine;
+
+    parse_context = AllocSetContextCreate(CurrentMemoryContext, "tree model", ALLOCSET_DEFAULT_SIZES);
+    old_context = MemoryContextSwitchTo(parse_context);
+
+    root = &DatumGetJsonbP(DirectFunctionCall1(jsonb_in, CStringGetDatum(data)))->root;
+    learner = json_get_container(root, "learner");
+    if(JsonContainerIsScalar(root) ||
+       (JsonContainerIsObject(root) && learner == NULL && json_get(root, "tree_info") == NULL)){
+        MemoryContextSwitchTo(old_context);
+        MemoryContextDelete(parse_context);
+        return NULL;
+    }
+
+    // full models carry their own classes and base score
+    if(!JsonContainerIsArray(root) && options != NULL && (options->num_class > 0 || options->has_base_score)){
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("tree model \"%s\": model options \"num_class\" and \"base_score\" only apply to XGBoost dumps", path)));
+    }
+
+    // the loaders ereport on a malformed file, the engine isn't palloc'ed
+    engine = new TreeEngine();
+    PG_TRY();
+    {
+        try {
+            if(JsonContainerIsArray(root)){
+                xgboost_load_dump(engine, root, path, options);
+            }else if(learner != NULL){
+                xgboost_load_model(engine, learner, path);
+            }else{
+                lightgbm_load(engine, root, path);
+            }
+        }
+        catch (const std::exception& e) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_OUT_OF_MEMORY),
+                     errmsg("tree model \"%s\" could not be loaded, error message: %s", path, e.what())));
+        }
+
+        for(size_t i = 0; i < engine->feature_.size(); i++){
+            if(engine->feature_[i] >= engine->num_features_){
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("tree model \"%s\": split on feature %d of %d", path,
+                                engine->feature_[i], engine->num_features_)));
+            }
+        }
+        for(size_t t = 0; t < engine->groups_.size(); t++){
+            if(engine->groups_[t] < 0 || engine->groups_[t] >= engine->num_outputs_){
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("tree model \"%s\": tree %zu adds to a class the model doesn't have", path, t)));
+            }
+        }
+        if(engine->roots_.empty()){
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("tree model \"%s\" has no trees", path)));
+        }
+    }
+    PG_CATCH();
+    {
+        delete engine;
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    MemoryContextSwitchTo(old_context);
+    MemoryContextDelete(parse_context);
+    return engine;
+}
+
+}
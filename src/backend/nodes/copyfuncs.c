@@ -1152,6 +1152,33 @@ _copyLimit(const Limit *from)
 	return newnode;
 }
 
+/*
+ * _copyPredict
+ */
+static Predict *
+_copyPredict(const Predict *from)
+{
+	Predict    *newnode = makeNode(Predict);
+
+	/*
+	 * copy node superclass fields
+	 */
+	CopyPlanFields((const Plan *) from, (Plan *) newnode);
+
+	/*
+	 * copy remainder of node
+	 */
+	COPY_SCALAR_FIELD(numPredicts);
+	COPY_POINTER_FIELD(predictFuncs, from->numPredicts * sizeof(Oid));
+	COPY_POINTER_FIELD(resultColIdx, from->numPredicts * sizeof(AttrNumber));
+	COPY_POINTER_FIELD(argColIdx, from->numPredicts * sizeof(AttrNumber));
+	COPY_POINTER_FIELD(numArgs, from->numPredicts * sizeof(int));
+	COPY_NODE_FIELD(modelNames);
+	COPY_NODE_FIELD(devices);
+
+	return newnode;
+}
+
 /*
  * _copyNestLoopParam
  */
@@ -4930,6 +4957,9 @@ copyObjectImpl(const void *from)
 		case T_Limit:
 			retval = _copyLimit(from);
 			break;
+		case T_Predict:
+			retval = _copyPredict(from);
+			break;
 		case T_NestLoopParam:
 			retval = _copyNestLoopParam(from);
 			break;
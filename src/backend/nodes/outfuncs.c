@@ -914,6 +914,22 @@ _outLimit(StringInfo str, const Limit *node)
 	WRITE_NODE_FIELD(limitCount);
 }
 
+static void
+_outPredict(StringInfo str, const Predict *node)
+{
+	WRITE_NODE_TYPE("PREDICT");
+
+	_outPlanInfo(str, (const Plan *) node);
+
+	WRITE_INT_FIELD(numPredicts);
+	WRITE_OID_ARRAY(predictFuncs, node->numPredicts);
+	WRITE_ATTRNUMBER_ARRAY(resultColIdx, node->numPredicts);
+	WRITE_ATTRNUMBER_ARRAY(argColIdx, node->numPredicts);
+	WRITE_INT_ARRAY(numArgs, node->numPredicts);
+	WRITE_NODE_FIELD(modelNames);
+	WRITE_NODE_FIELD(devices);
+}
+
 static void
 _outNestLoopParam(StringInfo str, const NestLoopParam *node)
 {
@@ -3776,6 +3792,9 @@ outNode(StringInfo str, const void *obj)
 			case T_Limit:
 				_outLimit(str, obj);
 				break;
+			case T_Predict:
+				_outPredict(str, obj);
+				break;
 			case T_NestLoopParam:
 				_outNestLoopParam(str, obj);
 				break;
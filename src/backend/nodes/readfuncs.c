@@ -2342,6 +2342,27 @@ _readLimit(void)
 	READ_DONE();
 }
 
+/*
+ * _readPredict
+ */
+static Predict *
+_readPredict(void)
+{
+	READ_LOCALS(Predict);
+
+	ReadCommonPlan(&local_node->plan);
+
+	READ_INT_FIELD(numPredicts);
+	READ_OID_ARRAY(predictFuncs, local_node->numPredicts);
+	READ_ATTRNUMBER_ARRAY(resultColIdx, local_node->numPredicts);
+	READ_ATTRNUMBER_ARRAY(argColIdx, local_node->numPredicts);
+	READ_INT_ARRAY(numArgs, local_node->numPredicts);
+	READ_NODE_FIELD(modelNames);
+	READ_NODE_FIELD(devices);
+
+	READ_DONE();
+}
+
 /*
  * _readNestLoopParam
  */
@@ -2786,6 +2807,8 @@ parseNodeString(void)
 		return_value = _readLockRows();
 	else if (MATCH("LIMIT", 5))
 		return_value = _readLimit();
+	else if (MATCH("PREDICT", 7))
+		return_value = _readPredict();
 	else if (MATCH("NESTLOOPPARAM", 13))
 		return_value = _readNestLoopParam();
 	else if (MATCH("PLANROWMARK", 11))
@@ -13,6 +13,7 @@
  *	cpu_operator_cost	Cost of CPU time to execute an operator or function
  *	parallel_tuple_cost Cost of CPU time to pass a tuple from worker to master backend
  *	parallel_setup_cost Cost of setting up shared memory for parallelism
+ *	predict_param_cost	Cost of CPU time per model parameter in one prediction
  *
  * We expect that the kernel will typically do some amount of read-ahead
  * optimization; this in conjunction with seek costs means that seq_page_cost
@@ -114,6 +115,7 @@ double		cpu_index_tuple_cost = DEFAULT_CPU_INDEX_TUPLE_COST;
 double		cpu_operator_cost = DEFAULT_CPU_OPERATOR_COST;
 double		parallel_tuple_cost = DEFAULT_PARALLEL_TUPLE_COST;
 double		parallel_setup_cost = DEFAULT_PARALLEL_SETUP_COST;
+double		predict_param_cost = DEFAULT_PREDICT_PARAM_COST;
 
 int			effective_cache_size = DEFAULT_EFFECTIVE_CACHE_SIZE;
 
@@ -138,6 +140,7 @@ bool		enable_partitionwise_aggregate = false;
 bool		enable_parallel_append = true;
 bool		enable_parallel_hash = true;
 bool		enable_partition_pruning = true;
+bool		enable_predict_batch = true;
 
 typedef struct
 {
@@ -21,6 +21,7 @@
 
 #include "access/sysattr.h"
 #include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
 #include "foreign/fdwapi.h"
 #include "miscadmin.h"
 #include "nodes/extensible.h"
@@ -40,6 +41,7 @@
 #include "parser/parse_clause.h"
 #include "parser/parsetree.h"
 #include "partitioning/partprune.h"
+#include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
 
 
@@ -6213,6 +6215,179 @@ materialize_finished_plan(Plan *subplan)
 	return matplan;
 }
 
+/*
+ * Is expr a predict_float/predict_text call whose model and device are
+ * constants, so that it can be evaluated for a batch of rows at once?
+ */
+static bool
+is_batchable_predict_call(Expr *expr)
+{
+	FuncExpr   *func;
+	int			argno = 0;
+	ListCell   *lc;
+
+	if (!IsA(expr, FuncExpr))
+		return false;
+	func = (FuncExpr *) expr;
+	if (func->funcid != F_PG_PREDICT_FLOAT && func->funcid != F_PG_PREDICT_TEXT)
+		return false;
+	if (func->funcvariadic || list_length(func->args) < 3)
+		return false;
+
+	foreach(lc, func->args)
+	{
+		Const	   *arg = (Const *) lfirst(lc);
+
+		if (argno++ == 2)
+			break;
+		if (!IsA(arg, Const) || arg->constisnull || arg->consttype != CSTRINGOID)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * predict_batch_finished_plan: batch the model calls of a completed plan
+ *
+ * If the final targetlist calls predict_float or predict_text with a
+ * constant model and device, put a Predict node right above the node that
+ * computes the targetlist, looking through Limit and Sort which only pass
+ * their input rows along.  That node then computes the model arguments of
+ * each call as resjunk columns, and the Predict node runs the calls a batch
+ * of rows at a time.  If the calls are computed below a Gather or
+ * GatherMerge, the Predict node goes there too, so that every worker
+ * batches the rows it scans.  Returns the (possibly new) top plan.
+ */
+Plan *
+predict_batch_finished_plan(Plan *top_plan)
+{
+	Plan	   *parent = NULL;
+	Plan	   *subplan = top_plan;
+	Predict    *node;
+	Plan	   *plan;
+	List	   *calls = NIL;
+	List	   *child_tlist = NIL;
+	AttrNumber	resno;
+	ListCell   *lc;
+	int			i;
+
+	while (IsA(subplan, Limit) || IsA(subplan, Sort))
+	{
+		parent = subplan;
+		subplan = subplan->lefttree;
+	}
+	if (IsA(subplan, Gather) || IsA(subplan, GatherMerge))
+	{
+		Plan	   *worker_parent = subplan;
+		Plan	   *worker_plan = subplan->lefttree;
+
+		while (IsA(worker_plan, Sort))
+		{
+			worker_parent = worker_plan;
+			worker_plan = worker_plan->lefttree;
+		}
+		if (is_projection_capable_plan(worker_plan))
+		{
+			foreach(lc, worker_plan->targetlist)
+			{
+				if (is_batchable_predict_call(lfirst_node(TargetEntry, lc)->expr))
+				{
+					parent = worker_parent;
+					subplan = worker_plan;
+					break;
+				}
+			}
+		}
+	}
+	if (!is_projection_capable_plan(subplan))
+		return top_plan;
+
+	foreach(lc, subplan->targetlist)
+	{
+		TargetEntry *tle = lfirst_node(TargetEntry, lc);
+
+		if (is_batchable_predict_call(tle->expr))
+			calls = lappend(calls, tle);
+	}
+	if (calls == NIL)
+		return top_plan;
+
+	node = makeNode(Predict);
+	node->numPredicts = list_length(calls);
+	node->predictFuncs = (Oid *) palloc(sizeof(Oid) * node->numPredicts);
+	node->resultColIdx = (AttrNumber *) palloc(sizeof(AttrNumber) * node->numPredicts);
+	node->argColIdx = (AttrNumber *) palloc(sizeof(AttrNumber) * node->numPredicts);
+	node->numArgs = (int *) palloc(sizeof(int) * node->numPredicts);
+
+	/* the child computes a NULL placeholder in place of each call ... */
+	foreach(lc, subplan->targetlist)
+	{
+		TargetEntry *tle = flatCopyTargetEntry(lfirst_node(TargetEntry, lc));
+
+		if (list_member_ptr(calls, lfirst(lc)))
+			tle->expr = (Expr *) makeNullConst(exprType((Node *) tle->expr),
+											   exprTypmod((Node *) tle->expr),
+											   exprCollation((Node *) tle->expr));
+		child_tlist = lappend(child_tlist, tle);
+	}
+
+	/* ... followed by the model arguments of all calls */
+	resno = list_length(child_tlist);
+	i = 0;
+	foreach(lc, calls)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+		FuncExpr   *func = (FuncExpr *) tle->expr;
+		int			argno = 0;
+		ListCell   *lc2;
+
+		node->predictFuncs[i] = func->funcid;
+		node->resultColIdx[i] = tle->resno;
+		node->argColIdx[i] = resno + 1;
+		node->numArgs[i] = list_length(func->args) - 2;
+		node->modelNames = lappend(node->modelNames,
+								   makeString(pstrdup(DatumGetCString(linitial_node(Const, func->args)->constvalue))));
+		node->devices = lappend(node->devices,
+								makeString(pstrdup(DatumGetCString(lsecond_node(Const, func->args)->constvalue))));
+
+		foreach(lc2, func->args)
+		{
+			if (argno++ < 2)
+				continue;
+			child_tlist = lappend(child_tlist,
+								  makeTargetEntry((Expr *) copyObject(lfirst(lc2)),
+												  ++resno, NULL, true));
+		}
+		i++;
+	}
+
+	plan = &node->plan;
+	plan->targetlist = subplan->targetlist;
+	plan->qual = NIL;
+	plan->lefttree = subplan;
+	plan->righttree = NULL;
+	subplan->targetlist = child_tlist;
+
+	/* the cost of the calls is already part of the child's tlist cost */
+	plan->startup_cost = subplan->startup_cost;
+	plan->total_cost = subplan->total_cost;
+	plan->plan_rows = subplan->plan_rows;
+	plan->plan_width = subplan->plan_width;
+	plan->parallel_aware = false;
+	plan->parallel_safe = subplan->parallel_safe;
+
+	if (parent == NULL)
+	{
+		/* same kluge as materialize_finished_plan for initPlans */
+		plan->initPlan = subplan->initPlan;
+		subplan->initPlan = NIL;
+		return plan;
+	}
+
+	parent->lefttree = plan;
+	return top_plan;
+}
+
 Agg *
 make_agg(List *tlist, List *qual,
 		 AggStrategy aggstrategy, AggSplit aggsplit,
@@ -6846,6 +7021,7 @@ is_projection_capable_plan(Plan *plan)
 		case T_Append:
 		case T_MergeAppend:
 		case T_RecursiveUnion:
+		case T_Predict:
 			return false;
 		case T_ProjectSet:
 
@@ -412,6 +412,14 @@ standard_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 
 	top_plan = create_plan(root, best_path);
 
+	/*
+	 * Evaluate the model calls of the final targetlist in batches, if
+	 * possible.
+	 */
+	if (enable_predict_batch && parse->commandType == CMD_SELECT &&
+		!parse->hasTargetSRFs)
+		top_plan = predict_batch_finished_plan(top_plan);
+
 	/*
 	 * If creating a plan for a scrollable cursor, make sure it can run
 	 * backwards on demand.  Add a Material node at the top at need.
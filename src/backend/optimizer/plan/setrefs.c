@@ -691,6 +691,16 @@ set_plan_refs(PlannerInfo *root, Plan *plan, int rtoffset)
 				}
 			}
 			break;
+		case T_Predict:
+
+			/*
+			 * Predict never evaluates its tlist row by row, but the predict
+			 * calls in it have to refer to the argument columns computed by
+			 * the child, both for the executor and for EXPLAIN.
+			 */
+			set_upper_references(root, plan, rtoffset);
+			Assert(plan->qual == NIL);
+			break;
 		case T_Limit:
 			{
 				Limit	   *splan = (Limit *) plan;
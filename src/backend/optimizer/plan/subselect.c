@@ -2727,6 +2727,7 @@ finalize_plan(PlannerInfo *root, Plan *plan,
 		case T_Unique:
 		case T_SetOp:
 		case T_Group:
+		case T_Predict:
 			/* no node-type-specific fields need fixing */
 			break;
 
@@ -10082,13 +10082,14 @@ LoadStmt:	LOAD file_name
  *****************************************************************************/	
 
 UpdatemdStmt:
-			MODIFY MODEL model_name PATH ICONST SCONST description_clause
+			MODIFY MODEL model_name PATH ICONST SCONST description_clause opt_reloptions
 				{
 					UpdatemdStmt *n = makeNode(UpdatemdStmt);
 					n->mdname = $3;
 					n->looid = $5;
 					n->md5 = $6;
 					n->desc = $7;
+					n->options = $8;
 					$$ = (Node *)n;
 				}
 		;
@@ -10101,7 +10102,7 @@ UpdatemdStmt:
  *****************************************************************************/	
 
 CreatemdStmt:
-			CREATE MODEL model_name PATH ICONST SCONST base_model description_clause
+			CREATE MODEL model_name PATH ICONST SCONST base_model description_clause opt_reloptions
 				{
 					CreatemdStmt *n = makeNode(CreatemdStmt);
 					n->mdname = $3;
@@ -10109,6 +10110,7 @@ CreatemdStmt:
 					n->md5 = $6;
 					n->base_model = $7;
 					n->desc = $8;
+					n->options = $9;
 					$$ = (Node *)n;
 				}
 		;
@@ -17,6 +17,7 @@
 #include "libpq/pqsignal.h"
 #include "access/parallel.h"
 #include "miscadmin.h"
+#include "model/inference_worker.h"
 #include "pgstat.h"
 #include "port/atomics.h"
 #include "postmaster/bgworker_internals.h"
@@ -129,6 +130,9 @@ static const struct
 	},
 	{
 		"ApplyWorkerMain", ApplyWorkerMain
+	},
+	{
+		"InferenceWorkerMain", InferenceWorkerMain
 	}
 };
 
@@ -109,6 +109,7 @@
 #include "pg_getopt.h"
 #include "pgstat.h"
 #include "port/pg_bswap.h"
+#include "model/inference_worker.h"
 #include "postmaster/autovacuum.h"
 #include "postmaster/bgworker_internals.h"
 #include "postmaster/fork_process.h"
@@ -1003,6 +1004,9 @@ PostmasterMain(int argc, char *argv[])
 	 */
 	ApplyLauncherRegister();
 
+	/* likewise for the inference workers */
+	InferenceWorkersRegister();
+
 	/*
 	 * process any libraries that should be preloaded at postmaster start
 	 */
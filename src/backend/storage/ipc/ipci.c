@@ -23,6 +23,11 @@
 #include "access/twophase.h"
 #include "commands/async.h"
 #include "miscadmin.h"
+#include "model/inference_worker.h"
+#include "model/model_cache.h"
+#include "model/model_stats.h"
+#include "model/result_cache.h"
+#include "model/torch_threads.h"
 #include "pgstat.h"
 #include "postmaster/autovacuum.h"
 #include "postmaster/bgworker_internals.h"
@@ -147,6 +152,11 @@ CreateSharedMemoryAndSemaphores(int port)
 		size = add_size(size, BTreeShmemSize());
 		size = add_size(size, SyncScanShmemSize());
 		size = add_size(size, AsyncShmemSize());
+		size = add_size(size, ModelCacheShmemSize());
+		size = add_size(size, InferenceQueueShmemSize());
+		size = add_size(size, TorchThreadsShmemSize());
+		size = add_size(size, ResultCacheShmemSize());
+		size = add_size(size, ModelStatsShmemSize());
 #ifdef EXEC_BACKEND
 		size = add_size(size, ShmemBackendArraySize());
 #endif
@@ -263,6 +273,11 @@ CreateSharedMemoryAndSemaphores(int port)
 	BTreeShmemInit();
 	SyncScanShmemInit();
 	AsyncShmemInit();
+	ModelCacheShmemInit();
+	InferenceQueueShmemInit();
+	TorchThreadsShmemInit();
+	ResultCacheShmemInit();
+	ModelStatsShmemInit();
 
 #ifdef EXEC_BACKEND
 
@@ -9,8 +9,16 @@
 #include "postgres.h"
 #include "fmgr.h"
 
+#include <sys/stat.h>
+
 #include "model/predict_wrapper.h"
+#include "model/result_cache.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/optimizer.h"
 #include "utils/builtins.h"
+#include "utils/syscache.h"
+#include "catalog/base_model_info.h"
+#include "catalog/model_info.h"
 #include "catalog/pg_type_d.h"
 
 
@@ -28,7 +36,17 @@ pg_predict_batch_accum(PG_FUNCTION_ARGS)
     
     /* Create the state data on the first call */
     if (state == NULL)
+    {
         state = makeVecAggState(fcinfo);
+        initVecAggColumnar(state, fcinfo, VECTOR_START_ARG_INDEX);
+    }
+
+    /* numeric features go straight into the batch matrix */
+    if (state->columnar)
+    {
+        appendVecAggFeatures(state, fcinfo, VECTOR_START_ARG_INDEX);
+        PG_RETURN_POINTER(state);
+    }
 
     old_context = MemoryContextSwitchTo(state->ctx);
 
@@ -50,7 +68,25 @@ pg_predict_batch_accum_inv(PG_FUNCTION_ARGS)
     /* finilize has been called */
     Assert((state != NULL) && (state->prcsd_batch_n != 0));
 
-    if (state->nxt_csr == state->prcsd_batch_n) 
+    if (state->nxt_csr == state->prcsd_batch_n && state->columnar)
+    {
+        /* keep the rows accumulated after the last batch */
+        int64   remain = state->feature_rows - state->prcsd_batch_n;
+
+        if (remain > 0)
+            memmove(state->features,
+                    state->features + (int64) state->prcsd_batch_n * state->feature_dim,
+                    remain * state->feature_dim * sizeof(float));
+        state->feature_rows = remain;
+        if (state->out_rows != NULL)
+        {
+            pfree(state->out_rows);
+            state->out_rows = NULL;
+        }
+        state->nxt_csr -= state->prcsd_batch_n;
+        state->prcsd_batch_n -= state->prcsd_batch_n;
+    }
+    else if (state->nxt_csr == state->prcsd_batch_n) 
     {
         for (int i = 0; i < state->prcsd_batch_n; i++) 
         {
@@ -74,7 +110,7 @@ fetch_next_from_predicted_batch(PG_FUNCTION_ARGS, bool ret_float8)
     state = PG_ARGISNULL(0) ? NULL : (VecAggState *) PG_GETARG_POINTER(0);
 
     /* If there were no non-null inputs, return NULL */
-    if (state == NULL || list_length(state->ins) == 0)
+    if (state == NULL || VecAggStateRows(state) == 0)
         return NULL;
 
     /* do batch infer once if need */
@@ -89,9 +125,9 @@ fetch_next_from_predicted_batch(PG_FUNCTION_ARGS, bool ret_float8)
             int64_t total = state->pre_time + state->infer_time + state->post_time;
             ereport(NOTICE, 
                 (errmsg("\nbatch %d:\n"
-                        " pre process: %ld ms(%.2f%%)\n"
-                        " infer: %ld ms(%.2f%%)\n"
-                        " post process: %ld ms(%.2f%%)",
+                        " pre process: %ld us(%.2f%%)\n"
+                        " infer: %ld us(%.2f%%)\n"
+                        " post process: %ld us(%.2f%%)",
                         state->batch_i, 
                         state->pre_time, (state->pre_time / (float)total) * 100, 
                         state->infer_time, (state->infer_time / (float)total)  * 100, 
@@ -101,7 +137,10 @@ fetch_next_from_predicted_batch(PG_FUNCTION_ARGS, bool ret_float8)
 
     /* consume one result */ 
     state = (VecAggState *) PG_GETARG_POINTER(0);
-    ret = (Args*)list_nth(state->outs, state->nxt_csr);
+    if (state->columnar)
+        ret = &state->out_rows[state->nxt_csr];
+    else
+        ret = (Args*)list_nth(state->outs, state->nxt_csr);
     state->nxt_csr++;
 
     return ret;
@@ -140,13 +179,30 @@ pg_predict_float(PG_FUNCTION_ARGS)
     char*           model_name = NULL; 
     char*           cuda = NULL;
 
-    Args*           args = (Args*)palloc((PG_NARGS()-2) * sizeof(Args)); 
+    Args*           args = NULL;
 
     Datum           ret;
+    uint64          input_hash;
+    bool            cacheable;
 
     model_name = PG_GETARG_CSTRING(0);
     cuda       = PG_GETARG_CSTRING(1);
 
+    cacheable = predict_result_cache_size > 0 &&
+                result_cache_hash_args(fcinfo, 2, &input_hash);
+    if (cacheable && result_cache_lookup(model_name, true, input_hash, &ret))
+        PG_RETURN_DATUM(ret);
+
+    // 树模型等由引擎直接对数值参数打分
+    if (predict_native(model_name, fcinfo, 2, true, &ret))
+    {
+        if (cacheable)
+            result_cache_store(model_name, true, input_hash, ret);
+        PG_RETURN_DATUM(ret);
+    }
+
+    args = (Args*)palloc((PG_NARGS()-2) * sizeof(Args));
+
     // 根据传入的列数生成参数
     for (int i = 2; i < PG_NARGS(); i++) {
         switch (get_fn_expr_argtype(fcinfo->flinfo, i)) {
@@ -194,6 +250,8 @@ pg_predict_float(PG_FUNCTION_ARGS)
 
     ret = Float8GetDatum(predict_float(model_name, cuda, args));
     pfree(args);
+    if (cacheable)
+        result_cache_store(model_name, true, input_hash, ret);
     PG_RETURN_DATUM(ret);
 }
 
@@ -209,13 +267,30 @@ pg_predict_text(PG_FUNCTION_ARGS)
     char*           model_name = NULL; 
     char*           cuda = NULL;
 
-    Args*           args = (Args*)palloc((PG_NARGS()-2) * sizeof(Args)); 
+    Args*           args = NULL;
 
     Datum           ret;
+    uint64          input_hash;
+    bool            cacheable;
 
     model_name = PG_GETARG_CSTRING(0);
     cuda       = PG_GETARG_CSTRING(1);
 
+    cacheable = predict_result_cache_size > 0 &&
+                result_cache_hash_args(fcinfo, 2, &input_hash);
+    if (cacheable && result_cache_lookup(model_name, false, input_hash, &ret))
+        PG_RETURN_DATUM(ret);
+
+    // 树模型等由引擎直接对数值参数打分
+    if (predict_native(model_name, fcinfo, 2, false, &ret))
+    {
+        if (cacheable)
+            result_cache_store(model_name, false, input_hash, ret);
+        PG_RETURN_DATUM(ret);
+    }
+
+    args = (Args*)palloc((PG_NARGS()-2) * sizeof(Args));
+
     // 根据传入的列数生成参数
     for (int i = 2; i < PG_NARGS(); i++) {
         switch (get_fn_expr_argtype(fcinfo->flinfo, i)) {
@@ -263,5 +338,89 @@ pg_predict_text(PG_FUNCTION_ARGS)
     
     ret = PointerGetDatum(predict_text(model_name, cuda, args));
     pfree(args);
+    if (cacheable)
+        result_cache_store(model_name, false, input_hash, ret);
     PG_RETURN_TEXT_P(ret);
-}
\ No newline at end of file
+}
+
+/*
+ * number of parameters of a model, estimated from the size of its weight
+ * file assuming float32 weights. -1 if the model or the file is missing.
+ */
+static double
+estimate_model_params(const char* model_name)
+{
+    HeapTuple       tuple;
+    HeapTuple       base_tuple;
+    Datum           datum;
+    bool            isnull;
+    char*           model_path = NULL;
+    struct stat     st;
+
+    tuple = SearchSysCache1(MODELNAME, CStringGetDatum(model_name));
+    if (!HeapTupleIsValid(tuple))
+        return -1;
+
+    // models fine-tuned from a base model use the weight file of the base
+    datum = SysCacheGetAttr(MODELNAME, tuple, Anum_model_info_basemodel, &isnull);
+    if (!isnull)
+    {
+        base_tuple = SearchSysCache1(BASEMODEL, datum);
+        if (HeapTupleIsValid(base_tuple))
+        {
+            datum = SysCacheGetAttr(BASEMODEL, base_tuple, Anum_base_model_info_modelpath, &isnull);
+            if (!isnull)
+                model_path = replace_model_path(TextDatumGetCString(datum));
+            ReleaseSysCache(base_tuple);
+        }
+    }
+    else
+    {
+        datum = SysCacheGetAttr(MODELNAME, tuple, Anum_model_info_modelpath, &isnull);
+        if (!isnull)
+            model_path = replace_model_path(TextDatumGetCString(datum));
+    }
+    ReleaseSysCache(tuple);
+
+    if (model_path == NULL || stat(model_path, &st) != 0)
+        return -1;
+
+    return (double) st.st_size / sizeof(float);
+}
+
+/**
+ * @description: planner support function of predict_float/predict_text, the
+ * cost of a call with a constant model name grows with the model size so
+ * that cheaper quals are checked first. Other calls fall back to procost.
+ * @return {*}
+ */
+Datum
+pg_predict_support(PG_FUNCTION_ARGS)
+{
+    Node*           rawreq = (Node *) PG_GETARG_POINTER(0);
+    Node*           ret = NULL;
+
+    if (IsA(rawreq, SupportRequestCost))
+    {
+        SupportRequestCost* req = (SupportRequestCost *) rawreq;
+        Node*           model;
+        double          nparams;
+
+        if (req->node == NULL || !IsA(req->node, FuncExpr))
+            PG_RETURN_POINTER(NULL);
+
+        model = (Node *) linitial(((FuncExpr *) req->node)->args);
+        if (!IsA(model, Const) || ((Const *) model)->constisnull)
+            PG_RETURN_POINTER(NULL);
+
+        nparams = estimate_model_params(DatumGetCString(((Const *) model)->constvalue));
+        if (nparams < 0)
+            PG_RETURN_POINTER(NULL);
+
+        req->startup = 0;
+        req->per_tuple = nparams * predict_param_cost;
+        ret = (Node *) req;
+    }
+
+    PG_RETURN_POINTER(ret);
+}
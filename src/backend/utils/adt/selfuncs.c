@@ -100,6 +100,7 @@
 #include "access/brin.h"
 #include "access/brin_page.h"
 #include "access/gin.h"
+#include "access/hnsw.h"
 #include "access/table.h"
 #include "access/tableam.h"
 #include "access/visibilitymap.h"
@@ -6487,6 +6488,51 @@ spgcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
 }
 
 
+void
+hnswcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
+				 Cost *indexStartupCost, Cost *indexTotalCost,
+				 Selectivity *indexSelectivity, double *indexCorrelation,
+				 double *indexPages)
+{
+	IndexOptInfo *index = path->indexinfo;
+	GenericCosts costs;
+	Cost		searchCost;
+
+	/* hnsw can't answer anything but ORDER BY a distance */
+	if (path->indexorderbys == NIL)
+	{
+		*indexStartupCost = disable_cost;
+		*indexTotalCost = disable_cost;
+		*indexSelectivity = 0;
+		*indexCorrelation = 0;
+		*indexPages = 0;
+		return;
+	}
+
+	MemSet(&costs, 0, sizeof(costs));
+
+	genericcostestimate(root, path, loop_count, &costs);
+
+	/*
+	 * The whole search runs before the first tuple is returned: the number
+	 * of layers grows with log(N) and each of them is searched with a
+	 * candidate list of about hnsw_ef_search elements.
+	 */
+	if (index->tuples > 1)		/* avoid computing log(0) */
+	{
+		searchCost = ceil(log(index->tuples)) * hnsw_ef_search *
+			cpu_operator_cost;
+		costs.indexStartupCost += searchCost;
+		costs.indexTotalCost += costs.num_sa_scans * searchCost;
+	}
+
+	*indexStartupCost = costs.indexStartupCost;
+	*indexTotalCost = costs.indexTotalCost;
+	*indexSelectivity = costs.indexSelectivity;
+	*indexCorrelation = costs.indexCorrelation;
+	*indexPages = costs.numIndexPages;
+}
+
 /*
  * Support routines for gincostestimate
  */
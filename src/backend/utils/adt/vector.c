@@ -1,16 +1,32 @@
 #include "postgres.h"
 
+#include <float.h>
+#include <math.h>
+
 #include "catalog/pg_type_d.h"
+#include "common/shortest_dec.h"
 #include "lib/stringinfo.h"
 #include "libpq/pqformat.h"
+#include "port/pg_bswap.h"
 #include "utils/builtins.h"
 #include "utils/array.h"
+#include "utils/float.h"
 #include "utils/palloc.h"
 #include "utils/vector.h"
+#include "utils/vector_distance.h"
 #include <stdbool.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define INIT_VECTOR 
 
+/* GUC: print every element instead of eliding the middle of long vectors */
+bool vector_output_full = false;
+
 static inline bool 
 is_space(char ch)
 {
@@ -76,241 +92,301 @@ shape_equal(Vector* vector_left, Vector* vector_right)
     return true;
 }
 
+static inline const char*
+skip_space(const char* p)
+{
+    while(is_space(*p)){
+        p++;
+    }
+    return p;
+}
+
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
 /*
-    parse vector shape
+    parse one float starting at p, like strtof. Plain decimal numbers with
+    up to 19 significant digits and an exponent of at most 22 are computed
+    exactly in double and rounded once to float. Everything else (nan,
+    infinity, hex, more digits, results outside the normal float range or
+    exactly halfway between two floats) goes through strtof.
 */
-static inline void 
-parse_vector_shape_str(char* shape_str, unsigned int* shape_size, int* shape)
+static inline float
+parse_float(const char* p, char** endp)
 {
-    char* str_copy = pstrdup(shape_str);
-    char* pt = NULL;
-    char* end = NULL;
+    const char* s = p;
+    bool neg = false;
+    bool any_digit = false;
+    uint64 mantissa = 0;
+    int ndigits = 0;
+    int exp10 = 0;
+    double d;
+    uint64 bits;
+
+    if(*s == '+' || *s == '-'){
+        neg = (*s == '-');
+        s++;
+    }
+
+    while(*s == '0'){
+        any_digit = true;
+        s++;
+    }
+    while(*s >= '0' && *s <= '9'){
+        if(ndigits == 19){
+            goto slow;
+        }
+        mantissa = mantissa * 10 + (*s - '0');
+        ndigits++;
+        any_digit = true;
+        s++;
+    }
+    if(*s == '.'){
+        s++;
+        if(mantissa == 0){
+            while(*s == '0'){
+                exp10--;
+                any_digit = true;
+                s++;
+            }
+        }
+        while(*s >= '0' && *s <= '9'){
+            if(ndigits == 19){
+                goto slow;
+            }
+            mantissa = mantissa * 10 + (*s - '0');
+            ndigits++;
+            exp10--;
+            any_digit = true;
+            s++;
+        }
+    }
+    if(!any_digit || *s == 'x' || *s == 'X'){
+        goto slow;
+    }
+    if(*s == 'e' || *s == 'E'){
+        const char* e = s + 1;
+        bool exp_neg = false;
+        int exp_value = 0;
 
-    while(is_space(*shape_str)){
-        shape_str++;
+        if(*e == '+' || *e == '-'){
+            exp_neg = (*e == '-');
+            e++;
+        }
+        /* without digits the 'e' isn't part of the number */
+        if(*e >= '0' && *e <= '9'){
+            while(*e >= '0' && *e <= '9'){
+                if(exp_value < 10000){
+                    exp_value = exp_value * 10 + (*e - '0');
+                }
+                e++;
+            }
+            exp10 += exp_neg ? -exp_value : exp_value;
+            s = e;
+        }
     }
 
-    if (*shape_str != '{'){
-        ereport(ERROR,
-				 errmsg("Vector shape must start with \"{\"."));
+    if(mantissa == 0){
+        *endp = (char*) s;
+        return neg ? -0.0f : 0.0f;
     }
 
-    shape_str++;
-    pt = strtok(shape_str, ",");
-    end = pt;
+    if(mantissa > ((uint64) 1 << 53) || exp10 < -22 || exp10 > 22){
+        goto slow;
+    }
 
-    while (pt != NULL && *end != '}') {
-        if (*shape_size == MAX_VECTOR_SHAPE_SIZE) {
-            ereport(ERROR,
-					(errmsg("vector shape cannot have more than %d", MAX_VECTOR_SHAPE_SIZE)));
-        }
+    d = (double) mantissa;
+    d = exp10 < 0 ? d / exact_pow10[-exp10] : d * exact_pow10[exp10];
 
-        while (is_space(*pt)){
-            pt++;
-        }
+    if(!(d >= FLT_MIN && d <= FLT_MAX)){
+        goto slow;
+    }
 
-        if (*pt == '\0') {
-            ereport(ERROR,
-					(errmsg("invalid input syntax for type vector shape: \"%s\"", str_copy)));
-        }
+    /* d is correctly rounded, rounding it again is only wrong at a float midpoint */
+    memcpy(&bits, &d, sizeof(bits));
+    if((bits & (((uint64) 1 << 29) - 1)) == ((uint64) 1 << 28)){
+        goto slow;
+    }
 
-        shape[*shape_size] = strtof(pt, &end);
+    *endp = (char*) s;
+    return neg ? -(float) d : (float) d;
 
-        (*shape_size)++;
+slow:
+    return strtof(p, endp);
+}
 
-        if(end == pt){
-            ereport(ERROR,
-					(errmsg("invalid input syntax for type vector shape: \"%s\"", str_copy)));
-        }
+/*
+    parse the optional shape after the data, p points at the "{"
+*/
+static inline void
+parse_vector_shape_str(const char* str, const char* p, Vector* vector)
+{
+    int64 shape_dim = 1;
+    unsigned int shape_size = 0;
 
-        while(is_space(*end)){
-            end++;
-        }
+    p = skip_space(p + 1);
+
+    for(;;){
+        char* end = NULL;
+        long value;
 
-        if (*end != '\0' && *end != '}'){
+        if(shape_size == MAX_VECTOR_SHAPE_SIZE){
             ereport(ERROR,
-					(errmsg("invalid input syntax for type vector shape: \"%s\"", str_copy)));
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("vector shape cannot have more than %d", MAX_VECTOR_SHAPE_SIZE)));
         }
 
-        pt = strtok(NULL, ",");
-    }
+        errno = 0;
+        value = strtol(p, &end, 10);
+        if(end == p || errno == ERANGE || value < 1 || value > PG_INT32_MAX){
+            ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("invalid input syntax for type vector shape: \"%s\"", str)));
+        }
+        vector->shape[shape_size++] = (int32) value;
+        shape_dim *= value;
+        if(shape_dim > MAX_VECTOR_DIM){
+            shape_dim = (int64) MAX_VECTOR_DIM + 1;
+        }
 
-    if (end == NULL || *end != '}'){
+        p = skip_space(end);
+        if(*p == ','){
+            p = skip_space(p + 1);
+            continue;
+        }
+        if(*p == '}'){
+            break;
+        }
         ereport(ERROR,
-					(errmsg("malformed vector literal4: \"%s\"", str_copy)));
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type vector shape: \"%s\"", str)));
     }
 
-    end++;
-
-    while (is_space(*end)){
-        end++;
-    }
-
-    for(pt = str_copy + 1; *pt != '\0'; pt++){
-        if (pt[-1] == ',' && *pt == ','){
-            ereport(ERROR,
-					(errmsg("malformed vector literal5: \"%s\"", str_copy)));
-        }
+    p = skip_space(p + 1);
+    if(*p != '\0'){
+        ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("malformed vector literal: \"%s\"", str)));
     }
 
-    if(*shape_size < 1){
+    if(shape_dim != vector->dim){
         ereport(ERROR,
-					(errmsg("vector must have at least 1 dimension")));
+					(errmsg("the multiplication of shape values not equals, dim:%d, shape_dim:%lld",
+                            vector->dim, (long long) shape_dim)));
     }
-
-    pfree(str_copy);
+    vector->shape_size = shape_size;
 }
 
-static inline void 
-parse_vector_str(char* str, unsigned int* dim, float* x,
-                 unsigned int* shape_size, int32* shape)
+/*
+    parse "[x,...]" with an optional "{shape}" in one pass. The commas are
+    counted first, so the vector is allocated once at its final size and the
+    values are parsed straight into it.
+*/
+static Vector*
+parse_vector_str(const char* str)
 {
-    char* str_copy = pstrdup(str);
-    char* index = str_copy;
-    char* pt = NULL;
-    char* end = NULL;
-
-    while(is_space(*str)){
-        str++;
-    }
+    const char* p = skip_space(str);
+    int64 max_dim = 1;
+    unsigned int dim = 0;
+    Vector* vector;
 
-    if (*str != '['){
+    if(*p != '['){
         ereport(ERROR,
-				 errmsg("Vector contents must start with \"[\"."));
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("Vector contents must start with \"[\".")));
     }
+    p++;
 
-    str++;
-    pt = strtok(str, ",");
-    end = pt;
-
-    while (pt != NULL && *end != ']') {
-        if (*dim == MAX_VECTOR_DIM) {
-            ereport(ERROR,
-					(errmsg("vector cannot have more than %d dimensions", MAX_VECTOR_DIM)));
+    for(const char* c = p; *c != '\0' && *c != ']'; c++){
+        if(*c == ','){
+            max_dim++;
         }
+    }
+    if(max_dim > MAX_VECTOR_DIM){
+        ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("vector cannot have more than %d dimensions", MAX_VECTOR_DIM)));
+    }
 
-        while (is_space(*pt)){
-            pt++;
-        }
+    vector = new_vector((unsigned int) max_dim, 0);
 
-        if (*pt == '\0') {
-            ereport(ERROR,
-					(errmsg("invalid input syntax for type vector: \"%s\"", str_copy)));
-        }
-
-        x[*dim] = strtof(pt, &end);
+    p = skip_space(p);
+    if(*p == ']'){
+        ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("vector must have at least 1 dimension")));
+    }
 
-        (*dim)++;
+    for(;;){
+        char* end = NULL;
 
-        if(end == pt){
+        vector->x[dim++] = parse_float(p, &end);
+        if(end == p){
             ereport(ERROR,
-					(errmsg("invalid input syntax for type vector: \"%s\"", str_copy)));
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("invalid input syntax for type vector: \"%s\"", str)));
         }
 
-        while(is_space(*end)){
-            end++;
+        p = skip_space(end);
+        if(*p == ','){
+            p = skip_space(p + 1);
+            continue;
         }
-
-        if (*end != '\0' && *end != ']'){
-            ereport(ERROR,
-					(errmsg("invalid input syntax for type vector: \"%s\"", str_copy)));
+        if(*p == ']'){
+            break;
         }
-
-        pt = strtok(NULL, ",");
-    }
-
-    if (end == NULL || *end != ']'){
         ereport(ERROR,
-					(errmsg("malformed vector literal3: \"%s\"", str_copy)));
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type vector: \"%s\"", str)));
     }
 
-    end++;
-
-    while (is_space(*end)){
-        end++;
-    }
+    /* every comma separated two values */
+    Assert(dim == max_dim);
 
-    switch (*end) {
+    p = skip_space(p + 1);
+    switch (*p) {
         case '{':
-            while(*str_copy != '{'){
-                str_copy++;
-            }
-            parse_vector_shape_str(str_copy, shape_size, shape);
-            str_copy = index;
+            parse_vector_shape_str(str, p, vector);
             break;
         case '\0':
-            *shape_size = 1;
-            shape[0] = (int32)(*dim);
+            vector->shape_size = 1;
+            vector->shape[0] = (int32) dim;
             break;
         default:
             ereport(ERROR,
-					(errmsg("malformed vector literal1: \"%s\"", str_copy)));
-    }
-
-    for(pt = str_copy + 1; *pt != '\0'; pt++){
-        if (pt[-1] == ',' && *pt == ','){
-            ereport(ERROR,
-					(errmsg("malformed vector literal2: \"%s\"", str_copy)));
-        }
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("malformed vector literal: \"%s\"", str)));
     }
 
-    if(*dim < 1){
-        ereport(ERROR,
-					(errmsg("vector must have at least 1 dimension")));
-    }
-
-    pfree(str_copy);
-
+    return vector;
 }
 
 Datum
 vector_input(PG_FUNCTION_ARGS)
 {
-    char            *str = NULL;
-    float           *x = palloc(sizeof(float) * MAX_VECTOR_DIM);
-    int32           shape[MAX_VECTOR_SHAPE_SIZE];
-    Vector*         vector = NULL;
-    unsigned int    dim = 0;
-    unsigned int    shape_size = 0;
-    unsigned int    shape_dim = 1;
-    
-    str = PG_GETARG_CSTRING(0);
-
-
-    parse_vector_str(str, &dim, x, &shape_size, shape);
-
+    char* str = PG_GETARG_CSTRING(0);
 
-    // if(PG_NARGS() == 1){
-    //     shape_size = 1;
-    //     shape[0] = dim;
-    // }else{
-    //     shape_str = PG_GETARG_CSTRING(0);
-    //     ereport(INFO,
-	// 				(errmsg("shape_str:%s", shape_str)));
-    //     parse_vector_shape_str(shape_str, &shape_size, shape);
-    // }
-
-    // Verify that the multiplication of shape values equals dim
-    for(int i=0; i<shape_size; i++){
-        shape_dim *= shape[i];
-    }
-
-    if(dim != shape_dim){
-        ereport(ERROR,
-					(errmsg("the multiplication of shape values not equals, dim:%d, shape_dim:%d", dim, shape_dim)));
-    }
-    vector = new_vector(dim, shape_size);
+    PG_RETURN_POINTER(parse_vector_str(str));
+}
 
-    for(int i=0; i<dim; ++i){
-        vector->x[i] = x[i];
-    }
+/*
+    append one element the way float4out prints it, without the fmgr call
+    and palloc per element
+*/
+static inline void
+append_float4(StringInfo buf, float4 num)
+{
+    enlargeStringInfo(buf, FLOAT_SHORTEST_DECIMAL_LEN + 16);
 
-    for(int i=0; i<shape_size; ++i){
-        vector->shape[i] = shape[i];
+    if(extra_float_digits > 0){
+        buf->len += float_to_shortest_decimal_bufn(num, buf->data + buf->len);
+    }else{
+        buf->len += pg_strfromd(buf->data + buf->len, FLOAT_SHORTEST_DECIMAL_LEN + 16,
+                                FLT_DIG + extra_float_digits, num);
     }
-
-    pfree(x);
-    PG_RETURN_POINTER(vector);
+    buf->data[buf->len] = '\0';
 }
 
 Datum
@@ -320,6 +396,7 @@ vector_output(PG_FUNCTION_ARGS)
     StringInfoData result;
     unsigned int dim = 0;
     unsigned int shape_size = 0;
+    char int_buf[12];
 
     vector = PG_GETARG_VECTOR_P(0);
 
@@ -339,22 +416,23 @@ vector_output(PG_FUNCTION_ARGS)
 
     initStringInfo(&result);
     appendStringInfoChar(&result, '[');
-    if(dim > 10){
+    /* pg_dump sets extra_float_digits to 3, its output must read back */
+    if(dim > 10 && !vector_output_full && extra_float_digits < 3){
         for(int i=0; i<3; ++i){
-            appendStringInfoString(&result, DatumGetCString(DirectFunctionCall1(float4out, Float4GetDatum(vector->x[i]))));
+            append_float4(&result, vector->x[i]);
             appendStringInfoChar(&result, ',');
         }
         appendStringInfoString(&result, "....");
         appendStringInfoChar(&result, ',');
         for(int i=dim-3; i<dim; ++i){
-            appendStringInfoString(&result, DatumGetCString(DirectFunctionCall1(float4out, Float4GetDatum(vector->x[i]))));
+            append_float4(&result, vector->x[i]);
             if (i != dim - 1) {
                 appendStringInfoChar(&result, ',');
             }
         }
     }else{
         for(int i=0; i<dim; ++i){
-            appendStringInfoString(&result, DatumGetCString(DirectFunctionCall1(float4out, Float4GetDatum(vector->x[i]))));
+            append_float4(&result, vector->x[i]);
             if (i != dim - 1) {
                 appendStringInfoChar(&result, ',');
             }
@@ -364,7 +442,8 @@ vector_output(PG_FUNCTION_ARGS)
     
     appendStringInfoChar(&result, '{');
     for(int i=0; i<shape_size; ++i){
-        appendStringInfoString(&result, DatumGetCString(DirectFunctionCall1(int4out, Int32GetDatum(vector->shape[i]))));
+        pg_ltoa(vector->shape[i], int_buf);
+        appendStringInfoString(&result, int_buf);
         if (i != shape_size - 1) {
             appendStringInfoChar(&result, ',');
         }
@@ -374,26 +453,127 @@ vector_output(PG_FUNCTION_ARGS)
     PG_RETURN_CSTRING(result.data);
 }
 
+/*
+    copy n 32-bit words swapping each between host and network byte order.
+    SSE2 and NEON are part of the x86-64 and aarch64 baselines, so they are
+    used without a runtime check.
+*/
+static void
+copy_swap32(char* dst, const char* src, unsigned int n)
+{
+#ifdef WORDS_BIGENDIAN
+    memcpy(dst, src, sizeof(uint32) * (size_t) n);
+#else
+    unsigned int i = 0;
+
+#if defined(__SSE2__)
+    for(; i + 4 <= n; i += 4){
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + 4 * i));
+
+        /* swap the bytes of each 16-bit half, then the halves */
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i*) (dst + 4 * i), v);
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    for(; i + 4 <= n; i += 4){
+        vst1q_u8((uint8_t*) (dst + 4 * i), vrev32q_u8(vld1q_u8((const uint8_t*) (src + 4 * i))));
+    }
+#endif
+    for(; i < n; i++){
+        uint32 v;
+
+        memcpy(&v, src + 4 * i, sizeof(v));
+        v = pg_bswap32(v);
+        memcpy(dst + 4 * i, &v, sizeof(v));
+    }
+#endif
+}
+
+/*
+    binary format, all integers in network byte order:
+
+        int32   dim
+        int16   format version (VECTOR_BINARY_VERSION)
+        int16   shape_size
+        int32   shape[shape_size]
+        float4  x[dim]
+
+    The first format was just dim and the data, it is still accepted and
+    recognized by its length.
+*/
+#define VECTOR_BINARY_VERSION 1
+
 Datum
 vector_receive(PG_FUNCTION_ARGS)
 {
     StringInfo        str;
     Vector*           result = NULL;
     unsigned int      dim = 0;
-    int               vector_size;
+    unsigned int      shape_size = 1;
+    int32             shape[MAX_VECTOR_SHAPE_SIZE];
+    int64             shape_dim = 1;
+    int               remaining;
 
     str = (StringInfo)PG_GETARG_POINTER(0);
-    dim = pq_getmsgint(str, sizeof(unsigned int));
+    dim = (unsigned int) pq_getmsgint(str, sizeof(int32));
 
-    vector_size = VECTOR_SIZE(dim);
+    if(dim < 1 || dim > MAX_VECTOR_DIM){
+        ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid vector dimension %u in external binary value", dim)));
+    }
 
-    result = (Vector *)palloc(vector_size);
-    SET_VARSIZE(result, vector_size);
+    remaining = str->len - str->cursor;
+    if(remaining == (int64) sizeof(float4) * dim){
+        shape[0] = (int32) dim;
+    }else{
+        int version = pq_getmsgint(str, sizeof(int16));
 
-    result->dim = dim;
-    for(int i=0; i<dim; ++i){
-        result->x[i] = pq_getmsgfloat4(str);
+        if(version != VECTOR_BINARY_VERSION){
+            ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("unsupported vector binary format version %d", version)));
+        }
+
+        shape_size = pq_getmsgint(str, sizeof(int16));
+        if(shape_size < 1 || shape_size > MAX_VECTOR_SHAPE_SIZE){
+            ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid vector shape size %u in external binary value", shape_size)));
+        }
+
+        shape_dim = 1;
+        for(int i=0; i<shape_size; ++i){
+            shape[i] = (int32) pq_getmsgint(str, sizeof(int32));
+            if(shape[i] < 1){
+                ereport(ERROR,
+						(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+						 errmsg("invalid vector shape in external binary value")));
+            }
+            shape_dim = Min(shape_dim * shape[i], (int64) MAX_VECTOR_DIM + 1);
+        }
+
+        if(shape_dim != dim){
+            ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("the multiplication of shape values not equals, dim:%u, shape_dim:%lld",
+							dim, (long long) shape_dim)));
+        }
+
+        if(str->len - str->cursor != (int64) sizeof(float4) * dim){
+            ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("incorrect vector data length in external binary value")));
+        }
+    }
+
+    result = new_vector(dim, shape_size);
+    for(int i=0; i<shape_size; ++i){
+        result->shape[i] = shape[i];
     }
+    copy_swap32((char*) result->x, pq_getmsgbytes(str, sizeof(float4) * dim), dim);
 
     PG_RETURN_POINTER(result);
 }
@@ -403,12 +583,19 @@ vector_send(PG_FUNCTION_ARGS)
 {
     Vector	        *vector = PG_GETARG_VECTOR_P(0);
 	StringInfoData  str;
+    size_t          data_size = sizeof(float4) * (size_t) vector->dim;
 
 	pq_begintypsend(&str);
-	pq_sendint(&str, vector->dim, sizeof(unsigned int));
-	for (int i = 0; i < vector->dim; ++i){
-        pq_sendfloat4(&str, vector->x[i]);
+    enlargeStringInfo(&str, 2 * sizeof(int32) + sizeof(int32) * vector->shape_size + data_size);
+	pq_sendint32(&str, vector->dim);
+    pq_sendint16(&str, VECTOR_BINARY_VERSION);
+    pq_sendint16(&str, vector->shape_size);
+    for(int i=0; i<vector->shape_size; ++i){
+        pq_sendint32(&str, vector->shape[i]);
     }
+    copy_swap32(str.data + str.len, (const char*) vector->x, vector->dim);
+    str.len += data_size;
+    str.data[str.len] = '\0';
 
 	PG_RETURN_BYTEA_P(pq_endtypsend(&str));
 }
@@ -485,36 +672,12 @@ text_to_vector(PG_FUNCTION_ARGS)
 {
     char             *str = NULL;
     Vector           *vector = NULL;
-    unsigned int     dim = 0;
-    int32            shape[MAX_VECTOR_SHAPE_SIZE];
-    float            *x = palloc(sizeof(float) * MAX_VECTOR_DIM);
-    unsigned int     shape_size = 0;
-    unsigned int     shape_dim = 1;
 
     str = TextDatumGetCString(PG_GETARG_DATUM(0));
 
-    parse_vector_str(str, &dim, x, &shape_size, shape);
-
-    for(int i=0; i<shape_size; i++){
-        shape_dim *= shape[i];
-    }
-
-    if(dim != shape_dim){
-        ereport(ERROR,
-					(errmsg("the multiplication of shape values not equals, dim:%d, shape_dim:%d", dim, shape_dim)));
-    }
-
-    vector = new_vector(dim, shape_size);
-    
-    for(int i=0; i<dim; ++i){
-        vector->x[i] = x[i];
-    }
+    vector = parse_vector_str(str);
 
-    for(int i=0; i<shape_size; ++i){
-        vector->shape[i] = shape[i];
-    }
-
-    pfree(x);
+    pfree(str);
     PG_RETURN_POINTER(vector);
 }
 
@@ -679,4 +842,67 @@ vector_equal(PG_FUNCTION_ARGS)
     }
 
     PG_RETURN_BOOL(true);
-}
\ No newline at end of file
+}
+
+static inline void
+check_distance_dims(Vector* vector_left, Vector* vector_right)
+{
+    if(vector_left->dim != vector_right->dim){
+        ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("the two vectors have different dimensions!")));
+    }
+}
+
+/*
+    distance functions, the shape is ignored and the data compared as a flat
+    array. Also the support functions of the hnsw operator classes.
+*/
+Datum
+vector_l2_distance(PG_FUNCTION_ARGS)
+{
+    Vector	        *vector_left = PG_GETARG_VECTOR_P(0);
+    Vector          *vector_right = PG_GETARG_VECTOR_P(1);
+
+    check_distance_dims(vector_left, vector_right);
+
+    PG_RETURN_FLOAT8(sqrt((double) vector_l2_squared_kernel(vector_left->x, vector_right->x,
+                                                            vector_left->dim)));
+}
+
+Datum
+vector_inner_product(PG_FUNCTION_ARGS)
+{
+    Vector	        *vector_left = PG_GETARG_VECTOR_P(0);
+    Vector          *vector_right = PG_GETARG_VECTOR_P(1);
+
+    check_distance_dims(vector_left, vector_right);
+
+    PG_RETURN_FLOAT8((double) vector_inner_product_kernel(vector_left->x, vector_right->x,
+                                                          vector_left->dim));
+}
+
+/* for <#>, so that ascending order puts the largest inner product first */
+Datum
+vector_negative_inner_product(PG_FUNCTION_ARGS)
+{
+    Vector	        *vector_left = PG_GETARG_VECTOR_P(0);
+    Vector          *vector_right = PG_GETARG_VECTOR_P(1);
+
+    check_distance_dims(vector_left, vector_right);
+
+    PG_RETURN_FLOAT8(-(double) vector_inner_product_kernel(vector_left->x, vector_right->x,
+                                                           vector_left->dim));
+}
+
+Datum
+vector_cosine_distance(PG_FUNCTION_ARGS)
+{
+    Vector	        *vector_left = PG_GETARG_VECTOR_P(0);
+    Vector          *vector_right = PG_GETARG_VECTOR_P(1);
+
+    check_distance_dims(vector_left, vector_right);
+
+    PG_RETURN_FLOAT8((double) vector_cosine_distance_kernel(vector_left->x, vector_right->x,
+                                                            vector_left->dim));
+}
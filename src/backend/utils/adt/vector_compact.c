@@ -0,0 +1,673 @@
+#include "postgres.h"
+
+#include <float.h>
+#include <math.h>
+
+#include "libpq/pqformat.h"
+#include "utils/builtins.h"
+#include "utils/fmgrprotos.h"
+#include "utils/vector.h"
+#include "utils/vector_compact.h"
+#include "utils/vector_distance.h"
+
+/*
+    halfvec, bf16vec and int8vec. The text format is the one of vector, input
+    and output go through a vector. Distances are computed on the compact
+    elements by the kernels of vector_distance.c.
+*/
+
+typedef enum CompactKind
+{
+    COMPACT_HALF,
+    COMPACT_BF16,
+    COMPACT_INT8
+} CompactKind;
+
+static const char* const compact_type_names[] = {"halfvec", "bf16vec", "int8vec"};
+
+#define COMPACT_ELEM_SIZE(kind_) ((kind_) == COMPACT_INT8 ? sizeof(int8) : sizeof(uint16))
+
+static CompactVector*
+new_compact_vector(CompactKind kind, unsigned int dim, unsigned int shape_size)
+{
+    Size size = COMPACT_VECTOR_SIZE(dim, shape_size, COMPACT_ELEM_SIZE(kind));
+    CompactVector* vector = (CompactVector*) palloc0(size);
+
+    SET_VARSIZE(vector, size);
+    vector->dim = dim;
+    vector->shape_size = (uint16) shape_size;
+    vector->scale = 1;
+
+    return vector;
+}
+
+static inline void
+check_compact_dims(CompactVector* vector_left, CompactVector* vector_right)
+{
+    if(vector_left->dim != vector_right->dim){
+        ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("the two vectors have different dimensions!")));
+    }
+}
+
+static inline bool
+compact_shape_equal(CompactVector* vector_left, CompactVector* vector_right)
+{
+    int32* shape_left = COMPACT_VECTOR_SHAPE(vector_left);
+    int32* shape_right = COMPACT_VECTOR_SHAPE(vector_right);
+
+    if(vector_left->shape_size <= 1 && vector_right->shape_size <= 1){
+        return true;
+    }
+    if(vector_left->shape_size != vector_right->shape_size){
+        return false;
+    }
+    for(int i=0; i<vector_left->shape_size; ++i){
+        if(shape_left[i] != shape_right[i]){
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline float
+compact_to_float(CompactKind kind, uint16 h)
+{
+    return kind == COMPACT_BF16 ? bf16_to_float(h) : half_to_float(h);
+}
+
+/* round to the 2-byte format, finite values that overflow are an error */
+static inline uint16
+float_to_compact_checked(CompactKind kind, float x)
+{
+    uint16 h = kind == COMPACT_BF16 ? float_to_bf16(x) : float_to_half(x);
+
+    if(isinf(compact_to_float(kind, h)) && !isinf(x)){
+        ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("value %g is out of range for type %s", x, compact_type_names[kind])));
+    }
+    return h;
+}
+
+/*
+    int8vec stores round(x / scale) with scale = max|x| / 127, so the largest
+    element maps to +-127. A vector of zeros gets scale 1.
+*/
+static CompactVector*
+vector_to_compact(Vector* vector, CompactKind kind)
+{
+    unsigned int shape_size = vector->shape_size > 1 ? vector->shape_size : 1;
+    CompactVector* result = new_compact_vector(kind, vector->dim, shape_size);
+
+    if(shape_size > 1){
+        memcpy(COMPACT_VECTOR_SHAPE(result), vector->shape, sizeof(int32) * shape_size);
+    }
+
+    if(kind == COMPACT_INT8){
+        int8* q = COMPACT_VECTOR_INT8(result);
+        float max_abs = 0;
+
+        for(int i=0; i<vector->dim; ++i){
+            float a = fabsf(vector->x[i]);
+
+            if(!isfinite(a)){
+                ereport(ERROR,
+							(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+							 errmsg("int8vec elements must be finite")));
+            }
+            if(a > max_abs){
+                max_abs = a;
+            }
+        }
+
+        result->scale = max_abs > 0 ? Max(max_abs / INT8VEC_MAX, FLT_TRUE_MIN) : 1;
+        for(int i=0; i<vector->dim; ++i){
+            float r = rintf(vector->x[i] / result->scale);
+
+            q[i] = (int8) Max(Min(r, INT8VEC_MAX), -INT8VEC_MAX);
+        }
+    }else{
+        uint16* h = COMPACT_VECTOR_HALF(result);
+
+        for(int i=0; i<vector->dim; ++i){
+            h[i] = float_to_compact_checked(kind, vector->x[i]);
+        }
+    }
+
+    return result;
+}
+
+static Vector*
+compact_to_vector(CompactVector* vector, CompactKind kind)
+{
+    Vector* result = new_vector(vector->dim, vector->shape_size > 1 ? vector->shape_size : 1);
+
+    if(vector->shape_size > 1){
+        memcpy(result->shape, COMPACT_VECTOR_SHAPE(vector), sizeof(int32) * vector->shape_size);
+    }else{
+        result->shape[0] = (int32) vector->dim;
+    }
+
+    if(kind == COMPACT_INT8){
+        int8* q = COMPACT_VECTOR_INT8(vector);
+
+        for(int i=0; i<vector->dim; ++i){
+            result->x[i] = vector->scale * q[i];
+        }
+    }else{
+        uint16* h = COMPACT_VECTOR_HALF(vector);
+
+        for(int i=0; i<vector->dim; ++i){
+            result->x[i] = compact_to_float(kind, h[i]);
+        }
+    }
+
+    return result;
+}
+
+static Datum
+compact_input(FunctionCallInfo fcinfo, CompactKind kind)
+{
+    Vector* vector = DatumGetVector(DirectFunctionCall1(vector_input, PG_GETARG_DATUM(0)));
+
+    PG_RETURN_POINTER(vector_to_compact(vector, kind));
+}
+
+static Datum
+compact_output(FunctionCallInfo fcinfo, CompactKind kind)
+{
+    Vector* vector = compact_to_vector(PG_GETARG_COMPACT_VECTOR_P(0), kind);
+
+    return DirectFunctionCall1(vector_output, PointerGetDatum(vector));
+}
+
+/*
+    binary format, all integers in network byte order:
+
+        int32   dim
+        int16   format version (COMPACT_VECTOR_BINARY_VERSION)
+        int16   shape_size
+        int32   shape[shape_size]
+        float4  scale               int8vec only
+        uint16  x[dim]              halfvec and bf16vec, the raw 2-byte values
+        int8    x[dim]              int8vec
+*/
+#define COMPACT_VECTOR_BINARY_VERSION 1
+
+static Datum
+compact_receive(FunctionCallInfo fcinfo, CompactKind kind)
+{
+    StringInfo      str = (StringInfo) PG_GETARG_POINTER(0);
+    CompactVector*  result;
+    unsigned int    dim;
+    unsigned int    shape_size;
+    int32           shape[MAX_VECTOR_SHAPE_SIZE];
+    int64           shape_dim = 1;
+    int             version;
+
+    dim = (unsigned int) pq_getmsgint(str, sizeof(int32));
+    if(dim < 1 || dim > MAX_VECTOR_DIM){
+        ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid %s dimension %u in external binary value",
+						compact_type_names[kind], dim)));
+    }
+
+    version = pq_getmsgint(str, sizeof(int16));
+    if(version != COMPACT_VECTOR_BINARY_VERSION){
+        ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("unsupported %s binary format version %d",
+						compact_type_names[kind], version)));
+    }
+
+    shape_size = pq_getmsgint(str, sizeof(int16));
+    if(shape_size < 1 || shape_size > MAX_VECTOR_SHAPE_SIZE){
+        ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid %s shape size %u in external binary value",
+						compact_type_names[kind], shape_size)));
+    }
+    for(int i=0; i<shape_size; ++i){
+        shape[i] = (int32) pq_getmsgint(str, sizeof(int32));
+        if(shape[i] < 1){
+            ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid %s shape in external binary value", compact_type_names[kind])));
+        }
+        shape_dim = Min(shape_dim * shape[i], (int64) MAX_VECTOR_DIM + 1);
+    }
+    if(shape_dim != dim){
+        ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("the multiplication of shape values not equals, dim:%u, shape_dim:%lld",
+						dim, (long long) shape_dim)));
+    }
+
+    result = new_compact_vector(kind, dim, shape_size);
+    if(shape_size > 1){
+        memcpy(COMPACT_VECTOR_SHAPE(result), shape, sizeof(int32) * shape_size);
+    }
+
+    if(kind == COMPACT_INT8){
+        result->scale = pq_getmsgfloat4(str);
+        if(!isfinite(result->scale) || result->scale <= 0){
+            ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid int8vec scale in external binary value")));
+        }
+        if(str->len - str->cursor != (int64) dim){
+            ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("incorrect int8vec data length in external binary value")));
+        }
+        pq_copymsgbytes(str, COMPACT_VECTOR_DATA(result), dim);
+    }else{
+        uint16* h = COMPACT_VECTOR_HALF(result);
+
+        if(str->len - str->cursor != (int64) sizeof(uint16) * dim){
+            ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("incorrect %s data length in external binary value",
+							compact_type_names[kind])));
+        }
+        for(int i=0; i<dim; ++i){
+            h[i] = (uint16) pq_getmsgint(str, sizeof(uint16));
+        }
+    }
+
+    PG_RETURN_POINTER(result);
+}
+
+static Datum
+compact_send(FunctionCallInfo fcinfo, CompactKind kind)
+{
+    CompactVector*  vector = PG_GETARG_COMPACT_VECTOR_P(0);
+    StringInfoData  str;
+    int32*          shape = COMPACT_VECTOR_SHAPE(vector);
+
+    pq_begintypsend(&str);
+    enlargeStringInfo(&str, 4 * sizeof(int32) + sizeof(int32) * vector->shape_size +
+                      COMPACT_ELEM_SIZE(kind) * (Size) vector->dim);
+    pq_sendint32(&str, vector->dim);
+    pq_sendint16(&str, COMPACT_VECTOR_BINARY_VERSION);
+    if(vector->shape_size > 1){
+        pq_sendint16(&str, vector->shape_size);
+        for(int i=0; i<vector->shape_size; ++i){
+            pq_sendint32(&str, shape[i]);
+        }
+    }else{
+        pq_sendint16(&str, 1);
+        pq_sendint32(&str, vector->dim);
+    }
+
+    if(kind == COMPACT_INT8){
+        pq_sendfloat4(&str, vector->scale);
+        pq_sendbytes(&str, COMPACT_VECTOR_DATA(vector), vector->dim);
+    }else{
+        uint16* h = COMPACT_VECTOR_HALF(vector);
+
+        for(int i=0; i<vector->dim; ++i){
+            pq_sendint16(&str, h[i]);
+        }
+    }
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&str));
+}
+
+/*
+    + and - of halfvec and bf16vec, computed in float and rounded once
+*/
+static Datum
+compact_add_sub(FunctionCallInfo fcinfo, CompactKind kind, bool sub)
+{
+    CompactVector*  vector_left = PG_GETARG_COMPACT_VECTOR_P(0);
+    CompactVector*  vector_right = PG_GETARG_COMPACT_VECTOR_P(1);
+    CompactVector*  result;
+    uint16*         a;
+    uint16*         b;
+    uint16*         r;
+
+    if(vector_left->dim != vector_right->dim){
+        ereport(ERROR,
+					(errmsg("the two vectors have different dimensions!")));
+    }
+    if(!compact_shape_equal(vector_left, vector_right)){
+        ereport(ERROR,
+					(errmsg("the two vectors have different shape!")));
+    }
+
+    result = new_compact_vector(kind, vector_left->dim, vector_left->shape_size);
+    if(vector_left->shape_size > 1){
+        memcpy(COMPACT_VECTOR_SHAPE(result), COMPACT_VECTOR_SHAPE(vector_left),
+               sizeof(int32) * vector_left->shape_size);
+    }
+
+    a = COMPACT_VECTOR_HALF(vector_left);
+    b = COMPACT_VECTOR_HALF(vector_right);
+    r = COMPACT_VECTOR_HALF(result);
+    for(int i=0; i<vector_left->dim; ++i){
+        float x = compact_to_float(kind, a[i]);
+        float y = compact_to_float(kind, b[i]);
+
+        r[i] = float_to_compact_checked(kind, sub ? x - y : x + y);
+    }
+
+    PG_RETURN_POINTER(result);
+}
+
+/*
+    int8vec distances come from the exact integer sums, the scales are
+    applied once at the end
+*/
+static void
+int8vec_sums(FunctionCallInfo fcinfo, double* dot, double* norm_left, double* norm_right)
+{
+    CompactVector*  vector_left = PG_GETARG_COMPACT_VECTOR_P(0);
+    CompactVector*  vector_right = PG_GETARG_COMPACT_VECTOR_P(1);
+    double          scale_left = vector_left->scale;
+    double          scale_right = vector_right->scale;
+    int64           idot, inorm_left, inorm_right;
+
+    check_compact_dims(vector_left, vector_right);
+
+    vector_int8_sums_kernel(COMPACT_VECTOR_INT8(vector_left), COMPACT_VECTOR_INT8(vector_right),
+                            vector_left->dim, &idot, &inorm_left, &inorm_right);
+
+    *dot = scale_left * scale_right * (double) idot;
+    *norm_left = scale_left * scale_left * (double) inorm_left;
+    *norm_right = scale_right * scale_right * (double) inorm_right;
+}
+
+#define COMPACT_HALF_ARGS() \
+    CompactVector* vector_left = PG_GETARG_COMPACT_VECTOR_P(0); \
+    CompactVector* vector_right = PG_GETARG_COMPACT_VECTOR_P(1); \
+    check_compact_dims(vector_left, vector_right)
+
+#define COMPACT_HALF_KERNEL(kernel_) \
+    ((double) (kernel_)(COMPACT_VECTOR_HALF(vector_left), COMPACT_VECTOR_HALF(vector_right), \
+                        vector_left->dim))
+
+/* halfvec */
+
+Datum
+halfvec_in(PG_FUNCTION_ARGS)
+{
+    return compact_input(fcinfo, COMPACT_HALF);
+}
+
+Datum
+halfvec_out(PG_FUNCTION_ARGS)
+{
+    return compact_output(fcinfo, COMPACT_HALF);
+}
+
+Datum
+halfvec_recv(PG_FUNCTION_ARGS)
+{
+    return compact_receive(fcinfo, COMPACT_HALF);
+}
+
+Datum
+halfvec_send(PG_FUNCTION_ARGS)
+{
+    return compact_send(fcinfo, COMPACT_HALF);
+}
+
+Datum
+vector_to_halfvec(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(vector_to_compact(PG_GETARG_VECTOR_P(0), COMPACT_HALF));
+}
+
+Datum
+halfvec_to_vector(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(compact_to_vector(PG_GETARG_COMPACT_VECTOR_P(0), COMPACT_HALF));
+}
+
+Datum
+halfvec_add(PG_FUNCTION_ARGS)
+{
+    return compact_add_sub(fcinfo, COMPACT_HALF, false);
+}
+
+Datum
+halfvec_sub(PG_FUNCTION_ARGS)
+{
+    return compact_add_sub(fcinfo, COMPACT_HALF, true);
+}
+
+Datum
+halfvec_l2_distance(PG_FUNCTION_ARGS)
+{
+    COMPACT_HALF_ARGS();
+
+    PG_RETURN_FLOAT8(sqrt(COMPACT_HALF_KERNEL(vector_half_l2_squared_kernel)));
+}
+
+Datum
+halfvec_inner_product(PG_FUNCTION_ARGS)
+{
+    COMPACT_HALF_ARGS();
+
+    PG_RETURN_FLOAT8(COMPACT_HALF_KERNEL(vector_half_inner_product_kernel));
+}
+
+Datum
+halfvec_negative_inner_product(PG_FUNCTION_ARGS)
+{
+    COMPACT_HALF_ARGS();
+
+    PG_RETURN_FLOAT8(-COMPACT_HALF_KERNEL(vector_half_inner_product_kernel));
+}
+
+Datum
+halfvec_cosine_distance(PG_FUNCTION_ARGS)
+{
+    COMPACT_HALF_ARGS();
+
+    PG_RETURN_FLOAT8(COMPACT_HALF_KERNEL(vector_half_cosine_distance_kernel));
+}
+
+/* bf16vec */
+
+Datum
+bf16vec_in(PG_FUNCTION_ARGS)
+{
+    return compact_input(fcinfo, COMPACT_BF16);
+}
+
+Datum
+bf16vec_out(PG_FUNCTION_ARGS)
+{
+    return compact_output(fcinfo, COMPACT_BF16);
+}
+
+Datum
+bf16vec_recv(PG_FUNCTION_ARGS)
+{
+    return compact_receive(fcinfo, COMPACT_BF16);
+}
+
+Datum
+bf16vec_send(PG_FUNCTION_ARGS)
+{
+    return compact_send(fcinfo, COMPACT_BF16);
+}
+
+Datum
+vector_to_bf16vec(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(vector_to_compact(PG_GETARG_VECTOR_P(0), COMPACT_BF16));
+}
+
+Datum
+bf16vec_to_vector(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(compact_to_vector(PG_GETARG_COMPACT_VECTOR_P(0), COMPACT_BF16));
+}
+
+Datum
+bf16vec_add(PG_FUNCTION_ARGS)
+{
+    return compact_add_sub(fcinfo, COMPACT_BF16, false);
+}
+
+Datum
+bf16vec_sub(PG_FUNCTION_ARGS)
+{
+    return compact_add_sub(fcinfo, COMPACT_BF16, true);
+}
+
+Datum
+bf16vec_l2_distance(PG_FUNCTION_ARGS)
+{
+    COMPACT_HALF_ARGS();
+
+    PG_RETURN_FLOAT8(sqrt(COMPACT_HALF_KERNEL(vector_bf16_l2_squared_kernel)));
+}
+
+Datum
+bf16vec_inner_product(PG_FUNCTION_ARGS)
+{
+    COMPACT_HALF_ARGS();
+
+    PG_RETURN_FLOAT8(COMPACT_HALF_KERNEL(vector_bf16_inner_product_kernel));
+}
+
+Datum
+bf16vec_negative_inner_product(PG_FUNCTION_ARGS)
+{
+    COMPACT_HALF_ARGS();
+
+    PG_RETURN_FLOAT8(-COMPACT_HALF_KERNEL(vector_bf16_inner_product_kernel));
+}
+
+Datum
+bf16vec_cosine_distance(PG_FUNCTION_ARGS)
+{
+    COMPACT_HALF_ARGS();
+
+    PG_RETURN_FLOAT8(COMPACT_HALF_KERNEL(vector_bf16_cosine_distance_kernel));
+}
+
+/* int8vec */
+
+Datum
+int8vec_in(PG_FUNCTION_ARGS)
+{
+    return compact_input(fcinfo, COMPACT_INT8);
+}
+
+Datum
+int8vec_out(PG_FUNCTION_ARGS)
+{
+    return compact_output(fcinfo, COMPACT_INT8);
+}
+
+Datum
+int8vec_recv(PG_FUNCTION_ARGS)
+{
+    return compact_receive(fcinfo, COMPACT_INT8);
+}
+
+Datum
+int8vec_send(PG_FUNCTION_ARGS)
+{
+    return compact_send(fcinfo, COMPACT_INT8);
+}
+
+Datum
+vector_to_int8vec(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(vector_to_compact(PG_GETARG_VECTOR_P(0), COMPACT_INT8));
+}
+
+Datum
+int8vec_to_vector(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(compact_to_vector(PG_GETARG_COMPACT_VECTOR_P(0), COMPACT_INT8));
+}
+
+/*
+    the sum of the squared differences, not |a|^2 + |b|^2 - 2ab, which
+    cancels to noise for vectors close to each other. With one scale for
+    both the differences are exact integers.
+*/
+Datum
+int8vec_l2_distance(PG_FUNCTION_ARGS)
+{
+    CompactVector*  vector_left = PG_GETARG_COMPACT_VECTOR_P(0);
+    CompactVector*  vector_right = PG_GETARG_COMPACT_VECTOR_P(1);
+    const int8*     a = COMPACT_VECTOR_INT8(vector_left);
+    const int8*     b = COMPACT_VECTOR_INT8(vector_right);
+    double          scale_left = vector_left->scale;
+    double          scale_right = vector_right->scale;
+    double          distance = 0;
+
+    check_compact_dims(vector_left, vector_right);
+
+    if(scale_left == scale_right){
+        int64 sum = 0;
+
+        for(unsigned int i = 0; i < vector_left->dim; i++){
+            int32 diff = (int32) a[i] - (int32) b[i];
+
+            sum += diff * diff;
+        }
+        distance = scale_left * scale_left * (double) sum;
+    }else{
+        for(unsigned int i = 0; i < vector_left->dim; i++){
+            double diff = scale_left * a[i] - scale_right * b[i];
+
+            distance += diff * diff;
+        }
+    }
+
+    PG_RETURN_FLOAT8(sqrt(distance));
+}
+
+Datum
+int8vec_inner_product(PG_FUNCTION_ARGS)
+{
+    double dot, norm_left, norm_right;
+
+    int8vec_sums(fcinfo, &dot, &norm_left, &norm_right);
+
+    PG_RETURN_FLOAT8(dot);
+}
+
+Datum
+int8vec_negative_inner_product(PG_FUNCTION_ARGS)
+{
+    double dot, norm_left, norm_right;
+
+    int8vec_sums(fcinfo, &dot, &norm_left, &norm_right);
+
+    PG_RETURN_FLOAT8(-dot);
+}
+
+Datum
+int8vec_cosine_distance(PG_FUNCTION_ARGS)
+{
+    double dot, norm_left, norm_right;
+    double similarity;
+
+    int8vec_sums(fcinfo, &dot, &norm_left, &norm_right);
+
+    if(norm_left == 0 || norm_right == 0){
+        PG_RETURN_FLOAT8(NAN);
+    }
+
+    similarity = dot / sqrt(norm_left * norm_right);
+    if(similarity > 1){
+        similarity = 1;
+    }else if(similarity < -1){
+        similarity = -1;
+    }
+
+    PG_RETURN_FLOAT8(1 - similarity);
+}
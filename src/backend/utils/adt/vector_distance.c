@@ -0,0 +1,829 @@
+/*
+ * vector_distance.c
+ *
+ * SIMD distance kernels for the vector type. x86 builds compile the AVX2 and
+ * AVX-512 variants with function target attributes, so no special compiler
+ * flags are needed and the binary still runs on CPUs without them, the CPU is
+ * probed once with __builtin_cpu_supports. aarch64 always has NEON.
+ */
+#include "postgres.h"
+
+#include <math.h>
+
+#include "utils/vector_compact.h"
+#include "utils/vector_distance.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define USE_VECTOR_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define USE_VECTOR_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+static float l2_squared_choose(const float *a, const float *b, int dim);
+static float inner_product_choose(const float *a, const float *b, int dim);
+static float cosine_distance_choose(const float *a, const float *b, int dim);
+
+VectorDistanceKernel vector_l2_squared_kernel = l2_squared_choose;
+VectorDistanceKernel vector_inner_product_kernel = inner_product_choose;
+VectorDistanceKernel vector_cosine_distance_kernel = cosine_distance_choose;
+
+static float half_l2_squared_choose(const uint16 *a, const uint16 *b, int dim);
+static float half_inner_product_choose(const uint16 *a, const uint16 *b, int dim);
+static float half_cosine_distance_choose(const uint16 *a, const uint16 *b, int dim);
+static float bf16_l2_squared_choose(const uint16 *a, const uint16 *b, int dim);
+static float bf16_inner_product_choose(const uint16 *a, const uint16 *b, int dim);
+static float bf16_cosine_distance_choose(const uint16 *a, const uint16 *b, int dim);
+static void int8_sums_choose(const int8 *a, const int8 *b, int dim,
+                             int64 *dot, int64 *norm_a, int64 *norm_b);
+
+VectorHalfDistanceKernel vector_half_l2_squared_kernel = half_l2_squared_choose;
+VectorHalfDistanceKernel vector_half_inner_product_kernel = half_inner_product_choose;
+VectorHalfDistanceKernel vector_half_cosine_distance_kernel = half_cosine_distance_choose;
+VectorHalfDistanceKernel vector_bf16_l2_squared_kernel = bf16_l2_squared_choose;
+VectorHalfDistanceKernel vector_bf16_inner_product_kernel = bf16_inner_product_choose;
+VectorHalfDistanceKernel vector_bf16_cosine_distance_kernel = bf16_cosine_distance_choose;
+VectorInt8SumsKernel vector_int8_sums_kernel = int8_sums_choose;
+
+static const char *kernel_isa = NULL;
+
+static inline float
+cosine_from_parts(float dot, float norm_a, float norm_b)
+{
+    double similarity;
+
+    if(norm_a == 0 || norm_b == 0){
+        return NAN;
+    }
+
+    similarity = (double) dot / sqrt((double) norm_a * (double) norm_b);
+
+    // rounding can leave the similarity slightly outside [-1, 1]
+    if(similarity > 1){
+        similarity = 1;
+    }else if(similarity < -1){
+        similarity = -1;
+    }
+    return (float) (1 - similarity);
+}
+
+/*
+ * plain C kernels, four independent accumulators so the compiler can use
+ * whatever vector unit the baseline target has
+ */
+static float
+l2_squared_c(const float *a, const float *b, int dim)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+
+    for(; i + 4 <= dim; i += 4){
+        float d0 = a[i] - b[i];
+        float d1 = a[i + 1] - b[i + 1];
+        float d2 = a[i + 2] - b[i + 2];
+        float d3 = a[i + 3] - b[i + 3];
+
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+        s2 += d2 * d2;
+        s3 += d3 * d3;
+    }
+    for(; i < dim; i++){
+        float d = a[i] - b[i];
+
+        s0 += d * d;
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static float
+inner_product_c(const float *a, const float *b, int dim)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+
+    for(; i + 4 <= dim; i += 4){
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for(; i < dim; i++){
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static float
+cosine_distance_c(const float *a, const float *b, int dim)
+{
+    float dot = 0, norm_a = 0, norm_b = 0;
+
+    for(int i = 0; i < dim; i++){
+        dot += a[i] * b[i];
+        norm_a += a[i] * a[i];
+        norm_b += b[i] * b[i];
+    }
+    return cosine_from_parts(dot, norm_a, norm_b);
+}
+
+/*
+ * plain C kernels of the 2-byte formats, bf16 is a constant so each wrapper
+ * below compiles to a loop with one conversion
+ */
+static inline float
+compact_element(const uint16 *x, int i, bool bf16)
+{
+    return bf16 ? bf16_to_float(x[i]) : half_to_float(x[i]);
+}
+
+static inline float
+l2_squared_compact_c(const uint16 *a, const uint16 *b, int dim, bool bf16)
+{
+    float s0 = 0, s1 = 0;
+    int i = 0;
+
+    for(; i + 2 <= dim; i += 2){
+        float d0 = compact_element(a, i, bf16) - compact_element(b, i, bf16);
+        float d1 = compact_element(a, i + 1, bf16) - compact_element(b, i + 1, bf16);
+
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+    }
+    for(; i < dim; i++){
+        float d = compact_element(a, i, bf16) - compact_element(b, i, bf16);
+
+        s0 += d * d;
+    }
+    return s0 + s1;
+}
+
+static inline float
+inner_product_compact_c(const uint16 *a, const uint16 *b, int dim, bool bf16)
+{
+    float s0 = 0, s1 = 0;
+    int i = 0;
+
+    for(; i + 2 <= dim; i += 2){
+        s0 += compact_element(a, i, bf16) * compact_element(b, i, bf16);
+        s1 += compact_element(a, i + 1, bf16) * compact_element(b, i + 1, bf16);
+    }
+    for(; i < dim; i++){
+        s0 += compact_element(a, i, bf16) * compact_element(b, i, bf16);
+    }
+    return s0 + s1;
+}
+
+static inline float
+cosine_distance_compact_c(const uint16 *a, const uint16 *b, int dim, bool bf16)
+{
+    float dot = 0, norm_a = 0, norm_b = 0;
+
+    for(int i = 0; i < dim; i++){
+        float va = compact_element(a, i, bf16);
+        float vb = compact_element(b, i, bf16);
+
+        dot += va * vb;
+        norm_a += va * va;
+        norm_b += vb * vb;
+    }
+    return cosine_from_parts(dot, norm_a, norm_b);
+}
+
+static float
+half_l2_squared_c(const uint16 *a, const uint16 *b, int dim)
+{
+    return l2_squared_compact_c(a, b, dim, false);
+}
+
+static float
+half_inner_product_c(const uint16 *a, const uint16 *b, int dim)
+{
+    return inner_product_compact_c(a, b, dim, false);
+}
+
+static float
+half_cosine_distance_c(const uint16 *a, const uint16 *b, int dim)
+{
+    return cosine_distance_compact_c(a, b, dim, false);
+}
+
+static float
+bf16_l2_squared_c(const uint16 *a, const uint16 *b, int dim)
+{
+    return l2_squared_compact_c(a, b, dim, true);
+}
+
+static float
+bf16_inner_product_c(const uint16 *a, const uint16 *b, int dim)
+{
+    return inner_product_compact_c(a, b, dim, true);
+}
+
+static float
+bf16_cosine_distance_c(const uint16 *a, const uint16 *b, int dim)
+{
+    return cosine_distance_compact_c(a, b, dim, true);
+}
+
+static void
+int8_sums_c(const int8 *a, const int8 *b, int dim,
+            int64 *dot, int64 *norm_a, int64 *norm_b)
+{
+    int64 sdot = 0, snorm_a = 0, snorm_b = 0;
+
+    for(int i = 0; i < dim; i++){
+        int32 va = a[i];
+        int32 vb = b[i];
+
+        sdot += va * vb;
+        snorm_a += va * va;
+        snorm_b += vb * vb;
+    }
+    *dot = sdot;
+    *norm_a = snorm_a;
+    *norm_b = snorm_b;
+}
+
+#ifdef USE_VECTOR_X86_KERNELS
+
+__attribute__((target("avx2,fma")))
+static inline float
+hsum_avx2(__m256 v)
+{
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static float
+l2_squared_avx2(const float *a, const float *b, int dim)
+{
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    float result;
+    int i = 0;
+
+    for(; i + 16 <= dim; i += 16){
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+
+        s0 = _mm256_fmadd_ps(d0, d0, s0);
+        s1 = _mm256_fmadd_ps(d1, d1, s1);
+    }
+    if(i + 8 <= dim){
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+
+        s0 = _mm256_fmadd_ps(d0, d0, s0);
+        i += 8;
+    }
+    result = hsum_avx2(_mm256_add_ps(s0, s1));
+    for(; i < dim; i++){
+        float d = a[i] - b[i];
+
+        result += d * d;
+    }
+    return result;
+}
+
+__attribute__((target("avx2,fma")))
+static float
+inner_product_avx2(const float *a, const float *b, int dim)
+{
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    float result;
+    int i = 0;
+
+    for(; i + 16 <= dim; i += 16){
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    if(i + 8 <= dim){
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        i += 8;
+    }
+    result = hsum_avx2(_mm256_add_ps(s0, s1));
+    for(; i < dim; i++){
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+__attribute__((target("avx2,fma")))
+static float
+cosine_distance_avx2(const float *a, const float *b, int dim)
+{
+    __m256 dot = _mm256_setzero_ps();
+    __m256 norm_a = _mm256_setzero_ps();
+    __m256 norm_b = _mm256_setzero_ps();
+    float sdot, snorm_a, snorm_b;
+    int i = 0;
+
+    for(; i + 8 <= dim; i += 8){
+        __m256 va = _mm256_loadu_ps(a + i);
+        __m256 vb = _mm256_loadu_ps(b + i);
+
+        dot = _mm256_fmadd_ps(va, vb, dot);
+        norm_a = _mm256_fmadd_ps(va, va, norm_a);
+        norm_b = _mm256_fmadd_ps(vb, vb, norm_b);
+    }
+    sdot = hsum_avx2(dot);
+    snorm_a = hsum_avx2(norm_a);
+    snorm_b = hsum_avx2(norm_b);
+    for(; i < dim; i++){
+        sdot += a[i] * b[i];
+        snorm_a += a[i] * a[i];
+        snorm_b += b[i] * b[i];
+    }
+    return cosine_from_parts(sdot, snorm_a, snorm_b);
+}
+
+/* AVX-512 handles the tail with a masked load instead of a scalar loop */
+__attribute__((target("avx512f")))
+static float
+l2_squared_avx512(const float *a, const float *b, int dim)
+{
+    __m512 sum = _mm512_setzero_ps();
+    int i = 0;
+
+    for(; i + 16 <= dim; i += 16){
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+
+        sum = _mm512_fmadd_ps(d, d, sum);
+    }
+    if(i < dim){
+        __mmask16 mask = (__mmask16) ((1U << (dim - i)) - 1);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                                 _mm512_maskz_loadu_ps(mask, b + i));
+
+        sum = _mm512_fmadd_ps(d, d, sum);
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+static float
+inner_product_avx512(const float *a, const float *b, int dim)
+{
+    __m512 sum = _mm512_setzero_ps();
+    int i = 0;
+
+    for(; i + 16 <= dim; i += 16){
+        sum = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum);
+    }
+    if(i < dim){
+        __mmask16 mask = (__mmask16) ((1U << (dim - i)) - 1);
+
+        sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                              _mm512_maskz_loadu_ps(mask, b + i), sum);
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+static float
+cosine_distance_avx512(const float *a, const float *b, int dim)
+{
+    __m512 dot = _mm512_setzero_ps();
+    __m512 norm_a = _mm512_setzero_ps();
+    __m512 norm_b = _mm512_setzero_ps();
+    int i = 0;
+
+    for(; i < dim; i += 16){
+        __mmask16 mask = dim - i >= 16 ? (__mmask16) 0xFFFF : (__mmask16) ((1U << (dim - i)) - 1);
+        __m512 va = _mm512_maskz_loadu_ps(mask, a + i);
+        __m512 vb = _mm512_maskz_loadu_ps(mask, b + i);
+
+        dot = _mm512_fmadd_ps(va, vb, dot);
+        norm_a = _mm512_fmadd_ps(va, va, norm_a);
+        norm_b = _mm512_fmadd_ps(vb, vb, norm_b);
+    }
+    return cosine_from_parts(_mm512_reduce_add_ps(dot),
+                             _mm512_reduce_add_ps(norm_a),
+                             _mm512_reduce_add_ps(norm_b));
+}
+
+/*
+ * AVX2 kernels of the compact formats, 8 elements are widened to floats in
+ * registers. Every CPU with AVX2 also has F16C.
+ */
+__attribute__((target("avx2,fma,f16c")))
+static inline __m256
+load_compact_avx2(const uint16 *x, bool bf16)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *) x);
+
+    if(bf16){
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(v), 16));
+    }
+    return _mm256_cvtph_ps(v);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static inline float
+l2_squared_compact_avx2(const uint16 *a, const uint16 *b, int dim, bool bf16)
+{
+    __m256 sum = _mm256_setzero_ps();
+    float result;
+    int i = 0;
+
+    for(; i + 8 <= dim; i += 8){
+        __m256 d = _mm256_sub_ps(load_compact_avx2(a + i, bf16), load_compact_avx2(b + i, bf16));
+
+        sum = _mm256_fmadd_ps(d, d, sum);
+    }
+    result = hsum_avx2(sum);
+    for(; i < dim; i++){
+        float d = compact_element(a, i, bf16) - compact_element(b, i, bf16);
+
+        result += d * d;
+    }
+    return result;
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static inline float
+inner_product_compact_avx2(const uint16 *a, const uint16 *b, int dim, bool bf16)
+{
+    __m256 sum = _mm256_setzero_ps();
+    float result;
+    int i = 0;
+
+    for(; i + 8 <= dim; i += 8){
+        sum = _mm256_fmadd_ps(load_compact_avx2(a + i, bf16), load_compact_avx2(b + i, bf16), sum);
+    }
+    result = hsum_avx2(sum);
+    for(; i < dim; i++){
+        result += compact_element(a, i, bf16) * compact_element(b, i, bf16);
+    }
+    return result;
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static inline float
+cosine_distance_compact_avx2(const uint16 *a, const uint16 *b, int dim, bool bf16)
+{
+    __m256 dot = _mm256_setzero_ps();
+    __m256 norm_a = _mm256_setzero_ps();
+    __m256 norm_b = _mm256_setzero_ps();
+    float sdot, snorm_a, snorm_b;
+    int i = 0;
+
+    for(; i + 8 <= dim; i += 8){
+        __m256 va = load_compact_avx2(a + i, bf16);
+        __m256 vb = load_compact_avx2(b + i, bf16);
+
+        dot = _mm256_fmadd_ps(va, vb, dot);
+        norm_a = _mm256_fmadd_ps(va, va, norm_a);
+        norm_b = _mm256_fmadd_ps(vb, vb, norm_b);
+    }
+    sdot = hsum_avx2(dot);
+    snorm_a = hsum_avx2(norm_a);
+    snorm_b = hsum_avx2(norm_b);
+    for(; i < dim; i++){
+        float va = compact_element(a, i, bf16);
+        float vb = compact_element(b, i, bf16);
+
+        sdot += va * vb;
+        snorm_a += va * va;
+        snorm_b += vb * vb;
+    }
+    return cosine_from_parts(sdot, snorm_a, snorm_b);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float
+half_l2_squared_avx2(const uint16 *a, const uint16 *b, int dim)
+{
+    return l2_squared_compact_avx2(a, b, dim, false);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float
+half_inner_product_avx2(const uint16 *a, const uint16 *b, int dim)
+{
+    return inner_product_compact_avx2(a, b, dim, false);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float
+half_cosine_distance_avx2(const uint16 *a, const uint16 *b, int dim)
+{
+    return cosine_distance_compact_avx2(a, b, dim, false);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float
+bf16_l2_squared_avx2(const uint16 *a, const uint16 *b, int dim)
+{
+    return l2_squared_compact_avx2(a, b, dim, true);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float
+bf16_inner_product_avx2(const uint16 *a, const uint16 *b, int dim)
+{
+    return inner_product_compact_avx2(a, b, dim, true);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float
+bf16_cosine_distance_avx2(const uint16 *a, const uint16 *b, int dim)
+{
+    return cosine_distance_compact_avx2(a, b, dim, true);
+}
+
+__attribute__((target("avx2")))
+static inline int64
+hsum_epi32_avx2(__m256i v)
+{
+    int32 lanes[8];
+    int64 sum = 0;
+
+    _mm256_storeu_si256((__m256i *) lanes, v);
+    for(int i = 0; i < 8; i++){
+        sum += lanes[i];
+    }
+    return sum;
+}
+
+/*
+ * 16 elements are sign extended to int16 and multiplied pairwise into int32
+ * lanes. A lane grows by at most 2 * 128 * 128 per step, the int32
+ * accumulators are moved to int64 every 4096 steps.
+ */
+__attribute__((target("avx2")))
+static void
+int8_sums_avx2(const int8 *a, const int8 *b, int dim,
+               int64 *dot, int64 *norm_a, int64 *norm_b)
+{
+    int64 sdot = 0, snorm_a = 0, snorm_b = 0;
+    int i = 0;
+
+    while(i + 16 <= dim){
+        __m256i vdot = _mm256_setzero_si256();
+        __m256i vnorm_a = _mm256_setzero_si256();
+        __m256i vnorm_b = _mm256_setzero_si256();
+
+        for(int step = 0; step < 4096 && i + 16 <= dim; step++, i += 16){
+            __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) (a + i)));
+            __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) (b + i)));
+
+            vdot = _mm256_add_epi32(vdot, _mm256_madd_epi16(va, vb));
+            vnorm_a = _mm256_add_epi32(vnorm_a, _mm256_madd_epi16(va, va));
+            vnorm_b = _mm256_add_epi32(vnorm_b, _mm256_madd_epi16(vb, vb));
+        }
+        sdot += hsum_epi32_avx2(vdot);
+        snorm_a += hsum_epi32_avx2(vnorm_a);
+        snorm_b += hsum_epi32_avx2(vnorm_b);
+    }
+    for(; i < dim; i++){
+        int32 va = a[i];
+        int32 vb = b[i];
+
+        sdot += va * vb;
+        snorm_a += va * va;
+        snorm_b += vb * vb;
+    }
+    *dot = sdot;
+    *norm_a = snorm_a;
+    *norm_b = snorm_b;
+}
+
+#endif                          /* USE_VECTOR_X86_KERNELS */
+
+#ifdef USE_VECTOR_NEON_KERNELS
+
+static float
+l2_squared_neon(const float *a, const float *b, int dim)
+{
+    float32x4_t s0 = vdupq_n_f32(0);
+    float32x4_t s1 = vdupq_n_f32(0);
+    float result;
+    int i = 0;
+
+    for(; i + 8 <= dim; i += 8){
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+
+        s0 = vfmaq_f32(s0, d0, d0);
+        s1 = vfmaq_f32(s1, d1, d1);
+    }
+    result = vaddvq_f32(vaddq_f32(s0, s1));
+    for(; i < dim; i++){
+        float d = a[i] - b[i];
+
+        result += d * d;
+    }
+    return result;
+}
+
+static float
+inner_product_neon(const float *a, const float *b, int dim)
+{
+    float32x4_t s0 = vdupq_n_f32(0);
+    float32x4_t s1 = vdupq_n_f32(0);
+    float result;
+    int i = 0;
+
+    for(; i + 8 <= dim; i += 8){
+        s0 = vfmaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+        s1 = vfmaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    result = vaddvq_f32(vaddq_f32(s0, s1));
+    for(; i < dim; i++){
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+static float
+cosine_distance_neon(const float *a, const float *b, int dim)
+{
+    float32x4_t dot = vdupq_n_f32(0);
+    float32x4_t norm_a = vdupq_n_f32(0);
+    float32x4_t norm_b = vdupq_n_f32(0);
+    float sdot, snorm_a, snorm_b;
+    int i = 0;
+
+    for(; i + 4 <= dim; i += 4){
+        float32x4_t va = vld1q_f32(a + i);
+        float32x4_t vb = vld1q_f32(b + i);
+
+        dot = vfmaq_f32(dot, va, vb);
+        norm_a = vfmaq_f32(norm_a, va, va);
+        norm_b = vfmaq_f32(norm_b, vb, vb);
+    }
+    sdot = vaddvq_f32(dot);
+    snorm_a = vaddvq_f32(norm_a);
+    snorm_b = vaddvq_f32(norm_b);
+    for(; i < dim; i++){
+        sdot += a[i] * b[i];
+        snorm_a += a[i] * a[i];
+        snorm_b += b[i] * b[i];
+    }
+    return cosine_from_parts(sdot, snorm_a, snorm_b);
+}
+
+#endif                          /* USE_VECTOR_NEON_KERNELS */
+
+/*
+ * the compact kernels only have AVX2 and plain C variants, AVX-512 and NEON
+ * machines get the best of those
+ */
+static void
+compact_distance_init(void)
+{
+#if defined(USE_VECTOR_X86_KERNELS)
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        vector_half_l2_squared_kernel = half_l2_squared_avx2;
+        vector_half_inner_product_kernel = half_inner_product_avx2;
+        vector_half_cosine_distance_kernel = half_cosine_distance_avx2;
+        vector_bf16_l2_squared_kernel = bf16_l2_squared_avx2;
+        vector_bf16_inner_product_kernel = bf16_inner_product_avx2;
+        vector_bf16_cosine_distance_kernel = bf16_cosine_distance_avx2;
+        vector_int8_sums_kernel = int8_sums_avx2;
+        return;
+    }
+#endif
+
+    vector_half_l2_squared_kernel = half_l2_squared_c;
+    vector_half_inner_product_kernel = half_inner_product_c;
+    vector_half_cosine_distance_kernel = half_cosine_distance_c;
+    vector_bf16_l2_squared_kernel = bf16_l2_squared_c;
+    vector_bf16_inner_product_kernel = bf16_inner_product_c;
+    vector_bf16_cosine_distance_kernel = bf16_cosine_distance_c;
+    vector_int8_sums_kernel = int8_sums_c;
+}
+
+static void
+float_distance_init(void)
+{
+#if defined(USE_VECTOR_X86_KERNELS)
+    if(__builtin_cpu_supports("avx512f")){
+        vector_l2_squared_kernel = l2_squared_avx512;
+        vector_inner_product_kernel = inner_product_avx512;
+        vector_cosine_distance_kernel = cosine_distance_avx512;
+        kernel_isa = "avx512f";
+        return;
+    }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        vector_l2_squared_kernel = l2_squared_avx2;
+        vector_inner_product_kernel = inner_product_avx2;
+        vector_cosine_distance_kernel = cosine_distance_avx2;
+        kernel_isa = "avx2";
+        return;
+    }
+#elif defined(USE_VECTOR_NEON_KERNELS)
+    vector_l2_squared_kernel = l2_squared_neon;
+    vector_inner_product_kernel = inner_product_neon;
+    vector_cosine_distance_kernel = cosine_distance_neon;
+    kernel_isa = "neon";
+    return;
+#endif
+
+    vector_l2_squared_kernel = l2_squared_c;
+    vector_inner_product_kernel = inner_product_c;
+    vector_cosine_distance_kernel = cosine_distance_c;
+    kernel_isa = "c";
+}
+
+void
+vector_distance_init(void)
+{
+    if(kernel_isa != NULL){
+        return;
+    }
+
+#if defined(USE_VECTOR_X86_KERNELS)
+    __builtin_cpu_init();
+#endif
+    compact_distance_init();
+    /* sets kernel_isa, which marks the kernels as chosen */
+    float_distance_init();
+}
+
+const char *
+vector_distance_isa(void)
+{
+    vector_distance_init();
+    return kernel_isa;
+}
+
+static float
+l2_squared_choose(const float *a, const float *b, int dim)
+{
+    vector_distance_init();
+    return vector_l2_squared_kernel(a, b, dim);
+}
+
+static float
+inner_product_choose(const float *a, const float *b, int dim)
+{
+    vector_distance_init();
+    return vector_inner_product_kernel(a, b, dim);
+}
+
+static float
+cosine_distance_choose(const float *a, const float *b, int dim)
+{
+    vector_distance_init();
+    return vector_cosine_distance_kernel(a, b, dim);
+}
+
+static float
+half_l2_squared_choose(const uint16 *a, const uint16 *b, int dim)
+{
+    vector_distance_init();
+    return vector_half_l2_squared_kernel(a, b, dim);
+}
+
+static float
+half_inner_product_choose(const uint16 *a, const uint16 *b, int dim)
+{
+    vector_distance_init();
+    return vector_half_inner_product_kernel(a, b, dim);
+}
+
+static float
+half_cosine_distance_choose(const uint16 *a, const uint16 *b, int dim)
+{
+    vector_distance_init();
+    return vector_half_cosine_distance_kernel(a, b, dim);
+}
+
+static float
+bf16_l2_squared_choose(const uint16 *a, const uint16 *b, int dim)
+{
+    vector_distance_init();
+    return vector_bf16_l2_squared_kernel(a, b, dim);
+}
+
+static float
+bf16_inner_product_choose(const uint16 *a, const uint16 *b, int dim)
+{
+    vector_distance_init();
+    return vector_bf16_inner_product_kernel(a, b, dim);
+}
+
+static float
+bf16_cosine_distance_choose(const uint16 *a, const uint16 *b, int dim)
+{
+    vector_distance_init();
+    return vector_bf16_cosine_distance_kernel(a, b, dim);
+}
+
+static void
+int8_sums_choose(const int8 *a, const int8 *b, int dim,
+                 int64 *dot, int64 *norm_a, int64 *norm_b)
+{
+    vector_distance_init();
+    vector_int8_sums_kernel(a, b, dim, dot, norm_a, norm_b);
+}
@@ -1,4 +1,5 @@
 #include "utils/vector_tensor.h"
+#include "utils/vector_compact.h"
 #include "c.h"
 
 extern "C"{
@@ -34,4 +35,40 @@ vector_to_tensor(Vector& vector)
     return tensor;
 }
 
-}
\ No newline at end of file
+static std::vector<int64_t>
+compact_vector_shape(CompactVector& vector)
+{
+    if (vector.shape_size > 1) {
+        int32* shape = COMPACT_VECTOR_SHAPE(&vector);
+        return std::vector<int64_t>(shape, shape + vector.shape_size);
+    }
+    return std::vector<int64_t>{(int64_t) vector.dim};
+}
+
+/*
+ * the compact types keep their element type, the tensors are not widened to
+ * float32 on the way in
+ */
+torch::Tensor
+halfvec_to_tensor(CompactVector& vector)
+{
+    torch::TensorOptions options = torch::TensorOptions().dtype(torch::kHalf);
+    return torch::from_blob(COMPACT_VECTOR_DATA(&vector), compact_vector_shape(vector), options).clone();
+}
+
+torch::Tensor
+bf16vec_to_tensor(CompactVector& vector)
+{
+    torch::TensorOptions options = torch::TensorOptions().dtype(torch::kBFloat16);
+    return torch::from_blob(COMPACT_VECTOR_DATA(&vector), compact_vector_shape(vector), options).clone();
+}
+
+torch::Tensor
+int8vec_to_tensor(CompactVector& vector, float* scale)
+{
+    torch::TensorOptions options = torch::TensorOptions().dtype(torch::kInt8);
+    *scale = vector.scale;
+    return torch::from_blob(COMPACT_VECTOR_DATA(&vector), compact_vector_shape(vector), options).clone();
+}
+
+}
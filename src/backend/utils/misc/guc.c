@@ -28,6 +28,7 @@
 
 #include "access/commit_ts.h"
 #include "access/gin.h"
+#include "access/hnsw.h"
 #include "access/rmgr.h"
 #include "access/tableam.h"
 #include "access/transam.h"
@@ -37,18 +38,26 @@
 #include "catalog/namespace.h"
 #include "catalog/pg_authid.h"
 #include "commands/async.h"
+#include "commands/mdcommands.h"
 #include "commands/prepare.h"
 #include "commands/user.h"
 #include "commands/vacuum.h"
 #include "commands/variable.h"
 #include "commands/trigger.h"
 #include "common/string.h"
+#include "executor/nodePredict.h"
 #include "funcapi.h"
 #include "jit/jit.h"
 #include "libpq/auth.h"
 #include "libpq/libpq.h"
 #include "libpq/pqformat.h"
 #include "miscadmin.h"
+#include "model/inference_worker.h"
+#include "model/model_cache.h"
+#include "model/model_stats.h"
+#include "model/result_cache.h"
+#include "model/thread_pool.h"
+#include "model/torch_threads.h"
 #include "optimizer/cost.h"
 #include "optimizer/geqo.h"
 #include "optimizer/optimizer.h"
@@ -94,6 +103,7 @@
 #include "utils/snapmgr.h"
 #include "utils/tzparser.h"
 #include "utils/varlena.h"
+#include "utils/vector.h"
 #include "utils/xml.h"
 
 #ifndef PG_KRB_SRVTAB
@@ -1053,6 +1063,18 @@ static struct config_bool ConfigureNamesBool[] =
 		true,
 		NULL, NULL, NULL
 	},
+	{
+		{"enable_predict_batch", PGC_USERSET, QUERY_TUNING_METHOD,
+			gettext_noop("Enables batched evaluation of predict_float and predict_text."),
+			gettext_noop("Allows the query planner to put a Predict node on top of "
+						 "a plan whose targetlist calls a model, so that rows are "
+						 "sent to the model in batches."),
+			GUC_EXPLAIN
+		},
+		&enable_predict_batch,
+		true,
+		NULL, NULL, NULL
+	},
 	{
 		{"geqo", PGC_USERSET, QUERY_TUNING_GEQO,
 			gettext_noop("Enables genetic query optimization."),
@@ -1339,6 +1361,26 @@ static struct config_bool ConfigureNamesBool[] =
 		false,
 		NULL, NULL, NULL
 	},
+	{
+		{"model_preload_on_create", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Loads uploaded models into the model cache right away."),
+			gettext_noop("CREATE MODEL and UPDATE MODEL keep the model in memory "
+						 "while writing it, if it fits in model_cache_size, and "
+						 "load it from there.")
+		},
+		&model_preload_on_create,
+		false,
+		NULL, NULL, NULL
+	},
+	{
+		{"track_model_stats", PGC_SUSET, STATS_COLLECTOR,
+			gettext_noop("Collects per-model inference statistics for pg_stat_model."),
+			NULL
+		},
+		&track_model_stats,
+		true,
+		NULL, NULL, NULL
+	},
 	{
 		{"log_parser_stats", PGC_SUSET, STATS_MONITORING,
 			gettext_noop("Writes parser performance statistics to the server log."),
@@ -1596,6 +1638,16 @@ static struct config_bool ConfigureNamesBool[] =
 		true,
 		NULL, NULL, NULL
 	},
+	{
+		{"vector_output_full", PGC_USERSET, CLIENT_CONN_LOCALE,
+			gettext_noop("Prints all elements of vector values."),
+			gettext_noop("Otherwise the middle of vectors with more than 10 elements "
+						 "is elided, unless extra_float_digits is 3 as pg_dump sets it.")
+		},
+		&vector_output_full,
+		false,
+		NULL, NULL, NULL
+	},
 	{
 		{"array_nulls", PGC_USERSET, COMPAT_OPTIONS_PREVIOUS,
 			gettext_noop("Enable input of NULL elements in arrays."),
@@ -2261,6 +2313,49 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"model_cache_size", PGC_SIGHUP, RESOURCES_MEM,
+			gettext_noop("Sets the maximum size of model weights shared between backends."),
+			gettext_noop("Least recently used models are evicted when the limit is "
+						 "reached. Zero disables the shared model cache."),
+			GUC_UNIT_KB
+		},
+		&model_cache_size,
+		1048576, 0, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"predict_result_cache_size", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Sets the maximum memory used by each backend to cache predict results."),
+			gettext_noop("Zero disables the predict result cache, including its shared tier."),
+			GUC_UNIT_KB
+		},
+		&predict_result_cache_size,
+		0, 0, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"predict_result_cache_shared_entries", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of predict results cached in shared memory."),
+			gettext_noop("Zero disables the shared tier of the predict result cache.")
+		},
+		&predict_result_cache_shared_entries,
+		0, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"model_stats_max", PGC_POSTMASTER, STATS_COLLECTOR,
+			gettext_noop("Sets the maximum number of models tracked by pg_stat_model."),
+			NULL
+		},
+		&model_stats_max,
+		1000, 100, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
 	/*
 	 * We use the hopefully-safely-small value of 100kB as the compiled-in
 	 * default for max_stack_depth.  InitializeGUCOptions will increase it if
@@ -3036,6 +3131,110 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"inference_workers", PGC_POSTMASTER, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of inference background workers."),
+			gettext_noop("Zero runs every model inside the calling backend.")
+		},
+		&inference_workers,
+		0, 0, MAX_INFERENCE_WORKERS,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"inference_max_batch_size", PGC_SIGHUP, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the maximum number of rows an inference worker runs in one forward pass."),
+			NULL
+		},
+		&inference_max_batch_size,
+		64, 1, INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"inference_max_wait_us", PGC_SIGHUP, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets how long an inference worker waits for more requests to batch, in microseconds."),
+			NULL
+		},
+		&inference_max_wait_us,
+		1000, 0, 1000000,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"inference_worker_threads", PGC_SIGHUP, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of intra-op threads of each inference worker."),
+			NULL
+		},
+		&inference_worker_threads,
+		1, 1, 1024,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"predict_batch_size", PGC_USERSET, QUERY_TUNING_OTHER,
+			gettext_noop("Sets the maximum number of rows a Predict node sends to a model at once."),
+			gettext_noop("Batches start small and double up to this size.")
+		},
+		&predict_batch_size,
+		1024, 1, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"hnsw_ef_search", PGC_USERSET, QUERY_TUNING_OTHER,
+			gettext_noop("Sets the size of the candidate list of hnsw index scans."),
+			gettext_noop("Larger values find the nearest neighbours more reliably and "
+						 "are slower. A scan that needs more rows searches again with "
+						 "twice as many.")
+		},
+		&hnsw_ef_search,
+		HNSW_DEFAULT_EF_SEARCH, 1, HNSW_MAX_EF_SEARCH,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"model_thread_pool_size", PGC_USERSET, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of threads preprocessing and postprocessing a prediction batch."),
+			gettext_noop("The backend itself counts as one of them. Zero uses one thread per CPU.")
+		},
+		&model_thread_pool_size,
+		0, 0, MAX_THREAD_POOL_SIZE,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"model_intra_op_threads", PGC_USERSET, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of intra-op threads of a forward pass."),
+			gettext_noop("Zero uses the libtorch default of one per core.")
+		},
+		&model_intra_op_threads,
+		0, 0, 1024,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"model_inter_op_threads", PGC_USERSET, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of inter-op threads of a backend."),
+			gettext_noop("Only takes effect before the first inference of a session. "
+						 "Zero uses the libtorch default.")
+		},
+		&model_inter_op_threads,
+		0, 0, 1024,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"model_thread_budget", PGC_SIGHUP, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of intra-op threads all backends may use at once."),
+			gettext_noop("A forward pass leases its threads from the budget and runs with "
+						 "one thread when it is spent. Zero means no limit.")
+		},
+		&model_thread_budget,
+		0, 0, 65536,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"autovacuum_work_mem", PGC_SIGHUP, RESOURCES_MEM,
 			gettext_noop("Sets the maximum memory to be used by each autovacuum worker process."),
@@ -3290,6 +3489,17 @@ static struct config_real ConfigureNamesReal[] =
 		DEFAULT_PARALLEL_SETUP_COST, 0, DBL_MAX,
 		NULL, NULL, NULL
 	},
+	{
+		{"predict_param_cost", PGC_USERSET, QUERY_TUNING_COST,
+			gettext_noop("Sets the planner's estimate of the cost of "
+						 "running a model, per model parameter and predicted row."),
+			NULL,
+			GUC_EXPLAIN
+		},
+		&predict_param_cost,
+		DEFAULT_PREDICT_PARAM_COST, 0, DBL_MAX,
+		NULL, NULL, NULL
+	},
 
 	{
 		{"jit_above_cost", PGC_USERSET, QUERY_TUNING_COST,
@@ -4209,6 +4419,17 @@ static struct config_string ConfigureNamesString[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"model_thread_affinity", PGC_USERSET, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the CPUs the inference threads of a backend run on."),
+			gettext_noop("A list of CPUs like 0-15,32-47, or numa to bind each backend "
+						 "to the CPUs of one NUMA node. Empty means no binding.")
+		},
+		&model_thread_affinity,
+		"",
+		check_model_thread_affinity, NULL, NULL
+	},
+
 	/* End-of-list marker */
 	{
 		{NULL, 0, 0, NULL, NULL}, NULL, NULL, NULL, NULL, NULL
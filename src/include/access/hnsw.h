@@ -0,0 +1,254 @@
+/*-------------------------------------------------------------------------
+ *
+ * hnsw.h
+ *	  header file for the hnsw (hierarchical navigable small world) index
+ *	  access method.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/hnsw.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef HNSW_H
+#define HNSW_H
+
+#include "access/amapi.h"
+#include "access/generic_xlog.h"
+#include "access/itup.h"
+#include "storage/bufpage.h"
+#include "utils/hsearch.h"
+#include "utils/relcache.h"
+#include "utils/vector_distance.h"
+
+/* Support procedure numbers */
+#define HNSW_DISTANCE_PROC				1
+#define HNSW_NPROC						1
+
+/* The only strategy: ORDER BY the distance operator of the opclass */
+#define HNSW_DISTANCE_STRATEGY			1
+#define HNSW_NSTRATEGIES				1
+
+/* reloptions */
+#define HNSW_DEFAULT_M					16
+#define HNSW_MIN_M						2
+#define HNSW_MAX_M						100
+#define HNSW_DEFAULT_EF_CONSTRUCTION	64
+#define HNSW_MIN_EF_CONSTRUCTION		4
+#define HNSW_MAX_EF_CONSTRUCTION		1000
+
+#define HNSW_DEFAULT_EF_SEARCH			40
+#define HNSW_MAX_EF_SEARCH				1000
+
+/* levels are capped, with m >= 2 level 15 is reached once in 2^15 elements */
+#define HNSW_MAX_LEVEL					15
+
+typedef struct HnswOptions
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int			m;				/* neighbours per element on layers > 0 */
+	int			efConstruction; /* candidate list size while inserting */
+} HnswOptions;
+
+#define HnswGetM(index) \
+	((index)->rd_options ? \
+	 ((HnswOptions *) (index)->rd_options)->m : HNSW_DEFAULT_M)
+#define HnswGetEfConstruction(index) \
+	((index)->rd_options ? \
+	 ((HnswOptions *) (index)->rd_options)->efConstruction : \
+	 HNSW_DEFAULT_EF_CONSTRUCTION)
+
+/*
+ * Page layout.  Block 0 is the metapage, all other pages hold element tuples
+ * which are appended and never moved, so that the TID of an element can be
+ * used as a link in the graph.
+ */
+#define HNSW_METAPAGE_BLKNO		0
+#define HNSW_HEAD_BLKNO			1
+
+#define HNSW_MAGIC_NUMBER		0x484E5357
+#define HNSW_VERSION			1
+
+/* Special space of every page */
+typedef struct HnswPageOpaqueData
+{
+	uint16		flags;
+	uint16		hnsw_page_id;	/* for identification of HNSW indexes */
+} HnswPageOpaqueData;
+
+typedef HnswPageOpaqueData *HnswPageOpaque;
+
+#define HNSW_META				(1 << 0)
+
+/* same role as BLOOM_PAGE_ID or SPGIST_PAGE_ID */
+#define HNSW_PAGE_ID			0xFF90
+
+#define HnswPageGetOpaque(page) ((HnswPageOpaque) PageGetSpecialPointer(page))
+
+typedef struct HnswMetaPageData
+{
+	uint32		magicNumber;
+	uint32		version;
+	uint32		dim;			/* dimension of the indexed vectors, 0 while
+								 * the index is empty */
+	uint16		m;				/* m the element tuples were laid out with */
+	int16		entryLevel;		/* top layer of the graph, -1 if empty */
+	ItemPointerData entryPoint; /* element the searches start at */
+	BlockNumber insertPage;		/* last page, new elements go there */
+} HnswMetaPageData;
+
+#define HnswPageGetMeta(page) ((HnswMetaPageData *) PageGetContents(page))
+
+/*
+ * One slot of a neighbour list.  The distance to the owner is kept so that a
+ * full list can be pruned without reading the neighbours.
+ */
+typedef struct HnswNeighbor
+{
+	ItemPointerData tid;		/* invalid if the slot is free */
+	float4		distance;
+} HnswNeighbor;
+
+/*
+ * An element: the heap TID, the neighbour lists of all its layers and the
+ * vector.  Layer 0 has 2 * m slots, every higher layer m.  The tuple size is
+ * fixed by the level when it is formed, neighbour lists are updated in place.
+ */
+typedef struct HnswElementTupleData
+{
+	ItemPointerData heaptid;
+	uint8		level;
+	uint8		deleted;		/* set by VACUUM, still used to navigate */
+	uint16		dim;
+	HnswNeighbor neighbors[FLEXIBLE_ARRAY_MEMBER];
+	/* float4 vector[dim] follows the neighbours */
+} HnswElementTupleData;
+
+typedef HnswElementTupleData *HnswElementTuple;
+
+#define HNSW_NEIGHBOR_COUNT(level, m)	((m) * ((level) + 2))
+#define HNSW_LAYER_START(layer, m)		((layer) == 0 ? 0 : (m) * ((layer) + 1))
+#define HNSW_LAYER_SIZE(layer, m)		((layer) == 0 ? 2 * (m) : (m))
+
+#define HNSW_ELEMENT_SIZE(level, m, dim) \
+	(offsetof(HnswElementTupleData, neighbors) + \
+	 sizeof(HnswNeighbor) * HNSW_NEIGHBOR_COUNT(level, m) + \
+	 sizeof(float4) * (dim))
+#define HnswElementVector(etup, m) \
+	((float4 *) &(etup)->neighbors[HNSW_NEIGHBOR_COUNT((etup)->level, m)])
+
+/* largest element tuple that fits on an empty page */
+#define HNSW_MAX_ELEMENT_SIZE \
+	(BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - \
+	 MAXALIGN(sizeof(HnswPageOpaqueData)) - sizeof(ItemIdData))
+
+/* which distance the opclass orders by */
+typedef enum HnswDistanceKind
+{
+	HNSW_DISTANCE_L2,
+	HNSW_DISTANCE_INNER_PRODUCT,
+	HNSW_DISTANCE_COSINE
+} HnswDistanceKind;
+
+/* Per-index information needed by build, insert and scan */
+typedef struct HnswState
+{
+	Relation	index;
+	int			m;
+	int			efConstruction;
+	int			dim;			/* 0 until the first vector is seen */
+	HnswDistanceKind kind;
+	VectorDistanceKernel kernel;
+} HnswState;
+
+/*
+ * An element met while searching a layer.  The distance is the internal one
+ * (squared for l2), HnswOrderByDistance turns it into the operator's value.
+ */
+typedef struct HnswCandidate
+{
+	ItemPointerData tid;		/* the element in the index */
+	ItemPointerData heaptid;
+	float4		distance;
+	bool		deleted;
+	bool		expanded;		/* neighbours already visited */
+} HnswCandidate;
+
+/* Opaque for scans */
+typedef struct HnswScanOpaqueData
+{
+	HnswState	state;
+	bool		first;			/* the search hasn't run yet */
+	bool		nullQuery;		/* ORDER BY distance to NULL */
+	float4	   *query;
+	HnswCandidate entry;		/* where the search enters layer 0 */
+	HnswCandidate *w;			/* results, nearest first */
+	int			nw;
+	int			ef;				/* size of w, grows when it runs out */
+	int			next;			/* next result to return */
+	HTAB	   *returned;		/* elements returned so far */
+	float4		lastDistance;	/* distance of the last one */
+	BlockNumber blkno;			/* position of a NULL query walk */
+	OffsetNumber offnum;
+	Oid		   *orderByTypes;
+	MemoryContext scanCtx;		/* reset by rescan */
+} HnswScanOpaqueData;
+
+typedef HnswScanOpaqueData *HnswScanOpaque;
+
+/* GUC */
+extern int	hnsw_ef_search;
+
+/* hnsw.c */
+extern bytea *hnswoptions(Datum reloptions, bool validate);
+
+/* hnswutils.c */
+extern void HnswInitState(HnswState *state, Relation index, bool readMeta);
+extern float4 HnswDistance(HnswState *state, const float4 *a, const float4 *b);
+extern double HnswOrderByDistance(HnswState *state, float4 distance);
+extern void HnswCheckDim(HnswState *state, int dim);
+extern int	HnswRandomLevel(int m, int dim);
+extern void HnswInitPage(Page page, uint16 flags);
+extern void HnswFillMetapage(Page page, int m);
+extern void HnswInitMetapage(Relation index, int m);
+extern void HnswGetMetaPageData(Relation index, HnswMetaPageData *meta);
+extern void HnswUpdateMetaPage(Relation index, HnswMetaPageData *meta);
+extern Buffer HnswNewBuffer(Relation index);
+extern void HnswLoadElement(HnswState *state, HnswCandidate *c,
+							const float4 *query);
+extern int	HnswSearchLayer(HnswState *state, const float4 *query,
+							HnswCandidate *w, int nw, int ef, int layer);
+
+/* hnswinsert.c */
+extern void HnswInsertElement(HnswState *state, ItemPointer heaptid,
+							  const float4 *vector, int dim);
+extern bool hnswinsert(Relation index, Datum *values, bool *isnull,
+					   ItemPointer ht_ctid, Relation heapRel,
+					   IndexUniqueCheck checkUnique,
+					   struct IndexInfo *indexInfo);
+
+/* hnswbuild.c */
+extern IndexBuildResult *hnswbuild(Relation heap, Relation index,
+								   struct IndexInfo *indexInfo);
+extern void hnswbuildempty(Relation index);
+
+/* hnswscan.c */
+extern IndexScanDesc hnswbeginscan(Relation r, int nkeys, int norderbys);
+extern void hnswrescan(IndexScanDesc scan, ScanKey scankey, int nscankeys,
+					   ScanKey orderbys, int norderbys);
+extern bool hnswgettuple(IndexScanDesc scan, ScanDirection dir);
+extern void hnswendscan(IndexScanDesc scan);
+
+/* hnswvacuum.c */
+extern IndexBulkDeleteResult *hnswbulkdelete(IndexVacuumInfo *info,
+											 IndexBulkDeleteResult *stats,
+											 IndexBulkDeleteCallback callback,
+											 void *callback_state);
+extern IndexBulkDeleteResult *hnswvacuumcleanup(IndexVacuumInfo *info,
+												IndexBulkDeleteResult *stats);
+
+/* hnswvalidate.c */
+extern bool hnswvalidate(Oid opclassoid);
+
+#endif							/* HNSW_H */
@@ -174,6 +174,18 @@ extern struct varlena *heap_tuple_untoast_attr_slice(struct varlena *attr,
 													 int32 sliceoffset,
 													 int32 slicelength);
 
+/* ----------
+ * heap_tuple_untoast_attr_into() -
+ *
+ *		Copies the specified portion of an attribute into a caller
+ *		supplied buffer, without a palloc'd copy of external values.
+ * ----------
+ */
+extern void heap_tuple_untoast_attr_into(struct varlena *attr,
+										 int32 sliceoffset,
+										 int32 slicelength,
+										 char *dest);
+
 /* ----------
  * toast_flatten_tuple -
  *
@@ -22,6 +22,7 @@ CATALOG(model_info,2023,ModelInfoRelationId)
 	text    	modelpath;
 	NameData    basemodel BKI_FORCE_NULL BKI_DEFAULT(_null_);
 	text 		description BKI_FORCE_NULL BKI_DEFAULT(_null_);
+	text		modeloptions[1] BKI_FORCE_NULL BKI_DEFAULT(_null_);	/* load options, name=value */
 	/*  注意：注释只能够是这种格式  */
 #endif
     
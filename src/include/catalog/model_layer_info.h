@@ -19,6 +19,7 @@ CATALOG(model_layer_info,2121,ModelLayerInfoRelationId)
 #ifdef CATALOG_VARLEN	
 	text    layername;
 	int16 	    layerindex;				
+	int32		layerchunkno;		/* part of a layer split into chunks */
 	Vector    	parameter;
 	/*  注意：注释只能够是这种格式  */
 #endif
@@ -28,4 +29,11 @@ CATALOG(model_layer_info,2121,ModelLayerInfoRelationId)
 
 typedef FormData_pg_model_layer_info *Form_pg_model_layer_info;
 
+/*
+ * Layers of more than MODEL_LAYER_CHUNK_DIM elements are stored as 1-D chunks
+ * of that many elements, numbered by layerchunkno from 0. Smaller layers are
+ * one row, chunk 0, whose vector has the shape of the parameter.
+ */
+#define MODEL_LAYER_CHUNK_DIM	(16 * 1024 * 1024)
+
 #endif
\ No newline at end of file
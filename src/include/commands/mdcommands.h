@@ -7,6 +7,9 @@
 #include "lib/stringinfo.h"
 #include "nodes/parsenodes.h"
 
+/* GUC parameter */
+extern bool model_preload_on_create;
+
 extern void createmd(ParseState *pstate, const CreatemdStmt *stmt);
 extern void dropmd(ParseState *pstate, const DropmdStmt *stmt);
 extern void updatemd(ParseState *pstate, const UpdatemdStmt *stmt);
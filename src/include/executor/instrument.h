@@ -32,12 +32,25 @@ typedef struct BufferUsage
 	instr_time	blk_write_time; /* time spent writing */
 } BufferUsage;
 
+typedef struct ModelUsage
+{
+	long		batches;		/* # of forward passes, a single row is one */
+	long		rows;			/* # of rows inferred */
+	long		switches;		/* # of times the model differed from the
+								 * previous pass */
+	int64		pre_us;			/* time spent preprocessing, in microseconds */
+	int64		infer_us;		/* time spent in forward */
+	int64		post_us;		/* time spent postprocessing */
+	char		model[NAMEDATALEN]; /* model of the last counted pass */
+} ModelUsage;
+
 /* Flag bits included in InstrAlloc's instrument_options bitmask */
 typedef enum InstrumentOption
 {
 	INSTRUMENT_TIMER = 1 << 0,	/* needs timer (and row counts) */
 	INSTRUMENT_BUFFERS = 1 << 1,	/* needs buffer usage */
 	INSTRUMENT_ROWS = 1 << 2,	/* needs row count */
+	INSTRUMENT_MODEL = 1 << 3,	/* needs model inference usage */
 	INSTRUMENT_ALL = PG_INT32_MAX
 } InstrumentOption;
 
@@ -46,6 +59,7 @@ typedef struct Instrumentation
 	/* Parameters set at node creation: */
 	bool		need_timer;		/* true if we need timer data */
 	bool		need_bufusage;	/* true if we need buffer usage data */
+	bool		need_modelusage;	/* true if we need model usage data */
 	/* Info about current plan cycle: */
 	bool		running;		/* true if we've completed first tuple */
 	instr_time	starttime;		/* Start time of current iteration of node */
@@ -53,6 +67,7 @@ typedef struct Instrumentation
 	double		firsttuple;		/* Time for first tuple of this cycle */
 	double		tuplecount;		/* Tuples emitted so far this cycle */
 	BufferUsage bufusage_start; /* Buffer usage at start */
+	ModelUsage	modelusage_start;	/* Model usage at start */
 	/* Accumulated statistics across all completed cycles: */
 	double		startup;		/* Total startup time (in seconds) */
 	double		total;			/* Total total time (in seconds) */
@@ -62,6 +77,8 @@ typedef struct Instrumentation
 	double		nfiltered1;		/* # tuples removed by scanqual or joinqual */
 	double		nfiltered2;		/* # tuples removed by "other" quals */
 	BufferUsage bufusage;		/* Total buffer usage */
+	ModelUsage	modelusage;		/* Total model usage */
+	bool		multiple_models;	/* modelusage covers more than one model */
 } Instrumentation;
 
 typedef struct WorkerInstrumentation
@@ -71,6 +88,7 @@ typedef struct WorkerInstrumentation
 } WorkerInstrumentation;
 
 extern PGDLLIMPORT BufferUsage pgBufferUsage;
+extern PGDLLIMPORT ModelUsage pgModelUsage;
 
 extern Instrumentation *InstrAlloc(int n, int instrument_options);
 extern void InstrInit(Instrumentation *instr, int instrument_options);
@@ -79,7 +97,9 @@ extern void InstrStopNode(Instrumentation *instr, double nTuples);
 extern void InstrEndLoop(Instrumentation *instr);
 extern void InstrAggNode(Instrumentation *dst, Instrumentation *add);
 extern void InstrStartParallelQuery(void);
-extern void InstrEndParallelQuery(BufferUsage *result);
-extern void InstrAccumParallelQuery(BufferUsage *result);
+extern void InstrEndParallelQuery(BufferUsage *bufusage, ModelUsage *modelusage);
+extern void InstrAccumParallelQuery(BufferUsage *bufusage, ModelUsage *modelusage);
+extern void InstrCountPrediction(const char *model, long rows,
+								 int64 pre_us, int64 infer_us, int64 post_us);
 
 #endif							/* INSTRUMENT_H */
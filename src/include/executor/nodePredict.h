@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * nodePredict.h
+ *
+ *
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/executor/nodePredict.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef NODEPREDICT_H
+#define NODEPREDICT_H
+
+#include "access/parallel.h"
+#include "nodes/execnodes.h"
+
+/* rows of the first batch, later batches double up to predict_batch_size */
+#define PREDICT_INITIAL_BATCH_SIZE	16
+
+extern PGDLLIMPORT int predict_batch_size;
+
+extern PredictState *ExecInitPredict(Predict *node, EState *estate, int eflags);
+extern void ExecEndPredict(PredictState *node);
+extern void ExecReScanPredict(PredictState *node);
+
+/* parallel scan support */
+extern void ExecPredictEstimate(PredictState *node, ParallelContext *pcxt);
+extern void ExecPredictInitializeDSM(PredictState *node, ParallelContext *pcxt);
+extern void ExecPredictInitializeWorker(PredictState *node, ParallelWorkerContext *pwcxt);
+
+#endif							/* NODEPREDICT_H */
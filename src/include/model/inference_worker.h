@@ -0,0 +1,39 @@
+/*
+ * inference_worker.h
+ *
+ * pool of inference background workers. Backends put their preprocessed
+ * input tensors into a shared request queue, workers coalesce queued requests
+ * for the same model into one forward pass and send every backend its slice
+ * of the output.
+ */
+#ifndef _INFERENCE_WORKER_H_
+#define _INFERENCE_WORKER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "postgres.h"
+
+#define MAX_INFERENCE_WORKERS       64
+#define INFERENCE_QUEUE_SIZE        256
+
+/* GUCs */
+extern int inference_workers;
+extern int inference_max_batch_size;
+extern int inference_max_wait_us;
+extern int inference_worker_threads;
+
+/* true in an inference worker, which must run forward() itself */
+extern bool am_inference_worker;
+
+extern Size InferenceQueueShmemSize(void);
+extern void InferenceQueueShmemInit(void);
+extern void InferenceWorkersRegister(void);
+extern void InferenceWorkerMain(Datum main_arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
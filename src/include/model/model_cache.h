@@ -0,0 +1,69 @@
+/*
+ * model_cache.h
+ *
+ * server-wide cache of model weights. The weights of a loaded module are
+ * written once into a blob file under pg_model_cache/ and every backend maps
+ * that file, so the pages are shared through the OS page cache instead of
+ * being copied into each backend's heap.
+ */
+#ifndef _MODEL_CACHE_H_
+#define _MODEL_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "postgres.h"
+
+#define MODEL_CACHE_DIR          "pg_model_cache"
+#define MODEL_CACHE_MAX_ENTRIES  256
+#define MODEL_CACHE_KEY_LEN      MAXPGPATH
+
+/* every tensor payload in a blob starts at a multiple of this */
+#define MODEL_CACHE_ALIGN        64
+#define MODEL_CACHE_ALIGN_SIZE(len) TYPEALIGN(MODEL_CACHE_ALIGN, (len))
+
+/* GUC: budget of all resident blobs, in kB */
+extern int model_cache_size;
+
+typedef struct ModelCacheSegment {
+    const void* data;
+    Size        len;
+} ModelCacheSegment;
+
+extern Size ModelCacheShmemSize(void);
+extern void ModelCacheShmemInit(void);
+
+/*
+ * map the blob for key if it is resident, NULL otherwise. The mapping lives
+ * until the backend exits.
+ */
+extern char* model_cache_attach(const char *key, Size *size);
+
+/*
+ * write segments (each aligned to MODEL_CACHE_ALIGN) as the blob for key and
+ * map it. Returns NULL when the budget can't be met or another backend is
+ * already storing the same key; the caller keeps its private copy then.
+ */
+extern char* model_cache_store(const char *key, const ModelCacheSegment *segs, int nsegs, Size *size);
+
+/*
+ * unmap the blob for key and drop this backend's pin on it, for a blob the
+ * caller found unusable. Nothing of it may be in use anymore.
+ */
+extern void model_cache_detach(const char *key);
+
+/* forget the blob for key, e.g. after DROP MODEL */
+extern void model_cache_evict(const char *key);
+
+/*
+ * forget the blob for model_path and those of its variants, keyed
+ * "<model_path>#<suffix>" (fine-tuned models, bf16 copies)
+ */
+extern void model_cache_evict_model(const char *model_path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
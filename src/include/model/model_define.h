@@ -9,6 +9,9 @@ typedef union {
     float8 floating;
 } Args;
 
+// 冻结/优化后保存的模型: <model path>.opt
+#define MODEL_OPTIMIZED_SUFFIX ".opt"
+
 void register_default_model();
 char* replace_model_path(char* origin_path);
 
@@ -0,0 +1,67 @@
+/*
+ * model_engine.h
+ *
+ * models served without libtorch. An engine recognizes the files of its
+ * format, keeps the model in its own layout and scores rows of float
+ * features as they come from the tuples, without tensors. The model manager
+ * offers a model file to the engines before torch::jit::load, TorchScript
+ * stays the default.
+ */
+#ifndef _MODEL_ENGINE_H_
+#define _MODEL_ENGINE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "postgres.h"
+
+#ifdef __cplusplus
+
+class ModelEngine {
+public:
+    virtual ~ModelEngine() {}
+
+    virtual const char* name() const = 0;
+
+    // columns a row needs at least, and scores per row
+    virtual int num_features() const = 0;
+    virtual int num_outputs() const = 0;
+
+    // the scores are class probabilities
+    virtual bool classifier() const = 0;
+
+    /*
+     * scores of nrows rows of ncols >= num_features() floats each, NaN is a
+     * missing value, into out[nrows * num_outputs()]. May run on the threads
+     * of the backend's pool, so it must not palloc or ereport.
+     */
+    virtual void predict(const float* rows, int64 nrows, int64 ncols, float8* out) const = 0;
+
+    virtual Size memory_bytes() const = 0;
+};
+
+/*
+ * CREATE MODEL ... WITH options for formats whose files leave out what a
+ * prediction needs, e.g. XGBoost dumps
+ */
+typedef struct ModelEngineOptions {
+    int     num_class = 0;          // 0: one output, or as the file says
+    bool    has_base_score = false;
+    double  base_score = 0.0;       // margin every output starts at
+} ModelEngineOptions;
+
+/*
+ * the model in data, NUL-terminated, if the file is in the engine's format
+ * and NULL otherwise. Errors in a file of its format are reported. options
+ * is NULL for a model created without options.
+ */
+typedef ModelEngine* (*ModelEngineLoader)(const char* path, char* data, Size len, const ModelEngineOptions* options);
+
+// tree_engine.cpp: XGBoost and LightGBM JSON models
+ModelEngine* tree_engine_load(const char* path, char* data, Size len, const ModelEngineOptions* options);
+
+}
+#endif
+
+#endif
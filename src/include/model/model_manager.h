@@ -11,28 +11,77 @@
 
 #include <torch/torch.h>
 #include <torch/script.h>
+#include "model/model_engine.h"
 
 extern "C"{
 
 #include "model_define.h"
+#include "postgres.h"
 #include <unordered_map>
+#include <unordered_set>
 
 using PreProcessCallback = bool(*)(std::vector<torch::jit::IValue>&, Args*);
+// 一次处理整个batch: rows[0..nrows)的参数，输出每个模型输入对应的[nrows, ...] tensor
+using BatchPreProcessCallback = bool(*)(std::vector<torch::jit::IValue>&, Args**, int);
 using OutputProcessFloatCallback = bool(*)(torch::jit::IValue&, Args*, float8&);
 using OutputProcessTextCallback = bool(*)(torch::jit::IValue&, Args*, std::string&);
+// 一次处理整个batch的输出: output为batch的forward结果，每行一个结果追加到results
+using BatchOutputProcessFloatCallback = bool(*)(torch::jit::IValue&, Args**, int, std::vector<float8>&);
+using BatchOutputProcessTextCallback = bool(*)(torch::jit::IValue&, Args**, int, std::vector<std::string>&);
+
+// 模型执行精度, WITH (precision = fp32|bf16|int8-dynamic)
+typedef enum ModelPrecision {
+    MODEL_PRECISION_FP32,
+    MODEL_PRECISION_BF16,           // 权重转为bfloat16，输入输出在调用时转换
+    MODEL_PRECISION_INT8_DYNAMIC    // Linear层权重量化为int8，激活在每次调用时动态量化
+} ModelPrecision;
+
+// CREATE MODEL ... WITH (...) 中的加载选项，只对非微调模型生效
+typedef struct ModelLoadOptions {
+    ModelPrecision                      precision = MODEL_PRECISION_FP32;
+    bool                                freeze = false;     // torch::jit::freeze
+    bool                                optimize = false;   // torch::jit::optimize_for_inference, implies freeze
+    int                                 warmup = 0;         // synthetic forward passes after loading
+    std::vector<std::vector<int64_t>>   warmup_shape;       // one shape per input: '1,3,224,224;1,10'
+    bool                                persist = false;    // save the frozen module as <model path>.opt
+    ModelEngineOptions                  engine;             // num_class, base_score of XGBoost dumps
+} ModelLoadOptions;
 
 typedef struct ModelManager {
     std::unordered_map<std::string, std::pair<torch::jit::script::Module, torch::DeviceType>>        module_handle_;  //key为路径，value为module句柄以及是否使用gpu
     std::unordered_map<std::string, PreProcessCallback>                                              module_preprocess_functions_; //key为模型路径，value为注册的预处理回调函数
+    std::unordered_map<std::string, BatchPreProcessCallback>                                         module_batch_preprocess_functions_; //key为模型路径，value为注册的batch预处理回调函数
     std::unordered_map<std::string, OutputProcessFloatCallback>                                      module_outputprocess_functions_float_; //key为模型路径，value为输出处理回调函数
     std::unordered_map<std::string, OutputProcessTextCallback>                                       module_outputprocess_functions_text_; //key为模型路径，value为输出处理回调函数
+    std::unordered_map<std::string, BatchOutputProcessFloatCallback>                                 module_batch_outputprocess_functions_float_; //key为模型路径，value为batch输出处理回调函数
+    std::unordered_map<std::string, BatchOutputProcessTextCallback>                                  module_batch_outputprocess_functions_text_; //key为模型路径，value为batch输出处理回调函数
+    std::unordered_set<std::string>                                                                  module_overridden_; //加载了微调参数的模型路径，不能交给inference worker
+    std::unordered_map<std::string, ModelLoadOptions>                                                module_load_options_; //key为模型路径，value为model_info中的加载选项
+    std::unordered_set<std::string>                                                                  module_frozen_; //冻结后的模型路径，权重是图中的常量，不共享也不能移到gpu
+    std::unordered_set<std::string>                                                                  module_bf16_; //bf16模型路径，forward前后转换输入输出的类型
+    std::unordered_map<std::string, std::shared_ptr<ModelEngine>>                                    module_engine_; //key为模型路径，value为不经过torch的引擎加载的模型，如树模型
 }ModelManager;
 
 
 // ... 其他函数声明 ...
 
+ModelPrecision model_manager_parse_precision(const char *name);
+
+void model_manager_parse_load_options(Datum options, ModelLoadOptions& load_options);
+
 bool model_manager_load_model(ModelManager *manager, const char *model_path, const char *model_name=NULL, const char *base_model=NULL);
 
+bool model_manager_load_model_from_buffer(ModelManager *manager, const char *model_path, char *data, size_t len);
+
+// bytes model_manager_publish_shared needs for a loaded model, 0 if it can't be published
+Size model_manager_shared_size(ModelManager *manager, const char *model_path);
+
+// copy the archive and the weights of a loaded model into dest, e.g. a parallel query's DSM segment
+bool model_manager_publish_shared(ModelManager *manager, const char *model_path, char *dest, Size size);
+
+// load a model published by model_manager_publish_shared, its weights stay in src
+bool model_manager_attach_shared(ModelManager *manager, const char *model_path, char *src);
+
 bool model_manager_get_model_path(ModelManager *manager, const char *model_name, char **model_path, char **base_model);
 
 bool model_manager_get_model_md5(ModelManager *manager, const char *model_path, char **md5);
@@ -41,21 +90,47 @@ bool model_manager_set_cuda(ModelManager *manager, const char *model_path);
 
 bool model_manager_get_device_type(ModelManager *manager, const char *model_path, torch::DeviceType& device_type);
 
+// bytes of the parameters and buffers of a loaded model, 0 if it is not loaded
+int64 model_manager_module_bytes(ModelManager *manager, const char *model_path);
+
+// the engine serving a loaded model, NULL for TorchScript models
+ModelEngine* model_manager_get_engine(ModelManager *manager, const char *model_path);
+
+// score rows of float features with an engine, split across the backend's thread pool
+void model_manager_engine_predict(ModelEngine *engine, const float *rows, int64 nrows, int64 ncols, float8 *out);
+
 bool model_manager_pre_process(ModelManager *manager, const char *model_path, std::vector<torch::jit::IValue>& input_tensor, Args *args);
 
+bool model_manager_has_batch_pre_process(ModelManager *manager, const char *model_path);
+
+bool model_manager_batch_pre_process(ModelManager *manager, const char *model_path, std::vector<torch::jit::IValue>& input_tensor, Args **rows, int nrows);
+
 bool model_manager_output_process_float(ModelManager *manager, const char *model_path, torch::jit::IValue& output_tensor, Args* args, float8& result);
 
 bool model_manager_output_process_text(ModelManager *manager, const char *model_path, torch::jit::IValue& output_tensor, Args* args, std::string& result);
 
+bool model_manager_batch_output_process_float(ModelManager *manager, const char *model_path, torch::jit::IValue& output_tensor, Args** rows, int nrows, std::vector<float8>& results);
+
+bool model_manager_batch_output_process_text(ModelManager *manager, const char *model_path, torch::jit::IValue& output_tensor, Args** rows, int nrows, std::vector<std::string>& results);
+
 void model_manager_register_pre_process(ModelManager *manager, const char *model_name, PreProcessCallback func);
 
+void model_manager_register_batch_pre_process(ModelManager *manager, const char *model_name, BatchPreProcessCallback func);
+
 void model_manager_register_output_process_float(ModelManager *manager, const char *model_name, OutputProcessFloatCallback func);
 
 void model_manager_register_output_process_text(ModelManager *manager, const char *model_name, OutputProcessTextCallback func);
 
+void model_manager_register_batch_output_process_float(ModelManager *manager, const char *model_name, BatchOutputProcessFloatCallback func);
+
+void model_manager_register_batch_output_process_text(ModelManager *manager, const char *model_name, BatchOutputProcessTextCallback func);
+
 bool model_manager_predict(ModelManager *manager, const char *model_path, torch::jit::IValue& input, torch::jit::IValue& output);
 
 bool model_manager_predict_multi_input(ModelManager *manager, const char *model_path, std::vector<torch::jit::IValue>& input, torch::jit::IValue& output);
 
+// inference_worker.cpp
+bool inference_queue_submit(const char *model_path, std::vector<torch::jit::IValue>& input, torch::jit::IValue& output);
+
 }
 #endif // _MODEL_MANAGER_H_
\ No newline at end of file
@@ -0,0 +1,55 @@
+/*
+ * model_stats.h
+ *
+ * per-model inference statistics of the pg_stat_model view: calls, rows and
+ * batches, cumulative and histogrammed preprocess/infer/postprocess time,
+ * loads and errors. Counters live in a shared hash keyed by database and
+ * model name and are updated in place at the end of every prediction.
+ */
+#ifndef _MODEL_STATS_H_
+#define _MODEL_STATS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "postgres.h"
+#include "fmgr.h"
+
+typedef enum ModelStatsStage {
+    MODEL_STATS_PRE,
+    MODEL_STATS_INFER,
+    MODEL_STATS_POST,
+    MODEL_STATS_NSTAGES
+} ModelStatsStage;
+
+/*
+ * latency histogram of a stage, bucket i counts the calls or batches that
+ * took [2^i, 2^(i+1)) microseconds, the first also shorter ones and the last
+ * also longer ones (from about 8 seconds).
+ */
+#define MODEL_STATS_HIST_BUCKETS    24
+
+/* GUCs */
+extern bool track_model_stats;
+extern int model_stats_max;
+
+extern Size ModelStatsShmemSize(void);
+extern void ModelStatsShmemInit(void);
+
+/*
+ * a prediction of model_name starts. If the transaction aborts before the
+ * matching model_stats_report the prediction counts as an error.
+ */
+extern void model_stats_begin(const char *model_name);
+/* one call (batch false) or one batch of rows finished, times in microseconds */
+extern void model_stats_report(const char *model_name, int64 rows, bool batch,
+                               const int64 stage_us[MODEL_STATS_NSTAGES]);
+/* the backend loaded model_name, resident_bytes is the size of its parameters and buffers */
+extern void model_stats_report_load(const char *model_name, int64 load_us, int64 resident_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
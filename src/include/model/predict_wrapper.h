@@ -32,28 +32,73 @@ typedef struct VecAggState {
     char* model;
     char* cuda;
     int nxt_csr;
-    int64_t pre_time;   // ms
-    int64_t infer_time; // ms
-    int64_t post_time;  // ms
+    int64_t pre_time;   // us
+    int64_t infer_time; // us
+    int64_t post_time;  // us
+    bool    columnar;           // numeric arguments only and no preprocess callback
+    float*  features;           // columnar: feature_rows x feature_dim, row-major
+    int     feature_dim;
+    Oid*    feature_types;
+    int64   feature_rows;
+    int64   feature_capacity;   // in rows, doubled when full
+    Args*   out_rows;           // columnar: results of the last batch
 } VecAggState;
 
+#define VEC_AGG_INITIAL_ROWS    1024
 
-typedef struct ModelLayer {
-    char*    layer_name;
-    Vector*  layer_parameter;
-} ModelLayer;
+/* rows accumulated and not yet removed by the inverse transition */
+#define VecAggStateRows(state) \
+    ((state)->columnar ? (int) (state)->feature_rows : list_length((state)->ins))
+
+
+/*
+ * called for every chunk of every parameter of a model, see
+ * MODEL_LAYER_CHUNK_DIM. chunk is freed once the callback returns.
+ */
+typedef void (*ModelLayerChunkCallback)(const char* layer_name, int16 layer_index, int32 chunk_no,
+                                        Vector* chunk, void* arg);
 
 VecAggState *makeVecAggState(FunctionCallInfo fcinfo);
 
 Args* makeVecFromArgs(FunctionCallInfo fcinfo, int start, int dim);
 
+void initVecAggTypes(VecAggState *state, const Oid *types, int ntypes);
+
+void initVecAggColumnar(VecAggState *state, FunctionCallInfo fcinfo, int start);
+
+void appendVecAggFeatures(VecAggState *state, FunctionCallInfo fcinfo, int start);
+
+void appendVecAggRow(VecAggState *state, const Datum *values, const bool *isnull);
+
 void infer_batch_internal(VecAggState* state, bool ret_float8);
 
 float8 predict_float(const char* model_name, const char* cuda, Args* args);
 
 text*  predict_text(const char* model_name, const char* cuda, Args* args);
 
-void   model_parameter_extraction(const char* model_path, ModelLayer** parameter_list, uint32* layer_size);
+/*
+ * predict_float/predict_text of one row of a model served by a model engine,
+ * e.g. a tree ensemble: the numeric arguments from start on are scored as
+ * they are, without Args or tensors. Returns false for other models, the
+ * caller takes the usual path then.
+ */
+bool predict_native(const char* model_name, FunctionCallInfo fcinfo, int start, bool ret_float8, Datum* result);
+
+uint32 model_parameter_extraction(const char* model_path, ModelLayerChunkCallback callback, void* arg);
+
+void model_warm_from_buffer(const char* model_path, char* data, Size len);
+
+void model_load_options_validate(Datum options);
+
+/*
+ * parallel query: the leader loads model_name and publishes it into the DSM
+ * segment, workers load it from there with their weights left in place
+ */
+Size model_shared_size(const char* model_name);
+
+bool model_shared_publish(const char* model_name, char* dest, Size size);
+
+bool model_shared_attach(const char* model_name, char* src);
 
 
 
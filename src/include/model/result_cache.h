@@ -0,0 +1,49 @@
+/*
+ * result_cache.h
+ *
+ * cache of predict_float/predict_text results keyed by the model identity
+ * (md5 of its weight file) and a hash of the input values. Each backend has
+ * its own LRU tier bounded by predict_result_cache_size, an optional shared
+ * tier of fixed-size slots lets backends reuse each other's results.
+ */
+#ifndef _RESULT_CACHE_H_
+#define _RESULT_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "postgres.h"
+#include "fmgr.h"
+
+/* models without md5 (fine-tuned ones) are keyed by "name@createtime" */
+#define RESULT_CACHE_MODEL_KEY_LEN      (NAMEDATALEN + 32)
+/* longer text results are only kept in the backend tier */
+#define RESULT_CACHE_SHARED_TEXT_LEN    64
+#define RESULT_CACHE_SHARED_WAYS        4
+
+/* GUCs */
+extern int predict_result_cache_size;
+extern int predict_result_cache_shared_entries;
+
+extern Size ResultCacheShmemSize(void);
+extern void ResultCacheShmemInit(void);
+
+/*
+ * hash the model arguments fcinfo[start..] into *input_hash. false if an
+ * argument type can't be hashed, the call is not cached then.
+ */
+extern bool result_cache_hash_args(FunctionCallInfo fcinfo, int start, uint64 *input_hash);
+/* the same for n values of the given types, e.g. the columns of a row */
+extern bool result_cache_hash_values(const Oid *types, const Datum *values, const bool *isnull,
+                                     int n, uint64 *input_hash);
+
+/* true and *result set (text is palloc'd) if the result of the call is cached */
+extern bool result_cache_lookup(const char *model_name, bool ret_float8, uint64 input_hash, Datum *result);
+extern void result_cache_store(const char *model_name, bool ret_float8, uint64 input_hash, Datum result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
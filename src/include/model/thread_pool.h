@@ -0,0 +1,78 @@
+/*
+ * thread_pool.h
+ *
+ * per-backend work-stealing thread pool used for the row-wise pre/post
+ * processing of batched prediction. Threads are created on first use and
+ * live until the backend exits.
+ */
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#ifdef __cplusplus
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#endif
+
+#include "postgres.h"
+
+#define MAX_THREAD_POOL_SIZE        256
+
+/* GUC: threads working on a batch including the backend itself, 0 = one per CPU */
+extern int model_thread_pool_size;
+
+/*
+ * for C callers: number of threads of the backend's pool including the
+ * caller, and a parallel_for over a plain function. fn runs on other threads
+ * and must not palloc, ereport or touch backend state that isn't thread safe.
+ */
+extern int thread_pool_nthreads(void);
+extern void thread_pool_parallel_for_c(int n, void (*fn) (int i, void *arg), void *arg);
+
+#ifdef __cplusplus
+
+struct ThreadPoolJob;
+
+typedef struct ThreadPoolTask {
+    ThreadPoolJob*  job;
+    int             begin;
+    int             end;
+} ThreadPoolTask;
+
+typedef struct ThreadPoolQueue {
+    std::mutex                  mutex;
+    std::deque<ThreadPoolTask>  tasks;
+} ThreadPoolQueue;
+
+typedef struct ThreadPool {
+    std::vector<std::thread>                        threads_;
+    std::vector<std::unique_ptr<ThreadPoolQueue>>   queues_;    // one per worker thread, owner pops the front, thieves the back
+    std::mutex                                      mutex_;
+    std::condition_variable                         wakeup_;
+    std::atomic<int>                                queued_;
+    bool                                            stop_;
+} ThreadPool;
+
+/* the backend's pool, (re)sized to model_thread_pool_size */
+ThreadPool* thread_pool_get(void);
+
+/*
+ * run fn(i) for every i in [0, n) on the pool and the calling thread, split
+ * into contiguous chunks. Returns when all chunks finished and rethrows the
+ * first exception thrown by fn, the remaining rows of a failed chunk are
+ * skipped.
+ */
+void thread_pool_parallel_for(ThreadPool* pool, int n, const std::function<void(int)>& fn);
+
+}
+#endif
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * torch_threads.h
+ *
+ * libtorch threads of a backend: intra-op and inter-op thread counts, an
+ * optional server-wide budget of intra-op threads that every forward pass
+ * leases its threads from, and optional CPU or NUMA node affinity of the
+ * inference threads.
+ */
+#ifndef _TORCH_THREADS_H_
+#define _TORCH_THREADS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "postgres.h"
+
+#include "utils/guc.h"
+
+/* GUCs */
+extern int model_intra_op_threads;      /* 0 = libtorch default, one per core */
+extern int model_inter_op_threads;      /* 0 = libtorch default */
+extern int model_thread_budget;         /* intra-op threads of all backends, 0 = unlimited */
+extern char* model_thread_affinity;     /* '', 'numa' or a CPU list like '0-15,32-47' */
+
+extern Size TorchThreadsShmemSize(void);
+extern void TorchThreadsShmemInit(void);
+
+extern bool check_model_thread_affinity(char** newval, void** extra, GucSource source);
+
+/*
+ * around every forward pass: applies the thread settings of the session and
+ * leases the intra-op threads from model_thread_budget. Returns the number of
+ * threads leased, which must be given back to torch_threads_release.
+ */
+extern int torch_threads_acquire(void);
+extern void torch_threads_release(int leased);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2377,4 +2377,34 @@ typedef struct LimitState
 	TupleTableSlot *subSlot;	/* tuple last obtained from subplan */
 } LimitState;
 
+/* ----------------
+ *	 PredictState information
+ *
+ *		Rows of the current batch are kept as minimal tuples in batchContext
+ *		along with the results of every predict call, and handed out one at
+ *		a time.  batchSize starts small and doubles up to predict_batch_size,
+ *		so the first rows come back quickly, e.g. under a LIMIT.
+ * ----------------
+ */
+struct VecAggState;
+
+typedef struct PredictState
+{
+	PlanState	ps;				/* its first field is NodeTag */
+	int			numPredicts;
+	struct VecAggState **batches;	/* batch state of each predict call */
+	bool		initialized;	/* batches set up for the argument types */
+	MemoryContext batchContext; /* rows and results of the current batch */
+	MinimalTuple *tuples;		/* rows of the current batch */
+	Datum	  **results;		/* per call, per row */
+	bool	  **resultNulls;
+	int			batchSize;		/* rows to fetch for the next batch */
+	int			numTuples;		/* rows in the current batch */
+	int			nextTuple;		/* next row to return */
+	bool		childDone;		/* child returned its last row */
+	int64		numBatches;		/* batches predicted so far, for EXPLAIN */
+	TupleTableSlot *batchSlot;	/* to deform buffered rows */
+	Size	   *sharedSizes;	/* leader: bytes each call publishes to DSM */
+} PredictState;
+
 #endif							/* EXECNODES_H */
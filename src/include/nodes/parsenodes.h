@@ -3114,6 +3114,7 @@ typedef struct CreatemdStmt
 	char 		*md5;
 	char        *base_model;    /* base model, if empty a new model */
 	char		*desc;			/* model description */
+	List		*options;		/* load options, list of DefElem nodes */
 } CreatemdStmt;
 
 
@@ -3139,6 +3140,7 @@ typedef struct UpdatemdStmt
 	int	   		looid;		    /* large object oid */
 	char 		*md5;
 	char		*desc;			/* model description */
+	List		*options;		/* load options, NIL keeps the current ones */
 } UpdatemdStmt;
 
 /* ----------------------
@@ -984,6 +984,27 @@ typedef struct Limit
 	Node	   *limitCount;		/* COUNT parameter, or NULL if none */
 } Limit;
 
+/* ----------------
+ *		predict node
+ *
+ * Evaluates the predict_float/predict_text calls of its targetlist for a
+ * batch of input rows at a time.  The child computes a NULL placeholder in
+ * place of each call, followed by the call's model arguments as resjunk
+ * columns; every other output column is passed through from the child.
+ * ----------------
+ */
+typedef struct Predict
+{
+	Plan		plan;
+	int			numPredicts;	/* number of predict calls */
+	Oid		   *predictFuncs;	/* F_PG_PREDICT_FLOAT or F_PG_PREDICT_TEXT */
+	AttrNumber *resultColIdx;	/* output column of each call */
+	AttrNumber *argColIdx;		/* first argument column in the child */
+	int		   *numArgs;		/* number of model arguments of each call */
+	List	   *modelNames;		/* model name of each call, as String */
+	List	   *devices;		/* "cpu" or "gpu" of each call, as String */
+} Predict;
+
 
 /*
  * RowMarkType -
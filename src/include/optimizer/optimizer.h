@@ -80,6 +80,7 @@ extern PGDLLIMPORT double cpu_index_tuple_cost;
 extern PGDLLIMPORT double cpu_operator_cost;
 extern PGDLLIMPORT double parallel_tuple_cost;
 extern PGDLLIMPORT double parallel_setup_cost;
+extern PGDLLIMPORT double predict_param_cost;
 extern PGDLLIMPORT int effective_cache_size;
 
 extern double clamp_row_est(double nrows);
@@ -70,5 +70,13 @@ extern void gincostestimate(struct PlannerInfo *root,
 							Selectivity *indexSelectivity,
 							double *indexCorrelation,
 							double *indexPages);
+extern void hnswcostestimate(struct PlannerInfo *root,
+							 struct IndexPath *path,
+							 double loop_count,
+							 Cost *indexStartupCost,
+							 Cost *indexTotalCost,
+							 Selectivity *indexSelectivity,
+							 double *indexCorrelation,
+							 double *indexPages);
 
 #endif							/* INDEX_SELFUNCS_H */
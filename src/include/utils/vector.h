@@ -32,6 +32,8 @@ typedef struct Vector
 #define PG_GETARG_VECTOR_P(x_) DatumGetVector(PG_GETARG_DATUM(x_))
 
 
+extern bool vector_output_full;
+
 // vector_tensor.cpp
 Vector* new_vector(unsigned int dim, unsigned int shape);
 void free_vector(Vector* vector);
@@ -0,0 +1,141 @@
+/*
+ * vector_compact.h
+ *
+ * halfvec (IEEE fp16), bf16vec (bfloat16) and int8vec (int8 with one float
+ * scale per vector): companions of vector that store the elements in 2 or 1
+ * bytes. They share one header, which only stores the shape when it has more
+ * than one dimension, flat vectors carry none of the shape slots of Vector.
+ */
+#ifndef VECTOR_COMPACT_H
+#define VECTOR_COMPACT_H
+
+#include <c.h>
+
+#include "utils/vector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct CompactVector
+{
+    int32 vl_len_;
+    unsigned int dim;
+    uint16 shape_size;
+    uint16 unused;
+    float scale;                /* int8vec: element i is scale * q[i], else 1 */
+    /* int32 shape[shape_size] if shape_size > 1, then the elements */
+    char data[FLEXIBLE_ARRAY_MEMBER];
+} CompactVector;
+
+#define COMPACT_VECTOR_SHAPE_BYTES(shape_size_) \
+    ((shape_size_) > 1 ? sizeof(int32) * (shape_size_) : 0)
+#define COMPACT_VECTOR_SIZE(dim_, shape_size_, elem_size_) \
+    (offsetof(CompactVector, data) + COMPACT_VECTOR_SHAPE_BYTES(shape_size_) + \
+     (Size) (elem_size_) * (dim_))
+
+#define COMPACT_VECTOR_SHAPE(v_) ((int32 *) (v_)->data)
+#define COMPACT_VECTOR_DATA(v_) \
+    ((v_)->data + COMPACT_VECTOR_SHAPE_BYTES((v_)->shape_size))
+#define COMPACT_VECTOR_HALF(v_) ((uint16 *) COMPACT_VECTOR_DATA(v_))
+#define COMPACT_VECTOR_INT8(v_) ((int8 *) COMPACT_VECTOR_DATA(v_))
+
+#define DatumGetCompactVector(x_) ((CompactVector *) PG_DETOAST_DATUM(x_))
+#define PG_GETARG_COMPACT_VECTOR_P(x_) DatumGetCompactVector(PG_GETARG_DATUM(x_))
+
+/* largest magnitude stored in an int8vec element */
+#define INT8VEC_MAX 127
+
+/*
+ * scalar conversions, both directions round to nearest even. Out of range
+ * values become infinity, callers check for it.
+ */
+static inline float
+half_to_float(uint16 h)
+{
+    uint32 sign = (uint32) (h & 0x8000) << 16;
+    uint32 exp = (h >> 10) & 0x1f;
+    uint32 mant = h & 0x3ff;
+    uint32 bits;
+    float f;
+
+    if(exp == 0){
+        if(mant == 0){
+            bits = sign;
+        }else{
+            /* subnormal half, normal float */
+            exp = 127 - 15 + 1;
+            while((mant & 0x400) == 0){
+                mant <<= 1;
+                exp--;
+            }
+            bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    }else if(exp == 0x1f){
+        bits = sign | 0x7f800000 | (mant << 13);
+    }else{
+        bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16
+float_to_half(float f)
+{
+    uint32 x;
+    uint32 sign;
+
+    memcpy(&x, &f, sizeof(x));
+    sign = (x >> 16) & 0x8000;
+    x &= 0x7fffffff;
+
+    /* 2^16 and above, infinity and NaN */
+    if(x >= 0x47800000){
+        return (uint16) (sign | (x > 0x7f800000 ? 0x7e00 : 0x7c00));
+    }
+
+    /* below 2^-14 the result is subnormal, let the FPU round it */
+    if(x < 0x38800000){
+        float t;
+        uint32 tb;
+
+        memcpy(&t, &x, sizeof(t));
+        t += 0.5f;
+        memcpy(&tb, &t, sizeof(tb));
+        return (uint16) (sign | (tb - 0x3f000000));
+    }
+
+    /* rebias the exponent and round the mantissa, a carry may give infinity */
+    x += ((uint32) (15 - 127) << 23) + 0xfff + ((x >> 13) & 1);
+    return (uint16) (sign | (x >> 13));
+}
+
+static inline float
+bf16_to_float(uint16 h)
+{
+    uint32 bits = (uint32) h << 16;
+    float f;
+
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16
+float_to_bf16(float f)
+{
+    uint32 x;
+
+    memcpy(&x, &f, sizeof(x));
+    if((x & 0x7fffffff) > 0x7f800000){
+        return (uint16) ((x >> 16) | 0x40);
+    }
+    x += 0x7fff + ((x >> 16) & 1);
+    return (uint16) (x >> 16);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
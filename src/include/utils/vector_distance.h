@@ -0,0 +1,62 @@
+/*
+ * vector_distance.h
+ *
+ * distance kernels over the data of vectors and of their compact companions
+ * (see vector_compact.h). Each kernel is a function pointer that picks the
+ * AVX-512, AVX2/FMA, NEON or plain C implementation on first use, depending
+ * on what the CPU we run on supports.
+ */
+#ifndef VECTOR_DISTANCE_H
+#define VECTOR_DISTANCE_H
+
+#include <c.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef float (*VectorDistanceKernel) (const float *a, const float *b, int dim);
+
+/* squared euclidean distance */
+extern VectorDistanceKernel vector_l2_squared_kernel;
+/* dot product */
+extern VectorDistanceKernel vector_inner_product_kernel;
+/* 1 - cosine similarity, NaN if one of the vectors is all zeros */
+extern VectorDistanceKernel vector_cosine_distance_kernel;
+
+/*
+ * the same for the 2-byte elements of halfvec (fp16) and bf16vec (bfloat16),
+ * computed without widening the vectors first
+ */
+typedef float (*VectorHalfDistanceKernel) (const uint16 *a, const uint16 *b, int dim);
+
+extern VectorHalfDistanceKernel vector_half_l2_squared_kernel;
+extern VectorHalfDistanceKernel vector_half_inner_product_kernel;
+extern VectorHalfDistanceKernel vector_half_cosine_distance_kernel;
+extern VectorHalfDistanceKernel vector_bf16_l2_squared_kernel;
+extern VectorHalfDistanceKernel vector_bf16_inner_product_kernel;
+extern VectorHalfDistanceKernel vector_bf16_cosine_distance_kernel;
+
+/*
+ * exact integer sums over the elements of two int8vecs: sum(a*b), sum(a*a)
+ * and sum(b*b). The distances follow from them and the scales.
+ */
+typedef void (*VectorInt8SumsKernel) (const int8 *a, const int8 *b, int dim,
+                                      int64 *dot, int64 *norm_a, int64 *norm_b);
+
+extern VectorInt8SumsKernel vector_int8_sums_kernel;
+
+/*
+ * select the kernels now. They are otherwise selected on first call, callers
+ * that use them from several threads call this beforehand.
+ */
+extern void vector_distance_init(void);
+
+/* name of the instruction set the kernels use, for debug output */
+extern const char *vector_distance_isa(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
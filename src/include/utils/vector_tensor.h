@@ -5,6 +5,7 @@
 #include <torch/script.h>
 
 #include "vector.h"
+#include "vector_compact.h"
 
 extern "C" {
 
@@ -12,6 +13,13 @@ Vector* tensor_to_vector(torch::Tensor& tensor);
 
 torch::Tensor vector_to_tensor(Vector& vector);
 
+torch::Tensor halfvec_to_tensor(CompactVector& vector);
+
+torch::Tensor bf16vec_to_tensor(CompactVector& vector);
+
+/* int8 tensor of the quantized values, element i is *scale * tensor[i] */
+torch::Tensor int8vec_to_tensor(CompactVector& vector, float* scale);
+
 
 }
 #endif
\ No newline at end of file
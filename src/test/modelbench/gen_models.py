@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+#
+# gen_models.py
+#	  Write the synthetic TorchScript models of the inference benchmark.
+#
+# Every model takes a float tensor [rows, features], the feature columns of
+# its bench table, and returns [rows, 10] logits, so it runs through the
+# columnar batch path without preprocess or output callbacks. Weights are
+# seeded: the same torch version always writes the same models.
+#
+# src/test/modelbench/gen_models.py
+
+import argparse
+import os
+
+import torch
+import torch.nn as nn
+
+NUM_CLASSES = 10
+TRANSFORMER_VOCAB = 1000
+TRANSFORMER_SEQ_LEN = 16
+
+
+class MLP(nn.Module):
+    """32 features"""
+
+    def __init__(self):
+        super().__init__()
+        self.net = nn.Sequential(
+            nn.Linear(32, 256), nn.ReLU(),
+            nn.Linear(256, 256), nn.ReLU(),
+            nn.Linear(256, NUM_CLASSES))
+
+    def forward(self, x):
+        return self.net(x)
+
+
+class CNN(nn.Module):
+    """64 features, read as a 1x8x8 image"""
+
+    def __init__(self):
+        super().__init__()
+        self.conv = nn.Sequential(
+            nn.Conv2d(1, 16, 3, padding=1), nn.ReLU(),
+            nn.Conv2d(16, 32, 3, padding=1), nn.ReLU(),
+            nn.AdaptiveAvgPool2d(1))
+        self.fc = nn.Linear(32, NUM_CLASSES)
+
+    def forward(self, x):
+        x = self.conv(x.view(-1, 1, 8, 8))
+        return self.fc(x.flatten(1))
+
+
+class Transformer(nn.Module):
+    """16 features, token ids below TRANSFORMER_VOCAB"""
+
+    def __init__(self):
+        super().__init__()
+        self.embed = nn.Embedding(TRANSFORMER_VOCAB, 64)
+        self.pos = nn.Parameter(torch.randn(TRANSFORMER_SEQ_LEN, 64) * 0.02)
+        layer = nn.TransformerEncoderLayer(64, 4, 128, dropout=0.0,
+                                           batch_first=True)
+        try:
+            self.encoder = nn.TransformerEncoder(layer, 2,
+                                                 enable_nested_tensor=False)
+        except TypeError:
+            # torch before 1.12
+            self.encoder = nn.TransformerEncoder(layer, 2)
+        self.fc = nn.Linear(64, NUM_CLASSES)
+
+    def forward(self, x):
+        tokens = x.long().clamp(0, TRANSFORMER_VOCAB - 1)
+        h = self.embed(tokens) + self.pos
+        return self.fc(self.encoder(h).mean(1))
+
+
+MODELS = {
+    "mlp": (MLP, 32),
+    "cnn": (CNN, 64),
+    "transformer": (Transformer, TRANSFORMER_SEQ_LEN),
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--out", default=".",
+                        help="directory the .pt files are written to")
+    parser.add_argument("models", nargs="*", default=list(MODELS),
+                        help="models to write (default: all)")
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    for name in args.models:
+        cls, features = MODELS[name]
+        torch.manual_seed(0)
+        model = cls().eval()
+        example = torch.rand(4, features)
+        with torch.no_grad():
+            traced = torch.jit.trace(model, example)
+        path = os.path.join(args.out, name + ".pt")
+        traced.save(path)
+        print("%s: %d features, %d parameters -> %s" % (
+            name, features, sum(p.numel() for p in model.parameters()), path))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,4 @@
+-- predict_text in the select list, batched by the Predict node up to
+-- predict_batch_size rows. Variables: model, features, table_rows, rows.
+\set start random(1, :table_rows - :rows + 1)
+SELECT predict_text(':model', 'cpu', :features) FROM :model WHERE id >= :start AND id < :start + :rows;
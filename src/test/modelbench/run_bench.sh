@@ -0,0 +1,185 @@
+#!/usr/bin/env bash
+#
+# run_bench.sh
+#	  Inference benchmark driver: runs the pgbench scripts of this directory
+#	  for every combination of model, predict path, batch size, intra-op
+#	  threads and clients, and appends one CSV line per run.
+#
+# The server must be running and reachable through the usual PG* environment
+# variables. Settings come from the environment, with these defaults:
+#
+#	MODELS="mlp cnn transformer"	synthetic models of gen_models.py
+#	PATHS="node window text_node text_window"
+#									Predict node or pg_predict_batch_float,
+#									text_*: predict_text or pg_predict_batch_text
+#	BATCH_SIZES="1 16 64 256 1024"
+#	THREADS="1 4"					model_intra_op_threads
+#	CLIENTS="1 4 16"				pgbench clients, one backend each
+#	DURATION=10						seconds per run
+#	ROWS=1024						rows predicted per transaction
+#	TABLE_ROWS=100000				rows of each bench table
+#	MODEL_DIR=./models				where gen_models.py writes the models
+#	OUT=modelbench.csv
+#	PYTHON=python3 PGBENCH=pgbench PSQL=psql
+#
+# src/test/modelbench/run_bench.sh
+
+set -eu
+
+here=$(cd "$(dirname "$0")" && pwd)
+
+MODELS=${MODELS:-"mlp cnn transformer"}
+PATHS=${PATHS:-"node window text_node text_window"}
+BATCH_SIZES=${BATCH_SIZES:-"1 16 64 256 1024"}
+THREADS=${THREADS:-"1 4"}
+CLIENTS=${CLIENTS:-"1 4 16"}
+DURATION=${DURATION:-10}
+ROWS=${ROWS:-1024}
+TABLE_ROWS=${TABLE_ROWS:-100000}
+MODEL_DIR=${MODEL_DIR:-./models}
+OUT=${OUT:-modelbench.csv}
+PYTHON=${PYTHON:-python3}
+PGBENCH=${PGBENCH:-pgbench}
+PSQL=${PSQL:-psql}
+
+tmpdir=$(mktemp -d)
+trap 'rm -rf "$tmpdir"' EXIT
+
+psql_quiet() {
+	"$PSQL" -X -q -v ON_ERROR_STOP=1 "$@"
+}
+
+features_of() {
+	case $1 in
+		mlp) echo 32 ;;
+		cnn) echo 64 ;;
+		transformer) echo 16 ;;
+		*) echo "unknown model $1" >&2; exit 1 ;;
+	esac
+}
+
+# f1, f2, ..., fN
+feature_list() {
+	local n=$1 i cols=""
+	for i in $(seq 1 "$n"); do
+		cols="$cols${cols:+, }f$i"
+	done
+	echo "$cols"
+}
+
+# cumulative pg_stat_model counters of a model: rows pre_ms infer_ms post_ms
+model_stats() {
+	psql_quiet -At -F ' ' -c "
+		SELECT coalesce(sum(rows), 0), coalesce(sum(pre_time), 0),
+			   coalesce(sum(infer_time), 0), coalesce(sum(post_time), 0)
+		FROM pg_stat_model
+		WHERE model = '$1' AND datname = current_database()"
+}
+
+setup_model() {
+	local model=$1 table=bench_$1 n cols="" i expr
+	n=$(features_of "$model")
+
+	if [ ! -f "$MODEL_DIR/$model.pt" ]; then
+		"$PYTHON" "$here/gen_models.py" --out "$MODEL_DIR" "$model"
+	fi
+
+	for i in $(seq 1 "$n"); do
+		if [ "$model" = transformer ]; then
+			expr="floor(random() * 1000)::float4"
+		else
+			expr="random()::float4"
+		fi
+		cols="$cols, $expr AS f$i"
+	done
+	psql_quiet <<EOF
+SELECT setseed(0.42);
+DROP TABLE IF EXISTS $table;
+CREATE TABLE $table AS SELECT id$cols FROM generate_series(1, $TABLE_ROWS) AS id;
+CREATE INDEX ON $table (id);
+ANALYZE $table;
+EOF
+	psql_quiet -c "DROP MODEL $table;" >/dev/null 2>&1 || true
+	psql_quiet -c "CREATE MODEL $table PATH '$(cd "$MODEL_DIR" && pwd)/$model.pt' DESCRIPTION 'modelbench $model';" >/dev/null
+}
+
+# one pgbench run, prints the CSV line
+run_one() {
+	local model=$1 path=$2 batch=$3 threads=$4 clients=$5
+	local table=bench_$1 script jobs output tps stats_before stats_after
+	local -a lat
+	local nlat p50 p99
+
+	case $path in
+		node) script=$here/predict_node.sql ;;
+		window) script=$here/window_agg.sql ;;
+		text_node) script=$here/predict_node_text.sql ;;
+		text_window) script=$here/window_agg_text.sql ;;
+		*) echo "unknown path $path" >&2; exit 1 ;;
+	esac
+	jobs=$clients
+	if [ "$jobs" -gt "$(nproc)" ]; then
+		jobs=$(nproc)
+	fi
+
+	rm -f "$tmpdir"/txn*
+	stats_before=$(model_stats "$table")
+	if ! output=$(PGOPTIONS="-c predict_batch_size=$batch -c model_intra_op_threads=$threads" \
+		"$PGBENCH" -n -M simple -f "$script" -c "$clients" -j "$jobs" -T "$DURATION" \
+			-D model="$table" -D features="$(feature_list "$(features_of "$model")")" \
+			-D table_rows="$TABLE_ROWS" -D rows="$ROWS" -D window="$((batch - 1))" \
+			-l --log-prefix="$tmpdir/txn" 2>&1); then
+		echo "pgbench failed for $model $path batch=$batch threads=$threads clients=$clients:" >&2
+		echo "$output" >&2
+		echo "$model,$path,$batch,$threads,$clients,$ROWS,0,,,,,,,"
+		return
+	fi
+	stats_after=$(model_stats "$table")
+
+	# the last tps line leaves out connection time
+	tps=$(echo "$output" | awk '/^tps = / { tps = $3 } END { print tps }')
+
+	# latencies in microseconds, without the first transaction of each
+	# client, which loads the model
+	mapfile -t lat < <(cat "$tmpdir"/txn* | awk '$2 > 0 { print $3 }' | sort -n)
+	nlat=${#lat[@]}
+	if [ "$nlat" -gt 0 ]; then
+		p50=$(awk -v us="${lat[$(( (nlat - 1) * 50 / 100 ))]}" 'BEGIN { printf "%.3f", us / 1000 }')
+		p99=$(awk -v us="${lat[$(( (nlat - 1) * 99 / 100 ))]}" 'BEGIN { printf "%.3f", us / 1000 }')
+	else
+		p50=""
+		p99=""
+	fi
+
+	echo "$stats_before $stats_after" | awk -v model="$model" -v path="$path" \
+		-v batch="$batch" -v threads="$threads" -v clients="$clients" \
+		-v rows="$ROWS" -v n="$nlat" -v tps="$tps" -v p50="$p50" -v p99="$p99" '
+		{
+			r = $5 - $1
+			pre = r > 0 ? ($6 - $2) * 1000 / r : 0
+			infer = r > 0 ? ($7 - $3) * 1000 / r : 0
+			post = r > 0 ? ($8 - $4) * 1000 / r : 0
+			printf "%s,%s,%d,%d,%d,%d,%d,%s,%.1f,%s,%s,%.2f,%.2f,%.2f\n",
+				model, path, batch, threads, clients, rows, n, tps,
+				tps * rows, p50, p99, pre, infer, post
+		}'
+}
+
+if [ ! -s "$OUT" ]; then
+	echo "model,path,batch_size,threads,clients,rows_per_txn,transactions,tps,rows_per_sec,p50_ms,p99_ms,pre_us_per_row,infer_us_per_row,post_us_per_row" > "$OUT"
+fi
+
+for model in $MODELS; do
+	setup_model "$model"
+	for path in $PATHS; do
+		for batch in $BATCH_SIZES; do
+			for threads in $THREADS; do
+				for clients in $CLIENTS; do
+					line=$(run_one "$model" "$path" "$batch" "$threads" "$clients")
+					echo "$line" >> "$OUT"
+					echo "$line"
+				done
+			done
+		done
+	done
+done
@@ -0,0 +1,4 @@
+-- pg_predict_batch_float over a sliding frame, a forward pass every
+-- window + 1 rows. Variables: model, features, table_rows, rows, window.
+\set start random(1, :table_rows - :rows + 1)
+SELECT pg_predict_batch_float(':model', 'cpu', :features) OVER (ORDER BY id ROWS BETWEEN CURRENT ROW AND :window FOLLOWING) FROM :model WHERE id >= :start AND id < :start + :rows;
@@ -0,0 +1,47 @@
+--
+-- HNSW
+-- approximate nearest-neighbour index on vector columns
+--
+
+CREATE TABLE hnsw_items (id int, v vector);
+INSERT INTO hnsw_items SELECT i, format('[%s,%s]', i, i % 3)::vector
+FROM generate_series(1, 100) i;
+INSERT INTO hnsw_items VALUES (0, NULL);
+
+CREATE INDEX hnsw_items_v_idx ON hnsw_items USING hnsw (v) WITH (m = 16, ef_construction = 64);
+
+SET enable_seqscan = off;
+
+EXPLAIN (COSTS OFF)
+SELECT id FROM hnsw_items ORDER BY v <-> '[50.2,1]' LIMIT 5;
+SELECT id, round((v <-> '[50.2,1]')::numeric, 4) AS distance
+FROM hnsw_items ORDER BY v <-> '[50.2,1]' LIMIT 5;
+
+-- rows inserted after the build are found
+INSERT INTO hnsw_items VALUES (101, '[50.3,1]');
+SELECT id FROM hnsw_items ORDER BY v <-> '[50.2,1]' LIMIT 3;
+
+-- a scan goes on past hnsw_ef_search rows, in order; the NULL is not indexed
+SET hnsw_ef_search = 10;
+SELECT count(*) FROM (SELECT id FROM hnsw_items ORDER BY v <-> '[0,0]' LIMIT 30) s;
+SELECT count(*), bool_and(ordered) FROM (
+    SELECT coalesce(d >= lag(d) OVER (), true) AS ordered FROM (
+        SELECT v <-> '[0,0]' AS d FROM hnsw_items ORDER BY v <-> '[0,0]' LIMIT 200) s) t;
+RESET hnsw_ef_search;
+
+-- dimensions must match the index
+INSERT INTO hnsw_items VALUES (102, '[1,2,3]');
+
+-- the cosine distance to a zero vector is NaN, it comes last
+CREATE TABLE hnsw_cosine (id int, v vector);
+INSERT INTO hnsw_cosine VALUES (1, '[1,0]'), (2, '[0,1]'), (3, '[0,0]'), (4, '[1,1]');
+CREATE INDEX ON hnsw_cosine USING hnsw (v vector_cosine_ops);
+SELECT id FROM hnsw_cosine ORDER BY v <=> '[1,0.1]';
+
+RESET enable_seqscan;
+
+SELECT opcname, amvalidate(oid) FROM pg_opclass
+WHERE opcmethod = (SELECT oid FROM pg_am WHERE amname = 'hnsw') ORDER BY 1;
+
+DROP TABLE hnsw_items;
+DROP TABLE hnsw_cosine;
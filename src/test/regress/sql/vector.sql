@@ -0,0 +1,52 @@
+--
+-- VECTOR
+-- text input and output of the vector type
+--
+
+-- elements print in the shortest form that reads back to the same float4
+SELECT v, v::text::vector::float4[] = v::float4[] AS round_trip
+  FROM (VALUES ('[1.4e-45]'::vector), ('[1.17549435e-38]'), ('[3.4028235e38]'),
+               ('[1e38]'), ('[-0]'), ('[0.1]'), ('[16777217]'),
+               ('[Infinity]'), ('[-inf]'), ('[NaN]')) t(v);
+
+-- decimal values halfway between two floats round to the even one
+SELECT '[16777217,16777219,1.000000059604644775390625,1.0000000596046448,1.0000000596046447]'::vector;
+
+-- with extra_float_digits <= 0 fewer digits are printed and some are lost
+SET extra_float_digits = 0;
+SELECT v, v::text::vector::float4[] = v::float4[] AS round_trip
+  FROM (VALUES ('[1.4e-45]'::vector), ('[1.17549435e-38]'), ('[3.4028235e38]'),
+               ('[1e38]'), ('[16777217]'), ('[0.1]')) t(v);
+RESET extra_float_digits;
+
+-- vectors of more than 10 elements are elided unless asked for in full
+SELECT '[1,2,3,4,5,6,7,8,9,10]'::vector;
+SELECT '[1,2,3,4,5,6,7,8,9,10,11,12]'::vector;
+SET vector_output_full = on;
+SELECT '[1,2,3,4,5,6,7,8,9,10,11,12]'::vector;
+RESET vector_output_full;
+SET extra_float_digits = 3;
+SELECT '[1,2,3,4,5,6,7,8,9,10,11,12]'::vector;
+RESET extra_float_digits;
+
+SELECT ' [ 1 , 2.5 ] '::vector, '[+1,-2e0,.5,0x10]'::vector;
+
+-- shaped input
+SELECT '[1,2,3,4]{2,2}'::vector, '[1,2,3,4,5,6]{ 3, 1, 2 }'::vector;
+SELECT '[1,2,3,4]{2,2}'::vector::int[] AS shape, '[1,2,3,4]{2,2}'::vector::float4[] AS data;
+SELECT '[1,2,3,4]{2,2}'::vector == '[1,2,3,4]{4}', '[1,2,3,4]{2,2}'::vector == '[1,2,3,4]{2,2}';
+SELECT '[1,2,3]{2,2}'::vector;
+SELECT '[1,2]{0,2}'::vector;
+SELECT '[1,2]{2'::vector;
+SELECT '[1,2]{2}x'::vector;
+SELECT '[1]{1,1,1,1,1,1,1,1,1,1,1}'::vector;
+
+-- malformed input
+SELECT '1,2'::vector;
+SELECT '[]'::vector;
+SELECT '[1,,2]'::vector;
+SELECT '[1,2'::vector;
+SELECT '[1 2]'::vector;
+SELECT '[1e]'::vector;
+SELECT '[a]'::vector;
+SELECT '[1,2]x'::vector;
@@ -0,0 +1,28 @@
+--
+-- VECTOR_COMPACT
+-- halfvec (fp16), bf16vec (bfloat16) and int8vec (scaled int8)
+--
+
+-- input rounds to the nearest value of the type
+SELECT '[1.5,-2,0.25,65504]'::halfvec;
+SELECT '[3.14159]'::halfvec, '[3.14159]'::bf16vec;
+SELECT '[1,2,3,4]{2,2}'::bf16vec;
+SELECT '[70000]'::halfvec;
+
+-- int8vec scales the largest element to 127
+SELECT '[2,-254,64]'::int8vec, '[3,-254]'::int8vec;
+
+SELECT '[1.5,2]'::vector::halfvec::vector;
+
+SELECT '[1,2]'::halfvec + '[0.5,0.5]', '[1,2]'::bf16vec - '[0.5,0.5]';
+SELECT '[60000]'::halfvec + '[60000]';
+
+SELECT '[1,2]'::halfvec <-> '[4,6]', '[1,2]'::halfvec <#> '[4,6]', '[1,0]'::halfvec <=> '[0,1]';
+SELECT '[1,2]'::bf16vec <-> '[4,6]', '[1,2]'::bf16vec <#> '[4,6]', '[1,0]'::bf16vec <=> '[0,1]';
+
+-- int8vec distances of vectors with one scale and with two
+SELECT '[100,127]'::int8vec <-> '[101,127]';
+SELECT round(('[2,-254]'::int8vec <-> '[127,0]')::numeric, 4), '[2,-254]'::int8vec <#> '[127,0]';
+SELECT '[0,0]'::int8vec <=> '[1,1]';
+
+SELECT '[1,2]'::halfvec <-> '[1,2,3]';